@@ -30,6 +30,39 @@ const MSG_TYPES = {
   TURN_WARNING: 28,
   GAME_TIMEOUT: 29,
   CHAT_MESSAGE: 30,
+  PLACE_FLEET: 31,
+};
+
+// Wire format v2 (server: ws_protocol.h)
+// type(1) | token_len(2, LE) | payload_len(2, LE) | token | payload
+const WS_SUBPROTOCOL_V2 = "battleship.v2";
+const V2_HEADER_LEN = 5;
+
+// Kích thước payload struct theo từng type (khớp ws_payload_size() bên server)
+const PAYLOAD_SIZES = {
+  [MSG_TYPES.REGISTER]: 64,
+  [MSG_TYPES.LOGIN]: 64,
+  [MSG_TYPES.AUTH_SUCCESS]: 544,
+  [MSG_TYPES.AUTH_FAILED]: 64,
+  [MSG_TYPES.START_GAME]: 128,
+  [MSG_TYPES.PLAYER_MOVE]: 73,
+  [MSG_TYPES.MOVE_RESULT]: 17,
+  [MSG_TYPES.CHAT]: 192,
+  [MSG_TYPES.CHAT_MESSAGE]: 192,
+  [MSG_TYPES.PLACE_SHIP]: 16,
+  [MSG_TYPES.PLAYER_READY]: 165,
+  [MSG_TYPES.ONLINE_PLAYERS_LIST]: 5004,
+  [MSG_TYPES.CHALLENGE_PLAYER]: 229,
+  [MSG_TYPES.CHALLENGE_RECEIVED]: 237,
+  [MSG_TYPES.CHALLENGE_ACCEPT]: 65,
+  [MSG_TYPES.CHALLENGE_DECLINE]: 65,
+  [MSG_TYPES.CHALLENGE_DECLINED]: 65,
+  [MSG_TYPES.CHALLENGE_EXPIRED]: 65,
+  [MSG_TYPES.CHALLENGE_CANCEL]: 65,
+  [MSG_TYPES.CHALLENGE_CANCELLED]: 65,
+  [MSG_TYPES.TURN_WARNING]: 4,
+  [MSG_TYPES.GAME_TIMEOUT]: 192,
+  [MSG_TYPES.PLACE_FLEET]: 22,
 };
 
 class WebSocketService {
@@ -48,6 +81,7 @@ class WebSocketService {
     this.autoReconnectEnabled = true;
     this.isLoggedOut = false;
     this.logoutTimeout = null;
+    this.protocolVersion = 1; // 2 nếu server chấp nhận battleship.v2
     // Định nghĩa cấu trúc từ C struct
     this.MAX_JWT_LEN = 512;
     this.USERNAME_LEN = 32;
@@ -59,7 +93,7 @@ class WebSocketService {
 
     const PLACE_SHIP_SIZE = 16; // ship_type(4) + row(4) + col(4) + is_horizontal(1) + padding(3)
     const MOVE_SIZE = 73; // ✅ CORRECT: game_id(65) + row(4) + col(4) = 73 bytes (packed)
-    const MOVE_RESULT_SIZE = 16; // ✅ row(4) + col(4) + is_hit(1) + is_sunk(1) + sunk_ship_type(4) + game_over(1) + padding(1)
+    const MOVE_RESULT_SIZE = 17; // ✅ row(4) + col(4) + is_hit(1) + is_sunk(1) + sunk_ship_type(4) + game_over(1) + is_your_shot(1) + padding(1)
     const START_GAME_SIZE = 128; // opponent[32] + game_id[64] + current_turn[32]
     const READY_SIZE = 165; // game_id[65] + board_state[100]
     const AUTH_SUCCESS_SIZE = this.MAX_JWT_LEN + this.USERNAME_LEN; // 512 + 32 = 544
@@ -110,7 +144,7 @@ class WebSocketService {
       }
 
       console.log(`[WS] Creating new connection to ${url}...`);
-      this.ws = new WebSocket(url);
+      this.ws = new WebSocket(url, [WS_SUBPROTOCOL_V2]);
       this.ws.binaryType = "arraybuffer";
 
       this.connectResolve = resolve;
@@ -118,7 +152,10 @@ class WebSocketService {
 
       this.ws.onopen = () => {
         this.reconnectAttempts = 0;
-        console.log(`[WS] ✅ Connected to ${url}`);
+        this.protocolVersion = this.ws.protocol === WS_SUBPROTOCOL_V2 ? 2 : 1;
+        console.log(
+          `[WS] ✅ Connected to ${url} (protocol v${this.protocolVersion})`
+        );
         this.notifyConnectionState("connected");
         this.startPing(); // gửi ping mỗi 30s
         const token = localStorage.getItem("auth_token");
@@ -203,7 +240,7 @@ class WebSocketService {
         const view = new DataView(buffer);
         view.setUint32(0, MSG_TYPES.PING, true); // ✅ Dùng constant
 
-        this.ws.send(buffer);
+        this.sendBuffer(buffer);
       }
     }, 30000); // 30 seconds
   }
@@ -353,6 +390,18 @@ class WebSocketService {
         .map((b) => b.toString(16).padStart(2, "0"))
         .join(" ");
       console.log("[WS] PLACE_SHIP hex dump (first 16 bytes):", hexDump);
+    } else if (type === MSG_TYPES.PLACE_FLEET) {
+      // place_fleet_payload (packed): count(1) + auto_place(1) + 5 x {ship_type, row, col, is_horizontal}
+      const ships = payload.auto_place ? [] : payload.ships || [];
+      view.setUint8(this.OFFSET_PAYLOAD, ships.length);
+      view.setUint8(this.OFFSET_PAYLOAD + 1, payload.auto_place ? 1 : 0);
+      ships.slice(0, 5).forEach((ship, i) => {
+        const offset = this.OFFSET_PAYLOAD + 2 + i * 4;
+        view.setUint8(offset, ship.ship_type);
+        view.setUint8(offset + 1, ship.row);
+        view.setUint8(offset + 2, ship.col);
+        view.setUint8(offset + 3, ship.is_horizontal ? 1 : 0);
+      });
     } else if (type === MSG_TYPES.PLAYER_MOVE) {
       // Serialize: game_id (65) + row (4) + col (4) = 73 bytes
       const gameIdBytes = new TextEncoder().encode(payload.game_id);
@@ -487,6 +536,89 @@ class WebSocketService {
     return buffer;
   }
 
+  /**
+   * Gửi buffer theo layout message_t; với v2 chỉ gửi token + payload thực tế
+   */
+  sendBuffer(buffer) {
+    this.ws.send(this.protocolVersion === 2 ? this.packV2(buffer) : buffer);
+  }
+
+  /**
+   * message_t (layout cố định) -> frame v2
+   */
+  packV2(buffer) {
+    const view = new DataView(buffer);
+    const uint8 = new Uint8Array(buffer);
+    const type = view.getUint32(this.OFFSET_TYPE, true);
+
+    const tokenBytes = uint8.subarray(
+      this.OFFSET_TOKEN,
+      this.OFFSET_TOKEN + this.MAX_JWT_LEN - 1
+    );
+    const tokenNull = tokenBytes.indexOf(0);
+    const tokenLen = tokenNull > -1 ? tokenNull : tokenBytes.length;
+
+    // Bỏ các byte 0 ở cuối payload, server tự zero-fill lại
+    let payloadLen = PAYLOAD_SIZES[type] ?? this.MAX_PAYLOAD_SIZE;
+    while (
+      payloadLen > 0 &&
+      uint8[this.OFFSET_PAYLOAD + payloadLen - 1] === 0
+    ) {
+      payloadLen--;
+    }
+
+    const out = new Uint8Array(V2_HEADER_LEN + tokenLen + payloadLen);
+    const outView = new DataView(out.buffer);
+    outView.setUint8(0, type);
+    outView.setUint16(1, tokenLen, true);
+    outView.setUint16(3, payloadLen, true);
+    out.set(tokenBytes.subarray(0, tokenLen), V2_HEADER_LEN);
+    out.set(
+      uint8.subarray(this.OFFSET_PAYLOAD, this.OFFSET_PAYLOAD + payloadLen),
+      V2_HEADER_LEN + tokenLen
+    );
+    return out.buffer;
+  }
+
+  /**
+   * Frame v2 -> message_t (layout cố định) để dùng lại deserializeMessage
+   */
+  unpackV2(arrayBuffer) {
+    if (arrayBuffer.byteLength < V2_HEADER_LEN) {
+      console.error(
+        `Received invalid v2 message (${arrayBuffer.byteLength} bytes)`
+      );
+      return null;
+    }
+
+    const view = new DataView(arrayBuffer);
+    const type = view.getUint8(0);
+    const tokenLen = view.getUint16(1, true);
+    const payloadLen = view.getUint16(3, true);
+
+    if (
+      tokenLen >= this.MAX_JWT_LEN ||
+      payloadLen > this.MAX_PAYLOAD_SIZE ||
+      V2_HEADER_LEN + tokenLen + payloadLen !== arrayBuffer.byteLength
+    ) {
+      console.error(
+        `Received invalid v2 message: token=${tokenLen}, payload=${payloadLen}, size=${arrayBuffer.byteLength}`
+      );
+      return null;
+    }
+
+    const src = new Uint8Array(arrayBuffer);
+    const buffer = new ArrayBuffer(this.MESSAGE_T_SIZE);
+    const uint8 = new Uint8Array(buffer);
+    new DataView(buffer).setUint32(this.OFFSET_TYPE, type, true);
+    uint8.set(
+      src.subarray(V2_HEADER_LEN, V2_HEADER_LEN + tokenLen),
+      this.OFFSET_TOKEN
+    );
+    uint8.set(src.subarray(V2_HEADER_LEN + tokenLen), this.OFFSET_PAYLOAD);
+    return buffer;
+  }
+
   /**
    * Giải nén (Deserialize) tin nhắn từ server
    */
@@ -670,6 +802,22 @@ class WebSocketService {
       payload.reason = decodeCString(this.OFFSET_PAYLOAD + 128, 64);
 
       console.log("[WS] GAME_TIMEOUT deserialized:", payload);
+    } else if (type === MSG_TYPES.PLACE_FLEET) {
+      // ✅ place_fleet_payload: hạm đội server đã chấp nhận (hoặc tự xếp)
+      const count = Math.min(view.getUint8(this.OFFSET_PAYLOAD), 5);
+      payload.auto_place = view.getUint8(this.OFFSET_PAYLOAD + 1) === 1;
+      payload.ships = [];
+      for (let i = 0; i < count; i++) {
+        const offset = this.OFFSET_PAYLOAD + 2 + i * 4;
+        payload.ships.push({
+          ship_type: view.getUint8(offset),
+          row: view.getUint8(offset + 1),
+          col: view.getUint8(offset + 2),
+          is_horizontal: view.getUint8(offset + 3) === 1,
+        });
+      }
+
+      console.log("[WS] PLACE_FLEET deserialized:", payload);
     }
     // Thêm các loại tin nhắn khác ở đây
 
@@ -684,25 +832,22 @@ class WebSocketService {
     if (type === MSG_TYPES.AUTH_TOKEN) {
       const token = payload.token || payload; // Accept both {token: "..."} or "..."
       const buffer = this.serializeMessage(type, {}, token); // Empty payload, token in token field
-      this.ws.send(buffer);
+      this.sendBuffer(buffer);
       console.log("[WS] Sent MSG_AUTH_TOKEN");
       return;
     }
 
-    // Lấy token từ authService (hoặc localStorage) nếu tin nhắn cần xác thực
-    let token = "";
-    if (type !== MSG_TYPES.REGISTER && type !== MSG_TYPES.LOGIN) {
-      // Bạn cần triển khai hàm getToken() này trong authService
-      token = localStorage.getItem("auth_token") || "";
-    }
-
-    // Gửi tin nhắn đã được đóng gói đúng
-    const buffer = this.serializeMessage(type, payload, token);
-    this.ws.send(buffer);
+    // Server giữ session theo connection sau LOGIN/REGISTER/AUTH_TOKEN,
+    // nên các message khác không cần gửi kèm token
+    const buffer = this.serializeMessage(type, payload);
+    this.sendBuffer(buffer);
   }
 
   handleMessage(data) {
-    const message = this.deserializeMessage(data);
+    const legacy = this.protocolVersion === 2 ? this.unpackV2(data) : data;
+    if (!legacy) return;
+
+    const message = this.deserializeMessage(legacy);
     if (!message) return; // Bỏ qua tin nhắn không hợp lệ
 
     const handlers = this.messageHandlers.get(message.type);
@@ -738,15 +883,10 @@ class WebSocketService {
     const buffer = new ArrayBuffer(this.MESSAGE_T_SIZE);
     const view = new DataView(buffer);
 
-    // Set message type
+    // Set message type (session đã xác thực, không cần token)
     view.setUint32(0, MSG_TYPES.JOIN_QUEUE, true);
 
-    // Set token
-    const tokenBytes = new TextEncoder().encode(token);
-    const uint8 = new Uint8Array(buffer);
-    uint8.set(tokenBytes.slice(0, this.MAX_JWT_LEN - 1), 4);
-
-    this.ws.send(buffer);
+    this.sendBuffer(buffer);
     console.log("[WS] Joined matchmaking queue");
   }
 
@@ -759,11 +899,7 @@ class WebSocketService {
 
     view.setUint32(0, MSG_TYPES.LEAVE_QUEUE, true);
 
-    const tokenBytes = new TextEncoder().encode(token);
-    const uint8 = new Uint8Array(buffer);
-    uint8.set(tokenBytes.slice(0, this.MAX_JWT_LEN - 1), 4);
-
-    this.ws.send(buffer);
+    this.sendBuffer(buffer);
     console.log("[WS] Left matchmaking queue");
   }
 
@@ -14,6 +14,7 @@ typedef struct {
 auth_result_t* auth_register(const char *username, const char *email, const char *password);
 auth_result_t* auth_login(const char *username, const char *password);
 bool auth_logout(const char *token);
+bool auth_logout_user(const char *user_id);
 user_t* auth_get_current_user(const char *token);
 void auth_result_free(auth_result_t *result);
 
@@ -2,10 +2,12 @@
 #define JWT_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <time.h>
 
 char* jwt_generate(const char *user_id);
 char* jwt_verify(const char *token);
+bool jwt_verify_claims(const char *token, char *user_id_out, size_t user_id_len, time_t *exp_out);
 bool jwt_is_expired(const char *token);
 
 #endif // JWT_H
\ No newline at end of file
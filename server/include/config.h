@@ -2,6 +2,7 @@
 #define CONFIG_H
 
 #include <stdlib.h>
+#include <stdbool.h>
 #include <string.h>
 #include <stdio.h>
 #include <ctype.h>
@@ -73,6 +74,75 @@ static inline int get_jwt_expiry() {
     return expiry ? atoi(expiry) : 604800;
 }
 
+// ======================= Server ========================
+static inline int get_ws_worker_count() {
+    const char* workers = getenv("WS_WORKERS");
+    int count = workers ? atoi(workers) : 16;
+    return count > 0 ? count : 16;
+}
+
+static inline int get_game_worker_count() {
+    const char* workers = getenv("GAME_WORKERS");
+    int count = workers ? atoi(workers) : 4;
+    return count > 0 ? count : 4;
+}
+
+// GAME_DURABILITY=persist: chỉ trả kết quả nước đi sau khi đã ghi xuống DB
+static inline bool get_game_durability_persist() {
+    const char* mode = getenv("GAME_DURABILITY");
+    return mode && strcmp(mode, "persist") == 0;
+}
+
+static inline int get_game_flush_ms() {
+    const char* ms = getenv("GAME_FLUSH_MS");
+    int value = ms ? atoi(ms) : 50;
+    return value > 0 ? value : 50;
+}
+
+// ======================= Game WAL =====================
+static inline const char* get_game_wal_dir() {
+    const char* dir = getenv("GAME_WAL_DIR");
+    return dir ? dir : "wal";
+}
+
+static inline int get_game_wal_segment_mb() {
+    const char* mb = getenv("GAME_WAL_SEGMENT_MB");
+    int value = mb ? atoi(mb) : 16;
+    return value > 0 ? value : 16;
+}
+
+static inline int get_game_wal_sync_ms() {
+    const char* ms = getenv("GAME_WAL_SYNC_MS");
+    int value = ms ? atoi(ms) : 10;
+    return value > 0 ? value : 10;
+}
+
+// ======================= Matchmaking ==================
+static inline int get_match_queue_max() {
+    const char* max = getenv("MATCH_QUEUE_MAX");
+    int value = max ? atoi(max) : 100000;
+    return value > 0 ? value : 100000;
+}
+
+// MATCH_MODE=batch: mỗi tick ghép cả pool tối ưu tổng chênh ELO (mặc định: greedy)
+static inline bool get_match_batch_mode() {
+    const char* mode = getenv("MATCH_MODE");
+    return mode && strcmp(mode, "batch") == 0;
+}
+
+static inline int get_match_tick_ms() {
+    const char* ms = getenv("MATCH_TICK_MS");
+    int value = ms ? atoi(ms) : 250;
+    return value > 0 ? value : 250;
+}
+
+// ======================= Challenge ====================
+static inline int get_challenge_max() {
+    const char* max = getenv("CHALLENGE_MAX");
+    int value = max ? atoi(max) : 65536;
+    return value > 0 ? value : 65536;
+}
+
 // ======================= Validation ===================
 #define MIN_USERNAME_LENGTH 3
 #define MAX_USERNAME_LENGTH 20
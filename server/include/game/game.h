@@ -6,21 +6,8 @@
 #include <stdint.h>
 #include <time.h>
 #include <pthread.h> 
-
-// Cấu trúc mô tả tọa độ (cho shots)
-typedef struct {
-    uint8_t x;
-    uint8_t y;
-} position_t;
-
-// Cấu trúc mô tả một lần bắn
-typedef struct {
-    char player_id[64];
-    uint8_t x;
-    uint8_t y;
-    bool hit; // Kết quả của cú bắn
-    long long timestamp;
-} shot_t;
+#include "utils/timer_wheel.h"
+#include "game/move_log.h"
 
 // Cấu trúc mô tả bảng của một người chơi
 // CHỈ LƯU MẢNG 1D VỚI GIÁ TRỊ LÀ KÍCH THƯỚC THUYỀN (hoặc 0)
@@ -37,11 +24,26 @@ typedef enum {
     GAME_STATE_FINISHED
 } game_state_t;
 
+struct game_cmd;
+struct game_persist_msg;
+
+// Dirty flags: phần nào của game cần ghi ở lần flush kế tiếp (game_persist.h).
+// Cú bắn không cần flag: mọi move sau moves_synced đều đang chờ ghi.
+#define GAME_DIRTY_STATE  (1u << 0)
+#define GAME_DIRTY_TURN   (1u << 1)
+#define GAME_DIRTY_READY  (1u << 2)
+#define GAME_DIRTY_BOARD1 (1u << 3)   // Ghi lại board (dạng nén, xem board_pack)
+#define GAME_DIRTY_BOARD2 (1u << 4)
+#define GAME_DIRTY_WINNER (1u << 5)   // winner_id + finished_at
+#define GAME_DIRTY_MOVES  (1u << 6)   // Ghi lại toàn bộ mảng moves
+
 // Cấu trúc mô tả toàn bộ phiên chơi
-typedef struct {
+typedef struct game_session {
     char game_id[65];
     char player1_id[64];
     char player2_id[64];
+    char player1_name[32];         // Username hiển thị, lấy một lần khi tạo/nạp game
+    char player2_name[32];
     int player1_socket;
     int player2_socket;
     
@@ -53,37 +55,83 @@ typedef struct {
     board_t player1_board; 
     board_t player2_board;
     
-    // Danh sách các cú bắn (shots)
-    shot_t shots[1000]; // Giả định tối đa 1000 cú bắn
-    uint16_t num_shots;
+    // Các cú bắn theo thứ tự (nén, xem move_log.h)
+    move_log_t moves;
+
+    // Persistence theo delta
+    uint32_t dirty;                // GAME_DIRTY_*
+    uint32_t moves_synced;         // Số move đầu tiên của log đã có trong DB
+    move_log_iter_t moves_sync_it; // Vị trí trong log ngay sau move đã ghi cuối
 
     long long created_at;
+    long long finished_at;         // Unix ms, 0 khi chưa kết thúc
     
     bool player1_ready;  // Ships placed?
     bool player2_ready;
+    bool elo_pending;    // Replay: đã kết thúc nhưng chưa thấy END (ELO có thể chưa cập nhật)
 
-    time_t turn_started_at;        // Timestamp khi turn bắt đầu
+    uint64_t turn_deadline_ms;     // timer_now_ms() lúc hết lượt
     int turn_timeout_seconds;      // 30 seconds
     bool turn_timeout_warned;      // warning
+    timer_entry_t turn_timer;      // Cảnh báo rồi xử thua khi hết lượt
+
+    // Vòng đời: mỗi game_get/game_find_by_player trả về +1 ref, registry giữ
+    // 1 ref tới khi game bị gỡ (GAME_EVICT_DELAY sau khi kết thúc)
+    int refcount;                  // atomic
+    struct game_session *reg_next; // Chain trong shard của game registry
+    timer_entry_t evict_timer;
+
+    // Mailbox của actor (xem game_actor.h). State ở trên chỉ được đổi bởi
+    // worker đang giữ mb_scheduled.
+    pthread_mutex_t mb_lock;
+    struct game_cmd *mb_head;
+    struct game_cmd *mb_tail;
+    bool mb_scheduled;             // Đang nằm trong run queue hoặc đang chạy
+    struct game_session *run_next;
+    uint64_t queue_delay_max_ms;   // Queueing delay lớn nhất của game này
+
+    // Write-behind (xem game_persist.h). state_lock bao quanh mỗi lệnh của
+    // worker; persist thread giữ nó khi chụp delta.
+    pthread_mutex_t state_lock;
+    struct game_persist_msg *persist_waiters; // Reply chờ flush (durability=persist)
+    bool persist_queued;           // Đang nằm trong hàng đợi flush (g_persist_lock)
+    struct game_session *persist_next;
+    uint32_t wal_pin;              // Segment WAL cũ nhất còn record chưa ghi (0: không có)
 } game_session_t;
 
 bool game_is_player_turn(const char *game_id, const char *player_id);
 void game_switch_turn(game_session_t *game);
 game_session_t* game_find_by_player(const char *player_id);
 
-// Game operations
-bool game_create(const char *player1_id, const char *player2_id, char *out_game_id);
+// Game operations. game_get/game_find_by_player/game_load_from_db trả về
+// game kèm 1 ref: caller phải gọi game_release() khi dùng xong.
+// Tạo game mới (DB + session trong registry, socket đã gán), trả về kèm 1 ref;
+// NULL nếu lỗi
+game_session_t* game_create(const char *player1_id, const char *player2_id,
+                            int player1_socket, int player2_socket);
 game_session_t* game_get(const char *game_id);
 game_session_t* game_load_from_db(const char *game_id);
-bool game_place_ship(const char *game_id, const char *player_id, 
+// Các thao tác dưới chạy trên game worker (hoặc replay) với state_lock đang
+// giữ; caller giữ ref của game. Chỉ ws handler mới tra game theo id.
+bool game_place_ship(game_session_t *game, const char *player_id,
                      ship_type_t type, int row, int col, bool is_horizontal);
-shot_result_t game_process_shot(const char *game_id, const char *player_id, int row, int col);
+// Đặt cả hạm đội và ready luôn (ships NULL: server tự xếp ngẫu nhiên). Hạm
+// đội được gửi lại qua MSG_PLACE_FLEET tới sock (<= 0: không gửi).
+bool game_place_fleet(game_session_t *game, const char *player_id, int sock,
+                      const ship_t *ships, int count);
+// false: phát bắn bị từ chối (sai lượt / ô đã bắn), lượt không đổi
+bool game_process_shot(game_session_t *game, const char *player_id, int row, int col,
+                       shot_result_t *out);
 bool game_update_state(const char *game_id, game_state_t new_state);
-bool game_end(const char *game_id, const char *winner_id);
-void game_free(game_session_t *game);
+bool game_end(game_session_t *game, const char *winner_id);
+void game_acquire(game_session_t *game);
+void game_release(game_session_t *game);
 
 // HÀM READY: Cập nhật board của người chơi bằng mảng 1D
-bool game_set_player_ready(const char *game_id, const char *player_id, const uint8_t board[BOARD_SIZE]);
-void* game_timeout_monitor_thread(void* arg);
-void game_init_timeout_monitor();
+bool game_set_player_ready(game_session_t *game, const char *player_id, const uint8_t board[BOARD_SIZE]);
+void game_start_turn_clock(game_session_t *game);
+
+// Chạy trên game worker (GAME_CMD_TURN_TIMER): cảnh báo hoặc xử thua; lúc
+// đặt tàu thì tự xếp hạm đội cho người chưa ready khi hết giờ
+void game_on_turn_timer(game_session_t *game);
 #endif // GAME_H
\ No newline at end of file
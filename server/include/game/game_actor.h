@@ -0,0 +1,50 @@
+#ifndef GAME_ACTOR_H
+#define GAME_ACTOR_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "game/game.h"
+#include "game/game_board.h"
+
+// Mỗi game là một actor: mọi lệnh làm thay đổi state (bắn, đặt tàu, ready,
+// chat, hết lượt) được đưa vào mailbox của game và thực thi tuần tự bởi pool
+// game worker. Một game chỉ chạy trên một worker tại một thời điểm, các game
+// khác nhau chạy song song, nên không cần lock state của game.
+
+typedef enum {
+    GAME_CMD_SHOT,
+    GAME_CMD_PLACE,
+    GAME_CMD_FLEET,
+    GAME_CMD_READY,
+    GAME_CMD_CHAT,
+    GAME_CMD_TURN_TIMER
+} game_cmd_type_t;
+
+typedef struct game_cmd {
+    struct game_cmd *next;
+    game_cmd_type_t type;
+    uint64_t enqueued_ms;          // timer_now_ms() lúc post, để đo queueing delay
+    int client_sock;               // Socket người gửi (-1 với lệnh nội bộ)
+    char player_id[64];
+    union {
+        struct { int row; int col; } shot;
+        struct { ship_type_t type; int row; int col; bool is_horizontal; } place;
+        struct { ship_t ships[MAX_SHIPS]; int count; bool auto_place; } fleet;
+        struct { uint8_t board[BOARD_SIZE]; } ready;
+        struct { char text[128]; } chat;
+    } u;
+} game_cmd_t;
+
+bool game_actor_start(int workers);
+
+// Cấp phát lệnh (NULL nếu hết bộ nhớ); caller điền u rồi post
+game_cmd_t* game_cmd_new(game_cmd_type_t type, int client_sock, const char *player_id);
+
+// Đưa lệnh vào mailbox của game (caller phải đang giữ ref của game).
+// Mailbox giữ quyền sở hữu cmd kể từ đây.
+void game_actor_post(game_session_t *game, game_cmd_t *cmd);
+
+// Tổng số lệnh đã chạy và queueing delay (tổng / lớn nhất, ms)
+void game_actor_stats(uint64_t *commands, uint64_t *delay_total_ms, uint64_t *delay_max_ms);
+
+#endif // GAME_ACTOR_H
@@ -2,6 +2,8 @@
 #define GAME_BOARD_H
 
 #include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
 
 #define GRID_SIZE 10
 #define BOARD_SIZE (GRID_SIZE * GRID_SIZE)
@@ -24,30 +26,85 @@ typedef enum {
     CELL_MISS = 3
 } cell_state_t;
 
-// Ship structure
+// Bitboard: bit i = ô i (row * GRID_SIZE + col), chỉ dùng 100 bit thấp
+typedef unsigned __int128 bitboard_t;
+
+#define BB_BIT(index) ((bitboard_t)1 << (index))
+
+// Ship structure (hits/sunk suy ra từ mask & board->hit_bits)
 typedef struct {
     ship_type_t type;
     int start_row;
     int start_col;
     bool is_horizontal;
-    int hits;  // Number of hits on this ship
-    bool is_sunk;
+    bitboard_t mask;     // Các ô tàu chiếm
 } ship_t;
 
 // Player board
 typedef struct {
-    cell_state_t grid[BOARD_SIZE];
+    bitboard_t ship_bits;   // Mọi ô có tàu
+    bitboard_t hit_bits;    // Ô tàu đã bị bắn trúng
+    bitboard_t miss_bits;   // Ô nước đã bị bắn
     ship_t ships[MAX_SHIPS];
     int ship_count;
-    int ships_remaining;
 } board_t;
 
+static inline int bb_popcount(bitboard_t bb) {
+    return __builtin_popcountll((uint64_t)bb) + __builtin_popcountll((uint64_t)(bb >> 64));
+}
+
+static inline int board_ship_hits(const board_t *board, int i) {
+    return bb_popcount(board->ships[i].mask & board->hit_bits);
+}
+
+static inline bool board_ship_is_sunk(const board_t *board, int i) {
+    return (board->ships[i].mask & ~board->hit_bits) == 0;
+}
+
+static inline int board_ships_remaining(const board_t *board) {
+    int remaining = 0;
+    for (int i = 0; i < board->ship_count; i++) {
+        if (!board_ship_is_sunk(board, i)) remaining++;
+    }
+    return remaining;
+}
+
 // Board operations
 void board_init(board_t *board);
 bool board_place_ship(board_t *board, ship_type_t type, int row, int col, bool is_horizontal);
 bool board_validate_placement(board_t *board, int row, int col, int length, bool is_horizontal);
 bool board_is_valid_shot(board_t *board, int row, int col);
 
+// Chuyển đổi với dạng lưới (BSON, debug)
+cell_state_t board_cell(const board_t *board, int index);
+void board_set_cell(board_t *board, int index, cell_state_t state);
+bool board_add_ship(board_t *board, ship_type_t type, int row, int col, bool is_horizontal);
+
+// Dựng tàu từ lưới client gửi lên (mỗi ô = độ dài tàu, 0 = nước)
+int board_load_layout(board_t *board, const uint8_t cells[BOARD_SIZE]);
+void board_to_layout(const board_t *board, uint8_t cells[BOARD_SIZE]);
+
+// Đặt cả hạm đội một lần: đúng MAX_SHIPS tàu, mỗi loại một chiếc, không chồng
+// hay sát nhau (dùng type/start_row/start_col/is_horizontal của ships). Thành
+// công thì thay toàn bộ board, lỗi thì board giữ nguyên.
+bool board_place_fleet(board_t *board, const ship_t *ships, int count);
+
+// Hạm đội ngẫu nhiên hợp lệ (người chơi AFK, bot). seed là trạng thái
+// xorshift64 của caller, được cập nhật sau mỗi lần gọi.
+bool board_auto_place(board_t *board, uint64_t *seed);
+
+// Dạng nén lưu trong DB (BSON binary). Version 1 là document cũ (ships + grid
+// 10x10 int32), chỉ còn được đọc để migrate.
+//   [0] version, [1] ship_count
+//   mỗi tàu 2 byte: type | horizontal << 3, ô bắt đầu (row * 10 + col)
+//   hit_bits, miss_bits: mỗi bitboard BOARD_BITS_BYTES byte little-endian
+#define BOARD_PACKED_VERSION 2
+#define BOARD_BITS_BYTES 13
+#define BOARD_PACKED_MAX (2 + MAX_SHIPS * 2 + 2 * BOARD_BITS_BYTES)
+
+size_t board_pack(const board_t *board, uint8_t out[BOARD_PACKED_MAX]);
+bool board_unpack(board_t *board, const uint8_t *data, size_t len);
+
 // Shot result structure
 typedef struct {
     bool is_hit;
@@ -0,0 +1,47 @@
+#ifndef GAME_PERSIST_H
+#define GAME_PERSIST_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "game/game.h"
+#include "network/ws_protocol.h"
+#include <bson/bson.h>
+
+// Write-behind cho game state: state trong memory là bản gốc, thay đổi chỉ
+// đánh dấu dirty rồi xếp game vào hàng đợi. Persist thread gom các game,
+// mỗi game một update_one (delta, xem GAME_DIRTY_*), ghi bằng một bulk write
+// sau GAME_FLUSH_MS hoặc khi đủ GAME_PERSIST_BATCH game.
+
+#define GAME_PERSIST_BATCH 128     // Flush ngay khi có ngần này game chờ
+
+typedef enum {
+    GAME_DURABILITY_IMMEDIATE,     // Trả lời người chơi ngay, ghi DB sau
+    GAME_DURABILITY_PERSIST        // Trả lời sau khi bulk write chứa thay đổi thành công
+} game_durability_t;
+
+bool game_persist_start(void);
+
+// Xếp game vào lần flush kế tiếp (caller đang giữ ref). Gọi sau khi đổi state,
+// trên thread đang giữ game->state_lock.
+void game_persist_schedule(game_session_t *game);
+
+// Gửi message theo chế độ durability: ngay lập tức, hoặc giữ lại tới khi
+// thay đổi hiện tại của game đã nằm trong DB.
+void game_persist_send(game_session_t *game, int sock, message_t *msg);
+
+typedef struct {
+    uint64_t queue_depth;          // Số game đang chờ flush
+    uint64_t queue_peak;
+    uint64_t flushes;              // Số bulk write đã chạy
+    uint64_t games_written;
+    uint64_t failures;
+    uint64_t flush_total_ms;
+    uint64_t flush_max_ms;
+} game_persist_stats_t;
+
+void game_persist_stats(game_persist_stats_t *out);
+
+// Board dạng nén (BSON binary subtype user, xem board_pack)
+void board_to_bson(bson_t *parent, const char *key, const board_t *board);
+
+#endif // GAME_PERSIST_H
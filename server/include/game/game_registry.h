@@ -0,0 +1,31 @@
+#ifndef GAME_REGISTRY_H
+#define GAME_REGISTRY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "game/game.h"
+
+// Registry các game đang nằm trong memory: hash map chia shard theo game_id,
+// kèm index player_id → game (game mới nhất của người chơi).
+// Reader lấy read lock của shard và tăng refcount trước khi nhả lock, nên
+// game trả về luôn hợp lệ cho tới khi caller gọi game_release().
+
+bool game_registry_init(void);
+
+// Game với +1 ref, NULL nếu không có trong memory
+game_session_t* game_registry_get(const char *game_id);
+game_session_t* game_registry_find_by_player(const char *player_id);
+
+// Thêm game vừa load (caller đang giữ 1 ref, registry lấy thêm ref riêng).
+// Nếu game_id đã có (hai thread cùng load từ DB) thì bản mới bị nhả và trả về
+// bản đã có, cũng với +1 ref cho caller.
+game_session_t* game_registry_insert(game_session_t *game);
+
+// Gỡ game khỏi cả hai index rồi nhả ref của registry.
+// Trả về false nếu game không (còn) nằm trong registry.
+bool game_registry_remove(game_session_t *game);
+
+// Số game đang trong registry (phục vụ log/metrics)
+size_t game_registry_size(void);
+
+#endif
@@ -0,0 +1,81 @@
+#ifndef GAME_WAL_H
+#define GAME_WAL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "game/game.h"
+
+// Write-ahead log cục bộ cho sự kiện game. Mỗi thay đổi state được chép vào
+// segment mmap (GAME_WAL_DIR/game-<seq>.wal) trước khi tới Mongo; sync thread
+// msync theo nhóm mỗi GAME_WAL_SYNC_MS. Khởi động lại thì replay các segment
+// còn lại để dựng lại game đang chơi dở.
+//
+// Segment bị xoá khi mọi game có record trong đó đã được persist thread ghi
+// xong (game->wal_pin giữ segment cũ nhất mà game còn record chưa ghi).
+//
+// Record: [crc32 4][len 2][type 1][pad 1][lsn 8][game_id 24][body len byte]
+
+typedef enum {
+    GAME_WAL_CREATE = 1,
+    GAME_WAL_PLACE,
+    GAME_WAL_READY,
+    GAME_WAL_SHOT,
+    GAME_WAL_END
+} game_wal_type_t;
+
+typedef struct {
+    game_wal_type_t type;
+    char game_id[25];
+    char player_id[64];            // Người thực hiện (CREATE: player1, END: winner)
+    uint64_t lsn;
+    union {
+        struct { char player2_id[64]; } create;
+        struct { uint8_t type, row, col; bool is_horizontal; } place;
+        struct { uint8_t board[BOARD_SIZE]; } ready;
+        struct { uint32_t index; uint8_t row, col; } shot;   // index: vị trí trong move log
+    } u;
+} game_wal_event_t;
+
+// Replay WAL còn lại rồi mở segment mới. Gọi một lần lúc khởi động, sau khi
+// registry/actor/persist đã chạy và trước khi nhận kết nối. Không mở được
+// thư mục WAL thì chạy tiếp không có WAL (trả về true).
+bool game_wal_start(void);
+
+// Ghi event (game đang giữ state_lock, hoặc NULL khi chưa có session).
+// Trả về LSN, 0 nếu WAL tắt hoặc đang replay.
+uint64_t game_wal_append(game_session_t *game, const game_wal_event_t *ev);
+
+// Gắn game vào segment (game đang giữ state_lock, chưa có pin)
+void game_wal_pin(game_session_t *game, uint32_t segment);
+
+// Persist thread: các record của game tới pin này đã nằm trong Mongo
+void game_wal_unpin(uint32_t segment);
+
+// Áp một event đọc lại từ segment vào game (cài đặt trong game.c); game
+// được pin vào segment cho tới lần flush kế tiếp. false nếu bỏ qua.
+bool game_replay_event(const game_wal_event_t *ev, uint32_t segment);
+
+// Gọi sau replay, khi WAL đã ghi được: cập nhật ELO cho các trận kết thúc
+// trong replay mà WAL chưa có END (cài đặt trong game.c)
+void game_replay_finish(void);
+
+// true trong lúc game_wal_start đang replay (không ghi WAL, ELO để lại cho
+// game_replay_finish)
+bool game_wal_replaying(void);
+
+typedef struct {
+    uint64_t appends;
+    uint64_t bytes;
+    uint64_t last_lsn;
+    uint64_t durable_lsn;          // LSN lớn nhất đã msync xong
+    uint64_t syncs;
+    uint64_t sync_total_ms;
+    uint64_t sync_max_ms;
+    uint64_t segments;             // Segment đang giữ trên đĩa
+    uint64_t replayed;             // Event đã replay lúc khởi động
+    uint64_t recovery_ms;
+} game_wal_stats_t;
+
+void game_wal_stats(game_wal_stats_t *out);
+
+#endif // GAME_WAL_H
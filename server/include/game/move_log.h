@@ -0,0 +1,57 @@
+#ifndef MOVE_LOG_H
+#define MOVE_LOG_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Nhật ký nước đi dạng nén, vài byte mỗi cú bắn:
+//   byte 0: bit 7 = người bắn (0: player1, 1: player2), bit 0-6 = ô (row * 10 + col)
+//   byte 1: bit 0 = trúng, bit 1 = chìm, bit 2-4 = loại tàu chìm, bit 5 = hết game
+//   varint: số ms kể từ nước trước (nước đầu: kể từ base_ms)
+// Dùng cho snapshot khi reconnect, replay và lưu DB.
+
+#define MOVE_LOG_INITIAL_CAP 64
+
+typedef struct {
+    uint8_t shooter;       // 0: player1, 1: player2
+    uint8_t row;
+    uint8_t col;
+    bool is_hit;
+    bool is_sunk;
+    uint8_t sunk_ship_type;
+    bool game_over;
+    uint64_t timestamp_ms; // Unix ms
+} move_t;
+
+typedef struct {
+    uint8_t *buf;
+    uint32_t len;
+    uint32_t cap;
+    uint32_t count;
+    uint64_t base_ms;      // Mốc của delta đầu tiên (thường là created_at)
+    uint64_t last_ms;      // Timestamp của nước cuối
+} move_log_t;
+
+// Đọc tuần tự: khởi tạo bằng move_log_iter_init rồi gọi move_log_next tới khi false
+typedef struct {
+    const move_log_t *log;
+    uint32_t pos;
+    uint64_t ts_ms;
+} move_log_iter_t;
+
+void move_log_init(move_log_t *log, uint64_t base_ms);
+void move_log_free(move_log_t *log);
+
+// Unix ms hiện tại (CLOCK_REALTIME)
+uint64_t move_log_now_ms(void);
+
+bool move_log_append(move_log_t *log, const move_t *move);
+
+// Nạp lại log từ bytes đã lưu (DB); false nếu dữ liệu hỏng
+bool move_log_load(move_log_t *log, uint64_t base_ms, const uint8_t *data, uint32_t len);
+
+void move_log_iter_init(move_log_iter_t *it, const move_log_t *log);
+bool move_log_next(move_log_iter_t *it, move_t *out);
+
+#endif // MOVE_LOG_H
@@ -3,10 +3,16 @@
 
 #include <stdbool.h>
 #include <stdint.h>
+#include "utils/timer_wheel.h"
 
-#define MAX_CHALLENGES 100
 #define CHALLENGE_EXPIRE_TIME 60  // 60 seconds
 
+// Lời mời nằm trong mảng slot cố định (CHALLENGE_MAX, mặc định 65536), được
+// index bằng hash theo challenge_id, theo người mời và theo người được mời:
+// mọi lookup và kiểm tra trùng là O(1). Một mutex bảo vệ cả store; lookup
+// trả về bản sao nên caller không giữ con trỏ vào slot có thể bị expiry
+// thread xoá. Id lấy từ bộ đếm tăng dần nên không bao giờ trùng.
+
 typedef enum {
     CHALLENGE_STATUS_PENDING,
     CHALLENGE_STATUS_ACCEPTED,
@@ -27,16 +33,17 @@ typedef struct {
     int64_t expires_at;           // Timestamp (seconds)
     challenge_status_t status;
     bool is_active;
+    timer_entry_t expire_timer;   // Hết hạn sau CHALLENGE_EXPIRE_TIME
 } challenge_session_t;
 
 // Challenge operations
-void challenge_manager_init(void);
+bool challenge_manager_init(void);
 void challenge_manager_cleanup(void);
 
-// Create/Delete
-char* challenge_create(const char *challenger_id, const char *target_id, 
-                       int challenger_sock, int target_sock,
-                       const char *game_mode, int time_control);
+// Create/Delete. out_id cần ít nhất 65 byte.
+bool challenge_create(const char *challenger_id, const char *target_id,
+                      int challenger_sock, int target_sock,
+                      const char *game_mode, int time_control, char *out_id);
 bool challenge_cancel(const char *challenge_id);
 bool challenge_remove(const char *challenge_id);
 
@@ -45,12 +52,9 @@ bool challenge_accept(const char *challenge_id);
 bool challenge_decline(const char *challenge_id);
 bool challenge_expire(const char *challenge_id);
 
-// Lookup
-challenge_session_t* challenge_get(const char *challenge_id);
-challenge_session_t* challenge_find_by_challenger(const char *user_id);
-challenge_session_t* challenge_find_by_target(const char *user_id);
-
-// Cleanup
-void challenge_check_expired(void);
+// Lookup: chép challenge vào out, false nếu không có
+bool challenge_get(const char *challenge_id, challenge_session_t *out);
+bool challenge_find_by_challenger(const char *user_id, challenge_session_t *out);
+bool challenge_find_by_target(const char *user_id, challenge_session_t *out);
 
 #endif
\ No newline at end of file
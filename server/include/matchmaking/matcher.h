@@ -2,26 +2,64 @@
 #define MATCHER_H
 
 #include <stdbool.h>
+#include <stdint.h>
 
 typedef struct {
     char user_id[64];
     int socket;
     int elo_rating;
     char game_type[32]; // "ranked", "casual", etc.
-    long long join_time; // timestamp
+    long long join_time; // timer_now_ms() lúc vào hàng đợi
 } queue_player_t;
 
+// Hàng đợi được index theo game type rồi theo ELO (mỗi giá trị ELO một bucket
+// FIFO, kèm bitmap bucket khác rỗng). Tìm đối thủ gần ELO nhất chỉ quét vài
+// word bitmap quanh ELO của người chơi; thêm/xóa theo user_id là O(1).
+//
+// Việc ghép chạy trên matchmaking thread, mỗi MATCH_TICK_MS một lượt cho cả
+// hàng đợi; tạo game và gửi START_GAME cũng ở đó, không nằm trên đường join.
+// Tầm ELO chấp nhận của mỗi người nới dần theo thời gian chờ.
+// MATCH_MODE=batch thay ghép greedy (người chờ lâu nhất lấy đối thủ gần
+// nhất) bằng ghép tối ưu tổng chênh ELO cho cả pool mỗi tick.
+//
+// Index thuộc riêng matchmaking thread. Join/leave (kể cả dọn dẹp lúc
+// disconnect) từ thread mạng chỉ push yêu cầu vào hàng MPSC không lock;
+// đầu mỗi tick matchmaking thread áp chúng theo đúng thứ tự push.
+
 // Matchmaking functions
-void matcher_init();
+bool matcher_init();
+bool matcher_start();      // Chạy matchmaking thread (sau khi game registry sẵn sàng)
 void matcher_cleanup();
 
-// Queue operations
+// Queue operations (gọi từ thread bất kỳ, không block; true = đã nhận yêu cầu)
 bool matcher_add_to_queue(int client_sock, const char *user_id, int elo_rating, const char *game_type);
 bool matcher_remove_from_queue(const char *user_id);
-void matcher_find_match(); // Tìm cặp đấu
+// Áp join/leave đang chờ rồi ghép một lượt cho cả hàng đợi. Chỉ
+// matchmaking thread gọi (mỗi tick).
+void matcher_find_match();
+
+int matcher_get_queue_size();  // Số người trong hàng đợi tại tick gần nhất
+
+#define MATCH_ELO_BANDS 5          // <800, 800-1199, 1200-1599, 1600-1999, >=2000
+
+typedef struct {
+    uint64_t queued;
+    uint64_t intake_pending;       // Join/leave đã nhận, chưa áp vào hàng đợi
+    uint64_t intake_ops;           // Tổng số join/leave đã áp
+    uint64_t passes;
+    uint64_t pass_max_ms;
+    uint64_t matches;             // Số cặp đã ghép
+    uint64_t elo_gap_total;       // Tổng chênh ELO của các cặp (chất lượng ghép)
+    uint64_t create_failures;
+    struct {
+        uint64_t players;          // Số người đã được ghép trong band
+        uint64_t p50_ms;           // Thời gian chờ tới lúc được ghép
+        uint64_t p90_ms;
+        uint64_t p99_ms;
+        uint64_t max_ms;
+    } bands[MATCH_ELO_BANDS];
+} matcher_stats_t;
 
-// Helper
-queue_player_t* matcher_get_player(const char *user_id);
-int matcher_get_queue_size();
+void matcher_stats(matcher_stats_t *out);
 
-#endif // MATCHER_H
\ No newline at end of file
+#endif // MATCHER_H
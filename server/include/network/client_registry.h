@@ -0,0 +1,28 @@
+#ifndef CLIENT_REGISTRY_H
+#define CLIENT_REGISTRY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Registry user_id ↔ socket cho các client đã đăng nhập.
+// Hash map chia shard, lookup không lock (đọc snapshot bảng đã publish);
+// chỉ ghi mới lấy lock của shard. Entry giữ lại sau khi disconnect
+// (socket = -1) để reconnect dùng lại, giống g_clients trước đây.
+
+bool client_registry_init(int max_sockets);
+void client_registry_cleanup(void);
+
+// Gắn user với socket, trả về socket cũ (-1 nếu chưa có / đã disconnect)
+int client_registry_bind(const char *user_id, int sock);
+
+// Socket hiện tại của user, -1 nếu offline. Không lock.
+int client_registry_lookup(const char *user_id);
+
+// Gỡ socket khi disconnect. Trả về true và copy user_id nếu socket này là
+// socket hiện tại của user (false nếu chưa login hoặc user đã sang socket khác).
+bool client_registry_unbind_socket(int sock, char *user_id_out, size_t len);
+
+// Số user đã từng đăng ký (phục vụ log/metrics)
+size_t client_registry_size(void);
+
+#endif
@@ -0,0 +1,108 @@
+#ifndef WS_CONN_H
+#define WS_CONN_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include "utils/timer_wheel.h"
+
+#define WS_CONN_RBUF_SIZE 8192
+#define WS_CONN_MAX_IOV 16         // Số iovec tối đa cho một lần gather write
+#define WS_CONN_OUTQ_MAX 256       // Số frame tối đa chờ gửi; vượt quá thì ngắt kết nối
+
+// Một frame đã đóng gói (header + payload) chờ reactor gửi
+typedef struct ws_outmsg {
+    struct ws_outmsg *next;
+    size_t len;
+    uint8_t *data;               // Trỏ ngay sau struct, cùng một lần malloc
+} ws_outmsg_t;
+
+typedef enum {
+    WS_CONN_HANDSHAKE,   // Đang chờ HTTP upgrade request
+    WS_CONN_OPEN,        // Đã handshake, nhận/gửi frame
+    WS_CONN_CLOSING      // Đã tách khỏi epoll, chờ worker cleanup
+} ws_conn_state_t;
+
+// Per-connection state. Read side and socket writes are owned by the
+// reactor thread; other threads only push frames into the outbound mailbox.
+typedef struct ws_conn {
+    int fd;
+    int worker;                  // Worker xử lý message của connection này
+    ws_conn_state_t state;
+    uint8_t proto_version;       // WS_PROTO_V1/V2, chốt lúc handshake
+    int refcount;                // Guarded by the fd table lock
+    uint64_t last_active_ms;     // timer_now_ms(); reactor ghi, timer đọc (atomic)
+    timer_entry_t idle_timer;    // Đóng connection im lặng quá WS_IDLE_TIMEOUT
+
+    // Session sau khi đăng nhập (chỉ worker của connection đọc/ghi)
+    bool authenticated;
+    char session_user_id[64];
+    time_t session_exp;
+
+    // Read state machine (reactor only): ring buffer, dữ liệu chưa parse
+    // nằm ở [rhead, rhead + rlen) modulo WS_CONN_RBUF_SIZE
+    uint8_t rbuf[WS_CONN_RBUF_SIZE];
+    size_t rhead;
+    size_t rlen;
+
+    // Write state machine
+    pthread_mutex_t wlock;
+    uint8_t *wbuf;               // Bytes chưa gửi được (socket đầy)
+    size_t wlen;
+    size_t wcap;
+    bool closed;
+
+    // Outbound mailbox: lock-free MPSC (Vyukov), chỉ reactor drain
+    ws_outmsg_t *out_head;       // Consumer (reactor)
+    ws_outmsg_t *out_tail;       // Producers: atomic exchange
+    ws_outmsg_t out_stub;
+    int out_depth;               // Số frame đang chờ (atomic)
+    int out_hwm;                 // High-water mark (atomic)
+    uint64_t out_drops;          // Frame bị từ chối vì đầy hàng đợi (atomic)
+    bool out_scheduled;          // Đang nằm trong ready list (atomic)
+    struct ws_conn *ready_next;
+} ws_conn_t;
+
+// fd table
+bool ws_conn_table_init(void);
+ws_conn_t* ws_conn_create(int fd, int worker);
+ws_conn_t* ws_conn_acquire(int fd);
+void ws_conn_release(ws_conn_t *conn);
+void ws_conn_close(ws_conn_t *conn);
+int ws_conn_table_size(void);
+
+// Receive ring (reactor only)
+ssize_t ws_conn_ring_fill(ws_conn_t *conn);
+void ws_conn_ring_linearize(ws_conn_t *conn);
+void ws_conn_ring_consume(ws_conn_t *conn, size_t n);
+
+// Phần dữ liệu liên tục bắt đầu từ rhead (không wrap)
+static inline size_t ws_conn_ring_contiguous(const ws_conn_t *conn) {
+    size_t to_end = WS_CONN_RBUF_SIZE - conn->rhead;
+    return conn->rlen < to_end ? conn->rlen : to_end;
+}
+
+// Write path (reactor only): non-blocking, một sendmsg cho header + payload
+// (và cả bytes đang tồn đọng); phần chưa gửi được giữ lại cho tới khi EPOLLOUT
+int ws_conn_write(ws_conn_t *conn, const void *header, size_t header_len,
+                  const void *payload, size_t payload_len);
+int ws_conn_writev(ws_conn_t *conn, const struct iovec *iov, int iovcnt);
+int ws_conn_flush(ws_conn_t *conn);
+void ws_conn_write_stats(uint64_t *frames, uint64_t *syscalls);
+
+// Outbound mailbox: gọi được từ mọi thread. Frame được copy vào hàng đợi
+// của connection và reactor gửi theo đúng thứ tự enqueue.
+int ws_conn_enqueue(ws_conn_t *conn, const void *header, size_t header_len,
+                    const void *payload, size_t payload_len);
+int ws_conn_drain(ws_conn_t *conn);
+int ws_conn_notify_fd(void);
+void ws_conn_drain_ready(void (*on_error)(ws_conn_t *conn));
+
+// Yêu cầu reactor đóng connection (an toàn từ mọi thread)
+void ws_conn_shutdown(int fd);
+
+#endif
@@ -12,18 +12,20 @@ void handle_message(int client_sock, message_t *msg);
 // Các hàm xử lý chi tiết
 void handle_register(int client_sock, auth_payload *auth);
 void handle_login(int client_sock, auth_payload *auth);
-void handle_join_queue(int client_sock, const char *token);
-void handle_leave_queue(int client_sock, const char *token);
-void handle_player_move(int client_sock, message_t *msg);
-void handle_chat(int client_sock, chat_payload *chat, const char *token);
-void handle_place_ship(int client_sock, place_ship_payload *payload, const char *token);
-void handle_logout(int client_sock, message_t *msg);
+void handle_join_queue(int client_sock, const char *user_id);
+void handle_leave_queue(int client_sock, const char *user_id);
+void handle_player_move(int client_sock, const char *user_id, message_t *msg);
+void handle_chat(int client_sock, chat_payload *chat, const char *user_id);
+void handle_place_ship(int client_sock, place_ship_payload *payload, const char *user_id);
+void handle_place_fleet(int client_sock, place_fleet_payload *payload, const char *user_id);
+void handle_logout(int client_sock, const char *user_id);
 int check_token(int client_sock, const char *token, auth_user_t *out_user);
-void handle_player_ready(int client_sock, message_t *msg);
-void handle_get_online_players(int client_sock, const char *token);
-void handle_challenge_player(int client_sock, challenge_payload *payload, const char *token);
-void handle_challenge_accept(int client_sock, challenge_response_payload *payload, const char *token);
-void handle_challenge_decline(int client_sock, challenge_response_payload *payload, const char *token);
-void handle_challenge_cancel(int client_sock, challenge_response_payload *payload, const char *token);
+void session_clear(int client_sock);
+void handle_player_ready(int client_sock, const char *user_id, message_t *msg);
+void handle_get_online_players(int client_sock, const char *user_id);
+void handle_challenge_player(int client_sock, challenge_payload *payload, const char *challenger_id);
+void handle_challenge_accept(int client_sock, challenge_response_payload *payload, const char *user_id);
+void handle_challenge_decline(int client_sock, challenge_response_payload *payload, const char *user_id);
+void handle_challenge_cancel(int client_sock, challenge_response_payload *payload, const char *user_id);
 void handle_auth_token(int client_sock, const char *token);
 #endif
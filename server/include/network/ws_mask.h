@@ -0,0 +1,16 @@
+#ifndef WS_MASK_H
+#define WS_MASK_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// XOR data với masking key (RFC 6455 §5.3), xử lý tại chỗ.
+// key_offset: vị trí byte đầu tiên trong chuỗi mask (0 nếu bắt đầu payload),
+// dùng khi unmask payload theo nhiều đoạn.
+// Tự chọn AVX2 / SSE2 / scalar 64-bit theo CPU lúc khởi động.
+void ws_mask_apply(uint8_t *data, size_t len, const uint8_t key[4], size_t key_offset);
+
+// Tên implementation đang dùng ("avx2", "sse2", "scalar")
+const char* ws_mask_impl_name(void);
+
+#endif
@@ -6,6 +6,7 @@
 #include <stdint.h>
 #include <sys/socket.h>
 #include "game/game_board.h"
+#include "network/ws_conn.h"
 
 // WebSocket opcode
 typedef enum {
@@ -58,6 +59,7 @@ typedef enum {
     MSG_TURN_WARNING = 28,
     MSG_GAME_TIMEOUT = 29,
     MSG_CHAT_MESSAGE = 30,
+    MSG_PLACE_FLEET = 31,             // Client ↔ Server: cả hạm đội trong một message
 } msg_type;
 
 typedef struct __attribute__((packed)) {
@@ -89,6 +91,21 @@ typedef struct {
     uint8_t _padding[3];
 } place_ship_payload;
 
+typedef struct __attribute__((packed)) {
+    uint8_t ship_type;      // Như place_ship_payload
+    uint8_t row;
+    uint8_t col;
+    uint8_t is_horizontal;
+} fleet_ship_t;
+
+// Client → Server: đủ MAX_SHIPS tàu, hoặc auto_place = 1 để server tự xếp.
+// Server → Client: hạm đội đã được chấp nhận (cả khi server tự xếp lúc hết giờ).
+typedef struct __attribute__((packed)) {
+    uint8_t count;
+    uint8_t auto_place;
+    fleet_ship_t ships[MAX_SHIPS];
+} place_fleet_payload;
+
 // Payload structs
 typedef struct { char username[32]; char password[32]; } auth_payload;
 typedef struct { char token[MAX_JWT_LEN]; char username[32]; } auth_success_payload;
@@ -148,6 +165,7 @@ typedef struct __attribute__((packed)) {
         chat_payload chat;
         chat_message_payload chat_msg;
         place_ship_payload place_ship;
+        place_fleet_payload place_fleet;
         ready_payload ready;
         online_players_payload online_players;
         challenge_payload challenge;
@@ -158,8 +176,31 @@ typedef struct __attribute__((packed)) {
     } payload;
 } message_t;
 
+// Lớn nhất là message_t (~5.5 KB)
+#define WS_MAX_FRAME_PAYLOAD (WS_CONN_RBUF_SIZE - 14)
+
+// Wire protocol versions, negotiated via Sec-WebSocket-Protocol
+#define WS_PROTO_V1 1              // Legacy: nguyên message_t cố định mỗi frame
+#define WS_PROTO_V2 2              // Compact: header + token + payload thực tế
+#define WS_SUBPROTOCOL_V2 "battleship.v2"
+
+// v2 frame: type(1) | token_len(2, LE) | payload_len(2, LE) | token | payload
+#define WS_V2_HEADER_LEN 5
+#define WS_V2_MAX_LEN (WS_V2_HEADER_LEN + MAX_JWT_LEN + sizeof(((message_t*)0)->payload))
+
+typedef enum {
+    WS_DECODE_ERROR = -1,
+    WS_DECODE_CLOSE = 0,
+    WS_DECODE_MESSAGE = 1,
+    WS_DECODE_CONTROL = 2    // PING/PONG đã xử lý, không có message
+} ws_decode_result_t;
+
 // WebSocket functions
 int ws_handshake(int sock);
+int ws_handshake_response(const char *request, char *response, size_t response_len, uint8_t *version);
+int ws_parse_frame(uint8_t *buf, size_t len, ws_frame_t *frame, char **payload);
+ws_decode_result_t ws_decode_message(int sock, uint8_t version, const ws_frame_t *frame, const char *payload, message_t *msg);
+size_t ws_payload_size(msg_type type);
 ssize_t ws_send_message(int sock, message_t *msg);
 ssize_t ws_recv_message(int sock, message_t *msg);
 int ws_send_frame(int sock, uint8_t opcode, const char *payload, size_t len);
@@ -0,0 +1,42 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Hierarchical timing wheel chạy trên một thread riêng, đánh thức bằng timerfd.
+// Mỗi deadline (lượt đi, lời mời, connection idle) là một timer_entry_t nhúng
+// thẳng trong object sở hữu nó: arm/cancel O(1), mỗi tick O(1) bất kể số timer.
+#define TIMER_TICK_MS 10
+#define TIMER_WHEEL_BITS 6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_BITS)   // 64 slot mỗi level
+#define TIMER_WHEEL_LEVELS 4                        // 10ms → ~46 giờ
+
+typedef void (*timer_cb_t)(void *arg);
+
+typedef struct timer_entry {
+    struct timer_entry *next;
+    struct timer_entry *prev;
+    uint64_t expires_tick;
+    timer_cb_t cb;
+    void *arg;
+    bool armed;
+} timer_entry_t;
+
+bool timer_wheel_start(void);
+
+// Monotonic clock (ms), dùng cho mọi deadline thay vì time(NULL)
+uint64_t timer_now_ms(void);
+
+void timer_init(timer_entry_t *t, timer_cb_t cb, void *arg);
+
+// Arm (hoặc dời) timer chạy sau delay_ms. Gọi được từ mọi thread, kể cả
+// từ chính callback để lặp lại.
+void timer_arm(timer_entry_t *t, uint64_t delay_ms);
+
+// Gỡ timer. Khi hàm trả về, callback chắc chắn không chạy nữa (nếu đang
+// chạy ở thread timer thì chờ xong), nên owner có thể free ngay sau đó.
+// Trả về true nếu timer còn đang chờ.
+bool timer_cancel(timer_entry_t *t);
+
+#endif // TIMER_WHEEL_H
@@ -109,8 +109,15 @@ bool auth_logout(const char *token) {
     char *user_id = jwt_verify(token);
     if (!user_id) return false;
 
-    user_t *user = user_find_by_id(user_id);
+    bool ok = auth_logout_user(user_id);
     free(user_id);
+    return ok;
+}
+
+bool auth_logout_user(const char *user_id) {
+    if (!user_id) return false;
+
+    user_t *user = user_find_by_id(user_id);
 
     if (user) {
         user_update_status(user->username, "offline");
@@ -3,69 +3,207 @@
 #include "utils/logger.h"
 #include <string.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <time.h>
-#include <openssl/hmac.h>
+#include <pthread.h>
 #include <openssl/evp.h>
-#include <openssl/buffer.h>
-#include <cjson/cJSON.h>
+#include <openssl/core_names.h>
+#include <openssl/crypto.h>
 #include <stdbool.h>
 
-// ===== Base64 URL Encode =====
-static char* base64url_encode(const unsigned char *input, size_t len) {
-    BIO *b64 = BIO_new(BIO_f_base64());
-    BIO_set_flags(b64, BIO_FLAGS_BASE64_NO_NL);
-    BIO *bmem = BIO_new(BIO_s_mem());
-    b64 = BIO_push(b64, bmem);
-    BIO_write(b64, input, len);
-    BIO_flush(b64);
-
-    BUF_MEM *bptr;
-    BIO_get_mem_ptr(b64, &bptr);
-
-    char *buff = malloc(bptr->length + 1);
-    memcpy(buff, bptr->data, bptr->length);
-    buff[bptr->length] = '\0';
-
-    // URL safe
-    for (size_t i = 0; i < bptr->length; i++) {
-        if (buff[i] == '+') buff[i] = '-';
-        else if (buff[i] == '/') buff[i] = '_';
+#define JWT_MAX_TOKEN_LEN 512
+#define JWT_MAX_PAYLOAD_LEN 384
+#define JWT_SIG_LEN 32            // HS256
+
+// ===== Base64 URL (table, không padding) =====
+static const char b64url_alphabet[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+
+static const int8_t b64url_table[256] = {
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 62, -1, -1,
+    52, 53, 54, 55, 56, 57, 58, 59, 60, 61, -1, -1, -1, -1, -1, -1,
+    -1,  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14,
+    15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, -1, -1, -1, -1, 63,
+    -1, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40,
+    41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 51, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+};
+
+// Encode vào out (cần ít nhất 4 * ceil(len / 3) + 1 bytes), trả về độ dài
+static size_t base64url_encode(const unsigned char *in, size_t len, char *out) {
+    size_t o = 0, i = 0;
+    for (; i + 3 <= len; i += 3) {
+        uint32_t v = ((uint32_t)in[i] << 16) | ((uint32_t)in[i + 1] << 8) | in[i + 2];
+        out[o++] = b64url_alphabet[(v >> 18) & 0x3F];
+        out[o++] = b64url_alphabet[(v >> 12) & 0x3F];
+        out[o++] = b64url_alphabet[(v >> 6) & 0x3F];
+        out[o++] = b64url_alphabet[v & 0x3F];
+    }
+    if (len - i == 1) {
+        uint32_t v = (uint32_t)in[i] << 16;
+        out[o++] = b64url_alphabet[(v >> 18) & 0x3F];
+        out[o++] = b64url_alphabet[(v >> 12) & 0x3F];
+    } else if (len - i == 2) {
+        uint32_t v = ((uint32_t)in[i] << 16) | ((uint32_t)in[i + 1] << 8);
+        out[o++] = b64url_alphabet[(v >> 18) & 0x3F];
+        out[o++] = b64url_alphabet[(v >> 12) & 0x3F];
+        out[o++] = b64url_alphabet[(v >> 6) & 0x3F];
+    }
+    out[o] = '\0';
+    return o;
+}
+
+// Decode vào out, trả về số bytes hoặc -1 nếu sai ký tự / không đủ chỗ
+static long base64url_decode(const char *in, size_t len, unsigned char *out, size_t out_cap) {
+    while (len > 0 && in[len - 1] == '=') len--;
+    if (len % 4 == 1) return -1;
+
+    size_t need = len / 4 * 3 + (len % 4 ? len % 4 - 1 : 0);
+    if (need > out_cap) return -1;
+
+    size_t o = 0, i = 0;
+    for (; i + 4 <= len; i += 4) {
+        int a = b64url_table[(unsigned char)in[i]];
+        int b = b64url_table[(unsigned char)in[i + 1]];
+        int c = b64url_table[(unsigned char)in[i + 2]];
+        int d = b64url_table[(unsigned char)in[i + 3]];
+        if ((a | b | c | d) < 0) return -1;
+        uint32_t v = ((uint32_t)a << 18) | ((uint32_t)b << 12) | ((uint32_t)c << 6) | (uint32_t)d;
+        out[o++] = (unsigned char)(v >> 16);
+        out[o++] = (unsigned char)(v >> 8);
+        out[o++] = (unsigned char)v;
+    }
+    size_t rem = len - i;
+    if (rem >= 2) {
+        int a = b64url_table[(unsigned char)in[i]];
+        int b = b64url_table[(unsigned char)in[i + 1]];
+        int c = rem == 3 ? b64url_table[(unsigned char)in[i + 2]] : 0;
+        if ((a | b | c) < 0) return -1;
+        uint32_t v = ((uint32_t)a << 18) | ((uint32_t)b << 12) | ((uint32_t)c << 6);
+        out[o++] = (unsigned char)(v >> 16);
+        if (rem == 3) out[o++] = (unsigned char)(v >> 8);
+    }
+    return (long)o;
+}
+
+// ===== HMAC-SHA256 =====
+// Mỗi thread giữ một EVP_MAC_CTX đã nạp key; EVP_MAC_init với key NULL
+// dùng lại ipad/opad đã tính nên không phải dựng lại key schedule mỗi lần.
+static EVP_MAC *g_hmac = NULL;
+static pthread_once_t g_hmac_once = PTHREAD_ONCE_INIT;
+static pthread_key_t g_hmac_key;
+
+static void hmac_ctx_free(void *ctx) {
+    EVP_MAC_CTX_free(ctx);
+}
+
+static void hmac_global_init(void) {
+    g_hmac = EVP_MAC_fetch(NULL, "HMAC", NULL);
+    if (!g_hmac) log_error("JWT: EVP_MAC_fetch(HMAC) failed");
+    pthread_key_create(&g_hmac_key, hmac_ctx_free);
+}
+
+static EVP_MAC_CTX* hmac_thread_ctx(void) {
+    pthread_once(&g_hmac_once, hmac_global_init);
+    if (!g_hmac) return NULL;
+
+    EVP_MAC_CTX *ctx = pthread_getspecific(g_hmac_key);
+    if (ctx) return ctx;
+
+    ctx = EVP_MAC_CTX_new(g_hmac);
+    if (!ctx) return NULL;
+
+    const char *secret = get_jwt_secret();
+    OSSL_PARAM params[] = {
+        OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, "SHA256", 0),
+        OSSL_PARAM_construct_end()
+    };
+    if (!EVP_MAC_init(ctx, (const unsigned char*)secret, strlen(secret), params)) {
+        log_error("JWT: EVP_MAC_init failed");
+        EVP_MAC_CTX_free(ctx);
+        return NULL;
     }
-    // remove padding
-    size_t len_url = bptr->length;
-    while (len_url > 0 && buff[len_url - 1] == '=') len_url--;
-    buff[len_url] = '\0';
 
-    BIO_free_all(b64);
-    return buff;
+    pthread_setspecific(g_hmac_key, ctx);
+    return ctx;
 }
 
-// ===== Base64 URL Decode =====
-static unsigned char* base64url_decode(const char *input, size_t *out_len) {
-    size_t len = strlen(input);
-    size_t padded_len = len + (4 - len % 4) % 4;
-    char *tmp = malloc(padded_len + 1);
-    strcpy(tmp, input);
-    for (size_t i = 0; i < len; i++) {
-        if (tmp[i] == '-') tmp[i] = '+';
-        else if (tmp[i] == '_') tmp[i] = '/';
+static bool hmac_sha256(const char *data, size_t len, unsigned char out[JWT_SIG_LEN]) {
+    EVP_MAC_CTX *ctx = hmac_thread_ctx();
+    if (!ctx) return false;
+
+    size_t out_len = 0;
+    if (!EVP_MAC_init(ctx, NULL, 0, NULL) ||
+        !EVP_MAC_update(ctx, (const unsigned char*)data, len) ||
+        !EVP_MAC_final(ctx, out, &out_len, JWT_SIG_LEN)) {
+        return false;
     }
-    for (size_t i = len; i < padded_len; i++) tmp[i] = '=';
-    tmp[padded_len] = '\0';
-
-    BIO *b64 = BIO_new(BIO_f_base64());
-    BIO_set_flags(b64, BIO_FLAGS_BASE64_NO_NL);
-    BIO *bmem = BIO_new_mem_buf(tmp, padded_len);
-    bmem = BIO_push(b64, bmem);
-
-    unsigned char *out = malloc(padded_len);
-    int decoded_len = BIO_read(bmem, out, padded_len);
-    if (decoded_len < 0) { free(out); out = NULL; }
-    else *out_len = decoded_len;
-
-    BIO_free_all(bmem);
-    free(tmp);
-    return out;
+    return out_len == JWT_SIG_LEN;
+}
+
+// ===== Payload scan =====
+// Payload do server tự sinh: {"user_id":"...","iat":N,"exp":N}; chỉ tìm
+// đúng key cần thiết thay vì dựng cây JSON.
+static const char* json_find_value(const char *json, size_t len, const char *key) {
+    size_t klen = strlen(key);
+    const char *end = json + len;
+    const char *p = json;
+
+    while (p < end) {
+        const char *q = memchr(p, '"', end - p);
+        if (!q || (size_t)(end - q) < klen + 2) return NULL;
+        if (memcmp(q + 1, key, klen) == 0 && q[klen + 1] == '"') {
+            p = q + klen + 2;
+            while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')) p++;
+            if (p >= end || *p != ':') return NULL;
+            p++;
+            while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')) p++;
+            return p < end ? p : NULL;
+        }
+        p = q + 1;
+    }
+    return NULL;
+}
+
+static bool json_get_string(const char *json, size_t len, const char *key, char *out, size_t out_len) {
+    const char *v = json_find_value(json, len, key);
+    const char *end = json + len;
+    if (!v || *v != '"') return false;
+    v++;
+
+    size_t n = 0;
+    while (v < end && *v != '"') {
+        if (*v == '\\' || n + 1 >= out_len) return false;  // id không có escape
+        out[n++] = *v++;
+    }
+    if (v >= end) return false;
+    out[n] = '\0';
+    return true;
+}
+
+static bool json_get_long(const char *json, size_t len, const char *key, long *out) {
+    const char *v = json_find_value(json, len, key);
+    const char *end = json + len;
+    if (!v) return false;
+
+    bool neg = false;
+    if (*v == '-') { neg = true; v++; }
+    if (v >= end || *v < '0' || *v > '9') return false;
+
+    long n = 0;
+    while (v < end && *v >= '0' && *v <= '9') n = n * 10 + (*v++ - '0');
+    *out = neg ? -n : n;
+    return true;
 }
 
 // ===== JWT Generate =====
@@ -74,76 +212,75 @@ char* jwt_generate(const char *user_id) {
     time_t now = time(NULL);
     time_t exp = now + get_jwt_expiry();
 
-    const char *header = "{\"alg\":\"HS256\",\"typ\":\"JWT\"}";
-    char payload[512];
-    snprintf(payload, sizeof(payload), "{\"user_id\":\"%s\",\"iat\":%ld,\"exp\":%ld}", user_id, (long)now, (long)exp);
+    static const char header[] = "{\"alg\":\"HS256\",\"typ\":\"JWT\"}";
+    char payload[JWT_MAX_PAYLOAD_LEN];
+    int payload_len = snprintf(payload, sizeof(payload), "{\"user_id\":\"%s\",\"iat\":%ld,\"exp\":%ld}", user_id, (long)now, (long)exp);
+    if (payload_len < 0 || (size_t)payload_len >= sizeof(payload)) return NULL;
 
-    char *enc_header = base64url_encode((unsigned char*)header, strlen(header));
-    char *enc_payload = base64url_encode((unsigned char*)payload, strlen(payload));
+    char token[64 + (JWT_MAX_PAYLOAD_LEN + 2) / 3 * 4 + 64];
+    size_t n = base64url_encode((const unsigned char*)header, sizeof(header) - 1, token);
+    token[n++] = '.';
+    n += base64url_encode((const unsigned char*)payload, payload_len, token + n);
 
-    size_t sig_input_len = strlen(enc_header) + 1 + strlen(enc_payload);
-    char *sig_input = malloc(sig_input_len + 1);
-    sprintf(sig_input, "%s.%s", enc_header, enc_payload);
+    unsigned char sig[JWT_SIG_LEN];
+    if (!hmac_sha256(token, n, sig)) {
+        log_error("JWT: HMAC failed for user %s", user_id);
+        return NULL;
+    }
+    token[n++] = '.';
+    n += base64url_encode(sig, sizeof(sig), token + n);
+    if (n > JWT_MAX_TOKEN_LEN) {
+        log_error("JWT: token too long for user %s", user_id);
+        return NULL;
+    }
 
-    unsigned char sig[EVP_MAX_MD_SIZE];
-    unsigned int sig_len;
-    HMAC(EVP_sha256(), get_jwt_secret(), strlen(get_jwt_secret()),
-         (unsigned char*)sig_input, strlen(sig_input),
-         sig, &sig_len);
-    free(sig_input);
+    log_info("Generated JWT for user: %s", user_id);
+    return strdup(token);
+}
 
-    char *enc_sig = base64url_encode(sig, sig_len);
+// ===== JWT Verify (claims) =====
+// Kiểm tra chữ ký, copy user_id vào buffer của caller và trả về exp.
+// Không cấp phát: chỉ dùng buffer trên stack và HMAC context của thread.
+bool jwt_verify_claims(const char *token, char *user_id_out, size_t user_id_len, time_t *exp_out) {
+    if (!token || !user_id_out || user_id_len == 0) return false;
 
-    size_t token_len = strlen(enc_header) + 1 + strlen(enc_payload) + 1 + strlen(enc_sig) + 1;
-    char *token = malloc(token_len);
-    sprintf(token, "%s.%s.%s", enc_header, enc_payload, enc_sig);
+    size_t len = strnlen(token, JWT_MAX_TOKEN_LEN + 1);
+    if (len > JWT_MAX_TOKEN_LEN) return false;
 
-    free(enc_header); free(enc_payload); free(enc_sig);
-    log_info("Generated JWT for user: %s", user_id);
-    return token;
-}
+    const char *dot1 = memchr(token, '.', len);
+    if (!dot1) return false;
+    const char *payload = dot1 + 1;
+    const char *dot2 = memchr(payload, '.', token + len - payload);
+    if (!dot2 || dot1 == token || dot2 == payload) return false;
+    const char *sig = dot2 + 1;
+    size_t sig_b64_len = token + len - sig;
+    if (sig_b64_len == 0 || memchr(sig, '.', sig_b64_len)) return false;
 
-// ===== JWT Verify =====
-char* jwt_verify(const char *token) {
-    if (!token) return NULL;
-    char *tok_copy = strdup(token);
-
-    char *header = strtok(tok_copy, ".");
-    char *payload = strtok(NULL, ".");
-    char *sig = strtok(NULL, ".");
-    if (!header || !payload || !sig) { free(tok_copy); return NULL; }
-
-    size_t sig_input_len = strlen(header) + 1 + strlen(payload);
-    char *sig_input = malloc(sig_input_len + 1);
-    sprintf(sig_input, "%s.%s", header, payload);
-
-    unsigned char expected[EVP_MAX_MD_SIZE];
-    unsigned int expected_len;
-    HMAC(EVP_sha256(), get_jwt_secret(), strlen(get_jwt_secret()),
-         (unsigned char*)sig_input, strlen(sig_input),
-         expected, &expected_len);
-    free(sig_input);
-
-    size_t sig_dec_len;
-    unsigned char *sig_dec = base64url_decode(sig, &sig_dec_len);
-    if (!sig_dec || sig_dec_len != expected_len || memcmp(sig_dec, expected, expected_len) != 0) {
-        free(sig_dec); free(tok_copy); return NULL;
+    unsigned char expected[JWT_SIG_LEN];
+    if (!hmac_sha256(token, dot2 - token, expected)) return false;
+
+    unsigned char sig_dec[JWT_SIG_LEN + 3];
+    long sig_dec_len = base64url_decode(sig, sig_b64_len, sig_dec, sizeof(sig_dec));
+    if (sig_dec_len != JWT_SIG_LEN || CRYPTO_memcmp(sig_dec, expected, JWT_SIG_LEN) != 0) {
+        return false;
     }
-    free(sig_dec);
 
-    size_t payload_dec_len;
-    unsigned char *payload_dec = base64url_decode(payload, &payload_dec_len);
-    if (!payload_dec) { free(tok_copy); return NULL; }
-    payload_dec[payload_dec_len] = '\0';
+    char json[JWT_MAX_PAYLOAD_LEN];
+    long json_len = base64url_decode(payload, dot2 - payload, (unsigned char*)json, sizeof(json));
+    if (json_len <= 0) return false;
 
-    cJSON *json = cJSON_Parse((char*)payload_dec);
-    free(payload_dec); free(tok_copy);
-    if (!json) return NULL;
+    if (!json_get_string(json, json_len, "user_id", user_id_out, user_id_len)) return false;
 
-    cJSON *user_id_json = cJSON_GetObjectItem(json, "user_id");
-    if (!user_id_json || !cJSON_IsString(user_id_json)) { cJSON_Delete(json); return NULL; }
+    if (exp_out) {
+        long exp = 0;
+        *exp_out = json_get_long(json, json_len, "exp", &exp) ? (time_t)exp : 0;
+    }
+    return true;
+}
 
-    char *user_id = strdup(user_id_json->valuestring);
-    cJSON_Delete(json);
-    return user_id;
+// ===== JWT Verify =====
+char* jwt_verify(const char *token) {
+    char user_id[128];
+    if (!jwt_verify_claims(token, user_id, sizeof(user_id), NULL)) return NULL;
+    return strdup(user_id);
 }
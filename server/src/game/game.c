@@ -1,5 +1,9 @@
 #include "game/game.h"
 #include "game/game_board.h"
+#include "game/game_registry.h"
+#include "game/game_actor.h"
+#include "game/game_persist.h"
+#include "game/game_wal.h"
 #include "database/mongo.h"
 #include "utils/logger.h"
 #include <stdlib.h>
@@ -10,105 +14,76 @@
 #include "game/elo.h"
 #include "network/ws_server.h"
 #define COLLECTION_GAMES "games"
-#define MAX_ACTIVE_GAMES 100
+#define GAME_TURN_TIMEOUT 30       // giây mỗi lượt
+#define GAME_TURN_WARNING 10       // cảnh báo khi còn 10 giây
+#define GAME_PLACE_TIMEOUT 120     // giây đặt tàu, hết giờ server tự xếp
+#define GAME_EVICT_DELAY 60        // giây giữ game đã kết thúc trong memory (chat sau trận)
 
-// In-memory cache for active games
-static game_session_t *active_games[MAX_ACTIVE_GAMES];
-static int active_game_count = 0;
+static void game_turn_timer_fired(void *arg);
+static void game_evict_timer_fired(void *arg);
 
-// ==================== Helper: Serialize board to BSON ====================
-static void board_to_bson(bson_t *parent, const char *key, const board_t *board) {
-    bson_t board_doc, ships_array;
-    
-    BSON_APPEND_DOCUMENT_BEGIN(parent, key, &board_doc);
+// ==================== Helper: Deserialize board from BSON ====================
+// Dạng mới: binary (board_pack). Dạng cũ (document, *legacy = true):
+//   có mảng "ships": grid là trạng thái ô (0-3), tàu dựng lại từ ships;
+//   chưa có "ships" (mới READY): grid là layout client gửi (mỗi ô = độ dài tàu).
+static bool bson_to_board(const bson_t *doc, const char *key, board_t *board, bool *legacy) {
+    bson_iter_t iter, child, array_iter;
     
-    // Serialize ships
-    BSON_APPEND_ARRAY_BEGIN(&board_doc, "ships", &ships_array);
-    for (int i = 0; i < board->ship_count; i++) {
-        bson_t ship_doc;
-        char index_str[16];
-        snprintf(index_str, sizeof(index_str), "%d", i);
-        
-        BSON_APPEND_DOCUMENT_BEGIN(&ships_array, index_str, &ship_doc);
-        BSON_APPEND_INT32(&ship_doc, "type", (int)board->ships[i].type);
-        BSON_APPEND_INT32(&ship_doc, "start_row", board->ships[i].start_row);
-        BSON_APPEND_INT32(&ship_doc, "start_col", board->ships[i].start_col);
-        BSON_APPEND_BOOL(&ship_doc, "is_horizontal", board->ships[i].is_horizontal);
-        BSON_APPEND_INT32(&ship_doc, "hits", board->ships[i].hits);
-        BSON_APPEND_BOOL(&ship_doc, "is_sunk", board->ships[i].is_sunk);
-        bson_append_document_end(&ships_array, &ship_doc);
+    *legacy = false;
+    if (!bson_iter_init_find(&iter, doc, key)) {
+        board_init(board);
+        return false;
     }
-    bson_append_array_end(&board_doc, &ships_array);
-    
-    BSON_APPEND_INT32(&board_doc, "ships_remaining", board->ships_remaining);
-    
-    bson_t grid_array;
-    BSON_APPEND_ARRAY_BEGIN(&board_doc, "grid", &grid_array);
     
-    for (int y = 0; y < GRID_SIZE; y++) {
-        bson_t row;
-        char key_str[16];
-        snprintf(key_str, sizeof(key_str), "%d", y);
-        BSON_APPEND_ARRAY_BEGIN(&grid_array, key_str, &row);
-        
-        for (int x = 0; x < GRID_SIZE; x++) {
-            char subkey[16];
-            snprintf(subkey, sizeof(subkey), "%d", x);
-            
-            int val = (int)board->grid[y * GRID_SIZE + x];
-            bson_append_int32(&row, subkey, -1, val);
+    if (BSON_ITER_HOLDS_BINARY(&iter)) {
+        bson_subtype_t subtype;
+        uint32_t len;
+        const uint8_t *data;
+        bson_iter_binary(&iter, &subtype, &len, &data);
+        if (subtype != BSON_SUBTYPE_USER || !board_unpack(board, data, len)) {
+            log_warn("Invalid packed board in %s", key);
+            return false;
         }
-        bson_append_array_end(&grid_array, &row);
+        return true;
     }
-    bson_append_array_end(&board_doc, &grid_array);
-    
-    bson_append_document_end(parent, &board_doc);
-}
-
-// ==================== Helper: Deserialize board from BSON ====================
-static bool bson_to_board(const bson_t *doc, const char *key, board_t *board) {
-    bson_iter_t iter, child, array_iter;
     
-    if (!bson_iter_init_find(&iter, doc, key) || !bson_iter_recurse(&iter, &child)) {
+    if (!bson_iter_recurse(&iter, &child)) {
+        board_init(board);
         return false;
     }
     
+    *legacy = true;
     board_init(board);
     
     // Deserialize ships
+    bool has_ships = false;
     if (bson_iter_find(&child, "ships") && bson_iter_recurse(&child, &array_iter)) {
-        int idx = 0;
-        while (bson_iter_next(&array_iter) && idx < MAX_SHIPS) {
+        has_ships = true;
+        while (bson_iter_next(&array_iter) && board->ship_count < MAX_SHIPS) {
             bson_iter_t ship_iter;
             if (bson_iter_recurse(&array_iter, &ship_iter)) {
-                ship_t *ship = &board->ships[idx];
+                ship_type_t type = 0;
+                int start_row = 0, start_col = 0;
+                bool is_horizontal = false;
                 
                 if (bson_iter_find(&ship_iter, "type"))
-                    ship->type = (ship_type_t)bson_iter_int32(&ship_iter);
+                    type = (ship_type_t)bson_iter_int32(&ship_iter);
                 if (bson_iter_find(&ship_iter, "start_row"))
-                    ship->start_row = bson_iter_int32(&ship_iter);
+                    start_row = bson_iter_int32(&ship_iter);
                 if (bson_iter_find(&ship_iter, "start_col"))
-                    ship->start_col = bson_iter_int32(&ship_iter);
+                    start_col = bson_iter_int32(&ship_iter);
                 if (bson_iter_find(&ship_iter, "is_horizontal"))
-                    ship->is_horizontal = bson_iter_bool(&ship_iter);
-                if (bson_iter_find(&ship_iter, "hits"))
-                    ship->hits = bson_iter_int32(&ship_iter);
-                if (bson_iter_find(&ship_iter, "is_sunk"))
-                    ship->is_sunk = bson_iter_bool(&ship_iter);
+                    is_horizontal = bson_iter_bool(&ship_iter);
                 
-                idx++;
+                if (!board_add_ship(board, type, start_row, start_col, is_horizontal)) {
+                    log_warn("Invalid ship in %s: type=%d pos=(%d,%d)", key, type, start_row, start_col);
+                }
             }
         }
-        board->ship_count = idx;
-    }
-    
-    // Deserialize ships_remaining
-    bson_iter_init(&child, doc);
-    if (bson_iter_find(&child, key) && bson_iter_recurse(&child, &child)) {
-        if (bson_iter_find(&child, "ships_remaining"))
-            board->ships_remaining = bson_iter_int32(&child);
     }
     
+    // Deserialize grid (hits/misses, hoặc layout nếu chưa có ships)
+    uint8_t cells[BOARD_SIZE] = {0};
     bson_iter_init(&child, doc);
     if (bson_iter_find(&child, key) && bson_iter_recurse(&child, &child) &&
         bson_iter_find(&child, "grid") && bson_iter_recurse(&child, &array_iter)) {
@@ -119,7 +94,7 @@ static bool bson_to_board(const bson_t *doc, const char *key, board_t *board) {
             if (bson_iter_recurse(&array_iter, &row_iter)) {
                 int col = 0;
                 while (bson_iter_next(&row_iter) && col < GRID_SIZE) {
-                    board->grid[row * GRID_SIZE + col] = (cell_state_t)bson_iter_int32(&row_iter);
+                    cells[row * GRID_SIZE + col] = (uint8_t)bson_iter_int32(&row_iter);
                     col++;
                 }
             }
@@ -127,18 +102,49 @@ static bool bson_to_board(const bson_t *doc, const char *key, board_t *board) {
         }
     }
     
+    if (has_ships) {
+        for (int i = 0; i < BOARD_SIZE; i++) {
+            board_set_cell(board, i, (cell_state_t)cells[i]);
+        }
+    } else {
+        board_load_layout(board, cells);
+    }
+    
     return true;
 }
 
 // ==================== Game Create ====================
-bool game_create(const char *player1_id, const char *player2_id, char *out_game_id) {
+// Username hiển thị, dùng cho message gửi client (fallback: user id).
+// Cắt theo cap: user id / username dài hơn buffer 32 byte của session.
+static void game_lookup_name(const char *user_id, char *out, size_t cap) {
+    user_t *user = user_find_by_id(user_id);
+    snprintf(out, cap, "%.*s", (int)cap - 1, user ? user->username : user_id);
+    if (user) user_free(user);
+}
+
+// Session rỗng (refcount = 1, chưa nằm trong registry)
+static game_session_t* game_session_new(const char *game_id) {
+    game_session_t *game = (game_session_t*)calloc(1, sizeof(game_session_t));
+    if (!game) return NULL;
+
+    game->refcount = 1;
+    pthread_mutex_init(&game->mb_lock, NULL);
+    pthread_mutex_init(&game->state_lock, NULL);
+    timer_init(&game->turn_timer, game_turn_timer_fired, game);
+    timer_init(&game->evict_timer, game_evict_timer_fired, game);
+    strncpy(game->game_id, game_id, 64);
+    return game;
+}
+
+game_session_t* game_create(const char *player1_id, const char *player2_id,
+                            int player1_socket, int player2_socket) {
     mongoc_client_t *client = mongo_get_client(g_mongo_ctx);
-    if (!client) return false;
+    if (!client) return NULL;
 
     mongoc_collection_t *collection = mongo_get_collection(client, COLLECTION_GAMES);
     if (!collection) {
         mongo_release_client(g_mongo_ctx, client);
-        return false;
+        return NULL;
     }
 
     bson_t *doc = bson_new();
@@ -148,52 +154,21 @@ bool game_create(const char *player1_id, const char *player2_id, char *out_game_
     BSON_APPEND_OID(doc, "_id", &oid);
     BSON_APPEND_UTF8(doc, "player1_id", player1_id);
     BSON_APPEND_UTF8(doc, "player2_id", player2_id);
+
+    // Lưu sẵn username để các bước sau không phải tra users
+    char player1_name[32], player2_name[32];
+    game_lookup_name(player1_id, player1_name, sizeof(player1_name));
+    game_lookup_name(player2_id, player2_name, sizeof(player2_name));
+    BSON_APPEND_UTF8(doc, "player1_name", player1_name);
+    BSON_APPEND_UTF8(doc, "player2_name", player2_name);
     BSON_APPEND_UTF8(doc, "phase", "placing_ships");
     BSON_APPEND_UTF8(doc, "current_turn", player1_id);
 
-    // --- TẠO BOARD 10×10 TOÀN 0 ---
-    bson_t board1, board2, grid1, grid2;
-
-    BSON_APPEND_DOCUMENT_BEGIN(doc, "player1_board", &board1);
-    BSON_APPEND_ARRAY_BEGIN(&board1, "grid", &grid1);
-
-    // tạo mảng 10 phần tử
-    for (int y = 0; y < 10; y++) {
-        bson_t row;
-        char key[16];
-        snprintf(key, sizeof(key), "%d", y);
-        BSON_APPEND_ARRAY_BEGIN(&grid1, key, &row);
-
-        for (int x = 0; x < 10; x++) {
-            char subkey[16];
-            snprintf(subkey, sizeof(subkey), "%d", x);
-            bson_append_int32(&row, subkey, strlen(subkey), 0);
-        }
-        bson_append_array_end(&grid1, &row);
-    }
-    bson_append_array_end(&board1, &grid1);
-    bson_append_document_end(doc, &board1);
-
-
-    // BOARD PLAYER 2
-    BSON_APPEND_DOCUMENT_BEGIN(doc, "player2_board", &board2);
-    BSON_APPEND_ARRAY_BEGIN(&board2, "grid", &grid2);
-
-    for (int y = 0; y < 10; y++) {
-        bson_t row;
-        char key[16];
-        snprintf(key, sizeof(key), "%d", y);
-        BSON_APPEND_ARRAY_BEGIN(&grid2, key, &row);
-
-        for (int x = 0; x < 10; x++) {
-            char subkey[16];
-            snprintf(subkey, sizeof(subkey), "%d", x);
-            bson_append_int32(&row, subkey, strlen(subkey), 0);
-        }
-        bson_append_array_end(&grid2, &row);
-    }
-    bson_append_array_end(&board2, &grid2);
-    bson_append_document_end(doc, &board2);
+    // --- BOARD RỖNG (dạng nén) ---
+    board_t empty;
+    board_init(&empty);
+    board_to_bson(doc, "player1_board", &empty);
+    board_to_bson(doc, "player2_board", &empty);
 
     BSON_APPEND_BOOL(doc, "player1_ready", false);
     BSON_APPEND_BOOL(doc, "player2_ready", false);
@@ -202,14 +177,27 @@ bool game_create(const char *player1_id, const char *player2_id, char *out_game_
     int64_t now_ms = (int64_t)time(NULL) * 1000;
     bson_append_date_time(doc, "created_at", strlen("created_at"), now_ms);
 
+    // Moves được ghi theo index ("moves.<n>") nên mảng phải có sẵn
+    bson_t moves;
+    BSON_APPEND_ARRAY_BEGIN(doc, "moves", &moves);
+    bson_append_array_end(doc, &moves);
+
     bson_error_t error;
     bool success = mongoc_collection_insert_one(collection, doc, NULL, NULL, &error);
 
+    game_session_t *game = NULL;
     if (success) {
         char oid_str[25];
         bson_oid_to_string(&oid, oid_str);
-        snprintf(out_game_id, 25, "%s", oid_str);
         log_info("Game created: %s", oid_str);
+
+        game_wal_event_t ev = { .type = GAME_WAL_CREATE };
+        strncpy(ev.game_id, oid_str, sizeof(ev.game_id) - 1);
+        strncpy(ev.player_id, player1_id, sizeof(ev.player_id) - 1);
+        strncpy(ev.u.create.player2_id, player2_id, sizeof(ev.u.create.player2_id) - 1);
+        game_wal_append(NULL, &ev);
+
+        game = game_session_new(oid_str);
     } else {
         log_error("Failed to create game: %s", error.message);
     }
@@ -218,20 +206,70 @@ bool game_create(const char *player1_id, const char *player2_id, char *out_game_
     mongoc_collection_destroy(collection);
     mongo_release_client(g_mongo_ctx, client);
 
-    return success;
+    if (!game) return NULL;
+
+    // Dựng session ngay từ dữ liệu vừa ghi, socket gán trước khi publish vào
+    // registry: sau đó chỉ worker của actor (giữ state_lock) được đổi state
+    strncpy(game->player1_id, player1_id, 63);
+    strncpy(game->player2_id, player2_id, 63);
+    memcpy(game->player1_name, player1_name, sizeof(game->player1_name));
+    memcpy(game->player2_name, player2_name, sizeof(game->player2_name));
+    game->player1_socket = player1_socket;
+    game->player2_socket = player2_socket;
+    game->state = GAME_STATE_PLACING_SHIPS;
+    strncpy(game->current_turn, player1_id, 63);
+    board_init(&game->player1_board);
+    board_init(&game->player2_board);
+    game->created_at = now_ms;
+    move_log_init(&game->moves, (uint64_t)now_ms);
+    move_log_iter_init(&game->moves_sync_it, &game->moves);
+
+    game = game_registry_insert(game);
+
+    // Hạn đặt tàu tính từ lúc tạo game
+    game->turn_deadline_ms = timer_now_ms() + (uint64_t)GAME_PLACE_TIMEOUT * 1000;
+    timer_arm(&game->turn_timer, (uint64_t)GAME_PLACE_TIMEOUT * 1000);
+    return game;
 }
 
-game_session_t* game_get(const char *game_id) {
-    // Check in-memory cache first
-    for (int i = 0; i < active_game_count; i++) {
-        if (strcmp(active_games[i]->game_id, game_id) == 0) {
-            return active_games[i];
-        }
+// ==================== Game Load (MongoDB → memory) ====================
+// Dựng lại move log từ mảng "moves"; false nếu document chưa có mảng này
+static bool moves_from_bson(const bson_t *doc, move_log_t *log) {
+    bson_iter_t iter, array_iter;
+    if (!bson_iter_init_find(&iter, doc, "moves") || !BSON_ITER_HOLDS_ARRAY(&iter) ||
+        !bson_iter_recurse(&iter, &array_iter)) {
+        return false;
     }
     
-    // Not in cache, load from MongoDB
-    log_info("Game %s not in cache, loading from MongoDB...", game_id);
-    
+    while (bson_iter_next(&array_iter)) {
+        bson_iter_t move_iter;
+        if (!bson_iter_recurse(&array_iter, &move_iter)) continue;
+        
+        move_t move = {0};
+        int cell = -1;
+        while (bson_iter_next(&move_iter)) {
+            const char *key = bson_iter_key(&move_iter);
+            if (strcmp(key, "by") == 0) move.shooter = bson_iter_int32(&move_iter) ? 1 : 0;
+            else if (strcmp(key, "cell") == 0) cell = bson_iter_int32(&move_iter);
+            else if (strcmp(key, "hit") == 0) move.is_hit = bson_iter_bool(&move_iter);
+            else if (strcmp(key, "sunk") == 0) {
+                move.is_sunk = true;
+                move.sunk_ship_type = (uint8_t)bson_iter_int32(&move_iter);
+            }
+            else if (strcmp(key, "over") == 0) move.game_over = bson_iter_bool(&move_iter);
+            else if (strcmp(key, "at") == 0) move.timestamp_ms = (uint64_t)bson_iter_date_time(&move_iter);
+        }
+        if (cell < 0 || cell >= BOARD_SIZE) continue;
+        
+        move.row = (uint8_t)(cell / GRID_SIZE);
+        move.col = (uint8_t)(cell % GRID_SIZE);
+        move_log_append(log, &move);
+    }
+    return true;
+}
+
+// Đọc document và dựng game mới (refcount = 1, chưa nằm trong registry)
+static game_session_t* game_fetch_from_db(const char *game_id) {
     if (strlen(game_id) != 24) {
         log_error("Invalid game_id format: %s", game_id);
         return NULL;
@@ -257,17 +295,29 @@ game_session_t* game_get(const char *game_id) {
     const bson_t *doc;
     
     if (mongoc_cursor_next(cursor, &doc)) {
-        game = (game_session_t*)calloc(1, sizeof(game_session_t));
+        game = game_session_new(game_id);
+    }
+    
+    if (game) {
         bson_iter_t iter;
         
-        strncpy(game->game_id, game_id, 64);
-        
         if (bson_iter_init_find(&iter, doc, "player1_id"))
             strncpy(game->player1_id, bson_iter_utf8(&iter, NULL), 63);
         
         if (bson_iter_init_find(&iter, doc, "player2_id"))
             strncpy(game->player2_id, bson_iter_utf8(&iter, NULL), 63);
         
+        // Document cũ chưa có username: tra một lần rồi giữ trong session
+        if (bson_iter_init_find(&iter, doc, "player1_name") && BSON_ITER_HOLDS_UTF8(&iter))
+            strncpy(game->player1_name, bson_iter_utf8(&iter, NULL), sizeof(game->player1_name) - 1);
+        else
+            game_lookup_name(game->player1_id, game->player1_name, sizeof(game->player1_name));
+        
+        if (bson_iter_init_find(&iter, doc, "player2_name") && BSON_ITER_HOLDS_UTF8(&iter))
+            strncpy(game->player2_name, bson_iter_utf8(&iter, NULL), sizeof(game->player2_name) - 1);
+        else
+            game_lookup_name(game->player2_id, game->player2_name, sizeof(game->player2_name));
+        
         if (bson_iter_init_find(&iter, doc, "phase")) {
             const char *state_str = bson_iter_utf8(&iter, NULL);
             if (strcmp(state_str, "placing_ships") == 0)
@@ -281,96 +331,44 @@ game_session_t* game_get(const char *game_id) {
         if (bson_iter_init_find(&iter, doc, "current_turn"))
             strncpy(game->current_turn, bson_iter_utf8(&iter, NULL), 63);
         
+        if (bson_iter_init_find(&iter, doc, "winner_id") && BSON_ITER_HOLDS_UTF8(&iter))
+            strncpy(game->winner_id, bson_iter_utf8(&iter, NULL), sizeof(game->winner_id) - 1);
+        
+        if (bson_iter_init_find(&iter, doc, "finished_at") && BSON_ITER_HOLDS_DATE_TIME(&iter))
+            game->finished_at = bson_iter_date_time(&iter);
+        
         if (bson_iter_init_find(&iter, doc, "player1_ready"))
             game->player1_ready = bson_iter_bool(&iter);
         
         if (bson_iter_init_find(&iter, doc, "player2_ready"))
             game->player2_ready = bson_iter_bool(&iter);
         
-        // Load boards
-        bson_to_board(doc, "player1_board", &game->player1_board);
-        bson_to_board(doc, "player2_board", &game->player2_board);
-        
-        // Add to cache
-        if (active_game_count < MAX_ACTIVE_GAMES) {
-            active_games[active_game_count++] = game;
-        }
-        
-        log_info("Game loaded from DB: %s", game_id);
-    }
-    
-    mongoc_cursor_destroy(cursor);
-    bson_destroy(query);
-    mongoc_collection_destroy(collection);
-    mongo_release_client(g_mongo_ctx, client);
-    
-    return game;
-}
-
-game_session_t* game_load_from_db(const char *game_id) {
-    mongoc_client_t *client = mongo_get_client(g_mongo_ctx);
-    if (!client) return NULL;
-
-    mongoc_collection_t *collection = mongo_get_collection(client, COLLECTION_GAMES);
-    if (!collection) {
-        mongo_release_client(g_mongo_ctx, client);
-        return NULL;
-    }
-    
-    bson_t *query = bson_new();
-    bson_oid_t oid;
-    bson_oid_init_from_string(&oid, game_id);
-    BSON_APPEND_OID(query, "_id", &oid);
-    
-    mongoc_cursor_t *cursor = mongoc_collection_find_with_opts(collection, query, NULL, NULL);
-    const bson_t *doc;
-    
-    game_session_t *game = NULL;
-    
-    if (mongoc_cursor_next(cursor, &doc)) {
-        game = (game_session_t*)malloc(sizeof(game_session_t));
-        memset(game, 0, sizeof(game_session_t));
-        
-        bson_iter_t iter;
-        
-        // Parse game_id
-        if (bson_iter_init_find(&iter, doc, "_id")) {
-            bson_oid_to_string(bson_iter_oid(&iter), game->game_id);
+        if (bson_iter_init_find(&iter, doc, "created_at") && BSON_ITER_HOLDS_DATE_TIME(&iter))
+            game->created_at = bson_iter_date_time(&iter);
+        move_log_init(&game->moves, game->created_at > 0 ? (uint64_t)game->created_at
+                                                         : move_log_now_ms());
+        // Document cũ chưa có mảng moves: lần flush đầu tạo mảng đầy đủ
+        if (!moves_from_bson(doc, &game->moves)) {
+            game->dirty |= GAME_DIRTY_MOVES;
         }
         
-        if (bson_iter_init_find(&iter, doc, "player1_id"))
-            strncpy(game->player1_id, bson_iter_utf8(&iter, NULL), 63);
-        
-        if (bson_iter_init_find(&iter, doc, "player2_id"))
-            strncpy(game->player2_id, bson_iter_utf8(&iter, NULL), 63);
-        
-        if (bson_iter_init_find(&iter, doc, "phase")) {
-            const char *state_str = bson_iter_utf8(&iter, NULL);
-            if (strcmp(state_str, "placing_ships") == 0)
-                game->state = GAME_STATE_PLACING_SHIPS;
-            else if (strcmp(state_str, "playing") == 0)
-                game->state = GAME_STATE_PLAYING;
-            else if (strcmp(state_str, "finished") == 0)
-                game->state = GAME_STATE_FINISHED;
+        // Mọi move vừa nạp đều đã có trong DB
+        move_t loaded;
+        game->moves_synced = game->moves.count;
+        move_log_iter_init(&game->moves_sync_it, &game->moves);
+        while (move_log_next(&game->moves_sync_it, &loaded)) {
         }
         
-        if (bson_iter_init_find(&iter, doc, "current_turn"))
-            strncpy(game->current_turn, bson_iter_utf8(&iter, NULL), 63);
-        
-        if (bson_iter_init_find(&iter, doc, "player1_ready"))
-            game->player1_ready = bson_iter_bool(&iter);
-        
-        if (bson_iter_init_find(&iter, doc, "player2_ready"))
-            game->player2_ready = bson_iter_bool(&iter);
+        // Load boards. Document cũ (grid int32) được ghi lại dạng nén ở lần flush đầu
+        bool legacy;
+        bson_to_board(doc, "player1_board", &game->player1_board, &legacy);
+        if (legacy) game->dirty |= GAME_DIRTY_BOARD1;
+        bson_to_board(doc, "player2_board", &game->player2_board, &legacy);
+        if (legacy) game->dirty |= GAME_DIRTY_BOARD2;
         
-        // Load boards
-        bson_to_board(doc, "player1_board", &game->player1_board);
-        bson_to_board(doc, "player2_board", &game->player2_board);
-        
-        // Add to cache
-        if (active_game_count < MAX_ACTIVE_GAMES) {
-            active_games[active_game_count++] = game;
-        }
+        // Game đang đặt tàu được nạp lại (restart, đọc lại sau khi evict) không
+        // có hạn đặt tàu: document bị bỏ dở không được thành trận thua có tính
+        // ELO. Hạn chỉ được đặt ở game_create.
         
         log_info("Game loaded from DB: %s", game_id);
     }
@@ -383,73 +381,36 @@ game_session_t* game_load_from_db(const char *game_id) {
     return game;
 }
 
-// ==================== Game Update (sync to DB) ====================
-static bool game_sync_to_db(game_session_t *game) {
-    mongoc_client_t *client = mongo_get_client(g_mongo_ctx);
-    if (!client) return false;
-    
-    mongoc_collection_t *collection = mongo_get_collection(client, COLLECTION_GAMES);
-    if (!collection) {
-        mongo_release_client(g_mongo_ctx, client);
-        return false;
-    }
-    
-    bson_t *query = bson_new();
-    bson_oid_t oid;
-    bson_oid_init_from_string(&oid, game->game_id);
-    BSON_APPEND_OID(query, "_id", &oid);
-    
-    bson_t *update = bson_new();
-    bson_t set_doc;
-    BSON_APPEND_DOCUMENT_BEGIN(update, "$set", &set_doc);
-    
-    // State
-    const char *state_str = "unknown";
-    switch (game->state) {
-        case GAME_STATE_PLACING_SHIPS: state_str = "placing_ships"; break;
-        case GAME_STATE_PLAYING: state_str = "playing"; break;
-        case GAME_STATE_FINISHED: state_str = "finished"; break;
-        default: break;
-    }
-    BSON_APPEND_UTF8(&set_doc, "state", state_str);
-    BSON_APPEND_UTF8(&set_doc, "current_turn", game->current_turn);
-    BSON_APPEND_BOOL(&set_doc, "player1_ready", game->player1_ready);
-    BSON_APPEND_BOOL(&set_doc, "player2_ready", game->player2_ready);
-    
-    // Boards
-    board_to_bson(&set_doc, "player1_board", &game->player1_board);
-    board_to_bson(&set_doc, "player2_board", &game->player2_board);
-    
-    bson_append_date_time(&set_doc, "updated_at", -1, (int64_t)time(NULL) * 1000);
+game_session_t* game_get(const char *game_id) {
+    // Check in-memory registry first
+    game_session_t *game = game_registry_get(game_id);
+    if (game) return game;
     
-    bson_append_document_end(update, &set_doc);
+    // Not in memory, load from MongoDB
+    log_info("Game %s not in cache, loading from MongoDB...", game_id);
+    return game_load_from_db(game_id);
+}
+
+game_session_t* game_load_from_db(const char *game_id) {
+    game_session_t *game = game_fetch_from_db(game_id);
+    if (!game) return NULL;
     
-    bson_error_t error;
-    bool success = mongoc_collection_update_one(collection, query, update, NULL, NULL, &error);
+    // Thread khác có thể vừa load cùng game: registry giữ bản đầu tiên
+    game = game_registry_insert(game);
     
-    if (!success) {
-        log_error("Failed to sync game %s to DB: %s", game->game_id, error.message);
+    // Game đã kết thúc nhưng vẫn được đọc lại (chat, xem lại): không giữ mãi
+    if (game->state == GAME_STATE_FINISHED) {
+        timer_arm(&game->evict_timer, (uint64_t)GAME_EVICT_DELAY * 1000);
     }
-    
-    bson_destroy(query);
-    bson_destroy(update);
-    mongoc_collection_destroy(collection);
-    mongo_release_client(g_mongo_ctx, client);
-    
-    return success;
+    return game;
 }
 
 // ==================== Game Operations (with DB sync) ====================
 
 game_session_t* game_find_by_player(const char *player_id) {
     // Check in-memory first
-    for (int i = 0; i < active_game_count; i++) {
-        game_session_t *game = active_games[i];
-        if (strcmp(game->player1_id, player_id) == 0 || 
-            strcmp(game->player2_id, player_id) == 0) {
-            return game;
-        }
-    }
+    game_session_t *found = game_registry_find_by_player(player_id);
+    if (found) return found;
     
     // Query MongoDB
     mongoc_client_t *client = mongo_get_client(g_mongo_ctx);
@@ -498,14 +459,35 @@ game_session_t* game_find_by_player(const char *player_id) {
     return game;
 }
 
-bool game_place_ship(const char *game_id, const char *player_id,
-                     ship_type_t type, int row, int col, bool is_horizontal) {
-    game_session_t *game = game_get(game_id);
-    if (!game) {
-        log_error("Game not found: %s", game_id);
-        return false;
+// Cả hai đã ready: vào PLAYING, player1 đi trước, báo START_GAME cho hai bên
+static void game_begin_play(game_session_t *game) {
+    game->state = GAME_STATE_PLAYING;
+    strncpy(game->current_turn, game->player1_id, 63);
+    game->dirty |= GAME_DIRTY_STATE | GAME_DIRTY_TURN;
+    game->turn_timeout_seconds = GAME_TURN_TIMEOUT;
+    game_start_turn_clock(game);
+    log_info("Game %s started! Both players ready.", game->game_id);
+
+    message_t start_msg = {0};
+    start_msg.type = MSG_START_GAME;
+    strncpy(start_msg.payload.start_game.game_id, game->game_id, 63);
+    strncpy(start_msg.payload.start_game.current_turn, game->player1_name, 31);
+
+    if (game->player1_socket > 0) {
+        strncpy(start_msg.payload.start_game.opponent, game->player2_name, 31);
+        game_persist_send(game, game->player1_socket, &start_msg);
+        log_info("✅ Sent START_GAME to player1 (socket %d)", game->player1_socket);
     }
-    
+
+    if (game->player2_socket > 0) {
+        strncpy(start_msg.payload.start_game.opponent, game->player1_name, 31);
+        game_persist_send(game, game->player2_socket, &start_msg);
+        log_info("✅ Sent START_GAME to player2 (socket %d)", game->player2_socket);
+    }
+}
+
+bool game_place_ship(game_session_t *game, const char *player_id,
+                     ship_type_t type, int row, int col, bool is_horizontal) {
     if (game->state != GAME_STATE_PLACING_SHIPS) {
         log_warn("Cannot place ships in current game state");
         return false;
@@ -529,26 +511,106 @@ bool game_place_ship(const char *game_id, const char *player_id,
         return false;
     }
     
+    game_wal_event_t ev = {
+        .type = GAME_WAL_PLACE,
+        .u.place = { (uint8_t)type, (uint8_t)row, (uint8_t)col, is_horizontal }
+    };
+    strncpy(ev.game_id, game->game_id, sizeof(ev.game_id) - 1);
+    strncpy(ev.player_id, player_id, sizeof(ev.player_id) - 1);
+    game_wal_append(game, &ev);
+    game->dirty |= (board == &game->player1_board) ? GAME_DIRTY_BOARD1 : GAME_DIRTY_BOARD2;
+    
     if (board->ship_count == MAX_SHIPS) {
         *ready_flag = true;
+        game->dirty |= GAME_DIRTY_READY;
         log_info("Player %s ready (all ships placed)", player_id);
         
         if (game->player1_ready && game->player2_ready) {
-            game->state = GAME_STATE_PLAYING;
-            log_info("Game %s started! Both players ready", game_id);
+            game_begin_play(game);
         }
     }
     
-    // ✅ Sync to DB
-    game_sync_to_db(game);
+    game_persist_schedule(game);
     
     return true;
 }
 
+static uint64_t g_fleet_seed = 0;
+
+// Seed riêng cho mỗi lần tự xếp (gọi từ nhiều game worker)
+static uint64_t game_fleet_seed(void) {
+    uint64_t seed = __atomic_add_fetch(&g_fleet_seed, 0x9E3779B97F4A7C15ULL, __ATOMIC_RELAXED);
+    return seed ^ (timer_now_ms() * 0xBF58476D1CE4E5B9ULL);
+}
+
+bool game_place_fleet(game_session_t *game, const char *player_id, int sock,
+                      const ship_t *ships, int count) {
+    bool is_p1 = strcmp(game->player1_id, player_id) == 0;
+    if (!is_p1 && strcmp(game->player2_id, player_id) != 0) {
+        log_error("Player not in game: %s", player_id);
+        return false;
+    }
+
+    bool *ready_flag = is_p1 ? &game->player1_ready : &game->player2_ready;
+    if (game->state != GAME_STATE_PLACING_SHIPS || *ready_flag) {
+        log_warn("Player %s cannot place a fleet in game %s now", player_id, game->game_id);
+        return false;
+    }
+
+    // Thay cả board (kể cả tàu đã đặt lẻ bằng MSG_PLACE_SHIP)
+    board_t *board = is_p1 ? &game->player1_board : &game->player2_board;
+    bool placed;
+    if (ships) {
+        placed = board_place_fleet(board, ships, count);
+    } else {
+        uint64_t seed = game_fleet_seed();
+        placed = board_auto_place(board, &seed);
+    }
+    if (!placed) {
+        return false;
+    }
+
+    *ready_flag = true;
+    game->dirty |= GAME_DIRTY_READY | (is_p1 ? GAME_DIRTY_BOARD1 : GAME_DIRTY_BOARD2);
+
+    // Ghi như READY: replay dựng lại đúng hạm đội từ layout
+    game_wal_event_t ev = { .type = GAME_WAL_READY };
+    strncpy(ev.game_id, game->game_id, sizeof(ev.game_id) - 1);
+    strncpy(ev.player_id, player_id, sizeof(ev.player_id) - 1);
+    board_to_layout(board, ev.u.ready.board);
+    game_wal_append(game, &ev);
+
+    log_info("Player %s fleet %s (game %s)", player_id, ships ? "placed" : "auto-placed", game->game_id);
+
+    if (sock > 0) {
+        message_t msg = {0};
+        msg.type = MSG_PLACE_FLEET;
+        msg.payload.place_fleet.count = (uint8_t)board->ship_count;
+        msg.payload.place_fleet.auto_place = ships ? 0 : 1;
+        for (int i = 0; i < board->ship_count; i++) {
+            fleet_ship_t *out = &msg.payload.place_fleet.ships[i];
+            out->ship_type = (uint8_t)board->ships[i].type;
+            out->row = (uint8_t)board->ships[i].start_row;
+            out->col = (uint8_t)board->ships[i].start_col;
+            out->is_horizontal = board->ships[i].is_horizontal ? 1 : 0;
+        }
+        game_persist_send(game, sock, &msg);
+    }
+
+    if (game->player1_ready && game->player2_ready) {
+        game_begin_play(game);
+    }
+
+    game_persist_schedule(game);
+    return true;
+}
+
 bool game_is_player_turn(const char *game_id, const char *player_id) {
     game_session_t *game = game_get(game_id);
     if (!game) return false;
-    return strcmp(game->current_turn, player_id) == 0;
+    bool is_turn = strcmp(game->current_turn, player_id) == 0;
+    game_release(game);
+    return is_turn;
 }
 
 void game_switch_turn(game_session_t *game) {
@@ -557,41 +619,47 @@ void game_switch_turn(game_session_t *game) {
     } else {
         strncpy(game->current_turn, game->player1_id, 63);
     }
-    game->turn_started_at = time(NULL);
-    game->turn_timeout_warned = false;
+    game->dirty |= GAME_DIRTY_TURN;
+    game_start_turn_clock(game);
     log_info("Turn switched to: %s", game->current_turn);
 }
 
-shot_result_t game_process_shot(const char *game_id, const char *player_id, int row, int col) {
+// Chỉ nhận phát bắn hợp lệ: đúng lượt, ô chưa bắn. Phát bắn bị từ chối không
+// đổi lượt, để state trong memory luôn khớp với những gì WAL ghi lại.
+bool game_process_shot(game_session_t *game, const char *player_id, int row, int col,
+                       shot_result_t *out) {
     shot_result_t result = {false, false, 0, false};
-    
-    game_session_t *game = game_get(game_id);
-    if (!game) {
-        log_error("Game not found: %s", game_id);
-        return result;
-    }
+    *out = result;
     
     if (game->state != GAME_STATE_PLAYING) {
         log_warn("Game not in playing state");
-        return result;
+        return false;
     }
     
     // ✅ Check turn
-    if (!game_is_player_turn(game_id, player_id)) {
+    if (strcmp(game->current_turn, player_id) != 0) {
         log_warn("Not player's turn: %s", player_id);
-        return result;
+        return false;
     }
     
     // ✅ Get opponent's board
     board_t *target_board = NULL;
+    uint8_t shooter = 0;
     
     if (strcmp(game->player1_id, player_id) == 0) {
         target_board = &game->player2_board;
     } else if (strcmp(game->player2_id, player_id) == 0) {
         target_board = &game->player1_board;
+        shooter = 1;
     } else {
         log_error("Player not in game");
-        return result;
+        return false;
+    }
+    
+    // Ô đã bắn rồi / ngoài bảng: từ chối, giữ nguyên lượt
+    if (!board_is_valid_shot(target_board, row, col)) {
+        log_warn("Rejected shot at (%d, %d) by %s", row, col, player_id);
+        return false;
     }
     
     // ✅ Process shot on target board
@@ -600,656 +668,428 @@ shot_result_t game_process_shot(const char *game_id, const char *player_id, int
     log_info("Shot result: hit=%d, sunk=%d, type=%d, game_over=%d",
              result.is_hit, result.is_sunk, result.sunk_ship_type, result.game_over);
     
+    game_wal_event_t ev = {
+        .type = GAME_WAL_SHOT,
+        .u.shot = { game->moves.count, (uint8_t)row, (uint8_t)col }
+    };
+    strncpy(ev.game_id, game->game_id, sizeof(ev.game_id) - 1);
+    strncpy(ev.player_id, player_id, sizeof(ev.player_id) - 1);
+    game_wal_append(game, &ev);
+    
+    move_t move = {
+        .shooter = shooter,
+        .row = (uint8_t)row,
+        .col = (uint8_t)col,
+        .is_hit = result.is_hit,
+        .is_sunk = result.is_sunk,
+        .sunk_ship_type = (uint8_t)result.sunk_ship_type,
+        .game_over = result.game_over,
+        .timestamp_ms = move_log_now_ms()
+    };
+    move_log_append(&game->moves, &move);
+    
     if (result.game_over) {
         game->state = GAME_STATE_FINISHED;
+        game->dirty |= GAME_DIRTY_STATE;
         log_info("🏆 Game over! Winner: %s", player_id);
-        game_end(game_id, player_id);
+        game_end(game, player_id);
     } else {
         game_switch_turn(game);
     }
     
-    game_sync_to_db(game);
+    game_persist_schedule(game);
     
-    return result;
+    *out = result;
+    return true;
 }
 
-bool game_end(const char *game_id, const char *winner_id) {
-    game_session_t *game = game_get(game_id);
-    if (!game) return false;
-    
+// Trận kết thúc trong lúc replay mà chưa thấy END: giữ ref tới game_replay_finish
+static game_session_t **g_elo_pending = NULL;
+static size_t g_elo_pending_count = 0;
+static size_t g_elo_pending_cap = 0;
+
+// Cập nhật ELO rồi mới ghi END: WAL có END nghĩa là ELO đã xong, replay bỏ qua
+static void game_end_rate(game_session_t *game) {
+    const char *loser_id = strcmp(game->winner_id, game->player1_id) != 0
+                           ? game->player1_id : game->player2_id;
+    elo_update_after_match(game->winner_id, loser_id);
+
+    game_wal_event_t ev = { .type = GAME_WAL_END };
+    strncpy(ev.game_id, game->game_id, sizeof(ev.game_id) - 1);
+    strncpy(ev.player_id, game->winner_id, sizeof(ev.player_id) - 1);
+    game_wal_append(game, &ev);
+}
+
+// Chạy trên game worker. Kết quả trận nằm trong memory và được ghi cùng lần
+// flush kế tiếp; chỉ ELO còn cập nhật đồng bộ.
+bool game_end(game_session_t *game, const char *winner_id) {
     game->state = GAME_STATE_FINISHED;
-    
-    // Update MongoDB with winner and final state
-    mongoc_client_t *client = mongo_get_client(g_mongo_ctx);
-    if (!client) return false;
-    
-    mongoc_collection_t *collection = mongo_get_collection(client, COLLECTION_GAMES);
-    if (!collection) {
-        mongo_release_client(g_mongo_ctx, client);
-        return false;
+    if (winner_id != game->winner_id) {
+        strncpy(game->winner_id, winner_id, sizeof(game->winner_id) - 1);
+    }
+    game->finished_at = (long long)time(NULL) * 1000;
+    game->dirty |= GAME_DIRTY_STATE | GAME_DIRTY_WINNER;
+    timer_cancel(&game->turn_timer);
+    
+    if (!game_wal_replaying()) {
+        game_end_rate(game);
+    } else if (!game->elo_pending) {
+        // Record END (nếu có) tới sau và xoá cờ; không thì game_replay_finish
+        // cập nhật ELO
+        if (g_elo_pending_count == g_elo_pending_cap) {
+            size_t cap = g_elo_pending_cap ? g_elo_pending_cap * 2 : 16;
+            game_session_t **grown = realloc(g_elo_pending, cap * sizeof(*grown));
+            if (grown) {
+                g_elo_pending = grown;
+                g_elo_pending_cap = cap;
+            }
+        }
+        if (g_elo_pending_count < g_elo_pending_cap) {
+            game_acquire(game);
+            game->elo_pending = true;
+            g_elo_pending[g_elo_pending_count++] = game;
+        } else {
+            log_error("[WAL] Out of memory, ELO for game %s not updated", game->game_id);
+        }
     }
     
-    bson_t *query = bson_new();
-    bson_oid_t oid;
-    bson_oid_init_from_string(&oid, game_id);
-    BSON_APPEND_OID(query, "_id", &oid);
-    
-    bson_t *update = bson_new();
-    bson_t set_doc;
-    BSON_APPEND_DOCUMENT_BEGIN(update, "$set", &set_doc);
-    BSON_APPEND_UTF8(&set_doc, "state", "finished");
-    BSON_APPEND_UTF8(&set_doc, "winner_id", winner_id);
-    bson_append_date_time(&set_doc, "finished_at", -1, (int64_t)time(NULL) * 1000);
-    bson_append_document_end(update, &set_doc);
+    // Giữ game thêm một lúc cho các message sau trận rồi gỡ khỏi memory
+    timer_arm(&game->evict_timer, (uint64_t)GAME_EVICT_DELAY * 1000);
     
-    bson_error_t error;
-    bool success = mongoc_collection_update_one(collection, query, update, NULL, NULL, &error);
+    game_persist_schedule(game);
+    log_info("Game ended: %s, winner: %s", game->game_id, winner_id);
     
-    if (success) {
-        log_info("Game ended: %s, winner: %s", game_id, winner_id);
-    } else {
-        log_error("Failed to update game end: %s", error.message);
-    }
-    const char* loser_id ;
-    if (winner_id != game->player1_id){
-        loser_id = game->player1_id;
-    }else{
-        loser_id = game->player2_id;
-    }
-    elo_update_after_match(winner_id,loser_id);
-    bson_destroy(query);
-    bson_destroy(update);
-    mongoc_collection_destroy(collection);
-    mongo_release_client(g_mongo_ctx, client);
-    
-    return success;
+    return true;
 }
 
-void game_free(game_session_t *game) {
+// ==================== Refcount ====================
+// Caller phải đang giữ một ref (registry lookup, run queue...)
+void game_acquire(game_session_t *game) {
+    __atomic_add_fetch(&game->refcount, 1, __ATOMIC_ACQ_REL);
+}
+
+void game_release(game_session_t *game) {
     if (!game) return;
-    
-    for (int i = 0; i < active_game_count; i++) {
-        if (active_games[i] == game) {
-            for (int j = i; j < active_game_count - 1; j++) {
-                active_games[j] = active_games[j + 1];
-            }
-            active_game_count--;
-            break;
+    if (__atomic_sub_fetch(&game->refcount, 1, __ATOMIC_ACQ_REL) != 0) return;
+
+    // Ref cuối: game đã rời registry. Sau khi cancel, timer callback không
+    // còn giữ con trỏ tới game
+    timer_cancel(&game->turn_timer);
+    timer_cancel(&game->evict_timer);
+    pthread_mutex_destroy(&game->mb_lock);
+    pthread_mutex_destroy(&game->state_lock);
+    if (game->wal_pin) {
+        log_warn("Game %s released with unpersisted WAL records", game->game_id);
+        game_wal_unpin(game->wal_pin);
+    }
+    move_log_free(&game->moves);
+    free(game);
+}
+
+// Timer callback chỉ có con trỏ thô: chỉ dùng game nếu còn ref sống
+static bool game_try_acquire(game_session_t *game) {
+    int ref = __atomic_load_n(&game->refcount, __ATOMIC_ACQUIRE);
+    while (ref > 0) {
+        if (__atomic_compare_exchange_n(&game->refcount, &ref, ref + 1, false,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            return true;
         }
     }
+    return false;
+}
 
-    if (game) free(game);
+static void game_evict_timer_fired(void *arg) {
+    game_session_t *game = (game_session_t*)arg;
+    if (!game_try_acquire(game)) return;
+
+    if (game_registry_remove(game)) {
+        log_info("Game %s evicted from memory (%zu games cached)",
+                 game->game_id, game_registry_size());
+    }
+    game_release(game);
 }
 
-void* game_timeout_monitor_thread(void* arg) {
-    log_info("[TIMEOUT_MONITOR] Thread started");
-    
-    while (1) {
-        sleep(1);
-        time_t now = time(NULL);
-        
-        // ✅ Create snapshot
-        int snapshot_count = active_game_count;
-        game_session_t *snapshot[MAX_ACTIVE_GAMES];
-        
-        for (int i = 0; i < snapshot_count; i++) {
-            snapshot[i] = active_games[i];
-        }
-        
-        // ✅ Process snapshot
-        for (int i = 0; i < snapshot_count; i++) {
-            game_session_t *game = snapshot[i];
-            
-            if (!game || game->state != GAME_STATE_PLAYING) {
-                continue;
-            }
-            
-            int elapsed = (int)(now - game->turn_started_at);
-            int remaining = game->turn_timeout_seconds - elapsed;
-            
-            // ✅ CASE 1: Send warning (ONLY to current player)
-            if (remaining <= 10 && remaining > 0 && !game->turn_timeout_warned) {
-                log_warn("[TIMEOUT_MONITOR] Game %s: %d seconds remaining for %s", 
-                         game->game_id, remaining, game->current_turn);
-                
-                int current_socket = -1;
-                
-                // ✅ Compare current_turn (USER_ID) with player IDs
-                if (strcmp(game->current_turn, game->player1_id) == 0) {
-                    current_socket = game->player1_socket;
-                    log_info("[TIMEOUT_MONITOR] Warning → Player1 (socket %d)", current_socket);
-                } else if (strcmp(game->current_turn, game->player2_id) == 0) {
-                    current_socket = game->player2_socket;
-                    log_info("[TIMEOUT_MONITOR] Warning → Player2 (socket %d)", current_socket);
-                } else {
-                    log_error("[TIMEOUT_MONITOR] ❌ current_turn mismatch: '%s'", game->current_turn);
-                }
-                
-                if (current_socket > 0) {
-                    message_t warning = {0};
-                    warning.type = MSG_TURN_WARNING;
-                    warning.payload.turn_warning.seconds_remaining = remaining;
-                    
-                    ws_send_message(current_socket, &warning);
-                    log_info("[TIMEOUT_MONITOR] ✅ Sent TURN_WARNING: %d seconds remaining", remaining);
-                    
-                    game->turn_timeout_warned = true;
-                } else {
-                    log_error("[TIMEOUT_MONITOR] ❌ Invalid socket!");
-                }
-            }
-            
-            // ✅ CASE 2: Timeout expired
-            if (elapsed > game->turn_timeout_seconds) {
-                log_error("[TIMEOUT_MONITOR] ⏰ TIMEOUT! Game %s", game->game_id);
-                
-                // ... (keep existing timeout logic)
-                char winner_username[64] = {0};
-                char loser_username[64] = {0};
-                int winner_socket = -1;
-                int loser_socket = -1;
-                
-                if (strcmp(game->current_turn, game->player1_id) == 0) {
-                    // Player 1 timeout → Player 2 wins
-                    user_t *winner_user = user_find_by_id(game->player2_id);
-                    user_t *loser_user = user_find_by_id(game->player1_id);
-                    
-                    if (winner_user) {
-                        strncpy(winner_username, winner_user->username, 63);
-                        user_free(winner_user);
-                    }
-                    
-                    if (loser_user) {
-                        strncpy(loser_username, loser_user->username, 63);
-                        user_free(loser_user);
-                    }
-                    
-                    winner_socket = game->player2_socket;
-                    loser_socket = game->player1_socket;
-                } else {
-                    // Player 2 timeout → Player 1 wins
-                    user_t *winner_user = user_find_by_id(game->player1_id);
-                    user_t *loser_user = user_find_by_id(game->player2_id);
-                    
-                    if (winner_user) {
-                        strncpy(winner_username, winner_user->username, 63);
-                        user_free(winner_user);
-                    }
-                    
-                    if (loser_user) {
-                        strncpy(loser_username, loser_user->username, 63);
-                        user_free(loser_user);
-                    }
-                    
-                    winner_socket = game->player1_socket;
-                    loser_socket = game->player2_socket;
-                }
-                
-                game->state = GAME_STATE_FINISHED;
-                strncpy(game->winner_id, winner_username, 63);
-                game_end(game->game_id, winner_username);
-                
-                message_t timeout_msg = {0};
-                timeout_msg.type = MSG_GAME_TIMEOUT;
-                strncpy(timeout_msg.payload.game_timeout.winner_id, winner_username, 63);
-                strncpy(timeout_msg.payload.game_timeout.loser_id, loser_username, 63);
-                strncpy(timeout_msg.payload.game_timeout.reason, "timeout", 63);
-                
-                if (winner_socket > 0) {
-                    ws_send_message(winner_socket, &timeout_msg);
-                    log_info("[TIMEOUT_MONITOR] ✅ Sent GAME_TIMEOUT to winner %s", winner_username);
-                }
-                
-                if (loser_socket > 0) {
-                    ws_send_message(loser_socket, &timeout_msg);
-                    log_info("[TIMEOUT_MONITOR] ✅ Sent GAME_TIMEOUT to loser %s", loser_username);
-                }
-                game_end(game->game_id, winner_username);
-    
-                game->player1_socket = 0;
-                game->player2_socket = 0;
-                
-                log_info("[TIMEOUT_MONITOR] ✅ Game %s ended. Winner: %s", 
-                         game->game_id, winner_username);
-            }
-        }
+// Bắt đầu (hoặc reset) đồng hồ của lượt hiện tại. Timer chạy lần đầu lúc
+// còn GAME_TURN_WARNING giây để cảnh báo, lần sau đúng lúc hết lượt.
+void game_start_turn_clock(game_session_t *game) {
+    if (game->turn_timeout_seconds <= 0) {
+        game->turn_timeout_seconds = GAME_TURN_TIMEOUT;
     }
-    
-    return NULL;
+
+    uint64_t timeout_ms = (uint64_t)game->turn_timeout_seconds * 1000;
+    uint64_t warning_ms = (uint64_t)GAME_TURN_WARNING * 1000;
+
+    game->turn_deadline_ms = timer_now_ms() + timeout_ms;
+    game->turn_timeout_warned = false;
+    timer_arm(&game->turn_timer, timeout_ms > warning_ms ? timeout_ms - warning_ms : 0);
 }
 
-// Khởi tạo timeout monitor thread
-void game_init_timeout_monitor() {
-    pthread_t tid;
-    int result = pthread_create(&tid, NULL, game_timeout_monitor_thread, NULL);
-    
-    if (result == 0) {
-        pthread_detach(tid);
-        log_info("[TIMEOUT_MONITOR] ✅ Thread initialized successfully");
+// Thread timer chỉ chuyển lệnh vào mailbox; game worker mới đụng tới state
+static void game_turn_timer_fired(void *arg) {
+    game_session_t *game = (game_session_t*)arg;
+    if (!game_try_acquire(game)) return;
+
+    game_cmd_t *cmd = game_cmd_new(GAME_CMD_TURN_TIMER, -1, NULL);
+    if (cmd) {
+        game_actor_post(game, cmd);
     } else {
-        log_error("[TIMEOUT_MONITOR] ❌ Failed to create thread: %d", result);
+        // Không post được: thử lại ở tick sau thay vì bỏ lỡ timeout
+        timer_arm(&game->turn_timer, TIMER_TICK_MS);
     }
+    game_release(game);
 }
 
-// Thêm vào game.c
-
-bool game_set_player_ready(const char *game_id, const char *player_id, const uint8_t board[BOARD_SIZE]) {
-    mongoc_client_t *client = mongo_get_client(g_mongo_ctx);
-    if (!client) return false;
+// Hết giờ đặt tàu: server xếp hạm đội cho người chưa ready rồi vào trận
+static void game_on_place_timer(game_session_t *game) {
+    uint64_t now = timer_now_ms();
+    if (now < game->turn_deadline_ms) {
+        timer_arm(&game->turn_timer, game->turn_deadline_ms - now);
+        return;
+    }
 
-    mongoc_collection_t *collection = mongo_get_collection(client, COLLECTION_GAMES);
-    if (!collection) {
-        mongo_release_client(g_mongo_ctx, client);
-        return false;
+    log_warn("[PLACE_TIMER] Game %s: placement time is up", game->game_id);
+    if (!game->player1_ready) {
+        game_place_fleet(game, game->player1_id, game->player1_socket, NULL, 0);
+    }
+    if (!game->player2_ready) {
+        game_place_fleet(game, game->player2_id, game->player2_socket, NULL, 0);
     }
+}
 
-    // =================================================================================
-    // BƯỚC 1: Tìm game để xác định vai trò (P1 hay P2) và trạng thái đối thủ
-    // =================================================================================
-    bson_t *query = bson_new();
-    bson_oid_t oid;
-    bson_oid_init_from_string(&oid, game_id);
-    BSON_APPEND_OID(query, "_id", &oid);
+void game_on_turn_timer(game_session_t *game) {
+    if (game->state == GAME_STATE_PLACING_SHIPS) {
+        game_on_place_timer(game);
+        return;
+    }
+    if (game->state != GAME_STATE_PLAYING) {
+        return;
+    }
 
-    const bson_t *doc;
-    mongoc_cursor_t *cursor = mongoc_collection_find_with_opts(collection, query, NULL, NULL);
-    
-    bool is_p1 = false;
-    bool is_p2 = false;
-    bool other_ready = false;
-    bool success = false;
-    bool both_ready = false;
+    uint64_t now = timer_now_ms();
+    uint64_t warning_ms = (uint64_t)GAME_TURN_WARNING * 1000;
 
-    // ✅ Khai báo buffer để lưu player IDs
-    char p1_id[65] = {0};
-    char p2_id[65] = {0};
+    if (now < game->turn_deadline_ms) {
+        uint64_t remaining_ms = game->turn_deadline_ms - now;
 
-    if (mongoc_cursor_next(cursor, &doc)) {
-        bson_iter_t iter;
-        
-        // ✅ Check Player 1 (dùng tên biến khác)
-        if (bson_iter_init_find(&iter, doc, "player1_id") && BSON_ITER_HOLDS_UTF8(&iter)) {
-            const char *p1_id_from_db = bson_iter_utf8(&iter, NULL);  // ✅ ĐỔI TÊN
-            strncpy(p1_id, p1_id_from_db, 64);  // Copy vào buffer
-            p1_id[64] = '\0';
+        // ✅ CASE 1: Send warning (ONLY to current player)
+        if (remaining_ms <= warning_ms && !game->turn_timeout_warned) {
+            int remaining = (int)((remaining_ms + 999) / 1000);
+            log_warn("[TURN_TIMER] Game %s: %d seconds remaining for %s", 
+                     game->game_id, remaining, game->current_turn);
             
-            if (strcmp(p1_id, player_id) == 0) {
-                is_p1 = true;
+            int current_socket = -1;
+            
+            // ✅ Compare current_turn (USER_ID) with player IDs
+            if (strcmp(game->current_turn, game->player1_id) == 0) {
+                current_socket = game->player1_socket;
+                log_info("[TURN_TIMER] Warning → Player1 (socket %d)", current_socket);
+            } else if (strcmp(game->current_turn, game->player2_id) == 0) {
+                current_socket = game->player2_socket;
+                log_info("[TURN_TIMER] Warning → Player2 (socket %d)", current_socket);
+            } else {
+                log_error("[TURN_TIMER] ❌ current_turn mismatch: '%s'", game->current_turn);
             }
-        }
-
-        // ✅ Check Player 2 (dùng tên biến khác)
-        if (bson_iter_init_find(&iter, doc, "player2_id") && BSON_ITER_HOLDS_UTF8(&iter)) {
-            const char *p2_id_from_db = bson_iter_utf8(&iter, NULL);  // ✅ ĐỔI TÊN
-            strncpy(p2_id, p2_id_from_db, 64);  // Copy vào buffer
-            p2_id[64] = '\0';
             
-            if (strcmp(p2_id, player_id) == 0) {
-                is_p2 = true;
+            if (current_socket > 0) {
+                message_t warning = {0};
+                warning.type = MSG_TURN_WARNING;
+                warning.payload.turn_warning.seconds_remaining = remaining;
+                
+                ws_send_message(current_socket, &warning);
+                log_info("[TURN_TIMER] ✅ Sent TURN_WARNING: %d seconds remaining", remaining);
+            } else {
+                log_error("[TURN_TIMER] ❌ Invalid socket!");
             }
+            game->turn_timeout_warned = true;
         }
 
-        // Check trạng thái đối thủ
-        if (is_p1) {
-            if (bson_iter_init_find(&iter, doc, "player2_ready") && BSON_ITER_HOLDS_BOOL(&iter)) {
-                other_ready = bson_iter_bool(&iter);
-            }
-        } else if (is_p2) {
-            if (bson_iter_init_find(&iter, doc, "player1_ready") && BSON_ITER_HOLDS_BOOL(&iter)) {
-                other_ready = bson_iter_bool(&iter);
-            }
+        // Đã cảnh báo: hẹn đúng lúc hết lượt; chưa tới lúc cảnh báo thì hẹn lại
+        if (game->turn_timeout_warned) {
+            timer_arm(&game->turn_timer, remaining_ms);
+        } else {
+            timer_arm(&game->turn_timer, remaining_ms - warning_ms);
         }
+        return;
     }
-    mongoc_cursor_destroy(cursor);
 
-    if (!is_p1 && !is_p2) {
-        log_error("Player %s not found in game %s", player_id, game_id);
-        bson_destroy(query);
-        mongoc_collection_destroy(collection);
-        mongo_release_client(g_mongo_ctx, client);
+    // ✅ CASE 2: Timeout expired
+    log_error("[TURN_TIMER] ⏰ TIMEOUT! Game %s", game->game_id);
+    
+    const char *winner_id, *winner_name, *loser_name;
+    int winner_socket, loser_socket;
+    
+    if (strcmp(game->current_turn, game->player1_id) == 0) {
+        // Player 1 timeout → Player 2 wins
+        winner_id = game->player2_id;
+        winner_name = game->player2_name;
+        loser_name = game->player1_name;
+        winner_socket = game->player2_socket;
+        loser_socket = game->player1_socket;
+    } else {
+        // Player 2 timeout → Player 1 wins
+        winner_id = game->player1_id;
+        winner_name = game->player1_name;
+        loser_name = game->player2_name;
+        winner_socket = game->player1_socket;
+        loser_socket = game->player2_socket;
+    }
+    
+    game_end(game, winner_id);
+    
+    message_t timeout_msg = {0};
+    timeout_msg.type = MSG_GAME_TIMEOUT;
+    strncpy(timeout_msg.payload.game_timeout.winner_id, winner_name, 63);
+    strncpy(timeout_msg.payload.game_timeout.loser_id, loser_name, 63);
+    strncpy(timeout_msg.payload.game_timeout.reason, "timeout", 63);
+    
+    if (winner_socket > 0) {
+        game_persist_send(game, winner_socket, &timeout_msg);
+        log_info("[TURN_TIMER] ✅ Sent GAME_TIMEOUT to winner %s", winner_name);
+    }
+    
+    if (loser_socket > 0) {
+        game_persist_send(game, loser_socket, &timeout_msg);
+        log_info("[TURN_TIMER] ✅ Sent GAME_TIMEOUT to loser %s", loser_name);
+    }
+
+    game->player1_socket = 0;
+    game->player2_socket = 0;
+    
+    log_info("[TURN_TIMER] ✅ Game %s ended. Winner: %s", 
+             game->game_id, winner_name);
+}
+
+// Thêm vào game.c
+
+// Chạy trên game worker. Vai trò, trạng thái đối thủ và username đều có sẵn
+// trong session; thay đổi đi theo lần flush kế tiếp (một update_one).
+bool game_set_player_ready(game_session_t *game, const char *player_id, const uint8_t board[BOARD_SIZE]) {
+    bool is_p1 = strcmp(game->player1_id, player_id) == 0;
+    if (!is_p1 && strcmp(game->player2_id, player_id) != 0) {
+        log_error("Player %s not found in game %s", player_id, game->game_id);
         return false;
     }
 
-    // =================================================================================
-    // BƯỚC 2: Chuẩn bị dữ liệu Update
-    // =================================================================================
-    bson_t *update = bson_new();
-    bson_t set_doc;
-    BSON_APPEND_DOCUMENT_BEGIN(update, "$set", &set_doc);
-
-    // Set trạng thái ready
-    const char *ready_field = is_p1 ? "player1_ready" : "player2_ready";
-    BSON_APPEND_BOOL(&set_doc, ready_field, true);
-
-    // Nếu đối thủ đã ready, chuyển game sang trạng thái playing
-    if (other_ready) {
-        BSON_APPEND_UTF8(&set_doc, "phase", "playing");
-        both_ready = true;
-        
-        // ✅ Fetch username của player1 để set làm current_turn
-        user_t *p1_user = user_find_by_id(p1_id);  // ✅ DÙNG buffer p1_id
-        if (p1_user) {
-            BSON_APPEND_UTF8(&set_doc, "current_turn", p1_user->username);
-            log_info("Set current_turn to: %s (username of player1)", p1_user->username);
-            user_free(p1_user);
-        } else {
-            // Fallback: dùng ID nếu không tìm thấy user
-            BSON_APPEND_UTF8(&set_doc, "current_turn", p1_id);
-            log_warn("Could not find user for player1_id, using ID as current_turn");
-        }
+    if (game->state != GAME_STATE_PLACING_SHIPS) {
+        log_warn("Game %s already started, ignoring READY from %s", game->game_id, player_id);
+        return false;
     }
 
-    // --- QUAN TRỌNG: Dùng Dot Notation để chỉ update Grid, KHÔNG ghi đè Ships ---
-    char grid_key_dot[64];
+    // Dựng tàu từ layout client gửi lên rồi kiểm tra như một hạm đội: layout
+    // phải dựng lại đúng từng ô (không ô lẻ / tàu dở), đủ MAX_SHIPS tàu mỗi
+    // loại một chiếc, không chạm nhau. Board rỗng thì không bao giờ thua.
+    board_t parsed;
+    board_load_layout(&parsed, board);
+    uint8_t rebuilt[BOARD_SIZE];
+    board_to_layout(&parsed, rebuilt);
+
+    board_t *target = is_p1 ? &game->player1_board : &game->player2_board;
+    board_t fleet;
+    if (memcmp(rebuilt, board, BOARD_SIZE) != 0 ||
+        !board_place_fleet(&fleet, parsed.ships, parsed.ship_count)) {
+        log_warn("Rejected READY from %s in game %s: invalid layout", player_id, game->game_id);
+        return false;
+    }
+    *target = fleet;
+    int ships = target->ship_count;
     if (is_p1) {
-        snprintf(grid_key_dot, sizeof(grid_key_dot), "player1_board.grid");
+        game->player1_ready = true;
     } else {
-        snprintf(grid_key_dot, sizeof(grid_key_dot), "player2_board.grid");
+        game->player2_ready = true;
     }
+    game->dirty |= GAME_DIRTY_READY | (is_p1 ? GAME_DIRTY_BOARD1 : GAME_DIRTY_BOARD2);
+    log_info("✅ Loaded %s board: %d ships", is_p1 ? "player1" : "player2", ships);
 
-    bson_t grid_arr;
-    BSON_APPEND_ARRAY_BEGIN(&set_doc, grid_key_dot, &grid_arr);
+    game_wal_event_t ev = { .type = GAME_WAL_READY };
+    strncpy(ev.game_id, game->game_id, sizeof(ev.game_id) - 1);
+    strncpy(ev.player_id, player_id, sizeof(ev.player_id) - 1);
+    memcpy(ev.u.ready.board, board, BOARD_SIZE);
+    game_wal_append(game, &ev);
 
-    for (int y = 0; y < 10; y++) {
-        bson_t row;
-        char key[16];
-        snprintf(key, sizeof(key), "%d", y);
-        BSON_APPEND_ARRAY_BEGIN(&grid_arr, key, &row);
+    // Nếu cả 2 đã ready -> Gửi thông báo Start Game
+    if (game->player1_ready && game->player2_ready) {
+        game_begin_play(game);
+    }
 
-        for (int x = 0; x < 10; x++) {
-            char subkey[16];
-            snprintf(subkey, sizeof(subkey), "%d", x);
-            
-            int val = (int)board[y * 10 + x]; 
-            bson_append_int32(&row, subkey, -1, val);
-        }
-        bson_append_array_end(&grid_arr, &row);
+    game_persist_schedule(game);
+    return true;
+}
+
+// ==================== WAL Replay ====================
+// Chạy lúc khởi động, trước khi nhận kết nối. Game được nạp từ Mongo rồi áp
+// lại các event chưa có trong DB; event đã có thì bị bỏ qua (index move,
+// trạng thái ready/finished) nên replay nhiều lần vẫn ra cùng kết quả.
+bool game_replay_event(const game_wal_event_t *ev, uint32_t segment) {
+    game_session_t *game = game_get(ev->game_id);
+    if (!game) {
+        log_warn("[WAL] Game %s not found in DB, skipping event %d", ev->game_id, ev->type);
+        return false;
     }
-    bson_append_array_end(&set_doc, &grid_arr);
     
-    bson_append_document_end(update, &set_doc);
-
-    // =================================================================================
-    // BƯỚC 3: Thực thi Update
-    // =================================================================================
-    bson_error_t error;
-    if (mongoc_collection_update_one(collection, query, update, NULL, NULL, &error)) {
-        success = true;
-        
-        // ✅ RELOAD GAME FROM DB TO UPDATE IN-MEMORY STATE
-        game_session_t *game = game_get(game_id);
-        if (!game) {
-            // Game chưa có trong memory → load từ DB
-            log_warn("Game not in cache, loading from DB: %s", game_id);
-            game = game_load_from_db(game_id);
-        } else {
-            // Game đã có trong memory → reload board từ DB
-            log_info("Reloading board from DB for game: %s", game_id);
-            
-            // ✅ Re-fetch document từ MongoDB - đồng bộ với ram
-            bson_t *reload_query = bson_new();
-            bson_oid_t reload_oid;
-            bson_oid_init_from_string(&reload_oid, game_id);
-            BSON_APPEND_OID(reload_query, "_id", &reload_oid);
-            
-            mongoc_cursor_t *reload_cursor = mongoc_collection_find_with_opts(
-                collection, reload_query, NULL, NULL
-            );
-            
-            const bson_t *reload_doc;
-            if (mongoc_cursor_next(reload_cursor, &reload_doc)) {
-    // ✅ Update in-memory board từ MongoDB
-    if (is_p1) {
-        bson_to_board(reload_doc, "player1_board", &game->player1_board);
-        log_info("✅ Reloaded player1_board from DB");
-        
-        // ✅ DEBUG: Dump grid state
-        log_info("=== PLAYER1 GRID STATE ===");
-        for (int y = 0; y < 10; y++) {
-            char row_str[200] = {0};
-            for (int x = 0; x < 10; x++) {
-                char cell[5];
-                snprintf(cell, sizeof(cell), "%2d ", game->player1_board.grid[y * 10 + x]);
-                strcat(row_str, cell);
+    pthread_mutex_lock(&game->state_lock);
+    game_wal_pin(game, segment);
+    
+    switch (ev->type) {
+        case GAME_WAL_CREATE:
+            // Document được insert đồng bộ, chỉ cần nạp game
+            break;
+        case GAME_WAL_PLACE:
+            // Tàu đã có trong DB thì board từ chối (trùng vị trí)
+            if (game->state == GAME_STATE_PLACING_SHIPS) {
+                game_place_ship(game, ev->player_id, (ship_type_t)ev->u.place.type,
+                                ev->u.place.row, ev->u.place.col, ev->u.place.is_horizontal);
             }
-            log_info("Row %d: %s", y, row_str);
-        }
-        
-        // ✅ ========== RECONSTRUCT SHIPS FROM GRID PATTERN ==========
-        log_info("=== RECONSTRUCTING PLAYER1 SHIPS ===");
-        
-        // Reset ships array
-        game->player1_board.ship_count = 0;
-        game->player1_board.ships_remaining = 0;
-        memset(game->player1_board.ships, 0, sizeof(game->player1_board.ships));
-        
-        // Track visited cells
-        bool visited[BOARD_SIZE] = {false};
-        
-        for (int row = 0; row < GRID_SIZE; row++) {
-            for (int col = 0; col < GRID_SIZE; col++) {
-                int index = row * GRID_SIZE + col;
-                int ship_size = game->player1_board.grid[index];
-                
-                // Skip if visited or water
-                if (visited[index] || ship_size == 0) {
-                    continue;
-                }
-                
-                // Detect ship orientation (horizontal)
-                int length = 0;
-                for (int i = 0; i < ship_size && col + i < GRID_SIZE; i++) {
-                    int check_index = row * GRID_SIZE + (col + i);
-                    if (game->player1_board.grid[check_index] == ship_size) {
-                        length++;
-                        visited[check_index] = true;
-                    } else {
-                        break;
-                    }
-                }
-                
-                // Found complete ship
-                if (length == ship_size && game->player1_board.ship_count < MAX_SHIPS) {
-                    ship_t *ship = &game->player1_board.ships[game->player1_board.ship_count];
-                    
-                    // Map size to type
-                    switch (ship_size) {
-                        case 5: ship->type = SHIP_CARRIER; break;
-                        case 4: ship->type = SHIP_BATTLESHIP; break;
-                        case 3: ship->type = SHIP_DESTROYER; break;
-                        case 2: ship->type = SHIP_SUBMARINE; break;
-                        case 1: ship->type = SHIP_PATROL; break;
-                        default: ship->type = SHIP_CARRIER; break;
-                    }
-                    
-                    ship->start_row = row;
-                    ship->start_col = col;
-                    ship->is_horizontal = true;
-                    ship->hits = 0;
-                    ship->is_sunk = false;
-                    
-                    // ✅ CONVERT GRID VALUES FROM SIZE → CELL_SHIP
-                    for (int i = 0; i < ship_size; i++) {
-                        game->player1_board.grid[row * GRID_SIZE + (col + i)] = CELL_SHIP;
-                    }
-                    
-                    game->player1_board.ship_count++;
-                    game->player1_board.ships_remaining++;
-                    
-                    log_info("✅ Reconstructed ship %d: type=%d, pos=(%d,%d), size=%d", 
-                             game->player1_board.ship_count - 1, ship->type, row, col, ship_size);
-                }
+            break;
+        case GAME_WAL_READY: {
+            bool ready = strcmp(ev->player_id, game->player1_id) == 0 ? game->player1_ready
+                                                                      : game->player2_ready;
+            if (!ready) {
+                game_set_player_ready(game, ev->player_id, ev->u.ready.board);
             }
+            break;
         }
-        
-        log_info("✅ Reconstruction complete: %d ships found", game->player1_board.ship_count);
-        
-        // ✅ DEBUG: Dump ships
-        log_info("=== PLAYER1 SHIPS (AFTER RECONSTRUCTION) ===");
-        for (int i = 0; i < game->player1_board.ship_count; i++) {
-            ship_t *ship = &game->player1_board.ships[i];
-            log_info("Ship %d: type=%d, pos=(%d,%d), horizontal=%d, hits=%d, sunk=%d",
-                     i, ship->type, ship->start_row, ship->start_col,
-                     ship->is_horizontal, ship->hits, ship->is_sunk);
-        }
-        
-    } else {
-        // ✅ ========== SAME LOGIC FOR PLAYER 2 ==========
-        bson_to_board(reload_doc, "player2_board", &game->player2_board);
-        log_info("✅ Reloaded player2_board from DB");
-        
-        // ✅ DEBUG: Dump grid state
-        log_info("=== PLAYER2 GRID STATE ===");
-        for (int y = 0; y < 10; y++) {
-            char row_str[200] = {0};
-            for (int x = 0; x < 10; x++) {
-                char cell[5];
-                snprintf(cell, sizeof(cell), "%2d ", game->player2_board.grid[y * 10 + x]);
-                strcat(row_str, cell);
+        case GAME_WAL_SHOT:
+            if (game->moves.count == ev->u.shot.index) {
+                shot_result_t result;
+                game_process_shot(game, ev->player_id, ev->u.shot.row, ev->u.shot.col,
+                                  &result);
             }
-            log_info("Row %d: %s", y, row_str);
-        }
-        
-        // ✅ RECONSTRUCT SHIPS
-        log_info("=== RECONSTRUCTING PLAYER2 SHIPS ===");
-        
-        game->player2_board.ship_count = 0;
-        game->player2_board.ships_remaining = 0;
-        memset(game->player2_board.ships, 0, sizeof(game->player2_board.ships));
-        
-        bool visited[BOARD_SIZE] = {false};
-        
-        for (int row = 0; row < GRID_SIZE; row++) {
-            for (int col = 0; col < GRID_SIZE; col++) {
-                int index = row * GRID_SIZE + col;
-                int ship_size = game->player2_board.grid[index];
-                
-                if (visited[index] || ship_size == 0) {
-                    continue;
-                }
-                
-                int length = 0;
-                for (int i = 0; i < ship_size && col + i < GRID_SIZE; i++) {
-                    int check_index = row * GRID_SIZE + (col + i);
-                    if (game->player2_board.grid[check_index] == ship_size) {
-                        length++;
-                        visited[check_index] = true;
-                    } else {
-                        break;
-                    }
-                }
-                
-                if (length == ship_size && game->player2_board.ship_count < MAX_SHIPS) {
-                    ship_t *ship = &game->player2_board.ships[game->player2_board.ship_count];
-                    
-                    switch (ship_size) {
-                        case 5: ship->type = SHIP_CARRIER; break;
-                        case 4: ship->type = SHIP_BATTLESHIP; break;
-                        case 3: ship->type = SHIP_DESTROYER; break;
-                        case 2: ship->type = SHIP_SUBMARINE; break;
-                        case 1: ship->type = SHIP_PATROL; break;
-                        default: ship->type = SHIP_CARRIER; break;
-                    }
-                    
-                    ship->start_row = row;
-                    ship->start_col = col;
-                    ship->is_horizontal = true;
-                    ship->hits = 0;
-                    ship->is_sunk = false;
-                    
-                    // ✅ CONVERT GRID VALUES
-                    for (int i = 0; i < ship_size; i++) {
-                        game->player2_board.grid[row * GRID_SIZE + (col + i)] = CELL_SHIP;
-                    }
-                    
-                    game->player2_board.ship_count++;
-                    game->player2_board.ships_remaining++;
-                    
-                    log_info("✅ Reconstructed ship %d: type=%d, pos=(%d,%d), size=%d", 
-                             game->player2_board.ship_count - 1, ship->type, row, col, ship_size);
-                }
+            break;
+        case GAME_WAL_END:
+            // Document đã ghi kết quả (hoặc SHOT cuối vừa replay đã kết thúc
+            // game): không chạy lại game_end, giữ nguyên finished_at
+            if (game->state != GAME_STATE_FINISHED) {
+                game_end(game, ev->player_id);
             }
-        }
-        
-        log_info("✅ Reconstruction complete: %d ships found", game->player2_board.ship_count);
-        
-        // ✅ DEBUG: Dump ships
-        log_info("=== PLAYER2 SHIPS (AFTER RECONSTRUCTION) ===");
-        for (int i = 0; i < game->player2_board.ship_count; i++) {
-            ship_t *ship = &game->player2_board.ships[i];
-            log_info("Ship %d: type=%d, pos=(%d,%d), horizontal=%d, hits=%d, sunk=%d",
-                     i, ship->type, ship->start_row, ship->start_col,
-                     ship->is_horizontal, ship->hits, ship->is_sunk);
-        }
+            // END chỉ được ghi sau khi ELO đã cập nhật
+            game->elo_pending = false;
+            break;
     }
+    
+    game_persist_schedule(game);
+    pthread_mutex_unlock(&game->state_lock);
+    game_release(game);
+    return true;
 }
-            
-            mongoc_cursor_destroy(reload_cursor);
-            bson_destroy(reload_query);
-        }
-        
-        // Nếu cả 2 đã ready -> Gửi thông báo Start Game
-        if (both_ready && game) {
-            game->state = GAME_STATE_PLAYING;
-            log_info("Game %s started! Both players ready.", game_id);
-            log_info("In-memory game state updated to PLAYING");
-            game->turn_timeout_seconds = 30;  // 30 giây mỗi turn
-            game->turn_started_at = time(NULL);
-            game->turn_timeout_warned = false;
-            // ✅ DEBUG: Log board state
-            if (is_p1) {
-                log_info("Player1 board: ship_count=%d, ships_remaining=%d",
-                         game->player1_board.ship_count,
-                         game->player1_board.ships_remaining);
-            } else {
-                log_info("Player2 board: ship_count=%d, ships_remaining=%d",
-                         game->player2_board.ship_count,
-                         game->player2_board.ships_remaining);
-            }
-            
-            // --- Gửi tin nhắn START_GAME ---
-            message_t start_msg = {0};
-            start_msg.type = MSG_START_GAME;
-            
-            strncpy(start_msg.payload.start_game.game_id, game_id, 63);
-            
-            // ✅ Fetch username để gửi current_turn
-            user_t *p1_user_for_msg = user_find_by_id(p1_id);
-            if (p1_user_for_msg) {
-                strncpy(start_msg.payload.start_game.current_turn, p1_user_for_msg->username, 31);
-                user_free(p1_user_for_msg);
-            }
 
-            // Gửi cho Player 1
-            if (game->player1_socket > 0) {
-                user_t *p2_user = user_find_by_id(p2_id);
-                if (p2_user) {
-                    strncpy(start_msg.payload.start_game.opponent, p2_user->username, 31);
-                    user_free(p2_user);
-                }
-                ws_send_message(game->player1_socket, &start_msg);
-                log_info("✅ Sent START_GAME to player1 (socket %d)", game->player1_socket);
-            }
-            
-            // Gửi cho Player 2
-            if (game->player2_socket > 0) {
-                user_t *p1_user_again = user_find_by_id(p1_id);
-                if (p1_user_again) {
-                    strncpy(start_msg.payload.start_game.opponent, p1_user_again->username, 31);
-                    user_free(p1_user_again);
-                }
-                ws_send_message(game->player2_socket, &start_msg);
-                log_info("✅ Sent START_GAME to player2 (socket %d)", game->player2_socket);
-            }
+void game_replay_finish(void) {
+    for (size_t i = 0; i < g_elo_pending_count; i++) {
+        game_session_t *game = g_elo_pending[i];
+
+        pthread_mutex_lock(&game->state_lock);
+        if (game->elo_pending) {
+            game->elo_pending = false;
+            log_info("[WAL] Game %s ended during replay without END, updating ELO",
+                     game->game_id);
+            game_end_rate(game);
+            game_persist_schedule(game);
         }
-    } else {
-        log_error("Failed to set player ready: %s", error.message);
+        pthread_mutex_unlock(&game->state_lock);
+        game_release(game);
     }
 
-    bson_destroy(query);
-    bson_destroy(update);
-    mongoc_collection_destroy(collection);
-    mongo_release_client(g_mongo_ctx, client);
-
-    return success;
-}
\ No newline at end of file
+    free(g_elo_pending);
+    g_elo_pending = NULL;
+    g_elo_pending_count = 0;
+    g_elo_pending_cap = 0;
+}
@@ -0,0 +1,286 @@
+#include "game/game_actor.h"
+#include "game/game.h"
+#include "game/game_chat.h"
+#include "game/game_persist.h"
+#include "network/ws_protocol.h"
+#include "network/ws_server.h"
+#include "utils/logger.h"
+#include "utils/timer_wheel.h"
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#define GAME_ACTOR_BATCH 32        // Số lệnh tối đa mỗi lượt, sau đó nhường game khác
+#define GAME_ACTOR_SLOW_MS 100     // Queueing delay vượt ngưỡng này thì log cảnh báo
+
+// Run queue: FIFO các game có lệnh chờ. Mỗi game nằm trong queue tối đa một
+// lần (mb_scheduled) và queue giữ một ref của game.
+static pthread_mutex_t g_run_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_run_cond = PTHREAD_COND_INITIALIZER;
+static game_session_t *g_run_head = NULL;
+static game_session_t *g_run_tail = NULL;
+
+static uint64_t g_cmd_count = 0;
+static uint64_t g_delay_total_ms = 0;
+static uint64_t g_delay_max_ms = 0;
+
+static void run_queue_push(game_session_t *game) {
+    pthread_mutex_lock(&g_run_lock);
+    game->run_next = NULL;
+    if (g_run_tail) {
+        g_run_tail->run_next = game;
+    } else {
+        g_run_head = game;
+    }
+    g_run_tail = game;
+    pthread_cond_signal(&g_run_cond);
+    pthread_mutex_unlock(&g_run_lock);
+}
+
+static game_session_t* run_queue_pop(void) {
+    pthread_mutex_lock(&g_run_lock);
+    while (!g_run_head) {
+        pthread_cond_wait(&g_run_cond, &g_run_lock);
+    }
+    game_session_t *game = g_run_head;
+    g_run_head = game->run_next;
+    if (!g_run_head) g_run_tail = NULL;
+    pthread_mutex_unlock(&g_run_lock);
+    return game;
+}
+
+// ====================== Commands ======================
+static void cmd_shot(game_session_t *game, const game_cmd_t *cmd) {
+    int row = cmd->u.shot.row;
+    int col = cmd->u.shot.col;
+
+    shot_result_t result;
+    if (!game_process_shot(game, cmd->player_id, row, col, &result)) {
+        // Không đổi lượt: chỉ báo cho người bắn, họ bắn lại
+        message_t resp = {0};
+        resp.type = MSG_AUTH_FAILED;
+        strncpy(resp.payload.auth_fail.reason, "Invalid shot (not your turn or already fired)", 63);
+        ws_send_message(cmd->client_sock, &resp);
+        return;
+    }
+
+    // ===== Response to shooter =====
+    message_t response = {0};
+    response.type = MSG_MOVE_RESULT;
+    response.payload.move_res.row = row;
+    response.payload.move_res.col = col;
+    response.payload.move_res.is_hit = result.is_hit;
+    response.payload.move_res.is_sunk = result.is_sunk;
+    response.payload.move_res.sunk_ship_type = result.sunk_ship_type;
+    response.payload.move_res.game_over = result.game_over;
+    response.payload.move_res.is_your_shot = 1;  // ✅ SHOOTER: is_your_shot = 1
+
+    game_persist_send(game, cmd->client_sock, &response);
+    log_info("✅ Sent MOVE_RESULT to shooter: hit=%d, sunk=%d, game_over=%d",
+             result.is_hit, result.is_sunk, result.game_over);
+
+    // ===== Send to opponent =====
+    int opponent_sock = (cmd->client_sock == game->player1_socket)
+                        ? game->player2_socket
+                        : game->player1_socket;
+
+    if (opponent_sock > 0) {
+        response.payload.move_res.is_your_shot = 0;  // ✅ DEFENDER: is_your_shot = 0
+        game_persist_send(game, opponent_sock, &response);
+        log_info("✅ Sent MOVE_RESULT to opponent (socket %d)", opponent_sock);
+    } else {
+        log_warn("Opponent socket not found for game %s", game->game_id);
+    }
+}
+
+// Thành công thì game_place_fleet gửi lại hạm đội; chỉ báo lỗi ở đây
+static void cmd_fleet(game_session_t *game, const game_cmd_t *cmd) {
+    const ship_t *ships = cmd->u.fleet.auto_place ? NULL : cmd->u.fleet.ships;
+
+    if (game_place_fleet(game, cmd->player_id, cmd->client_sock,
+                         ships, cmd->u.fleet.count)) {
+        return;
+    }
+
+    message_t resp = {0};
+    resp.type = MSG_AUTH_FAILED;
+    strncpy(resp.payload.auth_fail.reason, "Invalid fleet (overlap/spacing/out of bounds)", 63);
+    ws_send_message(cmd->client_sock, &resp);
+    log_warn("Failed to place fleet for player %s", cmd->player_id);
+}
+
+static void cmd_place(game_session_t *game, const game_cmd_t *cmd) {
+    const char *user_id = cmd->player_id;
+
+    bool success = game_place_ship(
+        game,
+        user_id,
+        cmd->u.place.type,
+        cmd->u.place.row,
+        cmd->u.place.col,
+        cmd->u.place.is_horizontal
+    );
+
+    message_t resp = {0};
+
+    if (success) {
+        resp.type = MSG_AUTH_SUCCESS;  // Or create MSG_PLACE_SHIP_SUCCESS
+        log_info("Ship placed successfully for player %s", user_id);
+        // START_GAME (nếu đủ hai bên) đã được game_place_ship gửi
+    } else {
+        resp.type = MSG_AUTH_FAILED;
+        strncpy(resp.payload.auth_fail.reason, "Failed to place ship (overlap/out of bounds)", 63);
+        log_warn("Failed to place ship for player %s", user_id);
+    }
+
+    ws_send_message(cmd->client_sock, &resp);
+}
+
+static void cmd_execute(game_session_t *game, const game_cmd_t *cmd) {
+    switch (cmd->type) {
+        case GAME_CMD_SHOT:
+            cmd_shot(game, cmd);
+            break;
+        case GAME_CMD_PLACE:
+            cmd_place(game, cmd);
+            break;
+        case GAME_CMD_FLEET:
+            cmd_fleet(game, cmd);
+            break;
+        case GAME_CMD_READY:
+            if (!game_set_player_ready(game, cmd->player_id, cmd->u.ready.board)) {
+                message_t resp = {0};
+                resp.type = MSG_AUTH_FAILED;
+                strncpy(resp.payload.auth_fail.reason, "Invalid fleet (overlap/spacing/out of bounds)", 63);
+                ws_send_message(cmd->client_sock, &resp);
+                log_error("Failed to set READY for player %s", cmd->player_id);
+            }
+            break;
+        case GAME_CMD_CHAT:
+            if (!game_chat_send_message(game->game_id, cmd->player_id, cmd->u.chat.text)) {
+                log_error("Failed to send chat message for user %s in game %s",
+                          cmd->player_id, game->game_id);
+            }
+            break;
+        case GAME_CMD_TURN_TIMER:
+            game_on_turn_timer(game);
+            break;
+        default:
+            log_warn("[GAME_ACTOR] Unknown command type %d", cmd->type);
+            break;
+    }
+}
+
+static void record_delay(game_session_t *game, const game_cmd_t *cmd) {
+    uint64_t now = timer_now_ms();
+    uint64_t delay = now > cmd->enqueued_ms ? now - cmd->enqueued_ms : 0;
+
+    __atomic_add_fetch(&g_cmd_count, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&g_delay_total_ms, delay, __ATOMIC_RELAXED);
+
+    uint64_t max = __atomic_load_n(&g_delay_max_ms, __ATOMIC_RELAXED);
+    while (delay > max &&
+           !__atomic_compare_exchange_n(&g_delay_max_ms, &max, delay, true,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+
+    if (delay > game->queue_delay_max_ms) game->queue_delay_max_ms = delay;
+    if (delay > GAME_ACTOR_SLOW_MS) {
+        log_warn("[GAME_ACTOR] Game %s: command %d waited %llums in queue",
+                 game->game_id, cmd->type, (unsigned long long)delay);
+    }
+}
+
+// ====================== Worker ======================
+static void* game_worker_thread(void *arg) {
+    (void)arg;
+
+    while (1) {
+        game_session_t *game = run_queue_pop();
+        bool idle = false;
+
+        for (int i = 0; i < GAME_ACTOR_BATCH; i++) {
+            pthread_mutex_lock(&game->mb_lock);
+            game_cmd_t *cmd = game->mb_head;
+            if (!cmd) {
+                // Mailbox rỗng: trả lại quyền chạy, lệnh post sau đó sẽ schedule lại
+                game->mb_scheduled = false;
+                pthread_mutex_unlock(&game->mb_lock);
+                idle = true;
+                break;
+            }
+            game->mb_head = cmd->next;
+            if (!game->mb_head) game->mb_tail = NULL;
+            pthread_mutex_unlock(&game->mb_lock);
+
+            record_delay(game, cmd);
+            pthread_mutex_lock(&game->state_lock);
+            cmd_execute(game, cmd);
+            pthread_mutex_unlock(&game->state_lock);
+            free(cmd);
+        }
+
+        if (idle) {
+            game_release(game);     // Ref của run queue
+        } else {
+            run_queue_push(game);   // Còn lệnh: xếp lại cuối hàng để công bằng
+        }
+    }
+
+    return NULL;
+}
+
+bool game_actor_start(int workers) {
+    for (int i = 0; i < workers; i++) {
+        pthread_t tid;
+        int result = pthread_create(&tid, NULL, game_worker_thread, NULL);
+        if (result != 0) {
+            log_error("[GAME_ACTOR] Failed to create worker %d: %d", i, result);
+            return false;
+        }
+        pthread_detach(tid);
+    }
+
+    log_info("[GAME_ACTOR] Started %d game worker threads", workers);
+    return true;
+}
+
+// ====================== Public API ======================
+game_cmd_t* game_cmd_new(game_cmd_type_t type, int client_sock, const char *player_id) {
+    game_cmd_t *cmd = calloc(1, sizeof(game_cmd_t));
+    if (!cmd) {
+        log_error("[GAME_ACTOR] Out of memory allocating command");
+        return NULL;
+    }
+    cmd->type = type;
+    cmd->client_sock = client_sock;
+    if (player_id) strncpy(cmd->player_id, player_id, sizeof(cmd->player_id) - 1);
+    return cmd;
+}
+
+void game_actor_post(game_session_t *game, game_cmd_t *cmd) {
+    cmd->next = NULL;
+    cmd->enqueued_ms = timer_now_ms();
+
+    pthread_mutex_lock(&game->mb_lock);
+    if (game->mb_tail) {
+        game->mb_tail->next = cmd;
+    } else {
+        game->mb_head = cmd;
+    }
+    game->mb_tail = cmd;
+    bool schedule = !game->mb_scheduled;
+    game->mb_scheduled = true;
+    pthread_mutex_unlock(&game->mb_lock);
+
+    if (schedule) {
+        game_acquire(game);
+        run_queue_push(game);
+    }
+}
+
+void game_actor_stats(uint64_t *commands, uint64_t *delay_total_ms, uint64_t *delay_max_ms) {
+    *commands = __atomic_load_n(&g_cmd_count, __ATOMIC_RELAXED);
+    *delay_total_ms = __atomic_load_n(&g_delay_total_ms, __ATOMIC_RELAXED);
+    *delay_max_ms = __atomic_load_n(&g_delay_max_ms, __ATOMIC_RELAXED);
+}
@@ -2,14 +2,18 @@
 #include "utils/logger.h"
 #include <string.h>
 #include <stdlib.h>
+#include <stdio.h>
 
 #define INDEX(row, col) ((row) * GRID_SIZE + (col))
 
+// Mask cột 0 / cột 9 / toàn bộ 100 ô, dùng khi dịch bitboard sang trái/phải
+#define BB_MAKE(hi, lo) (((bitboard_t)(hi) << 64) | (bitboard_t)(lo))
+#define BB_COL0 BB_MAKE(0x4010040ULL, 0x1004010040100401ULL)
+#define BB_COL9 BB_MAKE(0x802008020ULL, 0x802008020080200ULL)
+#define BB_FULL BB_MAKE(0xfffffffffULL, 0xffffffffffffffffULL)
+
 void board_init(board_t *board) {
-    memset(board->grid, CELL_WATER, sizeof(board->grid));
-    memset(board->ships, 0, sizeof(board->ships));
-    board->ship_count = 0;
-    board->ships_remaining = 0;
+    memset(board, 0, sizeof(*board));
 }
 
 static int get_ship_length(ship_type_t type) {
@@ -23,6 +27,61 @@ static int get_ship_length(ship_type_t type) {
     }
 }
 
+static bitboard_t ship_mask(int row, int col, int length, bool is_horizontal) {
+    bitboard_t mask = 0;
+    for (int i = 0; i < length; i++) {
+        int r = is_horizontal ? row : row + i;
+        int c = is_horizontal ? col + i : col;
+        mask |= BB_BIT(INDEX(r, c));
+    }
+    return mask;
+}
+
+// Các ô trong mask cộng 8 ô lân cận (không tràn qua mép trái/phải)
+static bitboard_t bb_dilate(bitboard_t bb) {
+    bitboard_t h = (bb | ((bb << 1) & ~BB_COL0) | ((bb >> 1) & ~BB_COL9)) & BB_FULL;
+    return (h | (h << GRID_SIZE) | (h >> GRID_SIZE)) & BB_FULL;
+}
+
+// Ô gốc (ô trên/trái) mà tàu dài length đặt được trọn trong vùng free.
+// Dịch ngang thì bỏ cột 9 mỗi bước để tàu không tràn sang hàng sau.
+static bitboard_t bb_origins(bitboard_t free, int length, bool is_horizontal) {
+    bitboard_t origins = free;
+    bitboard_t next = free;
+    for (int k = 1; k < length; k++) {
+        if (is_horizontal) {
+            next = (next >> 1) & ~BB_COL9;
+        } else {
+            next >>= GRID_SIZE;
+        }
+        origins &= next;
+    }
+    return origins;
+}
+
+// Vị trí bit bật thứ n (tính từ 0) của bb
+static int bb_select(bitboard_t bb, int n) {
+    uint64_t word = (uint64_t)bb;
+    int base = 0;
+    int low = __builtin_popcountll(word);
+    if (n >= low) {
+        word = (uint64_t)(bb >> 64);
+        n -= low;
+        base = 64;
+    }
+    while (n-- > 0) word &= word - 1;
+    return base + __builtin_ctzll(word);
+}
+
+static uint64_t xorshift64(uint64_t *state) {
+    uint64_t x = *state ? *state : 0x9E3779B97F4A7C15ULL;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    *state = x;
+    return x;
+}
+
 bool board_validate_placement(board_t *board, int row, int col, int length, bool is_horizontal) {
     // Check bounds
     if (row < 0 || row >= GRID_SIZE || col < 0 || col >= GRID_SIZE) {
@@ -43,37 +102,42 @@ bool board_validate_placement(board_t *board, int row, int col, int length, bool
         }
     }
     
-    // Check for overlapping ships
-    for (int i = 0; i < length; i++) {
-        int check_row = is_horizontal ? row : row + i;
-        int check_col = is_horizontal ? col + i : col;
-        
-        // Access 1D array using INDEX macro
-        if (board->grid[INDEX(check_row, check_col)] == CELL_SHIP) {
-            log_warn("Ship overlaps with existing ship at (%d, %d)", check_row, check_col);
-            return false;
-        }
-        
-        // Check adjacent cells (optional: enforce 1-cell spacing)
-        for (int dr = -1; dr <= 1; dr++) {
-            for (int dc = -1; dc <= 1; dc++) {
-                int adj_row = check_row + dr;
-                int adj_col = check_col + dc;
-                
-                if (adj_row >= 0 && adj_row < GRID_SIZE && 
-                    adj_col >= 0 && adj_col < GRID_SIZE) {
-                    if (board->grid[INDEX(adj_row, adj_col)] == CELL_SHIP) {
-                        log_warn("Ship too close to another ship");
-                        return false;
-                    }
-                }
-            }
-        }
+    // Chồng lên hoặc sát cạnh tàu khác (bắt buộc cách 1 ô): một phép AND
+    bitboard_t mask = ship_mask(row, col, length, is_horizontal);
+    if (mask & board->ship_bits) {
+        log_warn("Ship overlaps with existing ship at (%d, %d)", row, col);
+        return false;
+    }
+    if (mask & bb_dilate(board->ship_bits)) {
+        log_warn("Ship too close to another ship");
+        return false;
     }
     
     return true;
 }
 
+// Thêm tàu không kiểm tra khoảng cách (dữ liệu đã được validate từ trước)
+bool board_add_ship(board_t *board, ship_type_t type, int row, int col, bool is_horizontal) {
+    int length = get_ship_length(type);
+    if (board->ship_count >= MAX_SHIPS || length == 0 ||
+        row < 0 || col < 0 ||
+        (is_horizontal ? col + length : col + 1) > GRID_SIZE ||
+        (is_horizontal ? row + 1 : row + length) > GRID_SIZE) {
+        return false;
+    }
+
+    ship_t *ship = &board->ships[board->ship_count];
+    ship->type = type;
+    ship->start_row = row;
+    ship->start_col = col;
+    ship->is_horizontal = is_horizontal;
+    ship->mask = ship_mask(row, col, length, is_horizontal);
+
+    board->ship_bits |= ship->mask;
+    board->ship_count++;
+    return true;
+}
+
 bool board_place_ship(board_t *board, ship_type_t type, int row, int col, bool is_horizontal) {
     if (board->ship_count >= MAX_SHIPS) {
         log_warn("Maximum ships already placed");
@@ -97,23 +161,7 @@ bool board_place_ship(board_t *board, ship_type_t type, int row, int col, bool i
         return false;
     }
     
-    ship_t *ship = &board->ships[board->ship_count];
-    ship->type = type;
-    ship->start_row = row;
-    ship->start_col = col;
-    ship->is_horizontal = is_horizontal;
-    ship->hits = 0;
-    ship->is_sunk = false;
-    
-    for (int i = 0; i < length; i++) {
-        int r = is_horizontal ? row : row + i;
-        int c = is_horizontal ? col + i : col;
-        
-        board->grid[INDEX(r, c)] = CELL_SHIP; 
-    }
-    
-    board->ship_count++;
-    board->ships_remaining++;
+    board_add_ship(board, type, row, col, is_horizontal);
     
     log_info("Ship placed: type=%d, len=%d, pos=(%d,%d)", type, length, row, col);
     return true;
@@ -124,22 +172,169 @@ bool board_is_valid_shot(board_t *board, int row, int col) {
         return false;
     }
 
-    cell_state_t cell = board->grid[INDEX(row, col)];
-    return (cell != CELL_HIT && cell != CELL_MISS);
+    return ((board->hit_bits | board->miss_bits) & BB_BIT(INDEX(row, col))) == 0;
 }
 
-ship_t* board_get_ship_at(board_t *board, int row, int col) {
+cell_state_t board_cell(const board_t *board, int index) {
+    bitboard_t bit = BB_BIT(index);
+    if (board->hit_bits & bit) return CELL_HIT;
+    if (board->miss_bits & bit) return CELL_MISS;
+    if (board->ship_bits & bit) return CELL_SHIP;
+    return CELL_WATER;
+}
+
+// Chỉ nạp trạng thái bắn; ô tàu đến từ danh sách tàu (board_add_ship)
+void board_set_cell(board_t *board, int index, cell_state_t state) {
+    if (index < 0 || index >= BOARD_SIZE) return;
+
+    bitboard_t bit = BB_BIT(index);
+    board->hit_bits &= ~bit;
+    board->miss_bits &= ~bit;
+    if (state == CELL_HIT) board->hit_bits |= bit;
+    else if (state == CELL_MISS) board->miss_bits |= bit;
+}
+
+int board_load_layout(board_t *board, const uint8_t cells[BOARD_SIZE]) {
+    board_init(board);
+    bitboard_t visited = 0;
+
+    for (int row = 0; row < GRID_SIZE; row++) {
+        for (int col = 0; col < GRID_SIZE; col++) {
+            int index = INDEX(row, col);
+            int ship_size = cells[index];
+            if (ship_size == 0 || (visited & BB_BIT(index))) continue;
+
+            // Thử ngang trước, rồi dọc
+            int horizontal = 0, vertical = 0;
+            while (horizontal < ship_size && col + horizontal < GRID_SIZE &&
+                   cells[INDEX(row, col + horizontal)] == ship_size) horizontal++;
+            while (vertical < ship_size && row + vertical < GRID_SIZE &&
+                   cells[INDEX(row + vertical, col)] == ship_size) vertical++;
+
+            bool is_horizontal = horizontal == ship_size;
+            if (!is_horizontal && vertical != ship_size) {
+                log_warn("Incomplete ship of size %d at (%d,%d)", ship_size, row, col);
+                visited |= BB_BIT(index);
+                continue;
+            }
+
+            // Độ dài tàu trùng với giá trị ship_type_t
+            if (!board_add_ship(board, (ship_type_t)ship_size, row, col, is_horizontal)) {
+                log_warn("Cannot add ship of size %d at (%d,%d)", ship_size, row, col);
+                visited |= BB_BIT(index);
+                continue;
+            }
+            visited |= board->ships[board->ship_count - 1].mask;
+        }
+    }
+
+    return board->ship_count;
+}
+
+void board_to_layout(const board_t *board, uint8_t cells[BOARD_SIZE]) {
+    memset(cells, 0, BOARD_SIZE);
     for (int i = 0; i < board->ship_count; i++) {
-        ship_t *ship = &board->ships[i];
+        bitboard_t mask = board->ships[i].mask;
+        while (mask) {
+            int index = bb_select(mask, 0);
+            cells[index] = (uint8_t)board->ships[i].type;
+            mask &= mask - 1;
+        }
+    }
+}
+
+bool board_place_fleet(board_t *board, const ship_t *ships, int count) {
+    if (count != MAX_SHIPS) {
+        log_warn("Fleet must have %d ships, got %d", MAX_SHIPS, count);
+        return false;
+    }
+
+    board_t fleet;
+    board_init(&fleet);
+    unsigned seen = 0;
+    bitboard_t halo = 0;           // Ô tàu cộng vùng đệm 1 ô quanh các tàu đã đặt
+
+    for (int i = 0; i < count; i++) {
+        const ship_t *ship = &ships[i];
         int length = get_ship_length(ship->type);
-        
-        for (int j = 0; j < length; j++) {
-            int ship_row = ship->is_horizontal ? ship->start_row : ship->start_row + j;
-            int ship_col = ship->is_horizontal ? ship->start_col + j : ship->start_col;
-            
-            if (ship_row == row && ship_col == col) {
-                return ship;
-            }
+        if (length == 0 || (seen & (1u << length))) {
+            log_warn("Invalid or duplicate ship type %d in fleet", ship->type);
+            return false;
+        }
+        seen |= 1u << length;
+
+        if (!board_add_ship(&fleet, ship->type, ship->start_row, ship->start_col,
+                            ship->is_horizontal)) {
+            log_warn("Fleet ship %d out of bounds at (%d,%d)",
+                     ship->type, ship->start_row, ship->start_col);
+            return false;
+        }
+
+        bitboard_t mask = fleet.ships[i].mask;
+        if (mask & halo) {
+            log_warn("Fleet ship %d overlaps or touches another ship at (%d,%d)",
+                     ship->type, ship->start_row, ship->start_col);
+            return false;
+        }
+        halo |= bb_dilate(mask);
+    }
+
+    *board = fleet;
+    return true;
+}
+
+// Đặt từ tàu lớn tới nhỏ; mỗi tàu chọn đều ngẫu nhiên trong mọi (ô gốc, hướng)
+// còn hợp lệ, nên không bao giờ phải thử lại từng vị trí. Hiếm khi tàu nhỏ
+// hết chỗ thì làm lại cả hạm đội.
+#define BOARD_AUTO_PLACE_ATTEMPTS 16
+
+bool board_auto_place(board_t *board, uint64_t *seed) {
+    static const ship_type_t fleet_types[MAX_SHIPS] = {
+        SHIP_CARRIER, SHIP_BATTLESHIP, SHIP_DESTROYER, SHIP_SUBMARINE, SHIP_PATROL
+    };
+
+    for (int attempt = 0; attempt < BOARD_AUTO_PLACE_ATTEMPTS; attempt++) {
+        board_t fleet;
+        board_init(&fleet);
+        bitboard_t blocked = 0;
+        int placed = 0;
+
+        for (; placed < MAX_SHIPS; placed++) {
+            int length = get_ship_length(fleet_types[placed]);
+            bitboard_t free = ~blocked & BB_FULL;
+            bitboard_t horizontal = bb_origins(free, length, true);
+            // Tàu 1 ô: hai hướng trùng nhau, chỉ tính một lần
+            bitboard_t vertical = length > 1 ? bb_origins(free, length, false) : 0;
+
+            int h_count = bb_popcount(horizontal);
+            int total = h_count + bb_popcount(vertical);
+            if (total == 0) break;
+
+            int pick = (int)(xorshift64(seed) % (uint64_t)total);
+            bool is_horizontal = pick < h_count;
+            int index = is_horizontal ? bb_select(horizontal, pick)
+                                      : bb_select(vertical, pick - h_count);
+
+            board_add_ship(&fleet, fleet_types[placed], index / GRID_SIZE, index % GRID_SIZE,
+                           is_horizontal);
+            blocked |= bb_dilate(fleet.ships[placed].mask);
+        }
+
+        if (placed == MAX_SHIPS) {
+            *board = fleet;
+            return true;
+        }
+    }
+
+    log_warn("Auto placement failed after %d attempts", BOARD_AUTO_PLACE_ATTEMPTS);
+    return false;
+}
+
+ship_t* board_get_ship_at(board_t *board, int row, int col) {
+    bitboard_t bit = BB_BIT(INDEX(row, col));
+    for (int i = 0; i < board->ship_count; i++) {
+        if (board->ships[i].mask & bit) {
+            return &board->ships[i];
         }
     }
     
@@ -149,74 +344,43 @@ ship_t* board_get_ship_at(board_t *board, int row, int col) {
 shot_result_t board_process_shot(board_t *board, int row, int col) {
     shot_result_t result = {false, false, 0, false};
     
-    // DEBUG: Log input
-    log_info("=== board_process_shot DEBUG ===");
-    log_info("Shooting at (%d, %d)", row, col);
-    log_info("Board ship_count: %d", board->ship_count);
-    log_info("Board ships_remaining: %d", board->ships_remaining);
+    log_debug("Shooting at (%d, %d), ship_count=%d", row, col, board->ship_count);
     
     if (!board_is_valid_shot(board, row, col)) {
         log_warn("Invalid shot at (%d, %d)", row, col);
         return result;
     }
     
-    // Check CELL STATE
-    cell_state_t cell = board->grid[INDEX(row, col)];
-    log_info("Cell value at (%d,%d): %d (0=WATER, 1=SHIP, 2=HIT, 3=MISS)", 
-             row, col, cell);
+    bitboard_t bit = BB_BIT(INDEX(row, col));
     
-    // Nếu ô đó là tàu (CELL_SHIP hoặc ID tàu > 0)
-    if (cell == CELL_SHIP) {
-        log_info("✅ Cell is SHIP, processing HIT...");
-        
+    if (board->ship_bits & bit) {
         // 1. Đánh dấu ô đó đã bị bắn trúng
-        board->grid[INDEX(row, col)] = CELL_HIT;
+        board->hit_bits |= bit;
         result.is_hit = true;
         
         // 2. Tìm xem bắn trúng tàu nào
         ship_t *ship = board_get_ship_at(board, row, col);
         if (ship) {
-            log_info("Found ship: type=%d, pos=(%d,%d), hits=%d",
-                     ship->type, ship->start_row, ship->start_col, ship->hits);
-            
-            ship->hits++;
-            
-            // So sánh với ĐỘ DÀI thật của tàu
-            int max_health = get_ship_length(ship->type);
-            
-            log_info("Ship Hit! Current HP: %d/%d", ship->hits, max_health);
-
-            if (ship->hits >= max_health) {
-                ship->is_sunk = true;
+            // Chìm khi mọi ô của tàu đều đã trúng
+            if ((ship->mask & ~board->hit_bits) == 0) {
                 result.is_sunk = true;
                 result.sunk_ship_type = (int)ship->type;
-                board->ships_remaining--;
-                
                 log_info("Ship SUNK! Type=%s", ship_type_to_string(ship->type));
                 
-                if (board->ships_remaining == 0) {
+                // Game over khi không còn ô tàu nào chưa trúng
+                if ((board->ship_bits & ~board->hit_bits) == 0) {
                     result.game_over = true;
                     log_info("GAME OVER! All ships destroyed");
                 }
             }
         } else {
-            log_error("❌ Ghost Ship detected at (%d, %d)! Grid says SHIP but no ship struct found.", 
+            log_error("❌ Ghost Ship detected at (%d, %d)! Bitboard says SHIP but no ship mask found.", 
                      row, col);
-            
-            log_info("=== ALL SHIPS DUMP ===");
-            for (int i = 0; i < board->ship_count; i++) {
-                ship_t *s = &board->ships[i];
-                log_info("Ship %d: type=%d, pos=(%d,%d), horizontal=%d, hits=%d, sunk=%d",
-                         i, s->type, s->start_row, s->start_col,
-                         s->is_horizontal, s->hits, s->is_sunk);
-            }
         }
     } else {
-        log_info("❌ Cell is NOT SHIP (value=%d), marking as MISS", cell);
-        
-        board->grid[INDEX(row, col)] = CELL_MISS;
+        board->miss_bits |= bit;
         result.is_hit = false;
-        log_info("MISS at (%d, %d)", row, col);
+        log_debug("MISS at (%d, %d)", row, col);
     }
     
     return result;
@@ -236,7 +400,7 @@ const char* ship_type_to_string(ship_type_t type) {
 void board_debug_print(board_t *board, const char *label) {
     log_info("=== BOARD DEBUG: %s ===", label);
     log_info("Ship count: %d, Ships remaining: %d", 
-             board->ship_count, board->ships_remaining);
+             board->ship_count, board_ships_remaining(board));
     
     // Print grid
     log_info("Grid (0=WATER, 1=SHIP, 2=HIT, 3=MISS):");
@@ -248,7 +412,7 @@ void board_debug_print(board_t *board, const char *label) {
         
         for (int x = 0; x < 10; x++) {
             char cell[5];
-            snprintf(cell, sizeof(cell), "%2d ", board->grid[y * 10 + x]);
+            snprintf(cell, sizeof(cell), "%2d ", board_cell(board, y * 10 + x));
             strcat(row_str, cell);
         }
         log_info("%s", row_str);
@@ -262,6 +426,73 @@ void board_debug_print(board_t *board, const char *label) {
         log_info("  Ship %d: type=%d (%s), pos=(%d,%d), horizontal=%d, hits=%d/%d, sunk=%d",
                  i, ship->type, ship_type_to_string(ship->type),
                  ship->start_row, ship->start_col, ship->is_horizontal,
-                 ship->hits, ship_len, ship->is_sunk);
+                 board_ship_hits(board, i), ship_len, board_ship_is_sunk(board, i));
+    }
+}
+// ==================== Packed format ====================
+static uint8_t* bb_store(uint8_t *p, bitboard_t bb) {
+    for (int i = 0; i < BOARD_BITS_BYTES; i++) {
+        *p++ = (uint8_t)(bb >> (8 * i));
+    }
+    return p;
+}
+
+static bitboard_t bb_load(const uint8_t *p) {
+    bitboard_t bb = 0;
+    for (int i = BOARD_BITS_BYTES - 1; i >= 0; i--) {
+        bb = (bb << 8) | p[i];
+    }
+    return bb;
+}
+
+size_t board_pack(const board_t *board, uint8_t out[BOARD_PACKED_MAX]) {
+    uint8_t *p = out;
+
+    *p++ = BOARD_PACKED_VERSION;
+    *p++ = (uint8_t)board->ship_count;
+    for (int i = 0; i < board->ship_count; i++) {
+        const ship_t *ship = &board->ships[i];
+        *p++ = (uint8_t)(ship->type | (ship->is_horizontal ? 0x08 : 0));
+        *p++ = (uint8_t)INDEX(ship->start_row, ship->start_col);
+    }
+    p = bb_store(p, board->hit_bits);
+    p = bb_store(p, board->miss_bits);
+
+    return (size_t)(p - out);
+}
+
+// Kiểm tra kỹ vì dữ liệu đến từ DB: tàu hợp lệ, hit chỉ trên tàu, miss chỉ trên nước
+bool board_unpack(board_t *board, const uint8_t *data, size_t len) {
+    board_init(board);
+    if (len < 2 || data[0] != BOARD_PACKED_VERSION || data[1] > MAX_SHIPS) return false;
+
+    int ship_count = data[1];
+    if (len != (size_t)(2 + ship_count * 2 + 2 * BOARD_BITS_BYTES)) return false;
+
+    const uint8_t *p = data + 2;
+    for (int i = 0; i < ship_count; i++, p += 2) {
+        ship_type_t type = (ship_type_t)(p[0] & 0x07);
+        bool is_horizontal = (p[0] & 0x08) != 0;
+        if (p[1] >= BOARD_SIZE ||
+            !board_add_ship(board, type, p[1] / GRID_SIZE, p[1] % GRID_SIZE, is_horizontal)) {
+            board_init(board);
+            return false;
+        }
     }
-}
\ No newline at end of file
+
+    // Tàu chồng nhau thì ship_bits ít ô hơn tổng các mask
+    int cells = 0;
+    for (int i = 0; i < board->ship_count; i++) {
+        cells += bb_popcount(board->ships[i].mask);
+    }
+
+    board->hit_bits = bb_load(p);
+    board->miss_bits = bb_load(p + BOARD_BITS_BYTES);
+    if (cells != bb_popcount(board->ship_bits) ||
+        (board->hit_bits & ~board->ship_bits) || (board->miss_bits & board->ship_bits) ||
+        ((board->hit_bits | board->miss_bits) & ~BB_FULL)) {
+        board_init(board);
+        return false;
+    }
+    return true;
+}
@@ -67,6 +67,7 @@ bool game_chat_send_message(const char *game_id, const char *sender_id, const ch
     user_t *sender = user_find_by_id(sender_id);
     if (!sender) {
         log_error("Sender not found: %s", sender_id);
+        game_release(game);
         return false;
     }
     
@@ -116,6 +117,7 @@ bool game_chat_send_message(const char *game_id, const char *sender_id, const ch
     }
     
     user_free(sender);
+    game_release(game);
     
     if (!sent) {
         log_warn("No active sockets to send chat message");
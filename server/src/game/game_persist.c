@@ -0,0 +1,424 @@
+#include "game/game_persist.h"
+#include "game/game_wal.h"
+#include "game/game_board.h"
+#include "database/mongo.h"
+#include "network/ws_protocol.h"
+#include "utils/logger.h"
+#include "utils/timer_wheel.h"
+#include "config.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+
+// Message giữ lại tới khi flush xong (chỉ copy phần payload thật sự dùng)
+typedef struct game_persist_msg {
+    struct game_persist_msg *next;
+    int sock;
+    size_t len;
+    uint8_t data[];
+} game_persist_msg_t;
+
+// Vị trí sync trước khi chụp snapshot, để khôi phục nếu ghi lỗi
+typedef struct {
+    uint32_t dirty;
+    uint32_t moves_synced;
+    move_log_iter_t moves_sync_it;
+} game_sync_point_t;
+
+typedef struct {
+    game_session_t *game;
+    bson_t *update;                // NULL: không có gì để ghi
+    game_sync_point_t prev;
+    game_persist_msg_t *waiters;
+    bool skipped;                  // Game đang bận (state_lock), để lượt sau
+    uint32_t wal_pin;              // Segment WAL được nhả khi ghi thành công
+} game_flush_item_t;
+
+static pthread_mutex_t g_persist_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_persist_cond;
+static game_session_t *g_persist_head = NULL;
+static game_session_t *g_persist_tail = NULL;
+static int g_persist_count = 0;
+static game_durability_t g_durability = GAME_DURABILITY_IMMEDIATE;
+static int g_flush_ms = 50;
+
+static game_persist_stats_t g_stats;
+
+// ==================== Helper: Serialize board to BSON ====================
+void board_to_bson(bson_t *parent, const char *key, const board_t *board) {
+    uint8_t packed[BOARD_PACKED_MAX];
+    size_t len = board_pack(board, packed);
+    BSON_APPEND_BINARY(parent, key, BSON_SUBTYPE_USER, packed, (uint32_t)len);
+}
+
+static const char* game_state_to_string(game_state_t state) {
+    switch (state) {
+        case GAME_STATE_PLACING_SHIPS: return "placing_ships";
+        case GAME_STATE_PLAYING: return "playing";
+        case GAME_STATE_FINISHED: return "finished";
+        default: return "unknown";
+    }
+}
+
+// Mỗi move một document nhỏ (ghi theo index để retry không bị trùng)
+static void move_to_bson(bson_t *parent, const char *key, const move_t *move) {
+    bson_t doc;
+    
+    BSON_APPEND_DOCUMENT_BEGIN(parent, key, &doc);
+    BSON_APPEND_INT32(&doc, "by", move->shooter);
+    BSON_APPEND_INT32(&doc, "cell", move->row * GRID_SIZE + move->col);
+    BSON_APPEND_BOOL(&doc, "hit", move->is_hit);
+    if (move->is_sunk) BSON_APPEND_INT32(&doc, "sunk", move->sunk_ship_type);
+    if (move->game_over) BSON_APPEND_BOOL(&doc, "over", true);
+    BSON_APPEND_DATE_TIME(&doc, "at", (int64_t)move->timestamp_ms);
+    bson_append_document_end(parent, &doc);
+}
+
+// Chụp delta của game thành một update document (gọi khi giữ state_lock).
+// Dirty flag và con trỏ moves được chuyển giao ngay; ghi lỗi thì
+// game_restore_sync_point trả lại. NULL nếu không có gì thay đổi.
+static bson_t* game_build_update(game_session_t *game, game_sync_point_t *prev) {
+    uint32_t pending = game->moves.count - game->moves_synced;
+    if (!game->dirty && pending == 0) return NULL;
+    
+    // Board nén chỉ vài chục byte: cú bắn ghi lại cả board bị bắn. Nhiều move
+    // dồn lại (lần ghi trước lỗi) thì ghi lại cả hai board và cả mảng moves.
+    move_log_iter_t it = game->moves_sync_it;
+    move_t move;
+    if (pending > 1) {
+        game->dirty |= GAME_DIRTY_BOARD1 | GAME_DIRTY_BOARD2 | GAME_DIRTY_MOVES;
+    } else if (pending == 1) {
+        move_log_iter_t peek = it;
+        if (move_log_next(&peek, &move)) {
+            game->dirty |= move.shooter ? GAME_DIRTY_BOARD1 : GAME_DIRTY_BOARD2;
+        }
+    }
+    
+    prev->dirty = game->dirty;
+    prev->moves_synced = game->moves_synced;
+    prev->moves_sync_it = game->moves_sync_it;
+    
+    bson_t *update = bson_new();
+    bson_t set_doc;
+    BSON_APPEND_DOCUMENT_BEGIN(update, "$set", &set_doc);
+    
+    if (game->dirty & GAME_DIRTY_STATE)
+        BSON_APPEND_UTF8(&set_doc, "phase", game_state_to_string(game->state));
+    if (game->dirty & GAME_DIRTY_TURN)
+        BSON_APPEND_UTF8(&set_doc, "current_turn", game->current_turn);
+    if (game->dirty & GAME_DIRTY_READY) {
+        BSON_APPEND_BOOL(&set_doc, "player1_ready", game->player1_ready);
+        BSON_APPEND_BOOL(&set_doc, "player2_ready", game->player2_ready);
+    }
+    if (game->dirty & GAME_DIRTY_WINNER) {
+        BSON_APPEND_UTF8(&set_doc, "winner_id", game->winner_id);
+        bson_append_date_time(&set_doc, "finished_at", -1, game->finished_at);
+    }
+    
+    // Boards
+    if (game->dirty & GAME_DIRTY_BOARD1)
+        board_to_bson(&set_doc, "player1_board", &game->player1_board);
+    if (game->dirty & GAME_DIRTY_BOARD2)
+        board_to_bson(&set_doc, "player2_board", &game->player2_board);
+    
+    // Moves chưa ghi
+    if (game->dirty & GAME_DIRTY_MOVES) {
+        bson_t moves_array;
+        BSON_APPEND_ARRAY_BEGIN(&set_doc, "moves", &moves_array);
+        move_log_iter_init(&it, &game->moves);
+        for (uint32_t i = 0; move_log_next(&it, &move); i++) {
+            char key[16];
+            snprintf(key, sizeof(key), "%u", i);
+            move_to_bson(&moves_array, key, &move);
+        }
+        bson_append_array_end(&set_doc, &moves_array);
+    } else if (pending == 1 && move_log_next(&it, &move)) {
+        // "moves.<n>": đúng vị trí, ghi lại lần nữa cũng không sinh bản trùng
+        char key[32];
+        snprintf(key, sizeof(key), "moves.%u", game->moves_synced);
+        move_to_bson(&set_doc, key, &move);
+    }
+    
+    bson_append_date_time(&set_doc, "updated_at", -1, (int64_t)time(NULL) * 1000);
+    bson_append_document_end(update, &set_doc);
+    
+    // it đang đứng sau move cuối vừa chụp
+    game->dirty = 0;
+    game->moves_synced = game->moves.count;
+    game->moves_sync_it = it;
+    return update;
+}
+
+static void game_restore_sync_point(game_session_t *game, const game_sync_point_t *prev) {
+    game->dirty |= prev->dirty;
+    game->moves_synced = prev->moves_synced;
+    game->moves_sync_it = prev->moves_sync_it;
+}
+
+// ====================== Deferred replies ======================
+static void persist_send_waiters(game_persist_msg_t *w) {
+    message_t msg = {0};
+    while (w) {
+        game_persist_msg_t *next = w->next;
+        memcpy(&msg, w->data, w->len);
+        ws_send_message(w->sock, &msg);
+        free(w);
+        w = next;
+    }
+}
+
+void game_persist_send(game_session_t *game, int sock, message_t *msg) {
+    if (g_durability == GAME_DURABILITY_IMMEDIATE || sock <= 0) {
+        ws_send_message(sock, msg);
+        return;
+    }
+
+    size_t len = offsetof(message_t, payload) + ws_payload_size(msg->type);
+    if (len > sizeof(message_t)) len = sizeof(message_t);
+
+    game_persist_msg_t *w = malloc(sizeof(game_persist_msg_t) + len);
+    if (!w) {
+        ws_send_message(sock, msg);
+        return;
+    }
+    w->next = NULL;
+    w->sock = sock;
+    w->len = len;
+    memcpy(w->data, msg, len);
+
+    game_persist_msg_t **pp = &game->persist_waiters;
+    while (*pp) pp = &(*pp)->next;
+    *pp = w;
+
+    game_persist_schedule(game);
+}
+
+// ====================== Queue ======================
+void game_persist_schedule(game_session_t *game) {
+    pthread_mutex_lock(&g_persist_lock);
+    if (!game->persist_queued) {
+        game->persist_queued = true;
+        game_acquire(game);               // Hàng đợi giữ một ref tới khi flush xong
+
+        game->persist_next = NULL;
+        if (g_persist_tail) {
+            g_persist_tail->persist_next = game;
+        } else {
+            g_persist_head = game;
+        }
+        g_persist_tail = game;
+
+        g_persist_count++;
+        g_stats.queue_depth = (uint64_t)g_persist_count;
+        if (g_stats.queue_depth > g_stats.queue_peak) g_stats.queue_peak = g_stats.queue_depth;
+
+        // Game đầu tiên mở cửa sổ gom; đủ batch thì flush ngay
+        if (g_persist_count == 1 || g_persist_count >= GAME_PERSIST_BATCH) {
+            pthread_cond_signal(&g_persist_cond);
+        }
+    }
+    pthread_mutex_unlock(&g_persist_lock);
+}
+
+// ====================== Flush ======================
+static bool persist_bulk_write(game_flush_item_t *items, int n) {
+    mongoc_client_t *client = mongo_get_client(g_mongo_ctx);
+    if (!client) return false;
+
+    mongoc_collection_t *collection = mongo_get_collection(client, COLLECTION_GAMES);
+    if (!collection) {
+        mongo_release_client(g_mongo_ctx, client);
+        return false;
+    }
+
+    // Unordered: các game độc lập nhau, server có thể ghi song song
+    bson_t *opts = bson_new();
+    BSON_APPEND_BOOL(opts, "ordered", false);
+    mongoc_bulk_operation_t *bulk = mongoc_collection_create_bulk_operation_with_opts(collection, opts);
+
+    bson_error_t error;
+    bool success = true;
+    for (int i = 0; i < n && success; i++) {
+        if (!items[i].update) continue;
+
+        bson_t *selector = bson_new();
+        bson_oid_t oid;
+        bson_oid_init_from_string(&oid, items[i].game->game_id);
+        BSON_APPEND_OID(selector, "_id", &oid);
+
+        if (!mongoc_bulk_operation_update_one_with_opts(bulk, selector, items[i].update, NULL, &error)) {
+            log_error("[PERSIST] Failed to queue update for game %s: %s",
+                      items[i].game->game_id, error.message);
+            success = false;
+        }
+        bson_destroy(selector);
+    }
+
+    if (success) {
+        bson_t reply;
+        success = mongoc_bulk_operation_execute(bulk, &reply, &error) != 0;
+        if (!success) {
+            log_error("[PERSIST] Bulk write failed: %s", error.message);
+        }
+        bson_destroy(&reply);
+    }
+
+    mongoc_bulk_operation_destroy(bulk);
+    bson_destroy(opts);
+    mongoc_collection_destroy(collection);
+    mongo_release_client(g_mongo_ctx, client);
+
+    return success;
+}
+
+static void persist_flush(game_flush_item_t *items, int n) {
+    uint64_t start = timer_now_ms();
+    int writes = 0;
+
+    // Chụp delta của từng game. Game đang chạy lệnh (worker giữ state_lock,
+    // có thể đang chờ Mongo) thì để lượt sau, không chặn cả batch.
+    for (int i = 0; i < n; i++) {
+        game_session_t *game = items[i].game;
+        items[i].update = NULL;
+        items[i].waiters = NULL;
+        items[i].wal_pin = 0;
+        items[i].skipped = pthread_mutex_trylock(&game->state_lock) != 0;
+        if (items[i].skipped) continue;
+
+        items[i].update = game_build_update(game, &items[i].prev);
+        items[i].waiters = game->persist_waiters;
+        game->persist_waiters = NULL;
+        // Record WAL tới thời điểm này nằm trong update vừa chụp
+        items[i].wal_pin = game->wal_pin;
+        game->wal_pin = 0;
+        pthread_mutex_unlock(&game->state_lock);
+
+        if (items[i].update) writes++;
+    }
+
+    bool ok = writes == 0 || persist_bulk_write(items, n);
+    uint64_t elapsed = timer_now_ms() - start;
+
+    for (int i = 0; i < n; i++) {
+        game_session_t *game = items[i].game;
+        if (items[i].update) {
+            bson_destroy(items[i].update);
+
+            if (ok) {
+                game_wal_unpin(items[i].wal_pin);
+            } else {
+                // Trả lại dirty + reply đang chờ (trước reply mới hơn), flush lại sau
+                uint32_t newer_pin = 0;
+                pthread_mutex_lock(&game->state_lock);
+                game_restore_sync_point(game, &items[i].prev);
+                if (items[i].wal_pin) {
+                    newer_pin = game->wal_pin;
+                    game->wal_pin = items[i].wal_pin;
+                }
+                if (items[i].waiters) {
+                    game_persist_msg_t *last = items[i].waiters;
+                    while (last->next) last = last->next;
+                    last->next = game->persist_waiters;
+                    game->persist_waiters = items[i].waiters;
+                    items[i].waiters = NULL;
+                }
+                pthread_mutex_unlock(&game->state_lock);
+                game_wal_unpin(newer_pin);
+                game_persist_schedule(game);
+            }
+        } else if (items[i].skipped) {
+            game_persist_schedule(game);
+        } else {
+            game_wal_unpin(items[i].wal_pin);   // Không có gì để ghi
+        }
+
+        persist_send_waiters(items[i].waiters);
+        game_release(game);
+    }
+
+    if (writes > 0) {
+        pthread_mutex_lock(&g_persist_lock);
+        g_stats.flushes++;
+        g_stats.flush_total_ms += elapsed;
+        if (elapsed > g_stats.flush_max_ms) g_stats.flush_max_ms = elapsed;
+        if (ok) {
+            g_stats.games_written += (uint64_t)writes;
+        } else {
+            g_stats.failures++;
+        }
+        pthread_mutex_unlock(&g_persist_lock);
+    }
+}
+
+static void* persist_thread(void *arg) {
+    (void)arg;
+    game_flush_item_t items[GAME_PERSIST_BATCH];
+
+    while (1) {
+        pthread_mutex_lock(&g_persist_lock);
+        while (!g_persist_head) {
+            pthread_cond_wait(&g_persist_cond, &g_persist_lock);
+        }
+
+        // Group commit: gom thêm trong g_flush_ms, trừ khi đã đủ một batch
+        struct timespec deadline;
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_nsec += (long)g_flush_ms * 1000000L;
+        deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+        deadline.tv_nsec %= 1000000000L;
+        while (g_persist_count < GAME_PERSIST_BATCH) {
+            if (pthread_cond_timedwait(&g_persist_cond, &g_persist_lock, &deadline) == ETIMEDOUT) break;
+        }
+
+        int n = 0;
+        while (g_persist_head && n < GAME_PERSIST_BATCH) {
+            game_session_t *game = g_persist_head;
+            g_persist_head = game->persist_next;
+            if (!g_persist_head) g_persist_tail = NULL;
+            game->persist_queued = false;
+            g_persist_count--;
+            items[n++].game = game;
+        }
+        g_stats.queue_depth = (uint64_t)g_persist_count;
+        pthread_mutex_unlock(&g_persist_lock);
+
+        persist_flush(items, n);
+    }
+
+    return NULL;
+}
+
+// ====================== Public API ======================
+bool game_persist_start(void) {
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&g_persist_cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    g_durability = get_game_durability_persist() ? GAME_DURABILITY_PERSIST
+                                                 : GAME_DURABILITY_IMMEDIATE;
+    g_flush_ms = get_game_flush_ms();
+
+    pthread_t tid;
+    int result = pthread_create(&tid, NULL, persist_thread, NULL);
+    if (result != 0) {
+        log_error("[PERSIST] Failed to create thread: %d", result);
+        return false;
+    }
+    pthread_detach(tid);
+
+    log_info("[PERSIST] Write-behind started (flush=%dms, batch=%d, ack=%s)",
+             g_flush_ms, GAME_PERSIST_BATCH,
+             g_durability == GAME_DURABILITY_PERSIST ? "after-persist" : "immediate");
+    return true;
+}
+
+void game_persist_stats(game_persist_stats_t *out) {
+    pthread_mutex_lock(&g_persist_lock);
+    *out = g_stats;
+    pthread_mutex_unlock(&g_persist_lock);
+}
@@ -0,0 +1,266 @@
+#include "game/game_registry.h"
+#include "utils/logger.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#define GAME_REGISTRY_SHARDS 64           // Lũy thừa của 2
+#define GAME_REGISTRY_INITIAL_BUCKETS 16  // Mỗi shard, lũy thừa của 2
+
+// player_id → game. Link không giữ ref: nó luôn bị gỡ (dưới lock) trước khi
+// registry nhả ref của game.
+typedef struct player_link {
+    char player_id[64];
+    game_session_t *game;
+    struct player_link *next;
+} player_link_t;
+
+// Chaining: game nối qua game->reg_next, player qua link->next.
+// Bucket array nhân đôi khi số phần tử vượt số bucket.
+typedef struct {
+    pthread_rwlock_t lock;
+    size_t mask;
+    size_t count;
+    void **buckets;
+} registry_shard_t;
+
+static registry_shard_t g_game_shards[GAME_REGISTRY_SHARDS];
+static registry_shard_t g_player_shards[GAME_REGISTRY_SHARDS];
+static size_t g_total = 0;
+
+static uint64_t hash_key(const char *s) {
+    uint64_t h = 1469598103934665603ULL;  // FNV-1a
+    while (*s) {
+        h ^= (unsigned char)*s++;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+static registry_shard_t* shard_for(registry_shard_t *shards, uint64_t h) {
+    // Bit cao chọn shard, bit thấp chọn bucket
+    return &shards[(h >> 58) & (GAME_REGISTRY_SHARDS - 1)];
+}
+
+static bool shard_init(registry_shard_t *shard) {
+    pthread_rwlock_init(&shard->lock, NULL);
+    shard->mask = GAME_REGISTRY_INITIAL_BUCKETS - 1;
+    shard->count = 0;
+    shard->buckets = calloc(GAME_REGISTRY_INITIAL_BUCKETS, sizeof(void*));
+    return shard->buckets != NULL;
+}
+
+bool game_registry_init(void) {
+    for (int i = 0; i < GAME_REGISTRY_SHARDS; i++) {
+        if (!shard_init(&g_game_shards[i]) || !shard_init(&g_player_shards[i])) {
+            log_error("Failed to allocate game registry");
+            return false;
+        }
+    }
+
+    log_info("Game registry initialized (%d shards)", GAME_REGISTRY_SHARDS);
+    return true;
+}
+
+// ====================== Game index (gọi khi giữ lock) ======================
+static game_session_t** game_slot(registry_shard_t *shard, const char *game_id, uint64_t h) {
+    game_session_t **pp = (game_session_t**)&shard->buckets[h & shard->mask];
+    while (*pp && strcmp((*pp)->game_id, game_id) != 0) {
+        pp = &(*pp)->reg_next;
+    }
+    return pp;
+}
+
+static void game_shard_grow(registry_shard_t *shard) {
+    size_t size = (shard->mask + 1) * 2;
+    void **buckets = calloc(size, sizeof(void*));
+    if (!buckets) return;   // Giữ bảng cũ, chỉ là chain dài hơn
+
+    for (size_t i = 0; i <= shard->mask; i++) {
+        game_session_t *g = shard->buckets[i];
+        while (g) {
+            game_session_t *next = g->reg_next;
+            size_t b = hash_key(g->game_id) & (size - 1);
+            g->reg_next = buckets[b];
+            buckets[b] = g;
+            g = next;
+        }
+    }
+
+    free(shard->buckets);
+    shard->buckets = buckets;
+    shard->mask = size - 1;
+}
+
+// ====================== Player index (gọi khi giữ lock) ======================
+static player_link_t** player_slot(registry_shard_t *shard, const char *player_id, uint64_t h) {
+    player_link_t **pp = (player_link_t**)&shard->buckets[h & shard->mask];
+    while (*pp && strcmp((*pp)->player_id, player_id) != 0) {
+        pp = &(*pp)->next;
+    }
+    return pp;
+}
+
+static void player_shard_grow(registry_shard_t *shard) {
+    size_t size = (shard->mask + 1) * 2;
+    void **buckets = calloc(size, sizeof(void*));
+    if (!buckets) return;
+
+    for (size_t i = 0; i <= shard->mask; i++) {
+        player_link_t *l = shard->buckets[i];
+        while (l) {
+            player_link_t *next = l->next;
+            size_t b = hash_key(l->player_id) & (size - 1);
+            l->next = buckets[b];
+            buckets[b] = l;
+            l = next;
+        }
+    }
+
+    free(shard->buckets);
+    shard->buckets = buckets;
+    shard->mask = size - 1;
+}
+
+static void player_link_set(const char *player_id, game_session_t *game) {
+    if (!player_id[0]) return;
+
+    uint64_t h = hash_key(player_id);
+    registry_shard_t *shard = shard_for(g_player_shards, h);
+
+    pthread_rwlock_wrlock(&shard->lock);
+    player_link_t **pp = player_slot(shard, player_id, h);
+    if (*pp) {
+        // Game đã kết thúc được nạp lại (chat theo game_id, WAL replay) không
+        // được che game player đang chơi dở
+        game_session_t *cur = (*pp)->game;
+        if (cur == game || game->state != GAME_STATE_FINISHED ||
+            __atomic_load_n(&cur->state, __ATOMIC_RELAXED) == GAME_STATE_FINISHED) {
+            (*pp)->game = game;
+        }
+    } else {
+        player_link_t *l = calloc(1, sizeof(player_link_t));
+        if (l) {
+            strncpy(l->player_id, player_id, sizeof(l->player_id) - 1);
+            l->game = game;
+            *pp = l;
+            if (++shard->count > shard->mask + 1) player_shard_grow(shard);
+        } else {
+            log_error("Game registry: out of memory indexing player %s", player_id);
+        }
+    }
+    pthread_rwlock_unlock(&shard->lock);
+}
+
+// Chỉ gỡ nếu link vẫn trỏ tới game này (player có thể đã sang game mới)
+static void player_link_clear(const char *player_id, game_session_t *game) {
+    if (!player_id[0]) return;
+
+    uint64_t h = hash_key(player_id);
+    registry_shard_t *shard = shard_for(g_player_shards, h);
+
+    pthread_rwlock_wrlock(&shard->lock);
+    player_link_t **pp = player_slot(shard, player_id, h);
+    if (*pp && (*pp)->game == game) {
+        player_link_t *l = *pp;
+        *pp = l->next;
+        shard->count--;
+        free(l);
+    }
+    pthread_rwlock_unlock(&shard->lock);
+}
+
+// ====================== Public API ======================
+game_session_t* game_registry_get(const char *game_id) {
+    if (!game_id) return NULL;
+
+    uint64_t h = hash_key(game_id);
+    registry_shard_t *shard = shard_for(g_game_shards, h);
+
+    pthread_rwlock_rdlock(&shard->lock);
+    game_session_t *game = *game_slot(shard, game_id, h);
+    if (game) __atomic_add_fetch(&game->refcount, 1, __ATOMIC_ACQ_REL);
+    pthread_rwlock_unlock(&shard->lock);
+
+    return game;
+}
+
+game_session_t* game_registry_find_by_player(const char *player_id) {
+    if (!player_id || !player_id[0]) return NULL;
+
+    uint64_t h = hash_key(player_id);
+    registry_shard_t *shard = shard_for(g_player_shards, h);
+
+    pthread_rwlock_rdlock(&shard->lock);
+    player_link_t *l = *player_slot(shard, player_id, h);
+    game_session_t *game = l ? l->game : NULL;
+    if (game) __atomic_add_fetch(&game->refcount, 1, __ATOMIC_ACQ_REL);
+    pthread_rwlock_unlock(&shard->lock);
+
+    return game;
+}
+
+// Thứ tự lock luôn là shard game → shard player, nên insert/remove của cùng
+// một game được tuần tự hóa bởi shard game và index player không bao giờ
+// giữ link tới game đã gỡ.
+game_session_t* game_registry_insert(game_session_t *game) {
+    uint64_t h = hash_key(game->game_id);
+    registry_shard_t *shard = shard_for(g_game_shards, h);
+
+    pthread_rwlock_wrlock(&shard->lock);
+
+    game_session_t **pp = game_slot(shard, game->game_id, h);
+    if (*pp) {
+        game_session_t *existing = *pp;
+        __atomic_add_fetch(&existing->refcount, 1, __ATOMIC_ACQ_REL);
+        pthread_rwlock_unlock(&shard->lock);
+
+        game_release(game);
+        return existing;
+    }
+
+    __atomic_add_fetch(&game->refcount, 1, __ATOMIC_ACQ_REL);   // Ref của registry
+    game->reg_next = NULL;
+    *pp = game;
+    if (++shard->count > shard->mask + 1) game_shard_grow(shard);
+
+    player_link_set(game->player1_id, game);
+    player_link_set(game->player2_id, game);
+
+    pthread_rwlock_unlock(&shard->lock);
+
+    __atomic_add_fetch(&g_total, 1, __ATOMIC_RELAXED);
+    return game;
+}
+
+bool game_registry_remove(game_session_t *game) {
+    if (!game) return false;
+
+    uint64_t h = hash_key(game->game_id);
+    registry_shard_t *shard = shard_for(g_game_shards, h);
+
+    pthread_rwlock_wrlock(&shard->lock);
+
+    game_session_t **pp = game_slot(shard, game->game_id, h);
+    if (*pp != game) {
+        pthread_rwlock_unlock(&shard->lock);
+        return false;
+    }
+    *pp = game->reg_next;
+    game->reg_next = NULL;
+    shard->count--;
+
+    player_link_clear(game->player1_id, game);
+    player_link_clear(game->player2_id, game);
+
+    pthread_rwlock_unlock(&shard->lock);
+
+    __atomic_sub_fetch(&g_total, 1, __ATOMIC_RELAXED);
+    game_release(game);
+    return true;
+}
+
+size_t game_registry_size(void) {
+    return __atomic_load_n(&g_total, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,607 @@
+#include "game/game_wal.h"
+#include "utils/logger.h"
+#include "utils/timer_wheel.h"
+#include "config.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define WAL_MAGIC 0x4C415747u      // "GWAL"
+#define WAL_VERSION 1
+#define WAL_SEGMENT_HEADER 16      // magic, version, seq, reserved
+#define WAL_RECORD_HEADER 16       // crc, len, type, pad, lsn
+#define WAL_ID_LEN 24
+#define WAL_MAX_RECORD 256
+
+typedef struct wal_segment {
+    uint32_t seq;
+    int fd;
+    uint8_t *map;                  // NULL với segment đọc lại lúc khởi động
+    size_t size;
+    size_t write_off;
+    size_t synced_off;
+    uint64_t last_lsn;
+    int pins;                      // Số game có record chưa ghi bắt đầu từ segment này
+    char path[512];
+    struct wal_segment *next;
+} wal_segment_t;
+
+// Thứ tự lock: g_sync_lock → g_wal_lock. Segment chỉ được giải phóng khi giữ
+// cả hai, nên sync thread dùng con trỏ segment mà không cần g_wal_lock.
+static pthread_mutex_t g_wal_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t g_sync_lock = PTHREAD_MUTEX_INITIALIZER;
+static wal_segment_t *g_seg_head = NULL;   // Cũ nhất
+static wal_segment_t *g_seg_tail = NULL;   // Đang ghi
+static bool g_wal_enabled = false;
+static bool g_replaying = false;
+static uint64_t g_next_lsn = 1;
+static char g_wal_dir[256];
+static size_t g_segment_size;
+static int g_sync_ms;
+static game_wal_stats_t g_stats;
+static uint32_t g_crc_table[256];
+
+// ====================== Encoding ======================
+static void crc32_init(void) {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++) {
+            c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+        }
+        g_crc_table[i] = c;
+    }
+}
+
+static uint32_t crc32_compute(const uint8_t *p, size_t len) {
+    uint32_t c = 0xFFFFFFFFu;
+    while (len--) {
+        c = g_crc_table[(c ^ *p++) & 0xFF] ^ (c >> 8);
+    }
+    return c ^ 0xFFFFFFFFu;
+}
+
+static void put_u16(uint8_t *p, uint16_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+}
+
+static void put_u32(uint8_t *p, uint32_t v) {
+    for (int i = 0; i < 4; i++) p[i] = (uint8_t)(v >> (8 * i));
+}
+
+static void put_u64(uint8_t *p, uint64_t v) {
+    for (int i = 0; i < 8; i++) p[i] = (uint8_t)(v >> (8 * i));
+}
+
+static uint16_t get_u16(const uint8_t *p) {
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t get_u32(const uint8_t *p) {
+    uint32_t v = 0;
+    for (int i = 3; i >= 0; i--) v = (v << 8) | p[i];
+    return v;
+}
+
+static uint64_t get_u64(const uint8_t *p) {
+    uint64_t v = 0;
+    for (int i = 7; i >= 0; i--) v = (v << 8) | p[i];
+    return v;
+}
+
+static uint8_t* put_str(uint8_t *p, const char *s) {
+    size_t len = strnlen(s, 63);
+    *p++ = (uint8_t)len;
+    memcpy(p, s, len);
+    return p + len;
+}
+
+static const uint8_t* get_str(const uint8_t *p, const uint8_t *end, char *out, size_t cap) {
+    if (p >= end) return NULL;
+    size_t len = *p++;
+    if (len >= cap || p + len > end) return NULL;
+    memcpy(out, p, len);
+    out[len] = '\0';
+    return p + len;
+}
+
+static size_t wal_encode(uint8_t *buf, const game_wal_event_t *ev, uint64_t lsn) {
+    uint8_t *p = buf + WAL_RECORD_HEADER;
+
+    memset(p, 0, WAL_ID_LEN);
+    memcpy(p, ev->game_id, strnlen(ev->game_id, WAL_ID_LEN));
+    p += WAL_ID_LEN;
+    p = put_str(p, ev->player_id);
+
+    switch (ev->type) {
+        case GAME_WAL_CREATE:
+            p = put_str(p, ev->u.create.player2_id);
+            break;
+        case GAME_WAL_PLACE:
+            *p++ = ev->u.place.type;
+            *p++ = ev->u.place.row;
+            *p++ = ev->u.place.col;
+            *p++ = ev->u.place.is_horizontal ? 1 : 0;
+            break;
+        case GAME_WAL_READY:
+            memcpy(p, ev->u.ready.board, BOARD_SIZE);
+            p += BOARD_SIZE;
+            break;
+        case GAME_WAL_SHOT:
+            put_u32(p, ev->u.shot.index);
+            p += 4;
+            *p++ = ev->u.shot.row;
+            *p++ = ev->u.shot.col;
+            break;
+        case GAME_WAL_END:
+            break;
+    }
+
+    size_t len = (size_t)(p - (buf + WAL_RECORD_HEADER));
+    put_u16(buf + 4, (uint16_t)len);
+    buf[6] = (uint8_t)ev->type;
+    buf[7] = 0;
+    put_u64(buf + 8, lsn);
+    put_u32(buf, crc32_compute(buf + 4, WAL_RECORD_HEADER - 4 + len));
+    return WAL_RECORD_HEADER + len;
+}
+
+// Số byte của record hợp lệ tại p, 0 nếu hết dữ liệu / record hỏng
+static size_t wal_decode(const uint8_t *p, size_t avail, game_wal_event_t *ev) {
+    if (avail < WAL_RECORD_HEADER) return 0;
+
+    size_t len = get_u16(p + 4);
+    if (len < WAL_ID_LEN + 1 || WAL_RECORD_HEADER + len > avail) return 0;
+    if (crc32_compute(p + 4, WAL_RECORD_HEADER - 4 + len) != get_u32(p)) return 0;
+
+    memset(ev, 0, sizeof(*ev));
+    ev->type = (game_wal_type_t)p[6];
+    ev->lsn = get_u64(p + 8);
+
+    const uint8_t *q = p + WAL_RECORD_HEADER;
+    const uint8_t *end = q + len;
+    memcpy(ev->game_id, q, WAL_ID_LEN);
+    q += WAL_ID_LEN;
+    q = get_str(q, end, ev->player_id, sizeof(ev->player_id));
+    if (!q) return 0;
+
+    switch (ev->type) {
+        case GAME_WAL_CREATE:
+            if (!get_str(q, end, ev->u.create.player2_id, sizeof(ev->u.create.player2_id))) return 0;
+            break;
+        case GAME_WAL_PLACE:
+            if (end - q < 4) return 0;
+            ev->u.place.type = q[0];
+            ev->u.place.row = q[1];
+            ev->u.place.col = q[2];
+            ev->u.place.is_horizontal = q[3] != 0;
+            break;
+        case GAME_WAL_READY:
+            if (end - q < BOARD_SIZE) return 0;
+            memcpy(ev->u.ready.board, q, BOARD_SIZE);
+            break;
+        case GAME_WAL_SHOT:
+            if (end - q < 6) return 0;
+            ev->u.shot.index = get_u32(q);
+            ev->u.shot.row = q[4];
+            ev->u.shot.col = q[5];
+            break;
+        case GAME_WAL_END:
+            break;
+        default:
+            return 0;
+    }
+
+    return WAL_RECORD_HEADER + len;
+}
+
+// ====================== Segments ======================
+static void wal_segment_path(char *out, size_t cap, uint32_t seq) {
+    snprintf(out, cap, "%s/game-%010u.wal", g_wal_dir, seq);
+}
+
+static void wal_fsync_dir(void) {
+    int dfd = open(g_wal_dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dfd < 0) return;
+    fsync(dfd);
+    close(dfd);
+}
+
+// Tạo segment mới đã cấp đủ g_segment_size byte (vùng chưa ghi toàn 0)
+static wal_segment_t* wal_segment_create(uint32_t seq) {
+    wal_segment_t *seg = calloc(1, sizeof(wal_segment_t));
+    if (!seg) return NULL;
+
+    seg->seq = seq;
+    seg->size = g_segment_size;
+    wal_segment_path(seg->path, sizeof(seg->path), seq);
+
+    seg->fd = open(seg->path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (seg->fd < 0) {
+        log_error("[WAL] Cannot create %s: %s", seg->path, strerror(errno));
+        free(seg);
+        return NULL;
+    }
+
+    if (ftruncate(seg->fd, (off_t)seg->size) != 0) {
+        log_error("[WAL] Cannot size %s: %s", seg->path, strerror(errno));
+        close(seg->fd);
+        unlink(seg->path);
+        free(seg);
+        return NULL;
+    }
+
+    void *map = mmap(NULL, seg->size, PROT_READ | PROT_WRITE, MAP_SHARED, seg->fd, 0);
+    if (map == MAP_FAILED) {
+        log_error("[WAL] Cannot mmap %s: %s", seg->path, strerror(errno));
+        close(seg->fd);
+        unlink(seg->path);
+        free(seg);
+        return NULL;
+    }
+    seg->map = map;
+
+    put_u32(seg->map, WAL_MAGIC);
+    put_u32(seg->map + 4, WAL_VERSION);
+    put_u32(seg->map + 8, seq);
+    seg->write_off = WAL_SEGMENT_HEADER;
+
+    // File mới phải còn trong thư mục sau khi mất điện
+    wal_fsync_dir();
+    return seg;
+}
+
+static void wal_segment_free(wal_segment_t *seg) {
+    if (seg->map) munmap(seg->map, seg->size);
+    if (seg->fd >= 0) close(seg->fd);
+    if (unlink(seg->path) != 0 && errno != ENOENT) {
+        log_warn("[WAL] Cannot remove %s: %s", seg->path, strerror(errno));
+    }
+    free(seg);
+}
+
+static void wal_segment_link(wal_segment_t *seg) {
+    if (g_seg_tail) {
+        g_seg_tail->next = seg;
+    } else {
+        g_seg_head = seg;
+    }
+    g_seg_tail = seg;
+    g_stats.segments++;
+}
+
+// Gọi khi giữ g_wal_lock
+static wal_segment_t* wal_segment_find(uint32_t seq) {
+    for (wal_segment_t *seg = g_seg_head; seg; seg = seg->next) {
+        if (seg->seq == seq) return seg;
+    }
+    return NULL;
+}
+
+// Gỡ các segment cũ không còn game nào pin (segment đang ghi luôn được giữ)
+static void wal_truncate(void) {
+    pthread_mutex_lock(&g_sync_lock);
+    pthread_mutex_lock(&g_wal_lock);
+
+    wal_segment_t *dead = NULL;
+    wal_segment_t **dead_tail = &dead;
+    while (g_seg_head && g_seg_head != g_seg_tail && g_seg_head->pins == 0) {
+        wal_segment_t *seg = g_seg_head;
+        g_seg_head = seg->next;
+        seg->next = NULL;
+        *dead_tail = seg;
+        dead_tail = &seg->next;
+        g_stats.segments--;
+    }
+
+    pthread_mutex_unlock(&g_wal_lock);
+
+    while (dead) {
+        wal_segment_t *next = dead->next;
+        log_debug("[WAL] Segment %u persisted, removing", dead->seq);
+        wal_segment_free(dead);
+        dead = next;
+    }
+
+    pthread_mutex_unlock(&g_sync_lock);
+}
+
+// ====================== Group sync ======================
+// Record nằm trong page cache ngay khi memcpy (sống sót khi process crash);
+// msync theo nhóm để chịu được cả mất điện, mất tối đa ~GAME_WAL_SYNC_MS.
+static void* wal_sync_thread(void *arg) {
+    (void)arg;
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+
+    while (1) {
+        usleep((useconds_t)g_sync_ms * 1000);
+
+        uint64_t start = timer_now_ms();
+        uint64_t durable = 0;
+        int synced = 0;
+
+        pthread_mutex_lock(&g_sync_lock);
+
+        pthread_mutex_lock(&g_wal_lock);
+        wal_segment_t *seg = g_seg_head;
+        pthread_mutex_unlock(&g_wal_lock);
+
+        while (seg) {
+            pthread_mutex_lock(&g_wal_lock);
+            size_t from = seg->synced_off;
+            size_t to = seg->write_off;
+            uint64_t seg_lsn = seg->last_lsn;
+            wal_segment_t *next = seg->next;
+            pthread_mutex_unlock(&g_wal_lock);
+
+            if (seg->map && to > from) {
+                size_t aligned = from & ~(page - 1);
+                if (msync(seg->map + aligned, to - aligned, MS_SYNC) != 0) {
+                    log_error("[WAL] msync %s failed: %s", seg->path, strerror(errno));
+                } else {
+                    pthread_mutex_lock(&g_wal_lock);
+                    seg->synced_off = to;
+                    pthread_mutex_unlock(&g_wal_lock);
+                    durable = seg_lsn;
+                    synced++;
+                }
+            }
+            seg = next;
+        }
+
+        pthread_mutex_unlock(&g_sync_lock);
+
+        if (synced > 0) {
+            uint64_t elapsed = timer_now_ms() - start;
+            pthread_mutex_lock(&g_wal_lock);
+            g_stats.durable_lsn = durable;
+            g_stats.syncs++;
+            g_stats.sync_total_ms += elapsed;
+            if (elapsed > g_stats.sync_max_ms) g_stats.sync_max_ms = elapsed;
+            pthread_mutex_unlock(&g_wal_lock);
+        }
+    }
+
+    return NULL;
+}
+
+// ====================== Append / pin ======================
+void game_wal_pin(game_session_t *game, uint32_t segment) {
+    if (game->wal_pin != 0 || segment == 0) return;
+
+    pthread_mutex_lock(&g_wal_lock);
+    wal_segment_t *seg = wal_segment_find(segment);
+    if (seg) {
+        seg->pins++;
+        game->wal_pin = segment;
+    }
+    pthread_mutex_unlock(&g_wal_lock);
+}
+
+uint64_t game_wal_append(game_session_t *game, const game_wal_event_t *ev) {
+    if (!g_wal_enabled || g_replaying) return 0;
+
+    uint8_t buf[WAL_MAX_RECORD];
+
+    pthread_mutex_lock(&g_wal_lock);
+    uint64_t lsn = g_next_lsn++;
+    size_t len = wal_encode(buf, ev, lsn);
+
+    wal_segment_t *seg = g_seg_tail;
+    if (seg->write_off + len > seg->size) {
+        wal_segment_t *next = wal_segment_create(seg->seq + 1);
+        if (!next) {
+            pthread_mutex_unlock(&g_wal_lock);
+            log_error("[WAL] Rotation failed, event %d of game %s not logged",
+                      ev->type, ev->game_id);
+            return 0;
+        }
+        wal_segment_link(next);
+        seg = next;
+    }
+
+    memcpy(seg->map + seg->write_off, buf, len);
+    seg->write_off += len;
+    seg->last_lsn = lsn;
+
+    // Pin segment cũ nhất còn record chưa ghi của game (segment sau tự được giữ)
+    if (game && game->wal_pin == 0) {
+        seg->pins++;
+        game->wal_pin = seg->seq;
+    }
+
+    g_stats.appends++;
+    g_stats.bytes += len;
+    g_stats.last_lsn = lsn;
+    pthread_mutex_unlock(&g_wal_lock);
+
+    return lsn;
+}
+
+void game_wal_unpin(uint32_t segment) {
+    if (segment == 0) return;
+
+    pthread_mutex_lock(&g_wal_lock);
+    wal_segment_t *seg = wal_segment_find(segment);
+    if (seg && seg->pins > 0) seg->pins--;
+    bool reclaim = g_seg_head && g_seg_head != g_seg_tail && g_seg_head->pins == 0;
+    pthread_mutex_unlock(&g_wal_lock);
+
+    if (reclaim) wal_truncate();
+}
+
+bool game_wal_replaying(void) {
+    return g_replaying;
+}
+
+// ====================== Recovery ======================
+static int wal_seq_compare(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t*)a;
+    uint32_t y = *(const uint32_t*)b;
+    return (x > y) - (x < y);
+}
+
+static uint64_t wal_replay_segment(wal_segment_t *seg) {
+    int fd = open(seg->path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        log_error("[WAL] Cannot open %s: %s", seg->path, strerror(errno));
+        return 0;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < WAL_SEGMENT_HEADER) {
+        log_warn("[WAL] Segment %s too short, ignoring", seg->path);
+        close(fd);
+        return 0;
+    }
+
+    size_t size = (size_t)st.st_size;
+    uint8_t *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        log_error("[WAL] Cannot mmap %s: %s", seg->path, strerror(errno));
+        return 0;
+    }
+
+    if (get_u32(map) != WAL_MAGIC || get_u32(map + 8) != seg->seq) {
+        log_warn("[WAL] Segment %s has a bad header, ignoring", seg->path);
+        munmap(map, size);
+        return 0;
+    }
+
+    uint64_t replayed = 0;
+    size_t off = WAL_SEGMENT_HEADER;
+    while (off < size) {
+        game_wal_event_t ev;
+        size_t n = wal_decode(map + off, size - off, &ev);
+        if (n == 0) break;
+
+        if (ev.lsn >= g_next_lsn) g_next_lsn = ev.lsn + 1;
+        game_replay_event(&ev, seg->seq);
+        replayed++;
+        off += n;
+    }
+
+    // Dừng ở vùng toàn 0 là hết segment; còn lại là record ghi dở lúc crash
+    if (off + WAL_RECORD_HEADER <= size && get_u16(map + off + 4) != 0) {
+        log_warn("[WAL] Segment %u: torn or corrupt record at offset %zu, rest ignored",
+                 seg->seq, off);
+    }
+
+    munmap(map, size);
+    return replayed;
+}
+
+bool game_wal_start(void) {
+    crc32_init();
+    snprintf(g_wal_dir, sizeof(g_wal_dir), "%s", get_game_wal_dir());
+    g_segment_size = (size_t)get_game_wal_segment_mb() * 1024 * 1024;
+    g_sync_ms = get_game_wal_sync_ms();
+
+    if (mkdir(g_wal_dir, 0755) != 0 && errno != EEXIST) {
+        log_error("[WAL] Cannot create %s: %s (running without WAL)", g_wal_dir, strerror(errno));
+        return true;
+    }
+
+    DIR *dir = opendir(g_wal_dir);
+    if (!dir) {
+        log_error("[WAL] Cannot open %s: %s (running without WAL)", g_wal_dir, strerror(errno));
+        return true;
+    }
+
+    uint32_t *seqs = NULL;
+    size_t count = 0, cap = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        uint32_t seq;
+        int consumed = 0;
+        if (sscanf(entry->d_name, "game-%u.wal%n", &seq, &consumed) != 1 ||
+            consumed != (int)strlen(entry->d_name) || seq == 0) {
+            continue;
+        }
+        if (count == cap) {
+            cap = cap ? cap * 2 : 16;
+            uint32_t *grown = realloc(seqs, cap * sizeof(uint32_t));
+            if (!grown) break;
+            seqs = grown;
+        }
+        seqs[count++] = seq;
+    }
+    closedir(dir);
+    if (count > 0) qsort(seqs, count, sizeof(uint32_t), wal_seq_compare);
+
+    // Replay: các segment cũ vào danh sách trước để game_wal_pin tìm thấy
+    uint64_t start = timer_now_ms();
+    uint64_t replayed = 0;
+    uint32_t last_seq = 0;
+
+    g_replaying = true;
+    for (size_t i = 0; i < count; i++) {
+        wal_segment_t *seg = calloc(1, sizeof(wal_segment_t));
+        if (!seg) break;
+        seg->seq = seqs[i];
+        seg->fd = -1;
+        wal_segment_path(seg->path, sizeof(seg->path), seg->seq);
+
+        pthread_mutex_lock(&g_wal_lock);
+        wal_segment_link(seg);
+        pthread_mutex_unlock(&g_wal_lock);
+
+        replayed += wal_replay_segment(seg);
+        last_seq = seg->seq;
+    }
+    g_replaying = false;
+    free(seqs);
+
+    uint64_t elapsed = timer_now_ms() - start;
+
+    wal_segment_t *active = wal_segment_create(last_seq + 1);
+    if (!active) {
+        log_error("[WAL] Cannot open a new segment (running without WAL)");
+        return true;
+    }
+
+    pthread_mutex_lock(&g_wal_lock);
+    wal_segment_link(active);
+    g_stats.replayed = replayed;
+    g_stats.recovery_ms = elapsed;
+    g_stats.last_lsn = g_next_lsn - 1;
+    g_stats.durable_lsn = g_next_lsn - 1;
+    pthread_mutex_unlock(&g_wal_lock);
+
+    g_wal_enabled = true;
+
+    pthread_t tid;
+    int result = pthread_create(&tid, NULL, wal_sync_thread, NULL);
+    if (result != 0) {
+        log_error("[WAL] Failed to create sync thread: %d", result);
+        g_wal_enabled = false;
+        return false;
+    }
+    pthread_detach(tid);
+
+    // ELO của trận kết thúc trong replay mà chưa có END (record END vào
+    // segment mới)
+    game_replay_finish();
+
+    // Segment không còn game nào pin sau replay thì xoá luôn
+    wal_truncate();
+
+    log_info("[WAL] Replayed %llu events from %zu segments in %llums (dir=%s, segment=%zuMB, sync=%dms)",
+             (unsigned long long)replayed, count, (unsigned long long)elapsed,
+             g_wal_dir, g_segment_size / (1024 * 1024), g_sync_ms);
+    return true;
+}
+
+void game_wal_stats(game_wal_stats_t *out) {
+    pthread_mutex_lock(&g_wal_lock);
+    *out = g_stats;
+    pthread_mutex_unlock(&g_wal_lock);
+}
@@ -0,0 +1,145 @@
+#include "game/move_log.h"
+#include "game/game_board.h"
+#include "utils/logger.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define MOVE_SHOOTER_BIT 0x80
+#define MOVE_CELL_MASK 0x7F
+#define MOVE_HIT 0x01
+#define MOVE_SUNK 0x02
+#define MOVE_TYPE_SHIFT 2
+#define MOVE_TYPE_MASK 0x07
+#define MOVE_GAME_OVER 0x20
+#define MOVE_MAX_ENCODED 12        // 2 byte + varint 64-bit (tối đa 10 byte)
+
+uint64_t move_log_now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+void move_log_init(move_log_t *log, uint64_t base_ms) {
+    memset(log, 0, sizeof(*log));
+    log->base_ms = base_ms;
+    log->last_ms = base_ms;
+}
+
+void move_log_free(move_log_t *log) {
+    free(log->buf);
+    log->buf = NULL;
+    log->len = log->cap = log->count = 0;
+}
+
+static bool move_log_reserve(move_log_t *log, uint32_t extra) {
+    if (log->len + extra <= log->cap) return true;
+
+    uint32_t cap = log->cap ? log->cap : MOVE_LOG_INITIAL_CAP;
+    while (cap < log->len + extra) cap *= 2;
+
+    uint8_t *buf = realloc(log->buf, cap);
+    if (!buf) {
+        log_error("Move log: out of memory growing to %u bytes", cap);
+        return false;
+    }
+    log->buf = buf;
+    log->cap = cap;
+    return true;
+}
+
+bool move_log_append(move_log_t *log, const move_t *move) {
+    if (move->row >= GRID_SIZE || move->col >= GRID_SIZE) return false;
+    if (!move_log_reserve(log, MOVE_MAX_ENCODED)) return false;
+
+    uint8_t *p = log->buf + log->len;
+
+    *p++ = (uint8_t)((move->shooter ? MOVE_SHOOTER_BIT : 0) |
+                     (move->row * GRID_SIZE + move->col));
+    *p++ = (uint8_t)((move->is_hit ? MOVE_HIT : 0) |
+                     (move->is_sunk ? MOVE_SUNK : 0) |
+                     ((move->sunk_ship_type & MOVE_TYPE_MASK) << MOVE_TYPE_SHIFT) |
+                     (move->game_over ? MOVE_GAME_OVER : 0));
+
+    // Đồng hồ có thể lùi (chỉnh NTP): kẹp delta về 0 để log luôn đơn điệu
+    uint64_t ts = move->timestamp_ms > log->last_ms ? move->timestamp_ms : log->last_ms;
+    uint64_t delta = ts - log->last_ms;
+    while (delta >= 0x80) {
+        *p++ = (uint8_t)(delta | 0x80);
+        delta >>= 7;
+    }
+    *p++ = (uint8_t)delta;
+
+    log->len = (uint32_t)(p - log->buf);
+    log->last_ms = ts;
+    log->count++;
+    return true;
+}
+
+void move_log_iter_init(move_log_iter_t *it, const move_log_t *log) {
+    it->log = log;
+    it->pos = 0;
+    it->ts_ms = log->base_ms;
+}
+
+bool move_log_next(move_log_iter_t *it, move_t *out) {
+    const move_log_t *log = it->log;
+    if (it->pos + 3 > log->len) return false;
+
+    const uint8_t *p = log->buf + it->pos;
+    const uint8_t *end = log->buf + log->len;
+
+    uint8_t cell = p[0] & MOVE_CELL_MASK;
+    if (cell >= BOARD_SIZE) return false;
+
+    out->shooter = (p[0] & MOVE_SHOOTER_BIT) ? 1 : 0;
+    out->row = cell / GRID_SIZE;
+    out->col = cell % GRID_SIZE;
+    out->is_hit = (p[1] & MOVE_HIT) != 0;
+    out->is_sunk = (p[1] & MOVE_SUNK) != 0;
+    out->sunk_ship_type = (p[1] >> MOVE_TYPE_SHIFT) & MOVE_TYPE_MASK;
+    out->game_over = (p[1] & MOVE_GAME_OVER) != 0;
+    p += 2;
+
+    uint64_t delta = 0;
+    int shift = 0;
+    while (1) {
+        if (p >= end || shift > 63) return false;
+        uint8_t b = *p++;
+        delta |= (uint64_t)(b & 0x7F) << shift;
+        if (!(b & 0x80)) break;
+        shift += 7;
+    }
+
+    it->ts_ms += delta;
+    out->timestamp_ms = it->ts_ms;
+    it->pos = (uint32_t)(p - log->buf);
+    return true;
+}
+
+bool move_log_load(move_log_t *log, uint64_t base_ms, const uint8_t *data, uint32_t len) {
+    move_log_free(log);
+    move_log_init(log, base_ms);
+    if (len == 0) return true;
+    if (!move_log_reserve(log, len)) return false;
+
+    memcpy(log->buf, data, len);
+    log->len = len;
+
+    // Duyệt một lượt để kiểm tra dữ liệu và dựng lại count/last_ms
+    move_log_iter_t it;
+    move_t move;
+    move_log_iter_init(&it, log);
+    while (move_log_next(&it, &move)) {
+        log->count++;
+    }
+
+    if (it.pos != len) {
+        log_warn("Move log: corrupt data at byte %u of %u", it.pos, len);
+        move_log_free(log);
+        move_log_init(log, base_ms);
+        return false;
+    }
+    log->last_ms = it.ts_ms;
+    return true;
+}
@@ -20,7 +20,10 @@ int main() {
     }
 
     log_info("MongoDB connected successfully.");
-    matcher_init();
+    if (!matcher_init()) {
+        mongo_cleanup(g_mongo_ctx);
+        return 1;
+    }
     // 3️⃣ Start WebSocket / TCP server
     uint16_t port = 9090;
     log_info("Starting WebSocket/TCP server on port %d...", port);
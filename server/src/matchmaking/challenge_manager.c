@@ -1,70 +1,214 @@
 #include "matchmaking/challenge_manager.h"
 #include "network/ws_protocol.h"
 #include "utils/logger.h"
+#include "config.h"
 #include <string.h>
 #include <stdlib.h>
 #include <time.h>
 #include <stdio.h>
+#include <pthread.h>
 
-static challenge_session_t challenges[MAX_CHALLENGES];
+#define CHALLENGE_NIL (-1)
+
+// Slot kèm các link index: id_next (bảng challenge_id), by_challenger_next /
+// by_target_next (bảng user_id). Slot rảnh nối với nhau qua id_next.
+typedef struct {
+    challenge_session_t c;
+    uint64_t id_hash;
+    uint64_t challenger_hash;
+    uint64_t target_hash;
+    int32_t id_next;
+    int32_t by_challenger_next;
+    int32_t by_target_next;
+} challenge_slot_t;
+
+static pthread_mutex_t g_challenge_lock = PTHREAD_MUTEX_INITIALIZER;
+static challenge_slot_t *g_slots = NULL;
+static int32_t g_capacity = 0;
+static int32_t g_high_water = 0;   // Slot chưa từng dùng bắt đầu từ đây
+static int32_t g_free = CHALLENGE_NIL;
+static int32_t *g_by_id = NULL;
+static int32_t *g_by_challenger = NULL;
+static int32_t *g_by_target = NULL;
+static size_t g_hash_mask = 0;
 static int challenge_count = 0;
+static uint64_t g_next_seq = 0;
+static long g_boot_time = 0;
 
 extern ssize_t ws_send_message(int sock, message_t *msg);
 
-void challenge_manager_init(void) {
-    memset(challenges, 0, sizeof(challenges));
+static void challenge_expire_fired(void *arg);
+
+static uint64_t hash_key(const char *s) {
+    uint64_t h = 1469598103934665603ULL;  // FNV-1a
+    while (*s) {
+        h ^= (unsigned char)*s++;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+bool challenge_manager_init(void) {
+    g_capacity = get_challenge_max();
+
+    size_t buckets = 1;
+    while (buckets < (size_t)g_capacity) buckets <<= 1;
+
+    g_slots = calloc((size_t)g_capacity, sizeof(challenge_slot_t));
+    g_by_id = malloc(buckets * sizeof(int32_t));
+    g_by_challenger = malloc(buckets * sizeof(int32_t));
+    g_by_target = malloc(buckets * sizeof(int32_t));
+    if (!g_slots || !g_by_id || !g_by_challenger || !g_by_target) {
+        challenge_manager_cleanup();
+        log_error("Failed to allocate challenge store (%d challenges)", g_capacity);
+        return false;
+    }
+    memset(g_by_id, 0xFF, buckets * sizeof(int32_t));   // CHALLENGE_NIL
+    memset(g_by_challenger, 0xFF, buckets * sizeof(int32_t));
+    memset(g_by_target, 0xFF, buckets * sizeof(int32_t));
+    g_hash_mask = buckets - 1;
+    g_high_water = 0;
+    g_free = CHALLENGE_NIL;
     challenge_count = 0;
-    log_info("Challenge manager initialized");
+    g_boot_time = (long)time(NULL);
+
+    log_info("Challenge manager initialized (capacity %d)", g_capacity);
+    return true;
 }
 
 void challenge_manager_cleanup(void) {
+    // Gỡ timer trước khi free slot (timer_cancel chờ callback đang chạy)
+    for (int32_t i = 0; g_slots && i < g_high_water; i++) {
+        timer_cancel(&g_slots[i].c.expire_timer);
+    }
+
+    pthread_mutex_lock(&g_challenge_lock);
+    free(g_slots);
+    free(g_by_id);
+    free(g_by_challenger);
+    free(g_by_target);
+    g_slots = NULL;
+    g_by_id = g_by_challenger = g_by_target = NULL;
     challenge_count = 0;
+    pthread_mutex_unlock(&g_challenge_lock);
     log_info("Challenge manager cleaned up");
 }
 
-static void generate_challenge_id(char *out_id) {
-    sprintf(out_id, "chal_%ld_%d", time(NULL), rand() % 10000);
+// ==================== Index (gọi khi giữ g_challenge_lock) ====================
+static int32_t find_by_id(const char *challenge_id) {
+    uint64_t h = hash_key(challenge_id);
+    int32_t idx = g_by_id[h & g_hash_mask];
+    while (idx != CHALLENGE_NIL &&
+           (g_slots[idx].id_hash != h || strcmp(g_slots[idx].c.challenge_id, challenge_id) != 0)) {
+        idx = g_slots[idx].id_next;
+    }
+    return idx;
 }
 
-char* challenge_create(const char *challenger_id, const char *target_id,
-                       int challenger_sock, int target_sock,
-                       const char *game_mode, int time_control) {
-    if (challenge_count >= MAX_CHALLENGES) {
-        log_error("Challenge limit reached");
-        return NULL;
-    }
-    
-    // Check if already has pending challenge between these players
-    for (int i = 0; i < MAX_CHALLENGES; i++) {
-        if (challenges[i].is_active && 
-            challenges[i].status == CHALLENGE_STATUS_PENDING) {
-            if ((strcmp(challenges[i].challenger_id, challenger_id) == 0 &&
-                 strcmp(challenges[i].target_id, target_id) == 0) ||
-                (strcmp(challenges[i].challenger_id, target_id) == 0 &&
-                 strcmp(challenges[i].target_id, challenger_id) == 0)) {
-                log_warn("Challenge already exists between %s and %s", 
-                         challenger_id, target_id);
-                return NULL;
-            }
+// Challenge đang PENDING của user theo một vai (người mời hoặc người được
+// mời); other khác NULL thì chỉ lấy challenge với đúng người đó
+static int32_t find_pending(bool as_challenger, const char *user_id, const char *other) {
+    uint64_t h = hash_key(user_id);
+    int32_t idx = as_challenger ? g_by_challenger[h & g_hash_mask] : g_by_target[h & g_hash_mask];
+
+    while (idx != CHALLENGE_NIL) {
+        challenge_slot_t *slot = &g_slots[idx];
+        const char *self = as_challenger ? slot->c.challenger_id : slot->c.target_id;
+        const char *peer = as_challenger ? slot->c.target_id : slot->c.challenger_id;
+        uint64_t self_hash = as_challenger ? slot->challenger_hash : slot->target_hash;
+
+        if (self_hash == h && slot->c.status == CHALLENGE_STATUS_PENDING &&
+            strcmp(self, user_id) == 0 && (!other || strcmp(peer, other) == 0)) {
+            return idx;
         }
+        idx = as_challenger ? slot->by_challenger_next : slot->by_target_next;
     }
+    return CHALLENGE_NIL;
+}
 
-    int slot = -1;
-    for (int i = 0; i < MAX_CHALLENGES; i++) {
-        if (!challenges[i].is_active) {
-            slot = i;
-            break;
-        }
+static void index_link(int32_t idx) {
+    challenge_slot_t *slot = &g_slots[idx];
+
+    slot->id_next = g_by_id[slot->id_hash & g_hash_mask];
+    g_by_id[slot->id_hash & g_hash_mask] = idx;
+    slot->by_challenger_next = g_by_challenger[slot->challenger_hash & g_hash_mask];
+    g_by_challenger[slot->challenger_hash & g_hash_mask] = idx;
+    slot->by_target_next = g_by_target[slot->target_hash & g_hash_mask];
+    g_by_target[slot->target_hash & g_hash_mask] = idx;
+}
+
+static void index_unlink(int32_t idx) {
+    challenge_slot_t *slot = &g_slots[idx];
+    int32_t *pp;
+
+    pp = &g_by_id[slot->id_hash & g_hash_mask];
+    while (*pp != idx) pp = &g_slots[*pp].id_next;
+    *pp = slot->id_next;
+
+    pp = &g_by_challenger[slot->challenger_hash & g_hash_mask];
+    while (*pp != idx) pp = &g_slots[*pp].by_challenger_next;
+    *pp = slot->by_challenger_next;
+
+    pp = &g_by_target[slot->target_hash & g_hash_mask];
+    while (*pp != idx) pp = &g_slots[*pp].by_target_next;
+    *pp = slot->by_target_next;
+}
+
+// Gỡ challenge khỏi index (slot chưa được dùng lại cho tới challenge_release)
+static void challenge_detach(int32_t idx) {
+    index_unlink(idx);
+    g_slots[idx].c.is_active = false;
+    challenge_count--;
+}
+
+// Trả slot đã detach về free list. Gọi ngoài lock: timer_cancel chờ callback
+// đang chạy, mà callback cũng cần g_challenge_lock.
+static void challenge_release(int32_t idx) {
+    timer_cancel(&g_slots[idx].c.expire_timer);
+
+    pthread_mutex_lock(&g_challenge_lock);
+    memset(&g_slots[idx], 0, sizeof(challenge_slot_t));
+    g_slots[idx].id_next = g_free;
+    g_free = idx;
+    pthread_mutex_unlock(&g_challenge_lock);
+}
+
+bool challenge_create(const char *challenger_id, const char *target_id,
+                      int challenger_sock, int target_sock,
+                      const char *game_mode, int time_control, char *out_id) {
+    pthread_mutex_lock(&g_challenge_lock);
+    if (!g_slots) {
+        pthread_mutex_unlock(&g_challenge_lock);
+        log_error("Challenge manager not initialized");
+        return false;
     }
-    
-    if (slot == -1) {
-        log_error("No free challenge slot");
-        return NULL;
+
+    // Check if already has pending challenge between these players
+    if (find_pending(true, challenger_id, target_id) != CHALLENGE_NIL ||
+        find_pending(true, target_id, challenger_id) != CHALLENGE_NIL) {
+        pthread_mutex_unlock(&g_challenge_lock);
+        log_warn("Challenge already exists between %s and %s",
+                 challenger_id, target_id);
+        return false;
     }
-    
-    challenge_session_t *c = &challenges[slot];
-    
-    generate_challenge_id(c->challenge_id);
+
+    int32_t idx = g_free;
+    if (idx != CHALLENGE_NIL) {
+        g_free = g_slots[idx].id_next;
+    } else if (g_high_water < g_capacity) {
+        idx = g_high_water++;
+    } else {
+        pthread_mutex_unlock(&g_challenge_lock);
+        log_error("Challenge limit reached");
+        return false;
+    }
+
+    challenge_slot_t *slot = &g_slots[idx];
+    challenge_session_t *c = &slot->c;
+
+    // Khởi động + số thứ tự: không trùng trong một lần chạy lẫn giữa các lần
+    snprintf(c->challenge_id, sizeof(c->challenge_id), "chal_%lx_%llu",
+             g_boot_time, (unsigned long long)++g_next_seq);
     strncpy(c->challenger_id, challenger_id, 63);
     strncpy(c->target_id, target_id, 63);
     c->challenger_socket = challenger_sock;
@@ -75,134 +219,161 @@ char* challenge_create(const char *challenger_id, const char *target_id,
     c->expires_at = c->created_at + CHALLENGE_EXPIRE_TIME;
     c->status = CHALLENGE_STATUS_PENDING;
     c->is_active = true;
-    
+
+    slot->id_hash = hash_key(c->challenge_id);
+    slot->challenger_hash = hash_key(c->challenger_id);
+    slot->target_hash = hash_key(c->target_id);
+    index_link(idx);
     challenge_count++;
-    
-    log_info("Challenge created: %s (%s → %s)", 
-             c->challenge_id, challenger_id, target_id);
-    
-    return c->challenge_id;
+
+    // Callback timer chạy ngoài lock của timer wheel nên arm ở đây an toàn
+    timer_init(&c->expire_timer, challenge_expire_fired, slot);
+    timer_arm(&c->expire_timer, (uint64_t)CHALLENGE_EXPIRE_TIME * 1000);
+
+    memcpy(out_id, c->challenge_id, sizeof(c->challenge_id));
+    pthread_mutex_unlock(&g_challenge_lock);
+
+    log_info("Challenge created: %s (%s → %s)",
+             out_id, challenger_id, target_id);
+
+    return true;
+}
+
+// Chuyển PENDING sang status mới (false nếu không còn PENDING)
+static bool challenge_transition(const char *challenge_id, challenge_status_t status) {
+    pthread_mutex_lock(&g_challenge_lock);
+    int32_t idx = g_slots ? find_by_id(challenge_id) : CHALLENGE_NIL;
+    bool ok = idx != CHALLENGE_NIL && g_slots[idx].c.status == CHALLENGE_STATUS_PENDING;
+    if (ok) {
+        g_slots[idx].c.status = status;
+    }
+    pthread_mutex_unlock(&g_challenge_lock);
+    return ok;
 }
 
 bool challenge_accept(const char *challenge_id) {
-    challenge_session_t *c = challenge_get(challenge_id);
-    if (!c || c->status != CHALLENGE_STATUS_PENDING) {
+    if (!challenge_transition(challenge_id, CHALLENGE_STATUS_ACCEPTED)) {
         return false;
     }
-    
-    c->status = CHALLENGE_STATUS_ACCEPTED;
     log_info("Challenge accepted: %s", challenge_id);
     return true;
 }
 
 bool challenge_decline(const char *challenge_id) {
-    challenge_session_t *c = challenge_get(challenge_id);
-    if (!c || c->status != CHALLENGE_STATUS_PENDING) {
+    if (!challenge_transition(challenge_id, CHALLENGE_STATUS_DECLINED)) {
         return false;
     }
-    
-    c->status = CHALLENGE_STATUS_DECLINED;
     log_info("Challenge declined: %s", challenge_id);
     return true;
 }
 
 bool challenge_cancel(const char *challenge_id) {
-    challenge_session_t *c = challenge_get(challenge_id);
-    if (!c || c->status != CHALLENGE_STATUS_PENDING) {
+    if (!challenge_transition(challenge_id, CHALLENGE_STATUS_CANCELLED)) {
         return false;
     }
-    
-    c->status = CHALLENGE_STATUS_CANCELLED;
     log_info("Challenge cancelled: %s", challenge_id);
     return true;
 }
 
+bool challenge_expire(const char *challenge_id) {
+    if (!challenge_transition(challenge_id, CHALLENGE_STATUS_EXPIRED)) {
+        return false;
+    }
+    log_info("Challenge expired: %s", challenge_id);
+    return true;
+}
+
 bool challenge_remove(const char *challenge_id) {
-    for (int i = 0; i < MAX_CHALLENGES; i++) {
-        if (challenges[i].is_active && 
-            strcmp(challenges[i].challenge_id, challenge_id) == 0) {
-            memset(&challenges[i], 0, sizeof(challenge_session_t));
-            challenge_count--;
-            log_info("Challenge removed: %s", challenge_id);
-            return true;
-        }
+    pthread_mutex_lock(&g_challenge_lock);
+    int32_t idx = g_slots ? find_by_id(challenge_id) : CHALLENGE_NIL;
+    if (idx != CHALLENGE_NIL) {
+        challenge_detach(idx);
     }
-    return false;
+    pthread_mutex_unlock(&g_challenge_lock);
+
+    if (idx == CHALLENGE_NIL) return false;
+
+    // Gỡ timer trước khi slot được dùng lại
+    challenge_release(idx);
+    log_info("Challenge removed: %s", challenge_id);
+    return true;
 }
 
-challenge_session_t* challenge_get(const char *challenge_id) {
-    for (int i = 0; i < MAX_CHALLENGES; i++) {
-        if (challenges[i].is_active && 
-            strcmp(challenges[i].challenge_id, challenge_id) == 0) {
-            return &challenges[i];
-        }
+bool challenge_get(const char *challenge_id, challenge_session_t *out) {
+    pthread_mutex_lock(&g_challenge_lock);
+    int32_t idx = g_slots ? find_by_id(challenge_id) : CHALLENGE_NIL;
+    if (idx != CHALLENGE_NIL) {
+        *out = g_slots[idx].c;
     }
-    return NULL;
+    pthread_mutex_unlock(&g_challenge_lock);
+    return idx != CHALLENGE_NIL;
 }
 
-challenge_session_t* challenge_find_by_challenger(const char *user_id) {
-    for (int i = 0; i < MAX_CHALLENGES; i++) {
-        if (challenges[i].is_active && 
-            strcmp(challenges[i].challenger_id, user_id) == 0 &&
-            challenges[i].status == CHALLENGE_STATUS_PENDING) {
-            return &challenges[i];
-        }
+bool challenge_find_by_challenger(const char *user_id, challenge_session_t *out) {
+    pthread_mutex_lock(&g_challenge_lock);
+    int32_t idx = g_slots ? find_pending(true, user_id, NULL) : CHALLENGE_NIL;
+    if (idx != CHALLENGE_NIL) {
+        *out = g_slots[idx].c;
     }
-    return NULL;
+    pthread_mutex_unlock(&g_challenge_lock);
+    return idx != CHALLENGE_NIL;
 }
 
-challenge_session_t* challenge_find_by_target(const char *user_id) {
-    for (int i = 0; i < MAX_CHALLENGES; i++) {
-        if (challenges[i].is_active && 
-            strcmp(challenges[i].target_id, user_id) == 0 &&
-            challenges[i].status == CHALLENGE_STATUS_PENDING) {
-            return &challenges[i];
-        }
+bool challenge_find_by_target(const char *user_id, challenge_session_t *out) {
+    pthread_mutex_lock(&g_challenge_lock);
+    int32_t idx = g_slots ? find_pending(false, user_id, NULL) : CHALLENGE_NIL;
+    if (idx != CHALLENGE_NIL) {
+        *out = g_slots[idx].c;
     }
-    return NULL;
-}
-
-void challenge_check_expired(void) {
-    int64_t now = time(NULL);
-    
-    for (int i = 0; i < MAX_CHALLENGES; i++) {
-        if (challenges[i].is_active && 
-            challenges[i].status == CHALLENGE_STATUS_PENDING &&
-            now >= challenges[i].expires_at) {
-            
-            log_info("Challenge expired: %s", challenges[i].challenge_id);
-            
-            // Update status
-            challenges[i].status = CHALLENGE_STATUS_EXPIRED;
-            
-            // ✅ SEND EXPIRATION MESSAGES TO BOTH PLAYERS
-            
-            // Send to challenger
-            if (challenges[i].challenger_socket > 0) {
-                message_t expire_msg = {0};
-                expire_msg.type = MSG_CHALLENGE_EXPIRED;
-                strncpy(expire_msg.payload.challenge_resp.challenge_id, 
-                        challenges[i].challenge_id, 64);
-                
-                ws_send_message(challenges[i].challenger_socket, &expire_msg);
-                log_info("Sent CHALLENGE_EXPIRED to challenger (socket %d)", 
-                         challenges[i].challenger_socket);
-            }
-            
-            // Send to target
-            if (challenges[i].target_socket > 0) {
-                message_t expire_msg = {0};
-                expire_msg.type = MSG_CHALLENGE_EXPIRED;
-                strncpy(expire_msg.payload.challenge_resp.challenge_id, 
-                        challenges[i].challenge_id, 64);
-                
-                ws_send_message(challenges[i].target_socket, &expire_msg);
-                log_info("Sent CHALLENGE_EXPIRED to target (socket %d)", 
-                         challenges[i].target_socket);
-            }
-            
-            // ✅ Remove challenge after expiration
-            challenge_remove(challenges[i].challenge_id);
-        }
+    pthread_mutex_unlock(&g_challenge_lock);
+    return idx != CHALLENGE_NIL;
+}
+
+// Timer của từng challenge: chỉ chạy đúng lúc hết hạn, không quét cả mảng
+static void challenge_expire_fired(void *arg) {
+    challenge_slot_t *slot = (challenge_slot_t*)arg;
+    int32_t idx = (int32_t)(slot - g_slots);
+
+    // Slot chỉ được dùng lại sau timer_cancel, nên ở đây vẫn là challenge cũ
+    pthread_mutex_lock(&g_challenge_lock);
+    if (!slot->c.is_active || slot->c.status != CHALLENGE_STATUS_PENDING) {
+        pthread_mutex_unlock(&g_challenge_lock);
+        return;
     }
+    slot->c.status = CHALLENGE_STATUS_EXPIRED;
+    challenge_session_t c = slot->c;
+    challenge_detach(idx);
+    pthread_mutex_unlock(&g_challenge_lock);
+
+    log_info("Challenge expired: %s", c.challenge_id);
+
+    // ✅ SEND EXPIRATION MESSAGES TO BOTH PLAYERS
+
+    // Send to challenger
+    if (c.challenger_socket > 0) {
+        message_t expire_msg = {0};
+        expire_msg.type = MSG_CHALLENGE_EXPIRED;
+        strncpy(expire_msg.payload.challenge_resp.challenge_id,
+                c.challenge_id, 64);
+
+        ws_send_message(c.challenger_socket, &expire_msg);
+        log_info("Sent CHALLENGE_EXPIRED to challenger (socket %d)",
+                 c.challenger_socket);
+    }
+
+    // Send to target
+    if (c.target_socket > 0) {
+        message_t expire_msg = {0};
+        expire_msg.type = MSG_CHALLENGE_EXPIRED;
+        strncpy(expire_msg.payload.challenge_resp.challenge_id,
+                c.challenge_id, 64);
+
+        ws_send_message(c.target_socket, &expire_msg);
+        log_info("Sent CHALLENGE_EXPIRED to target (socket %d)",
+                 c.target_socket);
+    }
+
+    // ✅ Remove challenge after expiration (timer_cancel trên thread timer
+    // không chờ chính callback này)
+    challenge_release(idx);
 }
@@ -2,154 +2,764 @@
 #include "game/game.h"
 #include "network/ws_protocol.h"
 #include "utils/logger.h"
+#include "utils/timer_wheel.h"
+#include "config.h"
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <errno.h>
 #include <time.h>
 
-#define MAX_QUEUE_SIZE 1000
-#define ELO_TOLERANCE 200 // Chênh lệch ELO tối đa
+#define ELO_TOLERANCE 200 // Chênh lệch ELO cho phép lúc mới vào hàng đợi
+#define MATCH_WIDEN_ELO 50         // Nới thêm ngần này ELO ...
+#define MATCH_WIDEN_MS 5000        // ... sau mỗi khoảng chờ này
+#define MATCH_ELO_MAX 4095                           // ELO được kẹp vào [0, MATCH_ELO_MAX]
+#define MATCH_ELO_BUCKETS (MATCH_ELO_MAX + 1)        // Mỗi giá trị ELO một bucket
+#define MATCH_BITMAP_WORDS (MATCH_ELO_BUCKETS / 64)
+#define MATCH_MAX_GAME_TYPES 8
+#define MATCH_NIL (-1)
+#define MATCH_WAIT_BINS 160        // Histogram thời gian chờ: 4 bin mỗi lũy thừa 2 (ms)
+#define MATCH_BATCH_WINDOW 4       // Batch: chỉ ghép trong ngần này người liền kề theo ELO
 
-static queue_player_t queue[MAX_QUEUE_SIZE];
-static int queue_count = 0;
+// Người chơi nằm trong mảng slot cố định: nối vào bucket ELO qua prev/next
+// (slot rảnh nối qua next thành free list), vào bảng user_id qua hash_next.
+typedef struct {
+    queue_player_t player;
+    uint64_t hash;
+    int32_t prev;
+    int32_t next;
+    int32_t hash_next;
+    int32_t age_prev;              // Thứ tự vào hàng đợi (mọi game type)
+    int32_t age_next;
+    uint8_t pool;
+    bool used;
+} match_slot_t;
 
-void matcher_init() {
+// Một game type: bucket FIFO theo ELO và bitmap các bucket khác rỗng
+typedef struct {
+    char name[32];
+    int count;
+    uint64_t nonempty[MATCH_BITMAP_WORDS];
+    int32_t head[MATCH_ELO_BUCKETS];
+    int32_t tail[MATCH_ELO_BUCKETS];
+} match_pool_t;
+
+// Cặp đã rời hàng đợi, chờ tạo game
+typedef struct {
+    queue_player_t p1;             // Người chờ lâu hơn
+    queue_player_t p2;
+} match_pair_t;
+
+// Yêu cầu join/leave từ thread mạng, chờ matchmaking thread áp vào index
+typedef enum {
+    MATCH_OP_JOIN,
+    MATCH_OP_LEAVE
+} match_op_type_t;
+
+typedef struct match_op {
+    struct match_op *next;
+    match_op_type_t type;
+    queue_player_t player;         // LEAVE: chỉ dùng user_id
+} match_op_t;
+
+// Index dưới đây chỉ matchmaking thread đọc/ghi (không lock). Thread khác
+// chỉ push vào intake (MPSC, không lock) và đọc stats qua g_stats_lock.
+static pthread_mutex_t g_stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static match_op_t g_intake_stub;
+static match_op_t *g_intake_head = &g_intake_stub;   // Consumer (matchmaking thread)
+static match_op_t *g_intake_tail = &g_intake_stub;   // Producer
+static uint64_t g_intake_pending = 0;
+static uint64_t g_intake_ops = 0;
+static match_slot_t *g_slots = NULL;
+static int32_t g_capacity = 0;
+static int32_t g_high_water = 0;   // Slot chưa từng dùng bắt đầu từ đây
+static int32_t g_free = MATCH_NIL;
+static int32_t *g_hash = NULL;
+static size_t g_hash_mask = 0;
+static match_pool_t *g_pools[MATCH_MAX_GAME_TYPES];
+static int g_pool_count = 0;
+static int queue_count = 0;       // Thread khác đọc qua __atomic_load_n
+static int32_t g_age_head = MATCH_NIL;   // Người chờ lâu nhất
+static int32_t g_age_tail = MATCH_NIL;
+
+static int g_tick_ms = 250;
+static bool g_batch_mode = false;
+
+// Thời gian chờ tới khi được ghép, theo band ELO (giữ g_stats_lock)
+static uint32_t g_wait_hist[MATCH_ELO_BANDS][MATCH_WAIT_BINS];
+static uint64_t g_wait_max_ms[MATCH_ELO_BANDS];
+static uint64_t g_passes = 0;
+static uint64_t g_pass_max_ms = 0;
+static uint64_t g_matches = 0;
+static uint64_t g_elo_gap_total = 0;
+static uint64_t g_create_failures = 0;
+
+static uint64_t hash_key(const char *s) {
+    uint64_t h = 1469598103934665603ULL;  // FNV-1a
+    while (*s) {
+        h ^= (unsigned char)*s++;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+static int elo_bucket(int elo_rating) {
+    if (elo_rating < 0) return 0;
+    if (elo_rating > MATCH_ELO_MAX) return MATCH_ELO_MAX;
+    return elo_rating;
+}
+
+bool matcher_init() {
+    g_capacity = get_match_queue_max();
+
+    size_t buckets = 1;
+    while (buckets < (size_t)g_capacity) buckets <<= 1;
+
+    g_slots = calloc((size_t)g_capacity, sizeof(match_slot_t));
+    g_hash = malloc(buckets * sizeof(int32_t));
+    if (!g_slots || !g_hash) {
+        free(g_slots);
+        free(g_hash);
+        g_slots = NULL;
+        g_hash = NULL;
+        log_error("Failed to allocate matchmaking queue (%d players)", g_capacity);
+        return false;
+    }
+    memset(g_hash, 0xFF, buckets * sizeof(int32_t));   // MATCH_NIL
+    g_hash_mask = buckets - 1;
+    g_high_water = 0;
+    g_free = MATCH_NIL;
+    g_age_head = g_age_tail = MATCH_NIL;
     queue_count = 0;
-    log_info("Matchmaking system initialized");
+    g_batch_mode = get_match_batch_mode();
+
+    log_info("Matchmaking system initialized (capacity %d, %s pairing)",
+             g_capacity, g_batch_mode ? "batch" : "greedy");
+    return true;
 }
 
+static match_op_t* intake_pop(void);
+
 void matcher_cleanup() {
+    match_op_t *op;
+    while ((op = intake_pop()) != NULL) {
+        free(op);
+    }
+    for (int i = 0; i < g_pool_count; i++) {
+        free(g_pools[i]);
+        g_pools[i] = NULL;
+    }
+    g_pool_count = 0;
+    free(g_slots);
+    free(g_hash);
+    g_slots = NULL;
+    g_hash = NULL;
     queue_count = 0;
     log_info("Matchmaking system cleaned up");
 }
 
-// ==================== Queue Operations ====================
-bool matcher_add_to_queue(int client_sock, const char *user_id, int elo_rating, const char *game_type) {
-    if (queue_count >= MAX_QUEUE_SIZE) {
-        log_warn("Queue full, cannot add player %s", user_id);
-        return false;
+// ==================== Index (chỉ matchmaking thread) ====================
+static int pool_index(const char *game_type, bool create) {
+    for (int i = 0; i < g_pool_count; i++) {
+        if (strcmp(g_pools[i]->name, game_type) == 0) return i;
     }
-    
-    // Kiểm tra xem player đã trong queue chưa
-    for (int i = 0; i < queue_count; i++) {
-        if (strcmp(queue[i].user_id, user_id) == 0) {
-            log_warn("Player %s already in queue", user_id);
-            return false;
-        }
+    if (!create || g_pool_count >= MATCH_MAX_GAME_TYPES) return MATCH_NIL;
+
+    match_pool_t *pool = calloc(1, sizeof(match_pool_t));
+    if (!pool) return MATCH_NIL;
+    strncpy(pool->name, game_type, sizeof(pool->name) - 1);
+    memset(pool->head, 0xFF, sizeof(pool->head));
+    memset(pool->tail, 0xFF, sizeof(pool->tail));
+    g_pools[g_pool_count] = pool;
+    return g_pool_count++;
+}
+
+static void pool_link(match_pool_t *pool, int32_t idx) {
+    match_slot_t *slot = &g_slots[idx];
+    int b = elo_bucket(slot->player.elo_rating);
+
+    slot->next = MATCH_NIL;
+    slot->prev = pool->tail[b];
+    if (pool->tail[b] != MATCH_NIL) {
+        g_slots[pool->tail[b]].next = idx;
+    } else {
+        pool->head[b] = idx;
+        pool->nonempty[b >> 6] |= 1ULL << (b & 63);
     }
-    
-    // Thêm vào queue
-    queue_player_t *player = &queue[queue_count];
-    strncpy(player->user_id, user_id, 63);
-    player->user_id[63] = '\0';
-    player->socket = client_sock;
-    player->elo_rating = elo_rating;
-    strncpy(player->game_type, game_type, 31);
-    player->game_type[31] = '\0';
-    player->join_time = time(NULL);
-    
-    queue_count++;
-    log_info("Player %s added to queue (ELO: %d, Type: %s). Queue size: %d", 
-             user_id, elo_rating, game_type, queue_count);
-    
-    // Tự động tìm trận đấu
-    matcher_find_match();
-    
-    return true;
+    pool->tail[b] = idx;
+    pool->count++;
 }
 
-bool matcher_remove_from_queue(const char *user_id) {
-    for (int i = 0; i < queue_count; i++) {
-        if (strcmp(queue[i].user_id, user_id) == 0) {
-            // Xóa bằng cách shift array
-            for (int j = i; j < queue_count - 1; j++) {
-                queue[j] = queue[j + 1];
-            }
-            queue_count--;
-            log_info("Player %s removed from queue. Queue size: %d", user_id, queue_count);
-            return true;
+static void pool_unlink(match_pool_t *pool, int32_t idx) {
+    match_slot_t *slot = &g_slots[idx];
+    int b = elo_bucket(slot->player.elo_rating);
+
+    if (slot->prev != MATCH_NIL) g_slots[slot->prev].next = slot->next;
+    else pool->head[b] = slot->next;
+    if (slot->next != MATCH_NIL) g_slots[slot->next].prev = slot->prev;
+    else pool->tail[b] = slot->prev;
+
+    if (pool->head[b] == MATCH_NIL) {
+        pool->nonempty[b >> 6] &= ~(1ULL << (b & 63));
+    }
+    pool->count--;
+}
+
+static int32_t hash_find(const char *user_id, uint64_t h) {
+    int32_t idx = g_hash[h & g_hash_mask];
+    while (idx != MATCH_NIL &&
+           (g_slots[idx].hash != h || strcmp(g_slots[idx].player.user_id, user_id) != 0)) {
+        idx = g_slots[idx].hash_next;
+    }
+    return idx;
+}
+
+static void hash_remove(int32_t idx) {
+    int32_t *pp = &g_hash[g_slots[idx].hash & g_hash_mask];
+    while (*pp != idx) pp = &g_slots[*pp].hash_next;
+    *pp = g_slots[idx].hash_next;
+}
+
+// Bucket khác rỗng đầu tiên trong [from, to], MATCH_NIL nếu không có
+static int bitmap_next(const uint64_t *bits, int from, int to) {
+    if (from < 0) from = 0;
+    if (to > MATCH_ELO_MAX) to = MATCH_ELO_MAX;
+    while (from <= to) {
+        int w = from >> 6;
+        uint64_t word = bits[w] & (~0ULL << (from & 63));
+        if (word) {
+            int b = (w << 6) + __builtin_ctzll(word);
+            return b <= to ? b : MATCH_NIL;
         }
+        from = (w + 1) << 6;
     }
-    return false;
+    return MATCH_NIL;
 }
 
-queue_player_t* matcher_get_player(const char *user_id) {
-    for (int i = 0; i < queue_count; i++) {
-        if (strcmp(queue[i].user_id, user_id) == 0) {
-            return &queue[i];
+// Bucket khác rỗng cuối cùng trong [from, to]
+static int bitmap_prev(const uint64_t *bits, int from, int to) {
+    if (from < 0) from = 0;
+    if (to > MATCH_ELO_MAX) to = MATCH_ELO_MAX;
+    while (to >= from) {
+        int w = to >> 6;
+        uint64_t word = bits[w] & (~0ULL >> (63 - (to & 63)));
+        if (word) {
+            int b = (w << 6) + 63 - __builtin_clzll(word);
+            return b >= from ? b : MATCH_NIL;
         }
+        to = (w << 6) - 1;
+    }
+    return MATCH_NIL;
+}
+
+// Đối thủ gần ELO nhất của self trong tầm tolerance; cùng khoảng cách thì
+// người chờ lâu hơn
+static int32_t pool_nearest(const match_pool_t *pool, int32_t self, int tolerance) {
+    int b = elo_bucket(g_slots[self].player.elo_rating);
+    int32_t same = pool->head[b];
+    if (same == self) same = g_slots[self].next;
+    if (same != MATCH_NIL) return same;
+
+    int below = bitmap_prev(pool->nonempty, b - tolerance, b - 1);
+    int above = bitmap_next(pool->nonempty, b + 1, b + tolerance);
+
+    if (below == MATCH_NIL && above == MATCH_NIL) return MATCH_NIL;
+    if (below == MATCH_NIL) return pool->head[above];
+    if (above == MATCH_NIL) return pool->head[below];
+
+    int32_t lo = pool->head[below];
+    int32_t hi = pool->head[above];
+    if (b - below != above - b) return (b - below < above - b) ? lo : hi;
+    return g_slots[lo].player.join_time <= g_slots[hi].player.join_time ? lo : hi;
+}
+
+// Chờ càng lâu thì chấp nhận đối thủ lệch ELO càng nhiều
+static int match_tolerance(const queue_player_t *player, uint64_t now) {
+    uint64_t waited = now > (uint64_t)player->join_time ? now - (uint64_t)player->join_time : 0;
+    uint64_t tolerance = ELO_TOLERANCE + (waited / MATCH_WIDEN_MS) * MATCH_WIDEN_ELO;
+    return tolerance > MATCH_ELO_MAX ? MATCH_ELO_MAX : (int)tolerance;
+}
+
+static int elo_band(int elo_rating) {
+    if (elo_rating < 800) return 0;
+    if (elo_rating >= 2000) return MATCH_ELO_BANDS - 1;
+    return (elo_rating - 400) / 400;
+}
+
+static int wait_bin(uint64_t ms) {
+    if (ms < 4) return (int)ms;
+    int msb = 63 - __builtin_clzll(ms);
+    int bin = (msb - 1) * 4 + (int)((ms >> (msb - 2)) & 3);
+    return bin < MATCH_WAIT_BINS ? bin : MATCH_WAIT_BINS - 1;
+}
+
+// Giá trị lớn nhất mà bin chứa (sai số tối đa 25%)
+static uint64_t wait_bin_upper(int bin) {
+    if (bin < 4) return (uint64_t)bin;
+    int msb = bin / 4 + 1;
+    return ((uint64_t)(4 + bin % 4 + 1) << (msb - 2)) - 1;
+}
+
+static void record_pair(const match_pair_t *pair) {
+    g_elo_gap_total += (uint64_t)abs(elo_bucket(pair->p1.elo_rating) - elo_bucket(pair->p2.elo_rating));
+}
+
+static void record_wait(const queue_player_t *player, uint64_t now) {
+    uint64_t waited = now > (uint64_t)player->join_time ? now - (uint64_t)player->join_time : 0;
+    int band = elo_band(player->elo_rating);
+    g_wait_hist[band][wait_bin(waited)]++;
+    if (waited > g_wait_max_ms[band]) g_wait_max_ms[band] = waited;
+}
+
+static bool queue_insert(const queue_player_t *player) {
+    int pool = pool_index(player->game_type, true);
+    if (pool == MATCH_NIL) {
+        log_warn("Too many game types, cannot queue %s (%s)", player->user_id, player->game_type);
+        return false;
+    }
+
+    int32_t idx = g_free;
+    if (idx != MATCH_NIL) {
+        g_free = g_slots[idx].next;
+    } else if (g_high_water < g_capacity) {
+        idx = g_high_water++;
+    } else {
+        log_warn("Queue full, cannot add player %s", player->user_id);
+        return false;
+    }
+
+    match_slot_t *slot = &g_slots[idx];
+    slot->player = *player;
+    slot->hash = hash_key(player->user_id);
+    slot->pool = (uint8_t)pool;
+    slot->used = true;
+    pool_link(g_pools[pool], idx);
+
+    slot->hash_next = g_hash[slot->hash & g_hash_mask];
+    g_hash[slot->hash & g_hash_mask] = idx;
+
+    slot->age_next = MATCH_NIL;
+    slot->age_prev = g_age_tail;
+    if (g_age_tail != MATCH_NIL) g_slots[g_age_tail].age_next = idx;
+    else g_age_head = idx;
+    g_age_tail = idx;
+
+    __atomic_store_n(&queue_count, queue_count + 1, __ATOMIC_RELAXED);
+    return true;
+}
+
+static void queue_remove(int32_t idx) {
+    match_slot_t *slot = &g_slots[idx];
+    pool_unlink(g_pools[slot->pool], idx);
+    hash_remove(idx);
+
+    if (slot->age_prev != MATCH_NIL) g_slots[slot->age_prev].age_next = slot->age_next;
+    else g_age_head = slot->age_next;
+    if (slot->age_next != MATCH_NIL) g_slots[slot->age_next].age_prev = slot->age_prev;
+    else g_age_tail = slot->age_prev;
+
+    slot->used = false;
+    slot->next = g_free;
+    g_free = idx;
+    __atomic_store_n(&queue_count, queue_count - 1, __ATOMIC_RELAXED);
+}
+
+// ==================== Match start ====================
+static bool match_start(const match_pair_t *pair) {
+    const queue_player_t *p1 = &pair->p1;
+    const queue_player_t *p2 = &pair->p2;
+
+    log_info("Match found! %s (ELO: %d) vs %s (ELO: %d)",
+             p1->user_id, p1->elo_rating, p2->user_id, p2->elo_rating);
+
+    // Tạo game session (socket gán trước khi game vào registry)
+    game_session_t *game = game_create(p1->user_id, p2->user_id, p1->socket, p2->socket);
+    if (!game) {
+        log_error("Failed to create game for %s vs %s", p1->user_id, p2->user_id);
+        return false;
+    }
+
+    // id và tên không đổi sau khi tạo, đọc không cần state_lock
+    char game_id[65], p1_name[32], p2_name[32];
+    memcpy(game_id, game->game_id, sizeof(game_id));
+    memcpy(p1_name, game->player1_name, sizeof(p1_name));
+    memcpy(p2_name, game->player2_name, sizeof(p2_name));
+    game_release(game);
+
+    // Gửi START_GAME message cho cả 2 players
+    message_t msg1 = {0};
+    msg1.type = MSG_START_GAME;
+    strncpy(msg1.payload.start_game.opponent, p2_name, 31);
+    strncpy(msg1.payload.start_game.game_id, game_id, 63);
+    ws_send_message(p1->socket, &msg1);
+
+    message_t msg2 = {0};
+    msg2.type = MSG_START_GAME;
+    strncpy(msg2.payload.start_game.opponent, p1_name, 31);
+    strncpy(msg2.payload.start_game.game_id, game_id, 63);
+    ws_send_message(p2->socket, &msg2);
+
+    log_info("Game started: %s", game_id);
+    return true;
+}
+
+// Không tạo được game: trả cả hai về hàng đợi (không ghép lại ngay)
+// Leave gửi tới trong lúc tạo game nằm trong intake, lượt sau sẽ áp sau
+// bước này nên vẫn gỡ được người chơi ra.
+static void match_requeue(const match_pair_t *pair) {
+    queue_insert(&pair->p1);
+    queue_insert(&pair->p2);
+}
+
+// ==================== Intake (MPSC) ====================
+static void intake_push(match_op_t *op) {
+    op->next = NULL;
+    match_op_t *prev = __atomic_exchange_n(&g_intake_tail, op, __ATOMIC_ACQ_REL);
+    __atomic_store_n(&prev->next, op, __ATOMIC_RELEASE);
+}
+
+// Consumer side (matchmaking thread). NULL nếu rỗng hoặc producer đang push
+// dở; phần còn lại được lấy ở tick sau.
+static match_op_t* intake_pop(void) {
+    match_op_t *head = g_intake_head;
+    match_op_t *next = __atomic_load_n(&head->next, __ATOMIC_ACQUIRE);
+
+    if (head == &g_intake_stub) {
+        if (!next) return NULL;
+        g_intake_head = next;
+        head = next;
+        next = __atomic_load_n(&next->next, __ATOMIC_ACQUIRE);
+    }
+
+    if (next) {
+        g_intake_head = next;
+        return head;
+    }
+
+    if (head != __atomic_load_n(&g_intake_tail, __ATOMIC_ACQUIRE)) return NULL;
+
+    intake_push(&g_intake_stub);
+    next = __atomic_load_n(&head->next, __ATOMIC_ACQUIRE);
+    if (next) {
+        g_intake_head = next;
+        return head;
     }
+
     return NULL;
 }
 
+static bool intake_submit(match_op_type_t type, const queue_player_t *player) {
+    if (!g_slots) {
+        log_error("Matchmaking not initialized");
+        return false;
+    }
+
+    match_op_t *op = malloc(sizeof(match_op_t));
+    if (!op) {
+        log_error("Out of memory queuing matchmaking request for %s", player->user_id);
+        return false;
+    }
+    op->type = type;
+    op->player = *player;
+
+    __atomic_add_fetch(&g_intake_pending, 1, __ATOMIC_RELAXED);
+    intake_push(op);
+    return true;
+}
+
+// Áp các yêu cầu đã nhận theo đúng thứ tự push
+static void intake_apply(void) {
+    match_op_t *op;
+    uint64_t applied = 0;
+
+    while ((op = intake_pop()) != NULL) {
+        const queue_player_t *player = &op->player;
+        int32_t idx = hash_find(player->user_id, hash_key(player->user_id));
+
+        if (op->type == MATCH_OP_JOIN) {
+            if (idx != MATCH_NIL) {
+                log_warn("Player %s already in queue", player->user_id);
+            } else if (queue_insert(player)) {
+                log_info("Player %s added to queue (ELO: %d, Type: %s). Queue size: %d",
+                         player->user_id, player->elo_rating, player->game_type, queue_count);
+            }
+        } else if (idx != MATCH_NIL) {
+            queue_remove(idx);
+            log_info("Player %s removed from queue. Queue size: %d", player->user_id, queue_count);
+        }
+
+        free(op);
+        applied++;
+    }
+
+    if (applied) {
+        __atomic_sub_fetch(&g_intake_pending, applied, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&g_intake_ops, applied, __ATOMIC_RELAXED);
+    }
+}
+
+// ==================== Queue Operations ====================
+// Chỉ push yêu cầu rồi trả về, không lock: matchmaking thread áp vào hàng
+// đợi ở đầu tick kế tiếp (join trùng bị bỏ qua lúc áp).
+bool matcher_add_to_queue(int client_sock, const char *user_id, int elo_rating, const char *game_type) {
+    queue_player_t player = {0};
+    strncpy(player.user_id, user_id, sizeof(player.user_id) - 1);
+    player.socket = client_sock;
+    player.elo_rating = elo_rating;
+    strncpy(player.game_type, game_type, sizeof(player.game_type) - 1);
+    player.join_time = (long long)timer_now_ms();
+
+    return intake_submit(MATCH_OP_JOIN, &player);
+}
+
+bool matcher_remove_from_queue(const char *user_id) {
+    queue_player_t player = {0};
+    strncpy(player.user_id, user_id, sizeof(player.user_id) - 1);
+
+    return intake_submit(MATCH_OP_LEAVE, &player);
+}
+
 int matcher_get_queue_size() {
-    return queue_count;
+    return __atomic_load_n(&queue_count, __ATOMIC_RELAXED);
 }
 
 // ==================== Matchmaking Logic ====================
-void matcher_find_match() {
-    if (queue_count < 2) {
-        log_debug("Not enough players in queue (%d)", queue_count);
-        return;
-    }
-    
-    // Simple matching: tìm 2 player có ELO gần nhau
-    for (int i = 0; i < queue_count - 1; i++) {
-        for (int j = i + 1; j < queue_count; j++) {
-            queue_player_t *p1 = &queue[i];
-            queue_player_t *p2 = &queue[j];
-            
-            // Kiểm tra game type giống nhau
-            if (strcmp(p1->game_type, p2->game_type) != 0) {
-                continue;
+// Duyệt theo thứ tự vào hàng đợi: người chờ lâu nhất chọn trước, lấy đối thủ
+// gần ELO nhất trong tầm của mình. Những người chờ lâu hơn đã không chọn ai
+// trong tầm của họ, nên tầm của người đang xét là tầm rộng nhất còn lại.
+static int collect_pairs(match_pair_t *pairs, int max_pairs, uint64_t now) {
+    int n = 0;
+    int32_t idx = g_age_head;
+
+    while (idx != MATCH_NIL && n < max_pairs) {
+        match_slot_t *slot = &g_slots[idx];
+        int32_t opponent = pool_nearest(g_pools[slot->pool], idx,
+                                        match_tolerance(&slot->player, now));
+        int32_t next = slot->age_next;
+        if (opponent == MATCH_NIL) {
+            idx = next;
+            continue;
+        }
+        if (next == opponent) next = g_slots[opponent].age_next;
+
+        pairs[n].p1 = slot->player;
+        pairs[n].p2 = g_slots[opponent].player;
+        record_wait(&pairs[n].p1, now);
+        record_wait(&pairs[n].p2, now);
+        record_pair(&pairs[n]);
+        n++;
+        queue_remove(idx);
+        queue_remove(opponent);
+        idx = next;
+    }
+
+    g_matches += (uint64_t)n;
+    return n;
+}
+
+// Batch: tối ưu cả pool trong một lượt. Duyệt bucket tăng dần cho dãy người
+// chơi đã sắp theo ELO, rồi quy hoạch động trên dãy đó:
+//   cost[j] = chi phí nhỏ nhất cho j người đầu
+//   - người j-1 chờ lượt sau: cost[j-1] + tầm ELO hiện tại của họ
+//   - ghép j-1 với a (trong cửa sổ, hợp lệ theo tầm của một trong hai):
+//     cost[a] + chênh ELO + tầm của những người ở giữa (chờ lượt sau)
+// Tầm ELO tăng theo thời gian chờ nên bỏ lại người chờ lâu rất đắt: DP ưu
+// tiên ghép họ, còn người mới thì được ghép sát ELO nhất có thể. O(n * cửa sổ).
+static int collect_pairs_batch(match_pair_t *pairs, int max_pairs, uint64_t now) {
+    int32_t *order = malloc((size_t)queue_count * sizeof(int32_t));
+    int *tolerance = malloc((size_t)queue_count * sizeof(int));
+    int64_t *cost = malloc(((size_t)queue_count + 1) * sizeof(int64_t));
+    uint8_t *choice = malloc((size_t)queue_count + 1);
+    if (!order || !tolerance || !cost || !choice) {
+        free(order);
+        free(tolerance);
+        free(cost);
+        free(choice);
+        return collect_pairs(pairs, max_pairs, now);
+    }
+
+    int n = 0;
+    for (int p = 0; p < g_pool_count && n < max_pairs; p++) {
+        match_pool_t *pool = g_pools[p];
+        int m = 0;
+        for (int b = bitmap_next(pool->nonempty, 0, MATCH_ELO_MAX); b != MATCH_NIL;
+             b = bitmap_next(pool->nonempty, b + 1, MATCH_ELO_MAX)) {
+            for (int32_t idx = pool->head[b]; idx != MATCH_NIL; idx = g_slots[idx].next) {
+                order[m] = idx;
+                tolerance[m] = match_tolerance(&g_slots[idx].player, now);
+                m++;
             }
-            
-            // Kiểm tra ELO chênh lệch
-            int elo_diff = abs(p1->elo_rating - p2->elo_rating);
-            if (elo_diff > ELO_TOLERANCE) {
-                continue;
+        }
+        if (m < 2) continue;
+
+        cost[0] = 0;
+        for (int j = 1; j <= m; j++) {
+            int last = j - 1;
+            int last_elo = elo_bucket(g_slots[order[last]].player.elo_rating);
+
+            cost[j] = cost[j - 1] + tolerance[last];
+            choice[j] = 0;
+
+            int64_t between = 0;   // Tầm của những người nằm giữa a và last
+            for (int k = 1; k < MATCH_BATCH_WINDOW && last - k >= 0; k++) {
+                int a = last - k;
+                int gap = last_elo - elo_bucket(g_slots[order[a]].player.elo_rating);
+                int limit = tolerance[a] > tolerance[last] ? tolerance[a] : tolerance[last];
+                if (gap <= limit) {
+                    int64_t c = cost[a] + between + gap;
+                    if (c < cost[j]) {
+                        cost[j] = c;
+                        choice[j] = (uint8_t)k;
+                    }
+                }
+                between += tolerance[a];
             }
-            
-            log_info("Match found! %s (ELO: %d) vs %s (ELO: %d)", 
-                     p1->user_id, p1->elo_rating, p2->user_id, p2->elo_rating);
-            
-            // Tạo game session
-            char game_id[65];
-            if (!game_create(p1->user_id, p2->user_id, game_id)) {
-                log_error("Failed to create game for %s vs %s", p1->user_id, p2->user_id);
+        }
+
+        // Dựng lại các cặp từ cuối dãy, rồi mới gỡ khỏi hàng đợi
+        int first_pair = n;
+        for (int j = m; j > 0 && n < max_pairs; ) {
+            int k = choice[j];
+            if (k == 0) {
+                j--;
                 continue;
             }
+            const queue_player_t *x = &g_slots[order[j - 1 - k]].player;
+            const queue_player_t *y = &g_slots[order[j - 1]].player;
+            bool x_first = x->join_time <= y->join_time;
+            pairs[n].p1 = x_first ? *x : *y;
+            pairs[n].p2 = x_first ? *y : *x;
+            record_wait(x, now);
+            record_wait(y, now);
+            record_pair(&pairs[n]);
+            n++;
+            j -= k + 1;
+        }
+        for (int i = first_pair; i < n; i++) {
+            queue_remove(hash_find(pairs[i].p1.user_id, hash_key(pairs[i].p1.user_id)));
+            queue_remove(hash_find(pairs[i].p2.user_id, hash_key(pairs[i].p2.user_id)));
+        }
+    }
 
-            game_session_t *game = game_get(game_id);
-            if (game) {
-                game->player1_socket = p1->socket;
-                game->player2_socket = p2->socket;
-                log_info("Sockets assigned: player1=%d, player2=%d", p1->socket, p2->socket);
-            }
-            
-            // Gửi START_GAME message cho cả 2 players
-            message_t msg1 = {0};
-            msg1.type = MSG_START_GAME;
-            strncpy(msg1.payload.start_game.opponent, p2->user_id, 31);
-            strncpy(msg1.payload.start_game.game_id, game_id, 63);
-            ws_send_message(p1->socket, &msg1);
-            
-            message_t msg2 = {0};
-            msg2.type = MSG_START_GAME;
-            strncpy(msg2.payload.start_game.opponent, p1->user_id, 31);
-            strncpy(msg2.payload.start_game.game_id, game_id, 63);
-            ws_send_message(p2->socket, &msg2);
-            
-            log_info("Game started: %s", game_id);
-            
-            // Xóa cả 2 players khỏi queue
-            matcher_remove_from_queue(p1->user_id);
-            matcher_remove_from_queue(p2->user_id);
-            
-            // Tiếp tục tìm match cho các player còn lại
-            matcher_find_match();
-            return;
+    free(order);
+    free(tolerance);
+    free(cost);
+    free(choice);
+    g_matches += (uint64_t)n;
+    return n;
+}
+
+void matcher_find_match() {
+    uint64_t start = timer_now_ms();
+
+    intake_apply();
+    if (queue_count < 2) return;
+
+    int max_pairs = queue_count / 2;
+    match_pair_t *pairs = malloc((size_t)max_pairs * sizeof(match_pair_t));
+    int n = 0;
+    if (pairs) {
+        // record_* cập nhật stats trong lúc chọn cặp
+        pthread_mutex_lock(&g_stats_lock);
+        n = g_batch_mode ? collect_pairs_batch(pairs, max_pairs, start)
+                         : collect_pairs(pairs, max_pairs, start);
+        pthread_mutex_unlock(&g_stats_lock);
+    }
+
+    if (n == 0) {
+        log_debug("No suitable matches found");
+    }
+
+    // Cặp lỗi quay lại hàng đợi, lượt sau thử lại
+    int failures = 0;
+    for (int i = 0; i < n; i++) {
+        if (!match_start(&pairs[i])) {
+            match_requeue(&pairs[i]);
+            failures++;
+        }
+    }
+    free(pairs);
+
+    uint64_t elapsed = timer_now_ms() - start;
+    pthread_mutex_lock(&g_stats_lock);
+    g_passes++;
+    g_create_failures += (uint64_t)failures;
+    if (elapsed > g_pass_max_ms) g_pass_max_ms = elapsed;
+    pthread_mutex_unlock(&g_stats_lock);
+}
+
+static void* matcher_thread(void *arg) {
+    (void)arg;
+
+    while (1) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_nsec += (long)g_tick_ms * 1000000L;
+        deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+        deadline.tv_nsec %= 1000000000L;
+
+        // Không ai đánh thức sớm: join/leave chỉ nằm trong intake tới tick kế tiếp
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR) {
         }
+
+        matcher_find_match();
+    }
+
+    return NULL;
+}
+
+bool matcher_start() {
+    g_tick_ms = get_match_tick_ms();
+
+    pthread_t tid;
+    int result = pthread_create(&tid, NULL, matcher_thread, NULL);
+    if (result != 0) {
+        log_error("[MATCH] Failed to create thread: %d", result);
+        return false;
+    }
+    pthread_detach(tid);
+
+    log_info("[MATCH] Matchmaking thread started (tick=%dms, tolerance=%d +%d per %ds)",
+             g_tick_ms, ELO_TOLERANCE, MATCH_WIDEN_ELO, MATCH_WIDEN_MS / 1000);
+    return true;
+}
+
+// Percentile p (0-100) của một band từ histogram
+static uint64_t wait_percentile(const uint32_t *hist, uint64_t total, int p) {
+    if (total == 0) return 0;
+    uint64_t rank = (total * (uint64_t)p + 99) / 100;
+    uint64_t seen = 0;
+    for (int bin = 0; bin < MATCH_WAIT_BINS; bin++) {
+        seen += hist[bin];
+        if (seen >= rank) return wait_bin_upper(bin);
+    }
+    return wait_bin_upper(MATCH_WAIT_BINS - 1);
+}
+
+void matcher_stats(matcher_stats_t *out) {
+    memset(out, 0, sizeof(*out));
+
+    out->queued = (uint64_t)matcher_get_queue_size();
+    out->intake_pending = __atomic_load_n(&g_intake_pending, __ATOMIC_RELAXED);
+    out->intake_ops = __atomic_load_n(&g_intake_ops, __ATOMIC_RELAXED);
+
+    pthread_mutex_lock(&g_stats_lock);
+    out->passes = g_passes;
+    out->pass_max_ms = g_pass_max_ms;
+    out->matches = g_matches;
+    out->elo_gap_total = g_elo_gap_total;
+    out->create_failures = g_create_failures;
+
+    for (int band = 0; band < MATCH_ELO_BANDS; band++) {
+        uint64_t total = 0;
+        for (int bin = 0; bin < MATCH_WAIT_BINS; bin++) total += g_wait_hist[band][bin];
+
+        out->bands[band].players = total;
+        out->bands[band].p50_ms = wait_percentile(g_wait_hist[band], total, 50);
+        out->bands[band].p90_ms = wait_percentile(g_wait_hist[band], total, 90);
+        out->bands[band].p99_ms = wait_percentile(g_wait_hist[band], total, 99);
+        out->bands[band].max_ms = g_wait_max_ms[band];
     }
-    
-    log_debug("No suitable matches found");
+    pthread_mutex_unlock(&g_stats_lock);
 }
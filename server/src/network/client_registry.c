@@ -0,0 +1,204 @@
+#include "network/client_registry.h"
+#include "utils/logger.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#define REGISTRY_SHARDS 64                // Lũy thừa của 2
+#define REGISTRY_INITIAL_SLOTS 64         // Mỗi shard, lũy thừa của 2
+
+typedef struct {
+    char user_id[64];
+    int socket;                           // atomic, -1 = offline
+} client_entry_t;
+
+// Open addressing, linear probing. Slot chỉ chuyển NULL → entry một lần,
+// không bao giờ xóa, nên reader không cần lock.
+typedef struct client_table {
+    size_t mask;
+    struct client_table *retired_next;    // Bảng cũ sau resize, free khi cleanup
+    client_entry_t *slots[];
+} client_table_t;
+
+typedef struct {
+    pthread_mutex_t lock;                 // Chỉ dành cho writer
+    client_table_t *table;                // atomic publish
+    size_t count;
+    client_table_t *retired;
+} client_shard_t;
+
+static client_shard_t g_shards[REGISTRY_SHARDS];
+static client_entry_t **g_by_socket = NULL;   // fd → entry (atomic)
+static int g_max_sockets = 0;
+static size_t g_total = 0;
+
+static uint64_t hash_user_id(const char *s) {
+    uint64_t h = 1469598103934665603ULL;  // FNV-1a
+    while (*s) {
+        h ^= (unsigned char)*s++;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+static client_table_t* table_new(size_t slots) {
+    client_table_t *t = calloc(1, sizeof(client_table_t) + slots * sizeof(client_entry_t*));
+    if (t) t->mask = slots - 1;
+    return t;
+}
+
+static client_entry_t* table_find(const client_table_t *t, const char *user_id, uint64_t h) {
+    for (size_t i = h & t->mask; ; i = (i + 1) & t->mask) {
+        client_entry_t *e = __atomic_load_n(&t->slots[i], __ATOMIC_ACQUIRE);
+        if (!e) return NULL;
+        if (strcmp(e->user_id, user_id) == 0) return e;
+    }
+}
+
+static void table_insert(client_table_t *t, client_entry_t *e, uint64_t h) {
+    size_t i = h & t->mask;
+    while (t->slots[i]) i = (i + 1) & t->mask;
+    __atomic_store_n(&t->slots[i], e, __ATOMIC_RELEASE);
+}
+
+static client_shard_t* shard_for(uint64_t h) {
+    // Bit cao chọn shard, bit thấp chọn slot
+    return &g_shards[(h >> 58) & (REGISTRY_SHARDS - 1)];
+}
+
+bool client_registry_init(int max_sockets) {
+    g_by_socket = calloc(max_sockets, sizeof(client_entry_t*));
+    if (!g_by_socket) {
+        log_error("Failed to allocate client registry socket index");
+        return false;
+    }
+    g_max_sockets = max_sockets;
+
+    for (int i = 0; i < REGISTRY_SHARDS; i++) {
+        pthread_mutex_init(&g_shards[i].lock, NULL);
+        g_shards[i].table = table_new(REGISTRY_INITIAL_SLOTS);
+        if (!g_shards[i].table) return false;
+    }
+
+    log_info("Client registry initialized (%d shards, %d sockets)", REGISTRY_SHARDS, max_sockets);
+    return true;
+}
+
+void client_registry_cleanup(void) {
+    for (int i = 0; i < REGISTRY_SHARDS; i++) {
+        client_shard_t *shard = &g_shards[i];
+        client_table_t *t = shard->table;
+        if (!t) continue;
+
+        for (size_t j = 0; j <= t->mask; j++) free(t->slots[j]);
+        free(t);
+
+        while (shard->retired) {
+            client_table_t *next = shard->retired->retired_next;
+            free(shard->retired);
+            shard->retired = next;
+        }
+        shard->table = NULL;
+        pthread_mutex_destroy(&shard->lock);
+    }
+
+    free(g_by_socket);
+    g_by_socket = NULL;
+}
+
+// Gọi khi giữ shard->lock. Bảng mới được publish, bảng cũ vẫn hợp lệ cho
+// reader đang đọc dở nên chỉ được free lúc cleanup.
+static bool shard_grow(client_shard_t *shard) {
+    client_table_t *old = shard->table;
+    client_table_t *t = table_new((old->mask + 1) * 2);
+    if (!t) return false;
+
+    for (size_t i = 0; i <= old->mask; i++) {
+        client_entry_t *e = old->slots[i];
+        if (e) table_insert(t, e, hash_user_id(e->user_id));
+    }
+
+    __atomic_store_n(&shard->table, t, __ATOMIC_RELEASE);
+    old->retired_next = shard->retired;
+    shard->retired = old;
+    return true;
+}
+
+int client_registry_bind(const char *user_id, int sock) {
+    if (!user_id || sock < 0 || sock >= g_max_sockets) return -1;
+
+    uint64_t h = hash_user_id(user_id);
+    client_shard_t *shard = shard_for(h);
+
+    pthread_mutex_lock(&shard->lock);
+
+    client_entry_t *e = table_find(shard->table, user_id, h);
+    if (!e) {
+        // Giữ load factor <= 1/2 để probe ngắn
+        if ((shard->count + 1) * 2 > shard->table->mask + 1 && !shard_grow(shard)) {
+            pthread_mutex_unlock(&shard->lock);
+            log_error("Client registry: out of memory growing shard");
+            return -1;
+        }
+
+        e = calloc(1, sizeof(client_entry_t));
+        if (!e) {
+            pthread_mutex_unlock(&shard->lock);
+            return -1;
+        }
+        strncpy(e->user_id, user_id, sizeof(e->user_id) - 1);
+        e->socket = -1;
+
+        table_insert(shard->table, e, h);
+        shard->count++;
+        __atomic_add_fetch(&g_total, 1, __ATOMIC_RELAXED);
+    }
+
+    int old_sock = __atomic_exchange_n(&e->socket, sock, __ATOMIC_ACQ_REL);
+
+    // Socket này trước đó đăng nhập user khác: user đó không còn ở socket này nữa
+    client_entry_t *prev = __atomic_exchange_n(&g_by_socket[sock], e, __ATOMIC_ACQ_REL);
+    if (prev && prev != e) {
+        int expected = sock;
+        __atomic_compare_exchange_n(&prev->socket, &expected, -1, false,
+                                    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+    }
+
+    pthread_mutex_unlock(&shard->lock);
+    return old_sock;
+}
+
+int client_registry_lookup(const char *user_id) {
+    if (!user_id) return -1;
+
+    uint64_t h = hash_user_id(user_id);
+    client_table_t *t = __atomic_load_n(&shard_for(h)->table, __ATOMIC_ACQUIRE);
+
+    client_entry_t *e = table_find(t, user_id, h);
+    return e ? __atomic_load_n(&e->socket, __ATOMIC_ACQUIRE) : -1;
+}
+
+bool client_registry_unbind_socket(int sock, char *user_id_out, size_t len) {
+    if (sock < 0 || sock >= g_max_sockets) return false;
+
+    client_entry_t *e = __atomic_exchange_n(&g_by_socket[sock], NULL, __ATOMIC_ACQ_REL);
+    if (!e) return false;
+
+    // User có thể đã login lại ở socket khác: chỉ offline nếu vẫn là socket này
+    int expected = sock;
+    if (!__atomic_compare_exchange_n(&e->socket, &expected, -1, false,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        return false;
+    }
+
+    if (user_id_out && len > 0) {
+        strncpy(user_id_out, e->user_id, len - 1);
+        user_id_out[len - 1] = '\0';
+    }
+    return true;
+}
+
+size_t client_registry_size(void) {
+    return __atomic_load_n(&g_total, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,519 @@
+#include "network/ws_conn.h"
+#include "utils/logger.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/resource.h>
+#include <sys/eventfd.h>
+
+// fd → connection. fds are small dense integers so a flat array is enough.
+static ws_conn_t **g_conn_table = NULL;
+static int g_conn_table_size = 0;
+static pthread_mutex_t g_conn_table_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Connection có frame chờ gửi (Treiber stack) + eventfd đánh thức reactor
+static ws_conn_t *g_ready_list = NULL;
+static int g_notify_fd = -1;
+
+bool ws_conn_table_init(void) {
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0) {
+        // Nâng soft limit lên hard limit để chịu được hàng chục nghìn connection
+        if (rl.rlim_cur < rl.rlim_max) {
+            rl.rlim_cur = rl.rlim_max;
+            if (setrlimit(RLIMIT_NOFILE, &rl) != 0) {
+                getrlimit(RLIMIT_NOFILE, &rl);
+            }
+        }
+        g_conn_table_size = (rl.rlim_cur == RLIM_INFINITY || rl.rlim_cur > 1048576)
+                            ? 1048576 : (int)rl.rlim_cur;
+    } else {
+        g_conn_table_size = 1024;
+    }
+
+    g_conn_table = calloc(g_conn_table_size, sizeof(ws_conn_t*));
+    if (!g_conn_table) {
+        log_error("Failed to allocate connection table (%d entries)", g_conn_table_size);
+        return false;
+    }
+
+    g_notify_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (g_notify_fd < 0) {
+        log_error("Failed to create outbound notify eventfd");
+        return false;
+    }
+
+    log_info("Connection table initialized: %d fds", g_conn_table_size);
+    return true;
+}
+
+int ws_conn_table_size(void) {
+    return g_conn_table_size;
+}
+
+ws_conn_t* ws_conn_create(int fd, int worker) {
+    if (fd < 0 || fd >= g_conn_table_size) {
+        log_error("fd %d exceeds connection table size %d", fd, g_conn_table_size);
+        return NULL;
+    }
+
+    ws_conn_t *conn = calloc(1, sizeof(ws_conn_t));
+    if (!conn) return NULL;
+
+    conn->fd = fd;
+    conn->worker = worker;
+    conn->state = WS_CONN_HANDSHAKE;
+    conn->proto_version = 1;  // Legacy cho tới khi handshake chọn v2
+    conn->refcount = 1;  // Reference của fd table
+    conn->last_active_ms = timer_now_ms();
+    pthread_mutex_init(&conn->wlock, NULL);
+    conn->out_head = &conn->out_stub;
+    conn->out_tail = &conn->out_stub;
+
+    pthread_mutex_lock(&g_conn_table_mutex);
+    g_conn_table[fd] = conn;
+    pthread_mutex_unlock(&g_conn_table_mutex);
+
+    return conn;
+}
+
+ws_conn_t* ws_conn_acquire(int fd) {
+    if (fd < 0 || fd >= g_conn_table_size || !g_conn_table) return NULL;
+
+    pthread_mutex_lock(&g_conn_table_mutex);
+    ws_conn_t *conn = g_conn_table[fd];
+    if (conn) conn->refcount++;
+    pthread_mutex_unlock(&g_conn_table_mutex);
+
+    return conn;
+}
+
+void ws_conn_release(ws_conn_t *conn) {
+    if (!conn) return;
+
+    pthread_mutex_lock(&g_conn_table_mutex);
+    int remaining = --conn->refcount;
+    pthread_mutex_unlock(&g_conn_table_mutex);
+
+    if (remaining == 0) {
+        // Không còn producer nào: giải phóng các frame chưa kịp gửi
+        ws_outmsg_t *node = conn->out_head;
+        while (node) {
+            ws_outmsg_t *next = node->next;
+            if (node != &conn->out_stub) free(node);
+            node = next;
+        }
+
+        pthread_mutex_destroy(&conn->wlock);
+        free(conn->wbuf);
+        free(conn);
+    }
+}
+
+// Gỡ connection khỏi fd table rồi mới close(), để fd được tái sử dụng
+// không bao giờ bị nhầm với connection cũ
+void ws_conn_close(ws_conn_t *conn) {
+    // Sau khi cancel, idle callback không còn chạm tới connection này nữa
+    timer_cancel(&conn->idle_timer);
+
+    pthread_mutex_lock(&g_conn_table_mutex);
+    if (g_conn_table[conn->fd] == conn) {
+        g_conn_table[conn->fd] = NULL;
+    }
+    pthread_mutex_unlock(&g_conn_table_mutex);
+
+    pthread_mutex_lock(&conn->wlock);
+    __atomic_store_n(&conn->closed, true, __ATOMIC_RELEASE);
+    conn->wlen = 0;
+    pthread_mutex_unlock(&conn->wlock);
+
+    int hwm = __atomic_load_n(&conn->out_hwm, __ATOMIC_RELAXED);
+    uint64_t drops = __atomic_load_n(&conn->out_drops, __ATOMIC_RELAXED);
+    if (drops > 0) {
+        log_warn("Socket %d outbound queue: hwm=%d drops=%llu", conn->fd, hwm, (unsigned long long)drops);
+    } else {
+        log_debug("Socket %d outbound queue: hwm=%d", conn->fd, hwm);
+    }
+
+    close(conn->fd);
+    ws_conn_release(conn);
+}
+
+void ws_conn_shutdown(int fd) {
+    ws_conn_t *conn = ws_conn_acquire(fd);
+    if (!conn) return;
+
+    pthread_mutex_lock(&conn->wlock);
+    if (!conn->closed) {
+        // Reactor sẽ nhận EPOLLHUP/EOF và cleanup như disconnect bình thường
+        shutdown(conn->fd, SHUT_RDWR);
+    }
+    pthread_mutex_unlock(&conn->wlock);
+
+    ws_conn_release(conn);
+}
+
+// Đọc tối đa phần trống của ring trong một syscall (readv 2 đoạn khi wrap).
+// Trả về số byte đọc được, 0 nếu EOF, -1 nếu lỗi (errno giữ nguyên).
+ssize_t ws_conn_ring_fill(ws_conn_t *conn) {
+    size_t space = WS_CONN_RBUF_SIZE - conn->rlen;
+    if (space == 0) {
+        errno = ENOBUFS;
+        return -1;
+    }
+
+    size_t tail = (conn->rhead + conn->rlen) % WS_CONN_RBUF_SIZE;
+    size_t first = WS_CONN_RBUF_SIZE - tail;
+    if (first > space) first = space;
+
+    struct iovec iov[2];
+    int iovcnt = 1;
+    iov[0].iov_base = conn->rbuf + tail;
+    iov[0].iov_len = first;
+    if (space > first) {
+        iov[1].iov_base = conn->rbuf;
+        iov[1].iov_len = space - first;
+        iovcnt = 2;
+    }
+
+    ssize_t n = readv(conn->fd, iov, iovcnt);
+    if (n > 0) conn->rlen += n;
+    return n;
+}
+
+// Xoay ring để dữ liệu chưa parse nằm liền từ offset 0.
+// Chỉ cần khi một frame bị cắt ngang ở cuối buffer.
+void ws_conn_ring_linearize(ws_conn_t *conn) {
+    if (conn->rhead == 0) return;
+
+    size_t first = ws_conn_ring_contiguous(conn);
+    size_t wrapped = conn->rlen - first;
+
+    if (wrapped == 0) {
+        memmove(conn->rbuf, conn->rbuf + conn->rhead, first);
+    } else {
+        uint8_t tmp[WS_CONN_RBUF_SIZE];
+        memcpy(tmp, conn->rbuf + conn->rhead, first);
+        memmove(conn->rbuf + first, conn->rbuf, wrapped);
+        memcpy(conn->rbuf, tmp, first);
+    }
+    conn->rhead = 0;
+}
+
+void ws_conn_ring_consume(ws_conn_t *conn, size_t n) {
+    conn->rlen -= n;
+    // Ring rỗng thì quay về đầu để frame sau ít bị wrap
+    conn->rhead = conn->rlen == 0 ? 0 : (conn->rhead + n) % WS_CONN_RBUF_SIZE;
+}
+
+// Thống kê write path: frames đã gửi / số syscall ghi
+static uint64_t g_frames_written = 0;
+static uint64_t g_write_syscalls = 0;
+
+static int wbuf_append(ws_conn_t *conn, const uint8_t *data, size_t len) {
+    if (len == 0) return 0;
+
+    if (conn->wlen + len > conn->wcap) {
+        size_t new_cap = conn->wcap ? conn->wcap : 4096;
+        while (new_cap < conn->wlen + len) new_cap *= 2;
+
+        uint8_t *new_buf = realloc(conn->wbuf, new_cap);
+        if (!new_buf) return -1;
+        conn->wbuf = new_buf;
+        conn->wcap = new_cap;
+    }
+
+    memcpy(conn->wbuf + conn->wlen, data, len);
+    conn->wlen += len;
+    return 0;
+}
+
+// Gửi các iovec bằng sendmsg (gather write), trả về số byte đã gửi hoặc -1 nếu lỗi.
+// iov bị sửa tại chỗ khi gửi được một phần.
+static ssize_t send_iov(int fd, struct iovec *iov, int iovcnt) {
+    size_t sent = 0;
+
+    while (iovcnt > 0) {
+        struct msghdr mh;
+        memset(&mh, 0, sizeof(mh));
+        mh.msg_iov = iov;
+        mh.msg_iovlen = iovcnt;
+
+        ssize_t n = sendmsg(fd, &mh, MSG_NOSIGNAL);
+        __atomic_fetch_add(&g_write_syscalls, 1, __ATOMIC_RELAXED);
+
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        if (n < 0) return -1;
+
+        sent += n;
+        size_t left = (size_t)n;
+        while (iovcnt > 0 && left >= iov->iov_len) {
+            left -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (uint8_t*)iov->iov_base + left;
+            iov->iov_len -= left;
+        }
+    }
+
+    return (ssize_t)sent;
+}
+
+int ws_conn_writev(ws_conn_t *conn, const struct iovec *iov, int iovcnt) {
+    int rc = 0;
+
+    if (iovcnt <= 0 || iovcnt > WS_CONN_MAX_IOV) return -1;
+
+    struct iovec local[WS_CONN_MAX_IOV + 1];
+    int n = 0;
+
+    pthread_mutex_lock(&conn->wlock);
+    if (conn->closed) {
+        pthread_mutex_unlock(&conn->wlock);
+        return -1;
+    }
+
+    // Có bytes tồn đọng thì gửi chung trong cùng một syscall để giữ thứ tự
+    if (conn->wlen > 0) {
+        local[n].iov_base = conn->wbuf;
+        local[n].iov_len = conn->wlen;
+        n++;
+    }
+    for (int i = 0; i < iovcnt; i++) {
+        if (iov[i].iov_len == 0) continue;
+        local[n++] = iov[i];
+    }
+
+    // send_iov sửa iovec khi gửi một phần, nên đưa nó bản sao
+    struct iovec scratch[WS_CONN_MAX_IOV + 1];
+    memcpy(scratch, local, n * sizeof(struct iovec));
+    ssize_t sent = n > 0 ? send_iov(conn->fd, scratch, n) : 0;
+
+    struct iovec *cur = local;
+    int remaining = n;
+
+    if (sent < 0) {
+        log_error("Failed to write frame to socket %d (errno=%d)", conn->fd, errno);
+        rc = -1;
+    } else {
+        // Bỏ các iovec đã gửi hết; phần còn lại đưa vào wbuf chờ EPOLLOUT
+        size_t left = (size_t)sent;
+        size_t from_wbuf = 0;
+        if (conn->wlen > 0) {
+            from_wbuf = left < conn->wlen ? left : conn->wlen;
+            left -= from_wbuf;
+            memmove(conn->wbuf, conn->wbuf + from_wbuf, conn->wlen - from_wbuf);
+            conn->wlen -= from_wbuf;
+            cur++;
+            remaining--;
+        }
+
+        for (; remaining > 0 && rc == 0; cur++, remaining--) {
+            size_t skip = left < cur->iov_len ? left : cur->iov_len;
+            left -= skip;
+            if (wbuf_append(conn, (const uint8_t*)cur->iov_base + skip, cur->iov_len - skip) < 0) {
+                log_error("Out of memory buffering output for socket %d", conn->fd);
+                rc = -1;
+            }
+        }
+    }
+    pthread_mutex_unlock(&conn->wlock);
+
+    return rc;
+}
+
+int ws_conn_write(ws_conn_t *conn, const void *header, size_t header_len,
+                  const void *payload, size_t payload_len) {
+    struct iovec iov[2];
+    iov[0].iov_base = (void*)header;
+    iov[0].iov_len = header_len;
+    iov[1].iov_base = (void*)payload;
+    iov[1].iov_len = payload_len;
+
+    return ws_conn_writev(conn, iov, payload_len > 0 ? 2 : 1);
+}
+
+int ws_conn_flush(ws_conn_t *conn) {
+    int rc = 0;
+
+    pthread_mutex_lock(&conn->wlock);
+    if (!conn->closed && conn->wlen > 0) {
+        struct iovec iov = { conn->wbuf, conn->wlen };
+        ssize_t n = send_iov(conn->fd, &iov, 1);
+        if (n < 0) {
+            rc = -1;
+        } else if ((size_t)n < conn->wlen) {
+            memmove(conn->wbuf, conn->wbuf + n, conn->wlen - n);
+            conn->wlen -= n;
+        } else {
+            conn->wlen = 0;
+        }
+    }
+    pthread_mutex_unlock(&conn->wlock);
+
+    return rc;
+}
+
+void ws_conn_write_stats(uint64_t *frames, uint64_t *syscalls) {
+    *frames = __atomic_load_n(&g_frames_written, __ATOMIC_RELAXED);
+    *syscalls = __atomic_load_n(&g_write_syscalls, __ATOMIC_RELAXED);
+}
+
+// ====================== Outbound mailbox ======================
+static void outq_push(ws_conn_t *conn, ws_outmsg_t *node) {
+    node->next = NULL;
+    ws_outmsg_t *prev = __atomic_exchange_n(&conn->out_tail, node, __ATOMIC_ACQ_REL);
+    __atomic_store_n(&prev->next, node, __ATOMIC_RELEASE);
+}
+
+// Consumer side (reactor). NULL nếu rỗng hoặc producer đang push dở,
+// producer đó sẽ tự schedule lại connection.
+static ws_outmsg_t* outq_pop(ws_conn_t *conn) {
+    ws_outmsg_t *head = conn->out_head;
+    ws_outmsg_t *next = __atomic_load_n(&head->next, __ATOMIC_ACQUIRE);
+
+    if (head == &conn->out_stub) {
+        if (!next) return NULL;
+        conn->out_head = next;
+        head = next;
+        next = __atomic_load_n(&next->next, __ATOMIC_ACQUIRE);
+    }
+
+    if (next) {
+        conn->out_head = next;
+        return head;
+    }
+
+    if (head != __atomic_load_n(&conn->out_tail, __ATOMIC_ACQUIRE)) return NULL;
+
+    outq_push(conn, &conn->out_stub);
+    next = __atomic_load_n(&head->next, __ATOMIC_ACQUIRE);
+    if (next) {
+        conn->out_head = next;
+        return head;
+    }
+    return NULL;
+}
+
+static void schedule_drain(ws_conn_t *conn) {
+    if (__atomic_exchange_n(&conn->out_scheduled, true, __ATOMIC_ACQ_REL)) return;
+
+    // Ready list giữ một reference, reactor release sau khi drain
+    pthread_mutex_lock(&g_conn_table_mutex);
+    conn->refcount++;
+    pthread_mutex_unlock(&g_conn_table_mutex);
+
+    ws_conn_t *head = __atomic_load_n(&g_ready_list, __ATOMIC_RELAXED);
+    do {
+        conn->ready_next = head;
+    } while (!__atomic_compare_exchange_n(&g_ready_list, &head, conn, true,
+                                          __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+    uint64_t one = 1;
+    if (write(g_notify_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+        log_error("Failed to wake reactor (errno=%d)", errno);
+    }
+}
+
+int ws_conn_enqueue(ws_conn_t *conn, const void *header, size_t header_len,
+                    const void *payload, size_t payload_len) {
+    if (__atomic_load_n(&conn->closed, __ATOMIC_ACQUIRE)) return -1;
+
+    int depth = __atomic_add_fetch(&conn->out_depth, 1, __ATOMIC_ACQ_REL);
+    if (depth > WS_CONN_OUTQ_MAX) {
+        // Peer đọc không kịp: bỏ frame và ngắt kết nối thay vì để hàng đợi phình ra
+        __atomic_sub_fetch(&conn->out_depth, 1, __ATOMIC_ACQ_REL);
+        if (__atomic_fetch_add(&conn->out_drops, 1, __ATOMIC_RELAXED) == 0) {
+            log_warn("Outbound queue full on socket %d (%d frames), disconnecting slow client",
+                     conn->fd, WS_CONN_OUTQ_MAX);
+            ws_conn_shutdown(conn->fd);
+        }
+        return -1;
+    }
+
+    int hwm = __atomic_load_n(&conn->out_hwm, __ATOMIC_RELAXED);
+    while (depth > hwm &&
+           !__atomic_compare_exchange_n(&conn->out_hwm, &hwm, depth, true,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+
+    ws_outmsg_t *node = malloc(sizeof(ws_outmsg_t) + header_len + payload_len);
+    if (!node) {
+        __atomic_sub_fetch(&conn->out_depth, 1, __ATOMIC_ACQ_REL);
+        return -1;
+    }
+    node->data = (uint8_t*)(node + 1);
+    node->len = header_len + payload_len;
+    memcpy(node->data, header, header_len);
+    if (payload_len > 0) memcpy(node->data + header_len, payload, payload_len);
+
+    outq_push(conn, node);
+    schedule_drain(conn);
+    return 0;
+}
+
+static bool has_pending_output(ws_conn_t *conn) {
+    pthread_mutex_lock(&conn->wlock);
+    bool pending = conn->wlen > 0;
+    pthread_mutex_unlock(&conn->wlock);
+    return pending;
+}
+
+// Gửi các frame trong mailbox, tối đa WS_CONN_MAX_IOV frame mỗi syscall.
+// Dừng khi socket đầy; EPOLLOUT sẽ flush rồi gọi lại hàm này.
+int ws_conn_drain(ws_conn_t *conn) {
+    while (!has_pending_output(conn)) {
+        ws_outmsg_t *batch[WS_CONN_MAX_IOV];
+        struct iovec iov[WS_CONN_MAX_IOV];
+        int count = 0;
+
+        while (count < WS_CONN_MAX_IOV) {
+            ws_outmsg_t *node = outq_pop(conn);
+            if (!node) break;
+            batch[count] = node;
+            iov[count].iov_base = node->data;
+            iov[count].iov_len = node->len;
+            count++;
+        }
+        if (count == 0) return 0;
+
+        int rc = ws_conn_writev(conn, iov, count);
+        __atomic_fetch_add(&g_frames_written, (uint64_t)count, __ATOMIC_RELAXED);
+
+        for (int i = 0; i < count; i++) free(batch[i]);
+        __atomic_sub_fetch(&conn->out_depth, count, __ATOMIC_ACQ_REL);
+
+        if (rc < 0) return -1;
+    }
+    return 0;
+}
+
+int ws_conn_notify_fd(void) {
+    return g_notify_fd;
+}
+
+void ws_conn_drain_ready(void (*on_error)(ws_conn_t *conn)) {
+    uint64_t counter;
+    while (read(g_notify_fd, &counter, sizeof(counter)) < 0 && errno == EINTR) {
+    }
+
+    ws_conn_t *conn = __atomic_exchange_n(&g_ready_list, NULL, __ATOMIC_ACQUIRE);
+    while (conn) {
+        ws_conn_t *next = conn->ready_next;
+
+        // Clear trước khi drain: frame enqueue sau thời điểm này sẽ schedule lại
+        __atomic_store_n(&conn->out_scheduled, false, __ATOMIC_RELEASE);
+        if (ws_conn_drain(conn) < 0 && on_error) {
+            on_error(conn);
+        }
+
+        ws_conn_release(conn);
+        conn = next;
+    }
+}
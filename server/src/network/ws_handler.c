@@ -3,6 +3,7 @@
 #include "auth/auth.h"
 #include "game/game.h"
 #include "game/game_chat.h"
+#include "game/game_actor.h"
 #include "matchmaking/matcher.h"
 #include "utils/logger.h"
 #include <stdio.h>
@@ -11,6 +12,56 @@
 #include "game/game.h"
 #include "game/game_board.h"
 #include "matchmaking/challenge_manager.h"
+#include "network/ws_conn.h"
+#include "config.h"
+#include <time.h>
+
+// ====================== Session ======================
+// Connection giữ user_id + exp sau LOGIN/REGISTER/AUTH_TOKEN. Mọi message của
+// một connection chạy trên cùng một worker nên session không cần lock.
+static void session_establish(int client_sock, const char *user_id, time_t exp) {
+    ws_conn_t *conn = ws_conn_acquire(client_sock);
+    if (!conn) return;
+
+    strncpy(conn->session_user_id, user_id, sizeof(conn->session_user_id) - 1);
+    conn->session_user_id[sizeof(conn->session_user_id) - 1] = '\0';
+    conn->session_exp = exp;
+    conn->authenticated = true;
+
+    ws_conn_release(conn);
+}
+
+void session_clear(int client_sock) {
+    ws_conn_t *conn = ws_conn_acquire(client_sock);
+    if (!conn) return;
+
+    conn->authenticated = false;
+    conn->session_user_id[0] = '\0';
+    conn->session_exp = 0;
+
+    ws_conn_release(conn);
+}
+
+// 1 = session hợp lệ, 0 = hết hạn / chưa đăng nhập
+static int session_lookup(int client_sock, auth_user_t *out_user) {
+    ws_conn_t *conn = ws_conn_acquire(client_sock);
+    if (!conn) return 0;
+
+    int valid = 0;
+    if (conn->authenticated) {
+        if (conn->session_exp > time(NULL)) {
+            strncpy(out_user->user_id, conn->session_user_id, 63);
+            out_user->user_id[63] = '\0';
+            valid = 1;
+        } else {
+            log_info("Session expired for user %s (socket %d)", conn->session_user_id, client_sock);
+            conn->authenticated = false;
+        }
+    }
+
+    ws_conn_release(conn);
+    return valid;
+}
 
 void handle_message(int client_sock, message_t *msg) {
     log_debug("Handling WebSocket message type=%d for client %d", msg->type, client_sock);
@@ -21,21 +72,30 @@ void handle_message(int client_sock, message_t *msg) {
     // Các message cần xác thực
     switch(msg->type) {
         case MSG_JOIN_QUEUE:
+        case MSG_LEAVE_QUEUE:
         case MSG_PLAYER_MOVE:
         case MSG_CHAT:
         case MSG_LOGOUT:
+        case MSG_PLAYER_READY:
+        case MSG_GET_ONLINE_PLAYERS:
+        case MSG_CHALLENGE_PLAYER:
+        case MSG_CHALLENGE_ACCEPT:
+        case MSG_CHALLENGE_DECLINE:
+        case MSG_CHALLENGE_CANCEL:
             requires_auth = 1;
             break;
         case MSG_PLACE_SHIP:
+        case MSG_PLACE_FLEET:
             requires_auth = 1;
             break;
         default:
             break;
     }
 
+    // Xác thực theo session của connection, chỉ verify JWT một lần
     if (requires_auth) {
         if (!check_token(client_sock, msg->token, &user)) {
-            // Token không hợp lệ => dừng xử lý
+            // Session/token không hợp lệ => dừng xử lý
             return;
         }
     }
@@ -49,13 +109,13 @@ void handle_message(int client_sock, message_t *msg) {
             handle_login(client_sock, &msg->payload.auth);
             break;
         case MSG_PLAYER_MOVE:
-            handle_player_move(client_sock, msg);
+            handle_player_move(client_sock, user.user_id, msg);
             break;
         case MSG_CHAT:
-            handle_chat(client_sock, &msg->payload.chat, msg->token);
+            handle_chat(client_sock, &msg->payload.chat, user.user_id);
             break;
         case MSG_LOGOUT:
-            handle_logout(client_sock, msg);
+            handle_logout(client_sock, user.user_id);
             break;
         case MSG_PING:
             log_debug("Received MSG_PING from client %d", client_sock);
@@ -68,35 +128,38 @@ void handle_message(int client_sock, message_t *msg) {
             log_debug("Received MSG_PONG from client %d", client_sock);
             break;   
         case MSG_JOIN_QUEUE:
-            handle_join_queue(client_sock, msg->token);
+            handle_join_queue(client_sock, user.user_id);
             break;
             
         case MSG_LEAVE_QUEUE:
-            handle_leave_queue(client_sock, msg->token);
+            handle_leave_queue(client_sock, user.user_id);
             break;
         case MSG_PLACE_SHIP:
-            handle_place_ship(client_sock, &msg->payload.place_ship, msg->token);
+            handle_place_ship(client_sock, &msg->payload.place_ship, user.user_id);
+            break;
+        case MSG_PLACE_FLEET:
+            handle_place_fleet(client_sock, &msg->payload.place_fleet, user.user_id);
             break;
         case MSG_PLAYER_READY:
-            handle_player_ready(client_sock, msg);
+            handle_player_ready(client_sock, user.user_id, msg);
             break;
         case MSG_GET_ONLINE_PLAYERS:
-            handle_get_online_players(client_sock, msg->token);
+            handle_get_online_players(client_sock, user.user_id);
             break;
         case MSG_CHALLENGE_PLAYER:
-            handle_challenge_player(client_sock, &msg->payload.challenge, msg->token);
+            handle_challenge_player(client_sock, &msg->payload.challenge, user.user_id);
             break;
         
         case MSG_CHALLENGE_ACCEPT:
-            handle_challenge_accept(client_sock, &msg->payload.challenge_resp, msg->token);
+            handle_challenge_accept(client_sock, &msg->payload.challenge_resp, user.user_id);
             break;
         
         case MSG_CHALLENGE_DECLINE:
-            handle_challenge_decline(client_sock, &msg->payload.challenge_resp, msg->token);
+            handle_challenge_decline(client_sock, &msg->payload.challenge_resp, user.user_id);
             break;
         
         case MSG_CHALLENGE_CANCEL:
-            handle_challenge_cancel(client_sock, &msg->payload.challenge_resp, msg->token);
+            handle_challenge_cancel(client_sock, &msg->payload.challenge_resp, user.user_id);
             break;
         case MSG_AUTH_TOKEN:
             handle_auth_token(client_sock, msg->token);
@@ -113,8 +176,9 @@ void handle_auth_token(int client_sock, const char *token) {
     log_info("[AUTH_TOKEN] Client %d re-authenticating with token", client_sock);
     
     // Verify token
-    char *user_id = jwt_verify(token);
-    if (!user_id) {
+    char user_id[64];
+    time_t exp = 0;
+    if (!jwt_verify_claims(token, user_id, sizeof(user_id), &exp) || exp <= time(NULL)) {
         log_warn("[AUTH_TOKEN] Invalid token from client %d", client_sock);
         
         message_t resp = {0};
@@ -128,7 +192,6 @@ void handle_auth_token(int client_sock, const char *token) {
     user_t *user = user_find_by_id(user_id);
     if (!user) {
         log_error("[AUTH_TOKEN] User not found: %s", user_id);
-        free(user_id);
         
         message_t resp = {0};
         resp.type = MSG_AUTH_FAILED;
@@ -139,6 +202,7 @@ void handle_auth_token(int client_sock, const char *token) {
     
     // Register client with new socket
     client_register(client_sock, user_id);
+    session_establish(client_sock, user_id, exp);
     
     // Update status to online
     user_update_status(user->username, "online");
@@ -155,7 +219,6 @@ void handle_auth_token(int client_sock, const char *token) {
              user->username, client_sock);
     
     user_free(user);
-    free(user_id);
 }
 
 void handle_register(int client_sock, auth_payload *auth) {
@@ -174,7 +237,7 @@ void handle_register(int client_sock, auth_payload *auth) {
     }
 
     // Create response
-    message_t resp;
+    message_t resp = {0};
 
     if (res->success) {
         resp.type = MSG_AUTH_SUCCESS;
@@ -183,6 +246,7 @@ void handle_register(int client_sock, auth_payload *auth) {
         strncpy(resp.payload.auth_suc.username, res->user->username, 31);
         resp.payload.auth_suc.username[31] = '\0';
         client_register(client_sock, res->user->id);
+        session_establish(client_sock, res->user->id, time(NULL) + get_jwt_expiry());
         log_info("Registration successful for %s", auth->username);
     } else {
         resp.type = MSG_AUTH_FAILED;
@@ -206,7 +270,7 @@ void handle_login(int client_sock, auth_payload *auth) {
     log_info("Processing login for username: %s", auth->username);
     
     auth_result_t *res = auth_login(auth->username, auth->password);
-    message_t resp;
+    message_t resp = {0};
 
     if (res->success) {
         resp.type = MSG_AUTH_SUCCESS;
@@ -215,6 +279,7 @@ void handle_login(int client_sock, auth_payload *auth) {
         strncpy(resp.payload.auth_suc.username, res->user->username, 31);
         resp.payload.auth_suc.username[31] = '\0';
         client_register(client_sock, res->user->id);
+        session_establish(client_sock, res->user->id, time(NULL) + get_jwt_expiry());
         log_info("Login successful for %s, sending response...", auth->username);
     } else {
         resp.type = MSG_AUTH_FAILED;
@@ -236,12 +301,10 @@ void handle_login(int client_sock, auth_payload *auth) {
     log_debug("auth_result freed successfully for client %d", client_sock);
 }
 
-void handle_logout(int client_sock, message_t *msg) {
-    auth_user_t user;
-    if (!check_token(client_sock, msg->token, &user)) return;
-
-    log_info("User %s logging out", user.user_id);
-    auth_logout(msg->token);
+void handle_logout(int client_sock, const char *user_id) {
+    log_info("User %s logging out", user_id);
+    auth_logout_user(user_id);
+    session_clear(client_sock);
 
     message_t resp = {0};
     resp.type = MSG_AUTH_SUCCESS;
@@ -259,144 +322,95 @@ void handle_logout(int client_sock, message_t *msg) {
 //     add_to_queue(client_sock, user.user_id);
 // }
 
-void handle_player_move(int client_sock, message_t *msg) {
-    const char *token = msg->token;
+void handle_player_move(int client_sock, const char *user_id, message_t *msg) {
     move_payload *move = &msg->payload.move;
 
-    // Verify JWT
-    char *user_id = jwt_verify(token);
-    if (!user_id) {
-        log_error("Invalid token in PLAYER_MOVE");
-        return;
-    }
-    
     // Validate coordinates
     if (move->row < 0 || move->row >= 10 || move->col < 0 || move->col >= 10) {
         log_error("Invalid coordinates from player %s: row=%d, col=%d",
                   user_id, move->row, move->col);
-        free(user_id);
         return;
     }
     
     log_info("Player %s shooting at (%d, %d) in game %s", 
              user_id, move->row, move->col, move->game_id);
     
-    // Process shot
-    shot_result_t result = game_process_shot(move->game_id, user_id, move->row, move->col);
-    
-    // ===== Response to shooter =====
-    message_t response = {0};
-    response.type = MSG_MOVE_RESULT;
-    response.payload.move_res.row = move->row;
-    response.payload.move_res.col = move->col;
-    response.payload.move_res.is_hit = result.is_hit;
-    response.payload.move_res.is_sunk = result.is_sunk;
-    response.payload.move_res.sunk_ship_type = result.sunk_ship_type;
-    response.payload.move_res.game_over = result.game_over;
-    response.payload.move_res.is_your_shot = 1;  // ✅ SHOOTER: is_your_shot = 1
-    
-    ws_send_message(client_sock, &response);
-    log_info("✅ Sent MOVE_RESULT to shooter: hit=%d, sunk=%d, game_over=%d",
-             result.is_hit, result.is_sunk, result.game_over);
-    
-    // ===== Send to opponent =====
     game_session_t *game = game_get(move->game_id);
-    if (game) {
-        int opponent_sock = (client_sock == game->player1_socket) 
-                            ? game->player2_socket 
-                            : game->player1_socket;
-        
-        if (opponent_sock > 0) {
-            message_t opponent_msg = {0};
-            opponent_msg.type = MSG_MOVE_RESULT;
-            opponent_msg.payload.move_res.row = move->row;
-            opponent_msg.payload.move_res.col = move->col;
-            opponent_msg.payload.move_res.is_hit = result.is_hit;
-            opponent_msg.payload.move_res.is_sunk = result.is_sunk;
-            opponent_msg.payload.move_res.sunk_ship_type = result.sunk_ship_type;
-            opponent_msg.payload.move_res.game_over = result.game_over;
-            opponent_msg.payload.move_res.is_your_shot = 0;  // ✅ DEFENDER: is_your_shot = 0
-            
-            ws_send_message(opponent_sock, &opponent_msg);
-            log_info("✅ Sent MOVE_RESULT to opponent (socket %d)", opponent_sock);
-        } else {
-            log_warn("Opponent socket not found for game %s", move->game_id);
-        }
-    } else {
+    if (!game) {
         log_error("Game session not found: %s", move->game_id);
+        return;
     }
     
-    free(user_id);
+    // Process shot trên game worker; MOVE_RESULT được gửi từ đó
+    game_cmd_t *cmd = game_cmd_new(GAME_CMD_SHOT, client_sock, user_id);
+    if (cmd) {
+        cmd->u.shot.row = move->row;
+        cmd->u.shot.col = move->col;
+        game_actor_post(game, cmd);
+    }
+    game_release(game);
 }
 
-void handle_chat(int client_sock, chat_payload *chat, const char *token) {
-    // Verify token
-    char *user_id = jwt_verify(token);
-    if (!user_id) {
-        log_warn("Invalid token for chat message");
-        message_t resp = {0};
-        resp.type = MSG_AUTH_FAILED;
-        strncpy(resp.payload.auth_fail.reason, "Invalid token", 63);
-        ws_send_message(client_sock, &resp);
-        return;
-    }
-    
+void handle_chat(int client_sock, chat_payload *chat, const char *user_id) {
     log_info("Chat message from user %s (socket %d): %s", 
              user_id, client_sock, chat->message);
     
-    // Delegate to game_chat module
-    bool success = game_chat_send_message(
-        chat->game_id,
-        user_id,
-        chat->message
-    );
+    // If game_id not provided, find game by player
+    game_session_t *game = NULL;
+    if (chat->game_id[0] != '\0') {
+        game = game_get(chat->game_id);
+    } else {
+        game = game_find_by_player(user_id);
+    }
     
-    if (!success) {
+    if (!game) {
         log_error("Failed to send chat message for user %s in game %s", 
                   user_id, chat->game_id);
+        return;
     }
     
-    free(user_id);
+    // Delegate to game_chat module (chạy trên game worker)
+    game_cmd_t *cmd = game_cmd_new(GAME_CMD_CHAT, client_sock, user_id);
+    if (cmd) {
+        strncpy(cmd->u.chat.text, chat->message, sizeof(cmd->u.chat.text) - 1);
+        game_actor_post(game, cmd);
+    }
+    game_release(game);
 }
 
 int check_token(int client_sock, const char *token, auth_user_t *out_user) {
-    char *user_id = jwt_verify(token);
-    if (!user_id) {
-        log_warn("Client %d gửi token không hợp lệ", client_sock);
-
-        message_t resp;
-        resp.type = MSG_AUTH_FAILED;
-        strncpy(resp.payload.auth_fail.reason, "Invalid or expired token", 63);
-        resp.payload.auth_fail.reason[63] = '\0';
-        ws_send_message(client_sock, &resp);
+    if (session_lookup(client_sock, out_user)) {
+        return 1; // hợp lệ
+    }
 
-        return 0; // không hợp lệ
+    // Client cũ (v1) vẫn gửi token trong mọi frame: verify một lần rồi lưu session
+    char user_id[64];
+    time_t exp = 0;
+    if (token && token[0] != '\0' &&
+        jwt_verify_claims(token, user_id, sizeof(user_id), &exp) &&
+        exp > time(NULL)) {
+        session_establish(client_sock, user_id, exp);
+        strncpy(out_user->user_id, user_id, 63);
+        out_user->user_id[63] = '\0';
+        return 1; // hợp lệ
     }
 
-    strncpy(out_user->user_id, user_id, 63);
-    out_user->user_id[63] = '\0';
-    free(user_id);
+    log_warn("Client %d gửi token không hợp lệ", client_sock);
+
+    message_t resp = {0};
+    resp.type = MSG_AUTH_FAILED;
+    strncpy(resp.payload.auth_fail.reason, "Invalid or expired token", 63);
+    resp.payload.auth_fail.reason[63] = '\0';
+    ws_send_message(client_sock, &resp);
 
-    return 1; // hợp lệ
+    return 0; // không hợp lệ
 }
 
-void handle_join_queue(int client_sock, const char *token) {
-    // Verify token
-    char *user_id = jwt_verify(token);
-    if (!user_id) {
-        log_warn("Invalid token for join queue");
-        message_t resp = {0};
-        resp.type = MSG_AUTH_FAILED;
-        strncpy(resp.payload.auth_fail.reason, "Invalid token", 63);
-        ws_send_message(client_sock, &resp);
-        return;
-    }
-    
+void handle_join_queue(int client_sock, const char *user_id) {
     // Get user info
     user_t *user = user_find_by_id(user_id);
     if (!user) {
         log_error("User not found: %s", user_id);
-        free(user_id);
         return;
     }
     
@@ -420,31 +434,15 @@ void handle_join_queue(int client_sock, const char *token) {
     }
     
     user_free(user);
-    free(user_id);
 }
 
-void handle_leave_queue(int client_sock, const char *token) {
-    char *user_id = jwt_verify(token);
-    if (!user_id) return;
-    
+void handle_leave_queue(int client_sock, const char *user_id) {
     matcher_remove_from_queue(user_id);
     log_info("Player %s left queue", user_id);
     
-    free(user_id);
 }
 
-void handle_place_ship(int client_sock, place_ship_payload *payload, const char *token) {
-    // Verify token
-    char *user_id = jwt_verify(token);
-    if (!user_id) {
-        log_warn("Invalid token for place ship");
-        message_t resp = {0};
-        resp.type = MSG_AUTH_FAILED;
-        strncpy(resp.payload.auth_fail.reason, "Invalid token", 63);
-        ws_send_message(client_sock, &resp);
-        return;
-    }
-    
+void handle_place_ship(int client_sock, place_ship_payload *payload, const char *user_id) {
     log_info("Player %s placing ship: type=%d, pos=(%d,%d), horizontal=%d",
              user_id, payload->ship_type, payload->row, payload->col, payload->is_horizontal);
     
@@ -458,7 +456,6 @@ void handle_place_ship(int client_sock, place_ship_payload *payload, const char
         strncpy(resp.payload.auth_fail.reason, "No active game", 63);
         ws_send_message(client_sock, &resp);
         
-        free(user_id);
         return;
     }
     
@@ -477,92 +474,77 @@ void handle_place_ship(int client_sock, place_ship_payload *payload, const char
             resp.type = MSG_AUTH_FAILED;
             strncpy(resp.payload.auth_fail.reason, "Invalid ship type", 63);
             ws_send_message(client_sock, &resp);
+            game_release(game);
             
-            free(user_id);
             return;
     }
     
-    // Place ship
-    bool success = game_place_ship(
-        game->game_id,
-        user_id,
-        ship_type,
-        payload->row,
-        payload->col,
-        payload->is_horizontal
-    );
-    
-    message_t resp = {0};
-    
-    if (success) {
-        resp.type = MSG_AUTH_SUCCESS;  // Or create MSG_PLACE_SHIP_SUCCESS
-        log_info("Ship placed successfully for player %s", user_id);
-        
-        // Check if both players ready
-        if (game->player1_ready && game->player2_ready) {
-            log_info("Both players ready! Game %s starting...", game->game_id);
-            
-            // Send game start notification to both players
-            message_t start_msg = {0};
-            start_msg.type = MSG_START_GAME;
-            strncpy(start_msg.payload.start_game.opponent, 
-                    strcmp(game->player1_id, user_id) == 0 ? game->player2_id : game->player1_id,
-                    31);
-            
-            ws_send_message(client_sock, &start_msg);
-            
-            // Send to opponent
-            int opponent_sock = (strcmp(game->player1_id, user_id) == 0) ?
-                                game->player2_socket : game->player1_socket;
-            if (opponent_sock > 0) {
-                strncpy(start_msg.payload.start_game.opponent, user_id, 31);
-                ws_send_message(opponent_sock, &start_msg);
-            }
-        }
-    } else {
-        resp.type = MSG_AUTH_FAILED;
-        strncpy(resp.payload.auth_fail.reason, "Failed to place ship (overlap/out of bounds)", 63);
-        log_warn("Failed to place ship for player %s", user_id);
+    // Place ship trên game worker; kết quả được gửi từ đó
+    game_cmd_t *cmd = game_cmd_new(GAME_CMD_PLACE, client_sock, user_id);
+    if (cmd) {
+        cmd->u.place.type = ship_type;
+        cmd->u.place.row = payload->row;
+        cmd->u.place.col = payload->col;
+        cmd->u.place.is_horizontal = payload->is_horizontal;
+        game_actor_post(game, cmd);
     }
-    
-    ws_send_message(client_sock, &resp);
-    free(user_id);
+    game_release(game);
 }
 
-void handle_player_ready(int client_sock, message_t *msg) {
-    // Verify token
-    char *user_id = jwt_verify(msg->token);
-    if (!user_id) {
-        log_error("Invalid token in PLAYER_READY");
+void handle_place_fleet(int client_sock, place_fleet_payload *payload, const char *user_id) {
+    log_info("Player %s placing fleet: count=%d, auto=%d",
+             user_id, payload->count, payload->auto_place);
+
+    game_session_t *game = game_find_by_player(user_id);
+    if (!game) {
+        log_error("No active game found for player: %s", user_id);
+
+        message_t resp = {0};
+        resp.type = MSG_AUTH_FAILED;
+        strncpy(resp.payload.auth_fail.reason, "No active game", 63);
+        ws_send_message(client_sock, &resp);
         return;
     }
 
+    // Kiểm tra hạm đội (chồng, sát, tràn biên) trên game worker, một lượt
+    game_cmd_t *cmd = game_cmd_new(GAME_CMD_FLEET, client_sock, user_id);
+    if (cmd) {
+        cmd->u.fleet.auto_place = payload->auto_place != 0;
+        cmd->u.fleet.count = payload->count;   // Sai số lượng thì board_place_fleet từ chối
+        int copy = payload->count < MAX_SHIPS ? payload->count : MAX_SHIPS;
+        for (int i = 0; i < copy; i++) {
+            cmd->u.fleet.ships[i].type = (ship_type_t)payload->ships[i].ship_type;
+            cmd->u.fleet.ships[i].start_row = payload->ships[i].row;
+            cmd->u.fleet.ships[i].start_col = payload->ships[i].col;
+            cmd->u.fleet.ships[i].is_horizontal = payload->ships[i].is_horizontal != 0;
+        }
+        game_actor_post(game, cmd);
+    }
+    game_release(game);
+}
+
+void handle_player_ready(int client_sock, const char *user_id, message_t *msg) {
     // Lấy dữ liệu payload
     const char *game_id = msg->payload.ready.game_id;
     const uint8_t *board = msg->payload.ready.board_state;
 
     log_info("Player %s READY for game %s", user_id, game_id);
 
-    // Gọi game logic nhưng KHÔNG gửi phản hồi
-    if (!game_set_player_ready(game_id, user_id, board)) {
+    game_session_t *game = game_get(game_id);
+    if (!game) {
         log_error("Failed to set READY for player %s", user_id);
-        // Không gửi message lại
+        return;
     }
 
-    free(user_id);
-}
-void handle_get_online_players(int client_sock, const char *token) {
-    // Verify token
-    char *user_id = jwt_verify(token);
-    if (!user_id) {
-        log_warn("Invalid token for get online players");
-        message_t resp = {0};
-        resp.type = MSG_AUTH_FAILED;
-        strncpy(resp.payload.auth_fail.reason, "Invalid token", 63);
-        ws_send_message(client_sock, &resp);
-        return;
+    // Gọi game logic trên game worker nhưng KHÔNG gửi phản hồi
+    game_cmd_t *cmd = game_cmd_new(GAME_CMD_READY, client_sock, user_id);
+    if (cmd) {
+        memcpy(cmd->u.ready.board, board, BOARD_SIZE);
+        game_actor_post(game, cmd);
     }
-    
+    game_release(game);
+}
+void handle_get_online_players(int client_sock, const char *user_id) {
     log_info("User %s requesting online players list", user_id);
     
     // Lấy danh sách online players từ database
@@ -570,7 +552,6 @@ void handle_get_online_players(int client_sock, const char *token) {
     
     if (!players) {
         log_error("Failed to get online players");
-        free(user_id);
         return;
     }
     
@@ -603,22 +584,14 @@ void handle_get_online_players(int client_sock, const char *token) {
     
     // Cleanup
     online_players_free(players);
-    free(user_id);
 }
 
 // ✅ Handle CHALLENGE_PLAYER
-void handle_challenge_player(int client_sock, challenge_payload *payload, const char *token) {
-    char *challenger_id = jwt_verify(token);
-    if (!challenger_id) {
-        log_error("Invalid token for challenge");
-        return;
-    }
-    
+void handle_challenge_player(int client_sock, challenge_payload *payload, const char *challenger_id) {
     // Get challenger user info
     user_t *challenger = user_find_by_id(challenger_id);
     if (!challenger) {
         log_error("Challenger user not found: %s", challenger_id);
-        free(challenger_id);
         return;
     }
     
@@ -655,7 +628,6 @@ void handle_challenge_player(int client_sock, challenge_payload *payload, const
         
         user_free(challenger);
         user_free(target);
-        free(challenger_id);
         return;
     }
     
@@ -667,25 +639,25 @@ void handle_challenge_player(int client_sock, challenge_payload *payload, const
         log_error("Cannot find socket for target user: %s", payload->target_id);
         user_free(challenger);
         user_free(target);
-        free(challenger_id);
         return;
     }
     
     // Create challenge
-    char *challenge_id = challenge_create(
+    char challenge_id[65];
+    bool created = challenge_create(
         challenger_id, 
         target->id,
         client_sock,
         target_sock,
         payload->game_mode,
-        payload->time_control
+        payload->time_control,
+        challenge_id
     );
     
-    if (!challenge_id) {
+    if (!created) {
         log_error("Failed to create challenge");
         user_free(challenger);
         user_free(target);
-        free(challenger_id);
         return;
     }
     
@@ -702,8 +674,9 @@ void handle_challenge_player(int client_sock, challenge_payload *payload, const
             payload->game_mode, 31);
     recv_msg.payload.challenge_recv.time_control = payload->time_control;
     
-    challenge_session_t *c = challenge_get(challenge_id);
-    recv_msg.payload.challenge_recv.expires_at = c->expires_at;
+    challenge_session_t c;
+    recv_msg.payload.challenge_recv.expires_at = challenge_get(challenge_id, &c)
+        ? c.expires_at : (int64_t)time(NULL) + CHALLENGE_EXPIRE_TIME;
     
     ws_send_message(target_sock, &recv_msg);
     
@@ -712,141 +685,128 @@ void handle_challenge_player(int client_sock, challenge_payload *payload, const
     
     user_free(challenger);
     user_free(target);
-    free(challenger_id);
 }
 
 // ✅ Handle CHALLENGE_ACCEPT
-void handle_challenge_accept(int client_sock, challenge_response_payload *payload, const char *token) {
-    char *user_id = jwt_verify(token);
-    if (!user_id) return;
-    
-    challenge_session_t *c = challenge_get(payload->challenge_id);
-    if (!c) {
+void handle_challenge_accept(int client_sock, challenge_response_payload *payload, const char *user_id) {
+    challenge_session_t c;
+    if (!challenge_get(payload->challenge_id, &c)) {
         log_error("Challenge not found: %s", payload->challenge_id);
-        free(user_id);
         return;
     }
     
     // Verify that user is the target
-    if (strcmp(c->target_id, user_id) != 0) {
+    if (strcmp(c.target_id, user_id) != 0) {
         log_error("User %s not authorized to accept challenge %s", 
                   user_id, payload->challenge_id);
-        free(user_id);
         return;
     }
     
     // Accept challenge
     if (!challenge_accept(payload->challenge_id)) {
         log_error("Failed to accept challenge");
-        free(user_id);
         return;
     }
     
     // Create game
-    char game_id[65];
-    if (!game_create(c->challenger_id, c->target_id, game_id)) {
+    game_session_t *game = game_create(c.challenger_id, c.target_id,
+                                       c.challenger_socket, c.target_socket);
+    if (!game) {
         log_error("Failed to create game for challenge");
-        free(user_id);
+
+        // Challenge đã ACCEPTED nên expiry bỏ qua: phải tự gỡ, không thì slot
+        // bị giữ mãi. Báo cả hai bên là lời mời đã huỷ.
+        message_t cancel_msg = {0};
+        cancel_msg.type = MSG_CHALLENGE_CANCELLED;
+        strncpy(cancel_msg.payload.challenge_resp.challenge_id,
+                payload->challenge_id, 64);
+        ws_send_message(c.challenger_socket, &cancel_msg);
+        ws_send_message(c.target_socket, &cancel_msg);
+
+        challenge_remove(payload->challenge_id);
         return;
     }
     
-    // Assign sockets to game
-    game_session_t *game = game_get(game_id);
-    if (game) {
-        game->player1_socket = c->challenger_socket;
-        game->player2_socket = c->target_socket;
-    }
-    
-    // Get usernames
-    user_t *challenger = user_find_by_id(c->challenger_id);
-    user_t *target = user_find_by_id(c->target_id);
+    // Socket đã gán trong game_create; id và tên không đổi sau khi tạo
+    char game_id[65], challenger_name[32], target_name[32];
+    memcpy(game_id, game->game_id, sizeof(game_id));
+    memcpy(challenger_name, game->player1_name, sizeof(challenger_name));
+    memcpy(target_name, game->player2_name, sizeof(target_name));
+    game_release(game);
     
     // Send START_GAME to both players
     message_t start_msg1 = {0};
     start_msg1.type = MSG_START_GAME;
     strncpy(start_msg1.payload.start_game.game_id, game_id, 63);
-    strncpy(start_msg1.payload.start_game.opponent, 
-            target ? target->username : c->target_id, 31);
-    ws_send_message(c->challenger_socket, &start_msg1);
+    strncpy(start_msg1.payload.start_game.opponent, target_name, 31);
+    ws_send_message(c.challenger_socket, &start_msg1);
     
     message_t start_msg2 = {0};
     start_msg2.type = MSG_START_GAME;
     strncpy(start_msg2.payload.start_game.game_id, game_id, 63);
-    strncpy(start_msg2.payload.start_game.opponent, 
-            challenger ? challenger->username : c->challenger_id, 31);
-    ws_send_message(c->target_socket, &start_msg2);
+    strncpy(start_msg2.payload.start_game.opponent, challenger_name, 31);
+    ws_send_message(c.target_socket, &start_msg2);
     
     log_info("Challenge accepted, game started: %s", game_id);
     
     // Cleanup
     challenge_remove(payload->challenge_id);
-    
-    if (challenger) user_free(challenger);
-    if (target) user_free(target);
-    free(user_id);
 }
 
 // ✅ Handle CHALLENGE_DECLINE
-void handle_challenge_decline(int client_sock, challenge_response_payload *payload, const char *token) {
-    char *user_id = jwt_verify(token);
-    if (!user_id) return;
-    
-    challenge_session_t *c = challenge_get(payload->challenge_id);
-    if (!c) {
+void handle_challenge_decline(int client_sock, challenge_response_payload *payload, const char *user_id) {
+    challenge_session_t c;
+    if (!challenge_get(payload->challenge_id, &c)) {
         log_error("Challenge not found: %s", payload->challenge_id);
-        free(user_id);
         return;
     }
     
-    if (strcmp(c->target_id, user_id) != 0) {
+    if (strcmp(c.target_id, user_id) != 0) {
         log_error("User %s not authorized to decline challenge", user_id);
-        free(user_id);
         return;
     }
     
-    challenge_decline(payload->challenge_id);
+    // Đã được accept/cancel/expire ở thread khác
+    if (!challenge_decline(payload->challenge_id)) {
+        return;
+    }
     
     // Notify challenger
     message_t decline_msg = {0};
     decline_msg.type = MSG_CHALLENGE_DECLINED;
     strncpy(decline_msg.payload.challenge_resp.challenge_id, 
             payload->challenge_id, 64);
-    ws_send_message(c->challenger_socket, &decline_msg);
+    ws_send_message(c.challenger_socket, &decline_msg);
     
     log_info("Challenge declined: %s", payload->challenge_id);
     
     challenge_remove(payload->challenge_id);
-    free(user_id);
 }
 
 // ✅ Handle CHALLENGE_CANCEL
-void handle_challenge_cancel(int client_sock, challenge_response_payload *payload, const char *token) {
-    char *user_id = jwt_verify(token);
-    if (!user_id) return;
-    
-    challenge_session_t *c = challenge_get(payload->challenge_id);
-    if (!c) {
-        free(user_id);
+void handle_challenge_cancel(int client_sock, challenge_response_payload *payload, const char *user_id) {
+    challenge_session_t c;
+    if (!challenge_get(payload->challenge_id, &c)) {
         return;
     }
     
-    if (strcmp(c->challenger_id, user_id) != 0) {
+    if (strcmp(c.challenger_id, user_id) != 0) {
         log_error("User %s not authorized to cancel challenge", user_id);
-        free(user_id);
         return;
     }
     
-    challenge_cancel(payload->challenge_id);
+    if (!challenge_cancel(payload->challenge_id)) {
+        return;
+    }
     
     // Notify target
     message_t cancel_msg = {0};
     cancel_msg.type = MSG_CHALLENGE_CANCELLED;
     strncpy(cancel_msg.payload.challenge_resp.challenge_id, 
             payload->challenge_id, 64);
-    ws_send_message(c->target_socket, &cancel_msg);
+    ws_send_message(c.target_socket, &cancel_msg);
     
     log_info("Challenge cancelled: %s", payload->challenge_id);
     
     challenge_remove(payload->challenge_id);
-    free(user_id);
 }
@@ -0,0 +1,91 @@
+#include "network/ws_mask.h"
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define WS_MASK_X86 1
+#endif
+
+typedef void (*ws_mask_fn)(uint8_t *data, size_t len, uint32_t key32);
+
+// key32: 4 byte mask đã xoay theo key_offset, đọc theo thứ tự bộ nhớ
+static void mask_scalar(uint8_t *data, size_t len, uint32_t key32) {
+    uint64_t key64 = ((uint64_t)key32 << 32) | key32;
+    size_t i = 0;
+
+    for (; i + 8 <= len; i += 8) {
+        uint64_t word;
+        memcpy(&word, data + i, 8);
+        word ^= key64;
+        memcpy(data + i, &word, 8);
+    }
+
+    // Phần dư < 8 byte: vẫn bắt đầu ở bội số của 4 nên key không lệch pha
+    const uint8_t *key = (const uint8_t*)&key32;
+    for (; i < len; i++) {
+        data[i] ^= key[i & 3];
+    }
+}
+
+#ifdef WS_MASK_X86
+__attribute__((target("sse2")))
+static void mask_sse2(uint8_t *data, size_t len, uint32_t key32) {
+    __m128i key = _mm_set1_epi32((int)key32);
+    size_t i = 0;
+
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(data + i));
+        _mm_storeu_si128((__m128i*)(data + i), _mm_xor_si128(v, key));
+    }
+
+    mask_scalar(data + i, len - i, key32);
+}
+
+__attribute__((target("avx2")))
+static void mask_avx2(uint8_t *data, size_t len, uint32_t key32) {
+    __m256i key = _mm256_set1_epi32((int)key32);
+    size_t i = 0;
+
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(data + i));
+        _mm256_storeu_si256((__m256i*)(data + i), _mm256_xor_si256(v, key));
+    }
+
+    mask_scalar(data + i, len - i, key32);
+}
+#endif
+
+static ws_mask_fn g_mask_fn = mask_scalar;
+static const char *g_mask_name = "scalar";
+
+// Chọn implementation một lần trước main(), giống auto_load_env trong config.h
+__attribute__((constructor))
+static void ws_mask_select(void) {
+#ifdef WS_MASK_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        g_mask_fn = mask_avx2;
+        g_mask_name = "avx2";
+    } else if (__builtin_cpu_supports("sse2")) {
+        g_mask_fn = mask_sse2;
+        g_mask_name = "sse2";
+    }
+#endif
+}
+
+void ws_mask_apply(uint8_t *data, size_t len, const uint8_t key[4], size_t key_offset) {
+    if (len == 0) return;
+
+    uint8_t rotated[4];
+    for (int k = 0; k < 4; k++) {
+        rotated[k] = key[(key_offset + k) & 3];
+    }
+
+    uint32_t key32;
+    memcpy(&key32, rotated, 4);
+    g_mask_fn(data, len, key32);
+}
+
+const char* ws_mask_impl_name(void) {
+    return g_mask_name;
+}
@@ -1,7 +1,10 @@
 #include "network/ws_protocol.h"
+#include "network/ws_conn.h"
+#include "network/ws_mask.h"
 #include "utils/logger.h"
 #include <string.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <errno.h>
@@ -42,34 +45,39 @@ static void base64_encode(const unsigned char *in, size_t len, char *out) {
     out[j] = '\0';
 }
 
-// WebSocket handshake
-int ws_handshake(int sock) {
-    char buffer[2048] = {0};
-    int n = recv(sock, buffer, sizeof(buffer) - 1, 0);
-    
-    if (n <= 0) {
-        log_error("Failed to receive handshake request");
-        return -1;
-    }
-    
-    buffer[n] = '\0';
-    log_debug("Received handshake:\n%s", buffer);
-    
+// Client chọn wire format v2 bằng Sec-WebSocket-Protocol; không có thì dùng v1
+static uint8_t negotiate_version(const char *request) {
+    const char *proto = strstr(request, "Sec-WebSocket-Protocol:");
+    if (!proto) return WS_PROTO_V1;
+
+    const char *line_end = strstr(proto, "\r\n");
+    const char *v2 = strstr(proto, WS_SUBPROTOCOL_V2);
+    if (v2 && (!line_end || v2 < line_end)) return WS_PROTO_V2;
+
+    return WS_PROTO_V1;
+}
+
+// Build HTTP 101 response for a complete handshake request
+int ws_handshake_response(const char *request, char *response, size_t response_len, uint8_t *version) {
     // Parse Sec-WebSocket-Key
-    char *key_start = strstr(buffer, "Sec-WebSocket-Key: ");
+    const char *key_start = strstr(request, "Sec-WebSocket-Key: ");
     if (!key_start) {
         log_error("No Sec-WebSocket-Key found in handshake");
         return -1;
     }
     
     key_start += 19; // Length of "Sec-WebSocket-Key: "
-    char *key_end = strstr(key_start, "\r\n");
+    const char *key_end = strstr(key_start, "\r\n");
     if (!key_end) {
         log_error("Invalid Sec-WebSocket-Key format");
         return -1;
     }
     
     size_t key_len = key_end - key_start;
+    if (key_len >= 256) {
+        log_error("Sec-WebSocket-Key too long");
+        return -1;
+    }
     char client_key[256] = {0};
     strncpy(client_key, key_start, key_len);
     client_key[key_len] = '\0';
@@ -91,17 +99,38 @@ int ws_handshake(int sock) {
     
     log_debug("Sec-WebSocket-Accept: %s", accept_base64);
     
-    // Send handshake response
-    char response[1024];
-    snprintf(response, sizeof(response),
+    uint8_t negotiated = negotiate_version(request);
+    if (version) *version = negotiated;
+    
+    return snprintf(response, response_len,
         "HTTP/1.1 101 Switching Protocols\r\n"
         "Upgrade: websocket\r\n"
         "Connection: Upgrade\r\n"
         "Sec-WebSocket-Accept: %s\r\n"
+        "%s"
         "\r\n",
-        accept_base64);
+        accept_base64,
+        negotiated == WS_PROTO_V2 ? "Sec-WebSocket-Protocol: " WS_SUBPROTOCOL_V2 "\r\n" : "");
+}
+
+// WebSocket handshake (blocking socket)
+int ws_handshake(int sock) {
+    char buffer[2048] = {0};
+    int n = recv(sock, buffer, sizeof(buffer) - 1, 0);
+    
+    if (n <= 0) {
+        log_error("Failed to receive handshake request");
+        return -1;
+    }
+    
+    buffer[n] = '\0';
+    log_debug("Received handshake:\n%s", buffer);
+    
+    char response[1024];
+    int response_len = ws_handshake_response(buffer, response, sizeof(response), NULL);
+    if (response_len < 0) return -1;
     
-    int sent = send(sock, response, strlen(response), 0);
+    int sent = send(sock, response, response_len, 0);
     if (sent <= 0) {
         log_error("Failed to send handshake response");
         return -1;
@@ -112,40 +141,62 @@ int ws_handshake(int sock) {
 }
 
 // Send WebSocket frame
-int ws_send_frame(int sock, uint8_t opcode, const char *payload, size_t len) {
-    uint8_t header[10];
-    size_t header_len = 2;
-    
+// Build frame header (server → client, không mask). Trả về độ dài header.
+static size_t ws_frame_header(uint8_t opcode, size_t len, uint8_t header[10]) {
     header[0] = 0x80 | (opcode & 0x0F); // FIN + opcode
     
     if (len < 126) {
         header[1] = len;
-    } else if (len < 65536) {
+        return 2;
+    }
+    if (len < 65536) {
         header[1] = 126;
         header[2] = (len >> 8) & 0xFF;
         header[3] = len & 0xFF;
-        header_len = 4;
-    } else {
-        header[1] = 127;
-        for (int i = 0; i < 8; i++) {
-            header[9 - i] = (len >> (i * 8)) & 0xFF;
-        }
-        header_len = 10;
+        return 4;
     }
+    header[1] = 127;
+    for (int i = 0; i < 8; i++) {
+        header[9 - i] = (len >> (i * 8)) & 0xFF;
+    }
+    return 10;
+}
+
+static int ws_send_frame_conn(int sock, ws_conn_t *conn, uint8_t opcode, const void *payload, size_t len) {
+    uint8_t header[10];
+    size_t header_len = ws_frame_header(opcode, len, header);
     
-    if ((ssize_t)header_len != send(sock, (char*)header, header_len, 0)) {
-        log_error("Failed to send frame header");
-        return -1;
+    // Socket do reactor quản lý: đưa vào outbound mailbox, chỉ reactor ghi socket
+    if (conn) {
+        return ws_conn_enqueue(conn, header, header_len, payload, len);
     }
     
-    if (len > 0 && (ssize_t)len != send(sock, payload, len, 0)) {
-        log_error("Failed to send frame payload");
+    // Header + payload trong một lần gather write
+    
+    struct iovec iov[2] = {
+        { header, header_len },
+        { (void*)payload, len }
+    };
+    int iovcnt = len > 0 ? 2 : 1;
+    size_t total = header_len + len;
+    
+    ssize_t sent = writev(sock, iov, iovcnt);
+    if (sent < 0 || (size_t)sent != total) {
+        log_error("Failed to send frame (%zd/%zu bytes)", sent, total);
         return -1;
     }
     
     return 0;
 }
 
+// Send WebSocket frame
+int ws_send_frame(int sock, uint8_t opcode, const char *payload, size_t len) {
+    ws_conn_t *conn = ws_conn_acquire(sock);
+    int rc = ws_send_frame_conn(sock, conn, opcode, payload, len);
+    ws_conn_release(conn);
+    return rc;
+}
+
 // Receive WebSocket frame
 int ws_recv_frame(int sock, ws_frame_t *frame, char **payload) {
     uint8_t header[2];
@@ -210,9 +261,7 @@ int ws_recv_frame(int sock, ws_frame_t *frame, char **payload) {
         }
         
         if (frame->mask) {
-            for (size_t i = 0; i < frame->payload_len; i++) {
-                (*payload)[i] ^= frame->masking_key[i % 4];
-            }
+            ws_mask_apply((uint8_t*)*payload, frame->payload_len, frame->masking_key, 0);
         }
         (*payload)[frame->payload_len] = '\0';
     } else {
@@ -222,63 +271,239 @@ int ws_recv_frame(int sock, ws_frame_t *frame, char **payload) {
     return 0;
 }
 
-// Send WebSocket message (binary)
-ssize_t ws_send_message(int sock, message_t *msg) {
-    message_t tmp;
-    memcpy(&tmp, msg, sizeof(message_t));
+// Parse one frame from a receive buffer (non-blocking path).
+// Payload được unmask tại chỗ và *payload trỏ thẳng vào buf (zero-copy),
+// chỉ hợp lệ cho tới khi caller consume các byte này.
+// Returns bytes consumed, 0 if the frame is not complete yet, -1 on error.
+int ws_parse_frame(uint8_t *buf, size_t len, ws_frame_t *frame, char **payload) {
+    if (len < 2) return 0;
+    
+    frame->fin = (buf[0] & 0x80) >> 7;
+    frame->opcode = buf[0] & 0x0F;
+    frame->mask = (buf[1] & 0x80) >> 7;
+    frame->payload_len = buf[1] & 0x7F;
+    
+    size_t offset = 2;
+    if (frame->payload_len == 126) {
+        if (len < offset + 2) return 0;
+        frame->payload_len = (buf[2] << 8) | buf[3];
+        offset += 2;
+    } else if (frame->payload_len == 127) {
+        if (len < offset + 8) return 0;
+        frame->payload_len = 0;
+        for (int i = 0; i < 8; i++)
+            frame->payload_len = (frame->payload_len << 8) | buf[2 + i];
+        offset += 8;
+    }
+    
+    if (frame->mask) {
+        if (len < offset + 4) return 0;
+        memcpy(frame->masking_key, buf + offset, 4);
+        offset += 4;
+    }
     
-    if (ws_send_frame(sock, WS_OPCODE_BINARY, (char*)&tmp, sizeof(message_t)) < 0)
+    if (frame->payload_len > WS_MAX_FRAME_PAYLOAD) {
+        log_error("Frame too large: %llu bytes", (unsigned long long)frame->payload_len);
         return -1;
+    }
+    
+    if (len < offset + frame->payload_len) return 0;
+    
+    log_debug("Frame received: Opcode=0x%X, Len=%llu", frame->opcode, frame->payload_len);
+    
+    if (frame->payload_len > 0) {
+        *payload = (char*)(buf + offset);
+        if (frame->mask) {
+            ws_mask_apply((uint8_t*)*payload, frame->payload_len, frame->masking_key, 0);
+        }
+    } else {
+        *payload = NULL;
+    }
     
-    return sizeof(message_t);
+    return (int)(offset + frame->payload_len);
 }
 
-// Receive WebSocket message (binary)
-ssize_t ws_recv_message(int sock, message_t *msg) {
-    ws_frame_t frame;
-    char *payload = NULL;
-    
-    if (ws_recv_frame(sock, &frame, &payload) < 0) return -1;
+// Kích thước payload thực sự dùng cho từng loại message (v2)
+size_t ws_payload_size(msg_type type) {
+    message_t *m = NULL;
+
+    switch (type) {
+        case MSG_REGISTER:
+        case MSG_LOGIN:                 return sizeof(m->payload.auth);
+        case MSG_AUTH_SUCCESS:          return sizeof(m->payload.auth_suc);
+        case MSG_AUTH_FAILED:           return sizeof(m->payload.auth_fail);
+        case MSG_START_GAME:            return sizeof(m->payload.start_game);
+        case MSG_PLAYER_MOVE:           return sizeof(m->payload.move);
+        case MSG_MOVE_RESULT:           return sizeof(m->payload.move_res);
+        case MSG_CHAT:                  return sizeof(m->payload.chat);
+        case MSG_CHAT_MESSAGE:          return sizeof(m->payload.chat_msg);
+        case MSG_PLACE_SHIP:            return sizeof(m->payload.place_ship);
+        case MSG_PLACE_FLEET:           return sizeof(m->payload.place_fleet);
+        case MSG_PLAYER_READY:          return sizeof(m->payload.ready);
+        case MSG_ONLINE_PLAYERS_LIST:   return sizeof(m->payload.online_players);
+        case MSG_CHALLENGE_PLAYER:      return sizeof(m->payload.challenge);
+        case MSG_CHALLENGE_RECEIVED:    return sizeof(m->payload.challenge_recv);
+        case MSG_CHALLENGE_ACCEPT:
+        case MSG_CHALLENGE_DECLINE:
+        case MSG_CHALLENGE_DECLINED:
+        case MSG_CHALLENGE_EXPIRED:
+        case MSG_CHALLENGE_CANCEL:
+        case MSG_CHALLENGE_CANCELLED:   return sizeof(m->payload.challenge_resp);
+        case MSG_TURN_WARNING:          return sizeof(m->payload.turn_warning);
+        case MSG_GAME_TIMEOUT:          return sizeof(m->payload.game_timeout);
+        case MSG_JOIN_QUEUE:
+        case MSG_LEAVE_QUEUE:
+        case MSG_GAME_OVER:
+        case MSG_LOGOUT:
+        case MSG_PING:
+        case MSG_PONG:
+        case MSG_GET_ONLINE_PLAYERS:
+        case MSG_AUTH_TOKEN:            return 0;  // Chỉ có type (+ token)
+        default:                        return sizeof(m->payload);
+    }
+}
+
+static void put_u16_le(uint8_t *p, uint16_t v) {
+    p[0] = v & 0xFF;
+    p[1] = (v >> 8) & 0xFF;
+}
+
+static uint16_t get_u16_le(const uint8_t *p) {
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+// Encode v2: chỉ gửi token nếu có, payload bỏ phần zero ở cuối (bên nhận tự zero-fill)
+static size_t ws_encode_v2(const message_t *msg, uint8_t *out) {
+    size_t token_len = strnlen(msg->token, MAX_JWT_LEN - 1);
+    size_t payload_len = ws_payload_size(msg->type);
+    const uint8_t *payload = (const uint8_t*)&msg->payload;
+
+    while (payload_len > 0 && payload[payload_len - 1] == 0) payload_len--;
+
+    out[0] = (uint8_t)msg->type;
+    put_u16_le(out + 1, (uint16_t)token_len);
+    put_u16_le(out + 3, (uint16_t)payload_len);
+    memcpy(out + WS_V2_HEADER_LEN, msg->token, token_len);
+    memcpy(out + WS_V2_HEADER_LEN + token_len, payload, payload_len);
+
+    return WS_V2_HEADER_LEN + token_len + payload_len;
+}
+
+static int ws_decode_v2(const uint8_t *data, size_t len, message_t *msg) {
+    if (len < WS_V2_HEADER_LEN) {
+        log_error("v2 message too short: %zu bytes", len);
+        return -1;
+    }
+
+    size_t token_len = get_u16_le(data + 1);
+    size_t payload_len = get_u16_le(data + 3);
+
+    if (token_len >= MAX_JWT_LEN || payload_len > sizeof(msg->payload) ||
+        WS_V2_HEADER_LEN + token_len + payload_len != len) {
+        log_error("Invalid v2 message: token_len=%zu payload_len=%zu frame=%zu",
+                  token_len, payload_len, len);
+        return -1;
+    }
+
+    msg->type = (msg_type)data[0];
+    memcpy(msg->token, data + WS_V2_HEADER_LEN, token_len);
+    msg->token[token_len] = '\0';
+
+    // Zero-fill phần payload bị cắt để handler đọc struct như bản v1
+    uint8_t *payload = (uint8_t*)&msg->payload;
+    size_t full_len = ws_payload_size(msg->type);
+    memcpy(payload, data + WS_V2_HEADER_LEN + token_len, payload_len);
+    if (full_len > payload_len) {
+        memset(payload + payload_len, 0, full_len - payload_len);
+    }
+
+    return 0;
+}
+
+// Send WebSocket message (binary)
+ssize_t ws_send_message(int sock, message_t *msg) {
+    ws_conn_t *conn = ws_conn_acquire(sock);
+    uint8_t version = conn ? conn->proto_version : WS_PROTO_V1;
+    ssize_t rc;
+    
+    if (version == WS_PROTO_V2) {
+        uint8_t buf[WS_V2_MAX_LEN];
+        size_t len = ws_encode_v2(msg, buf);
+        rc = ws_send_frame_conn(sock, conn, WS_OPCODE_BINARY, buf, len) < 0 ? -1 : (ssize_t)len;
+    } else {
+        // Gửi thẳng từ msg, không cần bản sao tạm
+        rc = ws_send_frame_conn(sock, conn, WS_OPCODE_BINARY, msg, sizeof(message_t)) < 0
+             ? -1 : (ssize_t)sizeof(message_t);
+    }
     
-    if (frame.opcode == WS_OPCODE_CLOSE) { 
+    ws_conn_release(conn);
+    return rc;
+}
+
+// Turn a received frame into a message_t, answering control frames
+ws_decode_result_t ws_decode_message(int sock, uint8_t version, const ws_frame_t *frame, const char *payload, message_t *msg) {
+    if (frame->opcode == WS_OPCODE_CLOSE) { 
         log_info("Received CLOSE frame");
-        free(payload); 
-        return 0; 
+        return WS_DECODE_CLOSE; 
     }
     
-    if (frame.opcode == WS_OPCODE_PING) {
+    if (frame->opcode == WS_OPCODE_PING) {
         log_debug("Received PING, sending PONG");
-        ws_send_frame(sock, WS_OPCODE_PONG, payload, frame.payload_len);
-        free(payload);
-        return ws_recv_message(sock, msg); // Đệ quy để đọc message tiếp theo
+        ws_send_frame(sock, WS_OPCODE_PONG, payload, frame->payload_len);
+        return WS_DECODE_CONTROL;
+    }
+    
+    if (frame->opcode == WS_OPCODE_PONG) {
+        return WS_DECODE_CONTROL;
     }
     
     // DEBUG: Kiểm tra xem có phải client gửi nhầm Text Frame không
-    if (frame.opcode == WS_OPCODE_TEXT) {
+    if (frame->opcode == WS_OPCODE_TEXT) {
         log_warn("Received TEXT frame but server expects BINARY struct message_t.");
-        log_warn("Payload content: %s", payload ? payload : "(null)");
+        log_warn("Payload content: %.*s", (int)frame->payload_len, payload ? payload : "");
         // Nếu bạn muốn hỗ trợ JSON trong tương lai, parse payload tại đây.
         // Hiện tại code đang ép kiểu binary struct, nên text sẽ gây lỗi dữ liệu rác.
-        free(payload);
-        return -1; 
+        return WS_DECODE_ERROR; 
     }
 
-    if (frame.opcode != WS_OPCODE_BINARY) { 
-        log_error("Unsupported Opcode: 0x%X", frame.opcode);
-        free(payload); 
-        return -1; 
+    if (frame->opcode != WS_OPCODE_BINARY) { 
+        log_error("Unsupported Opcode: 0x%X", frame->opcode);
+        return WS_DECODE_ERROR; 
     }
     
-    if (frame.payload_len != sizeof(message_t)) { 
-        log_error("Size mismatch! Expected %lu bytes (sizeof message_t), got %llu bytes", sizeof(message_t), frame.payload_len);
-        free(payload); 
-        return -1; 
+    if (version == WS_PROTO_V2) {
+        if (ws_decode_v2((const uint8_t*)payload, frame->payload_len, msg) < 0)
+            return WS_DECODE_ERROR;
+        return WS_DECODE_MESSAGE;
     }
     
-    memcpy(msg, payload, sizeof(message_t));
-    free(payload);
+    if (frame->payload_len != sizeof(message_t)) { 
+        log_error("Size mismatch! Expected %lu bytes (sizeof message_t), got %llu bytes", sizeof(message_t), frame->payload_len);
+        return WS_DECODE_ERROR; 
+    }
     
-    return sizeof(message_t);
+    memcpy(msg, payload, sizeof(message_t));
+    return WS_DECODE_MESSAGE;
+}
+
+// Receive WebSocket message (binary, blocking socket)
+ssize_t ws_recv_message(int sock, message_t *msg) {
+    while (1) {
+        ws_frame_t frame;
+        char *payload = NULL;
+        
+        if (ws_recv_frame(sock, &frame, &payload) < 0) return -1;
+        
+        ws_decode_result_t res = ws_decode_message(sock, WS_PROTO_V1, &frame, payload, msg);
+        free(payload);
+        
+        switch (res) {
+            case WS_DECODE_MESSAGE: return sizeof(message_t);
+            case WS_DECODE_CLOSE: return 0;
+            case WS_DECODE_CONTROL: continue; // Đọc message tiếp theo
+            default: return -1;
+        }
+    }
 }
 
 // Close WebSocket
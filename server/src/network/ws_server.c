@@ -1,9 +1,17 @@
+#define _GNU_SOURCE
 #include "network/ws_server.h"
+#include "network/ws_conn.h"
 #include "network/ws_protocol.h"
+#include "network/ws_mask.h"
+#include "network/client_registry.h"
 #include "network/ws_handler.h"
 #include "utils/logger.h"
 #include "matchmaking/matcher.h"
 #include "game/game.h"
+#include "game/game_registry.h"
+#include "game/game_actor.h"
+#include "game/game_persist.h"
+#include "game/game_wal.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -12,86 +20,42 @@
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
-#include <sys/time.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
 #include "matchmaking/challenge_manager.h"
+#include "config.h"
+#include "utils/timer_wheel.h"
 
-#define MAX_CLIENTS 100
-
-typedef struct {
-    int socket;
-    char user_id[64];
-    bool authenticated;
-} client_info_t;
-
-static client_info_t g_clients[MAX_CLIENTS];
-static pthread_mutex_t g_clients_mutex = PTHREAD_MUTEX_INITIALIZER;
+#define WS_MAX_EVENTS 256
+#define WS_HANDSHAKE_MAX 4096
+#define WS_IDLE_TIMEOUT 300        // 5 minutes
+#define WS_STATS_INTERVAL 10
+#define WS_ACCEPT_PAUSE_MS 100    // Hết fd và không còn fd dự phòng: ngừng accept ngần này
 
 // ✅ Register client khi login thành công
 void client_register(int client_sock, const char *user_id) {
-    pthread_mutex_lock(&g_clients_mutex);
-
-    // ✅ Step 1: Check if user already registered (including disconnected with socket=-1)
-    for (int i = 0; i < MAX_CLIENTS; i++) {
-        if (g_clients[i].authenticated && 
-            strcmp(g_clients[i].user_id, user_id) == 0) {
-            
-            int old_socket = g_clients[i].socket;
-            
-            if (old_socket == -1) {
-                // User was disconnected, now reconnecting
-                log_info("✅ [CLIENT_REGISTER] User %s reconnected (new socket=%d)", 
-                         user_id, client_sock);
-            } else if (old_socket != client_sock) {
-                // User logging in from different socket
-                log_warn("🔄 [CLIENT_REGISTER] User %s already registered (old socket=%d → new socket=%d)", 
-                         user_id, old_socket, client_sock);
-                
-                // Close old socket if still open
-                if (old_socket > 0) {
-                    log_info("   Closing old socket %d", old_socket);
-                    close(old_socket);
-                }
-            } else {
-                // Same socket, same user (redundant call)
-                log_info("✅ [CLIENT_REGISTER] User %s already at socket %d", 
-                         user_id, client_sock);
-            }
-            
-            // Update to new socket
-            g_clients[i].socket = client_sock;
-            
-            // Update user status to online
-            user_update_status(user_id, "online");
-            
-            pthread_mutex_unlock(&g_clients_mutex);
-            return;
-        }
-    }
-    
-    // ✅ Step 2: User not found → Register new entry
-    for (int i = 0; i < MAX_CLIENTS; i++) {
-        if (g_clients[i].socket == 0 || g_clients[i].socket == -1) {
-            g_clients[i].socket = client_sock;
-            strncpy(g_clients[i].user_id, user_id, 63);
-            g_clients[i].user_id[63] = '\0';
-            g_clients[i].authenticated = true;
-            
-            log_info("✅ [CLIENT_REGISTER] New registration at slot %d: socket=%d, user_id=%s", 
-                     i, client_sock, user_id);
-            
-            // Set user status to online
-            user_update_status(user_id, "online");
-            
-            pthread_mutex_unlock(&g_clients_mutex);
-            return;
-        }
+    int old_socket = client_registry_bind(user_id, client_sock);
+
+    if (old_socket == -1) {
+        log_info("✅ [CLIENT_REGISTER] User %s registered at socket %d", user_id, client_sock);
+    } else if (old_socket != client_sock) {
+        // User logging in from different socket
+        log_warn("🔄 [CLIENT_REGISTER] User %s already registered (old socket=%d → new socket=%d)", 
+                 user_id, old_socket, client_sock);
+        
+        // Close old socket if still open
+        log_info("   Closing old socket %d", old_socket);
+        ws_conn_shutdown(old_socket);
+    } else {
+        // Same socket, same user (redundant call)
+        log_info("✅ [CLIENT_REGISTER] User %s already at socket %d", user_id, client_sock);
     }
     
-    //Step 3: Registry full
-    log_error("❌ [CLIENT_REGISTER] Registry FULL! Cannot register user_id=%s", 
-              user_id);
-    
-    pthread_mutex_unlock(&g_clients_mutex);
+    // Update user status to online
+    user_update_status(user_id, "online");
 }
 
 int get_socket_by_user_id(const char *user_id) {
@@ -100,131 +64,461 @@ int get_socket_by_user_id(const char *user_id) {
         return -1;
     }
     
-    pthread_mutex_lock(&g_clients_mutex);
-    
-    for (int i = 0; i < MAX_CLIENTS; i++) {
-        if (g_clients[i].authenticated && 
-            g_clients[i].socket > 0 &&
-            strcmp(g_clients[i].user_id, user_id) == 0) {
-            
-            int socket = g_clients[i].socket;
-            pthread_mutex_unlock(&g_clients_mutex);
-            
-            log_debug("Found socket %d for user_id: %s", socket, user_id);
-            return socket;
-        }
+    int socket = client_registry_lookup(user_id);
+    if (socket < 0) {
+        log_warn("Socket not found for user_id: %s", user_id);
+        return -1;
     }
     
-    pthread_mutex_unlock(&g_clients_mutex);
-    log_warn("Socket not found for user_id: %s", user_id);
-    return -1;
+    log_debug("Found socket %d for user_id: %s", socket, user_id);
+    return socket;
 }
 
-void* challenge_expiration_thread(void* arg) {
-    log_info("Challenge expiration thread started");
+// Cleanup khi disconnect
+static void client_cleanup(int client_sock) {
+    char user_id[64];
+    if (!client_registry_unbind_socket(client_sock, user_id, sizeof(user_id))) {
+        return; // Chưa đăng nhập, hoặc user đã chuyển sang socket khác
+    }
+    
+    log_info("[CLEANUP] Client socket=%d, user_id=%s", client_sock, user_id);
     
+    // Xóa khỏi matchmaking queue
+    matcher_remove_from_queue(user_id);
+    if (user_id[0] != '\0') {
+        user_update_status(user_id, "offline");
+        log_info("✅ User %s marked offline in database", user_id);
+    }
+}
+
+// ====================== Worker pool ======================
+// Reactor chỉ làm I/O; handle_message (có thể gọi MongoDB) chạy trên worker.
+// Mỗi connection gắn cố định vào một worker nên message được xử lý đúng thứ tự.
+typedef enum {
+    WS_JOB_MESSAGE,
+    WS_JOB_DISCONNECT
+} ws_job_kind_t;
+
+typedef struct ws_job {
+    ws_job_kind_t kind;
+    ws_conn_t *conn;
+    struct ws_job *next;
+    message_t msg;
+} ws_job_t;
+
+typedef struct {
+    pthread_t tid;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    ws_job_t *head;
+    ws_job_t *tail;
+} ws_worker_t;
+
+static ws_worker_t *g_workers = NULL;
+static int g_worker_count = 0;
+
+// Job được tái sử dụng thay vì malloc/free cho mỗi message
+static ws_job_t *g_job_freelist = NULL;
+static pthread_mutex_t g_job_freelist_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static ws_job_t* job_alloc(void) {
+    pthread_mutex_lock(&g_job_freelist_mutex);
+    ws_job_t *job = g_job_freelist;
+    if (job) g_job_freelist = job->next;
+    pthread_mutex_unlock(&g_job_freelist_mutex);
+
+    // Freelist rỗng: cấp phát mới, sau đó job sẽ được giữ lại để dùng tiếp
+    if (!job) job = malloc(sizeof(ws_job_t));
+    return job;
+}
+
+static void job_recycle(ws_job_t *job) {
+    pthread_mutex_lock(&g_job_freelist_mutex);
+    job->next = g_job_freelist;
+    g_job_freelist = job;
+    pthread_mutex_unlock(&g_job_freelist_mutex);
+}
+
+static void worker_submit(ws_job_t *job) {
+    ws_worker_t *w = &g_workers[job->conn->worker];
+
+    pthread_mutex_lock(&w->mutex);
+    job->next = NULL;
+    if (w->tail) {
+        w->tail->next = job;
+    } else {
+        w->head = job;
+    }
+    w->tail = job;
+    pthread_cond_signal(&w->cond);
+    pthread_mutex_unlock(&w->mutex);
+}
+
+static void* worker_thread(void* arg) {
+    ws_worker_t *w = (ws_worker_t*)arg;
+
     while (1) {
-        sleep(5);  // Check every 5 seconds
-        // Check for expired challenges
-        challenge_check_expired();
+        pthread_mutex_lock(&w->mutex);
+        while (!w->head) {
+            pthread_cond_wait(&w->cond, &w->mutex);
+        }
+        ws_job_t *job = w->head;
+        w->head = job->next;
+        if (!w->head) w->tail = NULL;
+        pthread_mutex_unlock(&w->mutex);
+
+        int client_sock = job->conn->fd;
+
+        if (job->kind == WS_JOB_MESSAGE) {
+            log_info("Received WebSocket message type=%d from client %d", job->msg.type, client_sock);
+            handle_message(client_sock, &job->msg);
+            log_info("Message handled successfully for client %d", client_sock);
+        } else {
+            log_info("[DISCONNECT] Client %d disconnecting, cleaning up...", client_sock);
+            client_cleanup(client_sock);
+            ws_conn_close(job->conn);
+            log_info("Client %d connection closed", client_sock);
+        }
+
+        ws_conn_release(job->conn);
+        job_recycle(job);
     }
-    
+
     return NULL;
 }
 
-// Cleanup khi disconnect
-static void client_cleanup(int client_sock) {
-    pthread_mutex_lock(&g_clients_mutex);
-    
-    for (int i = 0; i < MAX_CLIENTS; i++) {
-        if (g_clients[i].socket == client_sock) {
-            if (g_clients[i].authenticated) {
-                log_info("[CLEANUP] Client socket=%d, user_id=%s", 
-                         client_sock, g_clients[i].user_id);
-                
-                // Xóa khỏi matchmaking queue
-                matcher_remove_from_queue(g_clients[i].user_id);
-                g_clients[i].socket = -1;
-                char user_id[64];
-                strncpy(user_id, g_clients[i].user_id, 63);
-                user_id[63] = '\0';
-                if (user_id[0] != '\0') {
-                user_update_status(user_id, "offline");
-                log_info("✅ User %s marked offline in database", user_id);
-            }
-            } else {
-                // User chưa authenticated → xóa luôn
-                g_clients[i].socket = 0;
-                g_clients[i].user_id[0] = '\0';
-                g_clients[i].authenticated = false;
+static bool workers_start(int count) {
+    g_workers = calloc(count, sizeof(ws_worker_t));
+    if (!g_workers) return false;
+
+    for (int i = 0; i < count; i++) {
+        pthread_mutex_init(&g_workers[i].mutex, NULL);
+        pthread_cond_init(&g_workers[i].cond, NULL);
+
+        if (pthread_create(&g_workers[i].tid, NULL, worker_thread, &g_workers[i]) != 0) {
+            log_error("Failed to create worker thread %d", i);
+            return false;
+        }
+        pthread_detach(g_workers[i].tid);
+        g_worker_count++;
+    }
+
+    log_info("Started %d WebSocket worker threads", g_worker_count);
+    return true;
+}
+
+// ====================== Reactor ======================
+static int g_epoll_fd = -1;
+static int g_next_worker = 0;
+static int g_notify_marker;     // epoll data.ptr của eventfd outbound
+
+// Tách connection khỏi epoll; worker sẽ cleanup sau các message còn trong hàng đợi
+static void conn_begin_close(ws_conn_t *conn) {
+    if (conn->state == WS_CONN_CLOSING) return;
+
+    conn->state = WS_CONN_CLOSING;
+    epoll_ctl(g_epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+
+    ws_job_t *job = job_alloc();
+    if (!job) {
+        log_error("Out of memory queueing disconnect for socket %d", conn->fd);
+        return;
+    }
+    job->kind = WS_JOB_DISCONNECT;
+    job->conn = ws_conn_acquire(conn->fd);
+    if (!job->conn) {
+        job_recycle(job);
+        return;
+    }
+    worker_submit(job);
+}
+
+static int conn_process_handshake(ws_conn_t *conn) {
+    // Request handshake nhỏ và chỉ đến một lần: cho liền mạch để dùng memmem
+    ws_conn_ring_linearize(conn);
+
+    uint8_t *end = memmem(conn->rbuf, conn->rlen, "\r\n\r\n", 4);
+    if (!end) {
+        if (conn->rlen >= WS_HANDSHAKE_MAX) {
+            log_error("Handshake request too large from socket %d", conn->fd);
+            return -1;
+        }
+        return 0; // Chưa nhận đủ request
+    }
+
+    size_t request_len = (size_t)(end - conn->rbuf) + 4;
+    if (request_len > WS_HANDSHAKE_MAX) {
+        log_error("Handshake request too large from socket %d", conn->fd);
+        return -1;
+    }
+
+    char request[WS_HANDSHAKE_MAX + 1];
+    memcpy(request, conn->rbuf, request_len);
+    request[request_len] = '\0';
+    log_debug("Received handshake:\n%s", request);
+
+    char response[1024];
+    int response_len = ws_handshake_response(request, response, sizeof(response), &conn->proto_version);
+    if (response_len < 0 || ws_conn_write(conn, response, response_len, NULL, 0) < 0) {
+        log_error("WebSocket handshake failed for socket %d", conn->fd);
+        return -1;
+    }
+
+    ws_conn_ring_consume(conn, request_len);
+    conn->state = WS_CONN_OPEN;
+    log_info("WebSocket handshake completed for socket %d (protocol v%d)", conn->fd, conn->proto_version);
+    return 0;
+}
+
+// Parse mọi frame hoàn chỉnh ngay trong ring, giữ lại phần frame dở dang
+static int conn_process_input(ws_conn_t *conn) {
+    if (conn->state == WS_CONN_HANDSHAKE && conn_process_handshake(conn) < 0) {
+        return -1;
+    }
+
+    while (conn->state == WS_CONN_OPEN && conn->rlen > 0) {
+        ws_frame_t frame;
+        char *payload = NULL;
+
+        size_t contiguous = ws_conn_ring_contiguous(conn);
+        int consumed = ws_parse_frame(conn->rbuf + conn->rhead, contiguous, &frame, &payload);
+        if (consumed == 0 && contiguous < conn->rlen) {
+            // Frame bị cắt ở cuối ring: xoay cho liền rồi parse lại
+            ws_conn_ring_linearize(conn);
+            consumed = ws_parse_frame(conn->rbuf, conn->rlen, &frame, &payload);
+        }
+        if (consumed < 0) return -1;
+        if (consumed == 0) break;
+
+        ws_job_t *job = job_alloc();
+        if (!job) return -1;
+
+        // payload là view vào ring, chỉ copy một lần vào job->msg
+        ws_decode_result_t res = ws_decode_message(conn->fd, conn->proto_version, &frame, payload, &job->msg);
+        ws_conn_ring_consume(conn, consumed);
+
+        if (res == WS_DECODE_MESSAGE) {
+            job->kind = WS_JOB_MESSAGE;
+            job->conn = ws_conn_acquire(conn->fd);
+            worker_submit(job);
+            continue;
+        }
+
+        job_recycle(job);
+        if (res == WS_DECODE_CLOSE) {
+            log_info("Client %d closed WebSocket connection gracefully", conn->fd);
+            return -1;
+        }
+        if (res == WS_DECODE_ERROR) {
+            log_error("Invalid WebSocket message from client %d", conn->fd);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+// Edge-triggered: đọc đến khi EAGAIN, mỗi lần một readv lấp đầy phần trống của ring
+static void conn_on_readable(ws_conn_t *conn) {
+    while (conn->state != WS_CONN_CLOSING) {
+        ssize_t n = ws_conn_ring_fill(conn);
+        if (n > 0) {
+            __atomic_store_n(&conn->last_active_ms, timer_now_ms(), __ATOMIC_RELAXED);
+            if (conn_process_input(conn) < 0) {
+                conn_begin_close(conn);
+                return;
             }
-            break;
+            continue;
         }
+
+        if (n == 0) {
+            log_info("Client %d closed connection", conn->fd);
+            conn_begin_close(conn);
+            return;
+        }
+
+        if (errno == EINTR) continue;
+        if (errno == EAGAIN || errno == EWOULDBLOCK) return;
+
+        if (errno == ENOBUFS) {
+            log_error("Receive buffer overflow on socket %d", conn->fd);
+        } else {
+            log_error("recv failed on socket %d: errno=%d", conn->fd, errno);
+        }
+        conn_begin_close(conn);
+        return;
     }
-    
-    pthread_mutex_unlock(&g_clients_mutex);
 }
 
-// ====================== Thread client ======================
-void* client_thread(void* arg) {
-    int client_sock = (int)(intptr_t)arg;
-    message_t msg;
+// Thay cho SO_RCVTIMEO: mỗi connection có một idle timer. Nhận dữ liệu chỉ
+// cập nhật last_active_ms; timer tới hạn thì tự dời tới deadline mới nếu
+// connection vẫn hoạt động, nên không phải arm lại cho từng gói tin.
+// ws_conn_close cancel timer trước khi nhả connection nên conn luôn hợp lệ ở đây.
+static void conn_idle_expired(void *arg) {
+    ws_conn_t *conn = (ws_conn_t*)arg;
+    if (conn->state == WS_CONN_CLOSING) return;
 
-    log_info("Client connected: socket=%d", client_sock);
+    uint64_t idle = timer_now_ms() - __atomic_load_n(&conn->last_active_ms, __ATOMIC_RELAXED);
+    if (idle < (uint64_t)WS_IDLE_TIMEOUT * 1000) {
+        timer_arm(&conn->idle_timer, (uint64_t)WS_IDLE_TIMEOUT * 1000 - idle);
+        return;
+    }
 
-    struct timeval timeout;
-    timeout.tv_sec = 300;  // 5 minutes
-    timeout.tv_usec = 0;
-    
-    if (setsockopt(client_sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) < 0) {
-        log_warn("Không thể set socket timeout");
+    log_info("Closing idle connection: socket=%d", conn->fd);
+    ws_conn_shutdown(conn->fd);
+}
+
+static timer_entry_t g_stats_timer;
+
+static void write_stats_tick(void *arg) {
+    uint64_t frames, syscalls;
+    ws_conn_write_stats(&frames, &syscalls);
+    log_debug("Write path: %llu frames, %llu write syscalls",
+              (unsigned long long)frames, (unsigned long long)syscalls);
+
+    uint64_t commands, delay_total, delay_max;
+    game_actor_stats(&commands, &delay_total, &delay_max);
+    log_debug("Game actors: %llu commands, avg queue delay %llums, max %llums",
+              (unsigned long long)commands,
+              (unsigned long long)(commands ? delay_total / commands : 0),
+              (unsigned long long)delay_max);
+
+    game_persist_stats_t persist;
+    game_persist_stats(&persist);
+    log_debug("Game persist: queue %llu (peak %llu), %llu flushes, %llu games, %llu failed, "
+              "avg flush %llums, max %llums",
+              (unsigned long long)persist.queue_depth, (unsigned long long)persist.queue_peak,
+              (unsigned long long)persist.flushes, (unsigned long long)persist.games_written,
+              (unsigned long long)persist.failures,
+              (unsigned long long)(persist.flushes ? persist.flush_total_ms / persist.flushes : 0),
+              (unsigned long long)persist.flush_max_ms);
+
+    game_wal_stats_t wal;
+    game_wal_stats(&wal);
+    log_debug("Game WAL: %llu appends (%llu bytes), lsn %llu, durable %llu, %llu segments, "
+              "%llu syncs, avg sync %llums, max %llums",
+              (unsigned long long)wal.appends, (unsigned long long)wal.bytes,
+              (unsigned long long)wal.last_lsn, (unsigned long long)wal.durable_lsn,
+              (unsigned long long)wal.segments, (unsigned long long)wal.syncs,
+              (unsigned long long)(wal.syncs ? wal.sync_total_ms / wal.syncs : 0),
+              (unsigned long long)wal.sync_max_ms);
+
+    matcher_stats_t match;
+    matcher_stats(&match);
+    log_debug("Matchmaking: queue %llu (+%llu pending, %llu applied), %llu passes (max %llums), "
+              "%llu matches (avg gap %llu ELO), %llu create failures",
+              (unsigned long long)match.queued, (unsigned long long)match.intake_pending,
+              (unsigned long long)match.intake_ops, (unsigned long long)match.passes,
+              (unsigned long long)match.pass_max_ms, (unsigned long long)match.matches,
+              (unsigned long long)(match.matches ? match.elo_gap_total / match.matches : 0),
+              (unsigned long long)match.create_failures);
+    static const char *bands[MATCH_ELO_BANDS] = { "<800", "800-1199", "1200-1599", "1600-1999", ">=2000" };
+    for (int i = 0; i < MATCH_ELO_BANDS; i++) {
+        if (match.bands[i].players == 0) continue;
+        log_debug("Matchmaking wait ELO %s: %llu players, p50 %llums, p90 %llums, p99 %llums, max %llums",
+                  bands[i], (unsigned long long)match.bands[i].players,
+                  (unsigned long long)match.bands[i].p50_ms, (unsigned long long)match.bands[i].p90_ms,
+                  (unsigned long long)match.bands[i].p99_ms, (unsigned long long)match.bands[i].max_ms);
     }
-    
-    // Perform WebSocket handshake
-    if (ws_handshake(client_sock) < 0) {
-        log_error("WebSocket handshake failed for socket %d", client_sock);
-        close(client_sock);
-        return NULL;
+    timer_arm(&g_stats_timer, WS_STATS_INTERVAL * 1000);
+}
+
+// Giữ sẵn một fd: khi hết fd (EMFILE/ENFILE) thì nhả nó ra để accept rồi đóng
+// ngay kết nối đang chờ. Nếu không, kết nối nằm mãi trong backlog và listener
+// level-triggered làm epoll_wait trả về liên tục (reactor quay 100% CPU).
+static int g_reserve_fd = -1;
+static int g_listen_fd = -1;
+static timer_entry_t g_accept_timer;
+
+static void listener_set_paused(bool paused) {
+    struct epoll_event ev;
+    ev.events = paused ? 0 : EPOLLIN;
+    ev.data.ptr = NULL;
+    epoll_ctl(g_epoll_fd, EPOLL_CTL_MOD, g_listen_fd, &ev);
+}
+
+static void accept_resume(void *arg) {
+    (void)arg;
+    if (g_reserve_fd < 0) {
+        g_reserve_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    }
+    listener_set_paused(false);
+}
+
+// Trả về true nếu đã bỏ được một kết nối và có thể accept tiếp
+static bool accept_shed(int server_sock) {
+    if (g_reserve_fd >= 0) {
+        close(g_reserve_fd);
+        g_reserve_fd = -1;
+
+        int sock = accept4(server_sock, NULL, NULL, SOCK_CLOEXEC);
+        if (sock >= 0) close(sock);
+        g_reserve_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+        if (sock >= 0 && g_reserve_fd >= 0) return true;
     }
 
-    log_info("WebSocket handshake completed for socket %d", client_sock);
+    // Không lấy lại được fd dự phòng: tạm ngừng theo dõi listener
+    listener_set_paused(true);
+    timer_arm(&g_accept_timer, WS_ACCEPT_PAUSE_MS);
+    return false;
+}
+
+static void accept_connections(int server_sock) {
+    int shed = 0;
 
     while (1) {
-        log_debug("Waiting for WebSocket message from client %d...", client_sock);
-        
-        int n = ws_recv_message(client_sock, &msg);
-        
-        if (n == 0) {
-            log_info("Client %d closed WebSocket connection gracefully", client_sock);
+        struct sockaddr_in client_addr;
+        socklen_t addr_len = sizeof(client_addr);
+
+        int client_sock = accept4(server_sock, (struct sockaddr*)&client_addr, &addr_len,
+                                  SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (client_sock < 0) {
+            if (errno == EINTR) continue;
+            if ((errno == EMFILE || errno == ENFILE) && accept_shed(server_sock)) {
+                shed++;
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EMFILE && errno != ENFILE) {
+                log_error("Accept failed: errno=%d", errno);
+            }
             break;
         }
-        
-        if (n < 0) {
-            log_debug("%d", n);
-            log_error("ws_recv_message error for client %d", client_sock);
-            break;
+
+        int nodelay = 1;
+        setsockopt(client_sock, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+
+        ws_conn_t *conn = ws_conn_create(client_sock, g_next_worker);
+        if (!conn) {
+            close(client_sock);
+            continue;
         }
+        g_next_worker = (g_next_worker + 1) % g_worker_count;
 
-        log_info("Received WebSocket message type=%d from client %d", msg.type, client_sock);
+        timer_init(&conn->idle_timer, conn_idle_expired, conn);
+        timer_arm(&conn->idle_timer, (uint64_t)WS_IDLE_TIMEOUT * 1000);
 
-        // Handle message
-        handle_message(client_sock, &msg);
-        
-        log_info("Message handled successfully for client %d, waiting for next message...", client_sock);
+        struct epoll_event ev;
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        ev.data.ptr = conn;
+        if (epoll_ctl(g_epoll_fd, EPOLL_CTL_ADD, client_sock, &ev) < 0) {
+            log_error("epoll_ctl ADD failed for socket %d", client_sock);
+            ws_conn_close(conn);
+            continue;
+        }
+
+        log_info("New WebSocket connection accepted from %s:%d (socket=%d)",
+                 inet_ntoa(client_addr.sin_addr),
+                 ntohs(client_addr.sin_port), client_sock);
     }
 
-    log_info("[DISCONNECT] Client %d disconnecting, cleaning up...", client_sock);
-    client_cleanup(client_sock);
-    
-    close(client_sock);
-    log_info("Client %d thread terminated", client_sock);
-    
-    return NULL;
+    if (shed > 0) {
+        log_warn("Out of file descriptors: dropped %d pending connection(s)", shed);
+    }
 }
 
 // ====================== Setup server ======================
 int setup_ws_server(uint16_t port) {
-    int server_sock = socket(AF_INET, SOCK_STREAM, 0);
+    int server_sock = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
     if (server_sock < 0) {
         log_error("Socket creation failed");
         return -1;
@@ -249,7 +543,7 @@ int setup_ws_server(uint16_t port) {
         return -1;
     }
 
-    if (listen(server_sock, MAX_CLIENTS) < 0) {
+    if (listen(server_sock, SOMAXCONN) < 0) {
         log_error("Listen failed");
         close(server_sock);
         return -1;
@@ -261,49 +555,119 @@ int setup_ws_server(uint16_t port) {
 
 // ====================== Start server ======================
 void start_ws_server(uint16_t port) {
+    if (!timer_wheel_start()) return;
+    if (!ws_conn_table_init()) return;
+    if (!client_registry_init(ws_conn_table_size())) return;
+    if (!game_registry_init()) return;
+    if (!game_actor_start(get_game_worker_count())) return;
+    if (!game_persist_start()) return;
+    if (!game_wal_start()) return;      // Replay xong mới nhận kết nối
+    if (!matcher_start()) return;
+
     int server_sock = setup_ws_server(port);
     if (server_sock < 0) return;
 
+    g_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (g_epoll_fd < 0) {
+        log_error("epoll_create1 failed");
+        close(server_sock);
+        return;
+    }
+
+    // Listening socket dùng level-triggered để không bỏ sót accept khi hết fd
+    g_listen_fd = server_sock;
+    g_reserve_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    timer_init(&g_accept_timer, accept_resume, NULL);
+
+    struct epoll_event listen_ev;
+    listen_ev.events = EPOLLIN;
+    listen_ev.data.ptr = NULL;
+    if (epoll_ctl(g_epoll_fd, EPOLL_CTL_ADD, server_sock, &listen_ev) < 0) {
+        log_error("epoll_ctl ADD failed for listening socket");
+        close(g_epoll_fd);
+        close(server_sock);
+        return;
+    }
+
+    // Worker/timer thread enqueue frame rồi đánh thức reactor qua eventfd
+    struct epoll_event notify_ev;
+    notify_ev.events = EPOLLIN;
+    notify_ev.data.ptr = &g_notify_marker;
+    if (epoll_ctl(g_epoll_fd, EPOLL_CTL_ADD, ws_conn_notify_fd(), &notify_ev) < 0) {
+        log_error("epoll_ctl ADD failed for notify eventfd");
+        close(g_epoll_fd);
+        close(server_sock);
+        return;
+    }
+
+    if (!workers_start(get_ws_worker_count())) {
+        close(g_epoll_fd);
+        close(server_sock);
+        return;
+    }
+
     log_info("WebSocket server ready to accept connections");
-    memset(g_clients, 0, sizeof(g_clients));
-    challenge_manager_init();
-    pthread_t expiration_tid;
-    int result = pthread_create(&expiration_tid, NULL, challenge_expiration_thread, NULL);
-    if (result == 0) {
-        pthread_detach(expiration_tid);
-        log_info("Challenge expiration thread created");
-    } else {
-        log_error("Failed to create expiration thread: %d", result);
+    log_info("WebSocket unmask kernel: %s", ws_mask_impl_name());
+    if (!challenge_manager_init()) {
+        close(g_epoll_fd);
+        close(server_sock);
+        return;
     }
-    game_init_timeout_monitor();
+
+    // Turn timeout, challenge expiry và idle connection đều chạy trên timer wheel
+    timer_init(&g_stats_timer, write_stats_tick, NULL);
+    timer_arm(&g_stats_timer, WS_STATS_INTERVAL * 1000);
+
+    struct epoll_event events[WS_MAX_EVENTS];
+
     while (1) {
-        struct sockaddr_in client_addr;
-        socklen_t addr_len = sizeof(client_addr);
-        
-        log_debug("Waiting for new WebSocket client connection...");
-        int client_sock = accept(server_sock, (struct sockaddr*)&client_addr, &addr_len);
-        
-        if (client_sock < 0) {
-            log_error("Accept failed");
-            continue;
+        int n = epoll_wait(g_epoll_fd, events, WS_MAX_EVENTS, -1);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            log_error("epoll_wait failed: errno=%d", errno);
+            break;
         }
 
-        log_info("New WebSocket connection accepted from %s:%d", 
-                 inet_ntoa(client_addr.sin_addr), 
-                 ntohs(client_addr.sin_port));
+        bool notified = false;
+        for (int i = 0; i < n; i++) {
+            ws_conn_t *conn = (ws_conn_t*)events[i].data.ptr;
 
-        // Create thread for client
-        pthread_t thread_id;
-        if (pthread_create(&thread_id, NULL, client_thread, (void*)(intptr_t)client_sock) == 0) {
-            log_debug("Thread created for WebSocket client socket=%d", client_sock);
-            pthread_detach(thread_id); // Auto cleanup when thread finishes
-        } else {
-            log_error("Failed to create thread for WebSocket client");
-            close(client_sock);
+            if (!conn) {
+                accept_connections(server_sock);
+                continue;
+            }
+
+            if (events[i].data.ptr == &g_notify_marker) {
+                notified = true;
+                continue;
+            }
+
+            if (events[i].events & EPOLLOUT) {
+                // Socket ghi được lại: gửi phần tồn đọng rồi tiếp tục drain mailbox
+                if (ws_conn_flush(conn) < 0 || ws_conn_drain(conn) < 0) {
+                    conn_begin_close(conn);
+                    continue;
+                }
+            }
+
+            if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+                conn_on_readable(conn);
+            }
+        }
+
+        // Drain sau cả batch: drain lỗi sẽ đóng connection (worker free nó),
+        // mà connection đó có thể còn event phía sau trong events[] với
+        // data.ptr không giữ ref. Ngoài batch thì nó đã bị EPOLL_CTL_DEL.
+        if (notified) {
+            ws_conn_drain_ready(conn_begin_close);
         }
     }
 
     challenge_manager_cleanup();
+    client_registry_cleanup();
+    timer_cancel(&g_accept_timer);
+    if (g_reserve_fd >= 0) close(g_reserve_fd);
+    close(g_epoll_fd);
     close(server_sock);
     log_info("WebSocket server shutdown");
 }
\ No newline at end of file
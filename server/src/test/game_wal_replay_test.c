@@ -0,0 +1,375 @@
+// Test replay WAL của game (không cần Mongo server / mạng).
+//
+// Mỗi "lần chạy server" là một process con: ghi WAL bằng các thao tác game
+// thật (game.c + game_wal.c), rồi _exit không flush như khi crash. Các process
+// sau seed registry bằng state "đang có trong Mongo" (game_get không phải đọc
+// DB) rồi gọi game_wal_start để replay:
+//   1. Trận kết thúc bình thường: replay hai lần đều ra đúng state, không cập
+//      nhật ELO lần nào (END chỉ được ghi sau ELO).
+//   2. Crash trong lúc cập nhật ELO (chưa có END): replay đầu cập nhật ELO
+//      đúng một lần và ghi END, replay sau không cập nhật nữa.
+//   3. Mongo đã có kết quả trận: replay không chạy lại game_end (finished_at,
+//      evict timer giữ nguyên).
+//
+// Build (từ thư mục server/, cần libmongoc-dev như khi build server):
+//   gcc -std=gnu11 -O2 -Iinclude $(pkg-config --cflags libmongoc-1.0) -o game_wal_replay_test
+//       src/test/game_wal_replay_test.c src/game/game.c src/game/game_wal.c
+//       src/game/game_registry.c src/game/game_board.c src/game/move_log.c
+//       $(pkg-config --libs libmongoc-1.0) -lpthread
+
+#include "game/game.h"
+#include "game/game_wal.h"
+#include "game/game_registry.h"
+#include "game/game_persist.h"
+#include "game/game_actor.h"
+#include "game/elo.h"
+#include "database/mongo.h"
+#include "database/mongo_user.h"
+#include "network/ws_protocol.h"
+#include "utils/logger.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#define TEST_GAME_ID "0123456789abcdef01234567"
+#define TEST_P1 "player-one"
+#define TEST_P2 "player-two"
+#define TEST_FINISHED_AT 1234567890123LL
+
+// ==================== Stub ====================
+mongo_context_t *g_mongo_ctx = NULL;
+
+mongoc_client_t* mongo_get_client(mongo_context_t *ctx) {
+    (void)ctx;
+    return NULL;
+}
+
+void mongo_release_client(mongo_context_t *ctx, mongoc_client_t *client) {
+    (void)ctx; (void)client;
+}
+
+mongoc_collection_t* mongo_get_collection(mongoc_client_t *client, const char *collection_name) {
+    (void)client; (void)collection_name;
+    return NULL;
+}
+
+user_t* user_find_by_id(const char *user_id) {
+    (void)user_id;
+    return NULL;
+}
+
+void user_free(user_t *user) {
+    (void)user;
+}
+
+void log_message(log_level_t level, const char *file, int line, const char *fmt, ...) {
+    (void)level; (void)file; (void)line; (void)fmt;
+}
+
+uint64_t timer_now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+// Không có timer thread: chỉ ghi lại trạng thái armed để kiểm tra
+void timer_init(timer_entry_t *t, timer_cb_t cb, void *arg) {
+    memset(t, 0, sizeof(*t));
+    t->cb = cb;
+    t->arg = arg;
+}
+
+void timer_arm(timer_entry_t *t, uint64_t delay_ms) {
+    (void)delay_ms;
+    t->armed = true;
+}
+
+bool timer_cancel(timer_entry_t *t) {
+    bool was_armed = t->armed;
+    t->armed = false;
+    return was_armed;
+}
+
+// Persist thread không chạy: segment WAL không bao giờ được unpin
+void game_persist_schedule(game_session_t *game) {
+    (void)game;
+}
+
+void game_persist_send(game_session_t *game, int sock, message_t *msg) {
+    (void)game; (void)sock; (void)msg;
+}
+
+void board_to_bson(bson_t *parent, const char *key, const board_t *board) {
+    (void)parent; (void)key; (void)board;
+}
+
+game_cmd_t* game_cmd_new(game_cmd_type_t type, int client_sock, const char *player_id) {
+    (void)type; (void)client_sock; (void)player_id;
+    return NULL;
+}
+
+void game_actor_post(game_session_t *game, game_cmd_t *cmd) {
+    (void)game; (void)cmd;
+}
+
+ssize_t ws_send_message(int sock, message_t *msg) {
+    (void)sock; (void)msg;
+    return 0;
+}
+
+static int g_elo_updates = 0;
+static bool g_crash_in_elo = false;
+
+bool elo_update_after_match(const char *winner_id, const char *loser_id) {
+    (void)winner_id; (void)loser_id;
+    if (g_crash_in_elo) _exit(0);
+    g_elo_updates++;
+    return true;
+}
+
+// ==================== Helpers ====================
+// Phần state so sánh giữa lần chạy gốc và các lần replay
+typedef struct {
+    game_state_t state;
+    char current_turn[64];
+    char winner_id[64];
+    bool player1_ready;
+    bool player2_ready;
+    bitboard_t bits[2][3];         // ship/hit/miss của hai board
+    uint32_t move_count;
+    uint8_t moves[2 * BOARD_SIZE]; // shooter << 7 | ô
+} snapshot_t;
+
+static char g_dir[256];
+static int g_failures = 0;
+
+#define CHECK(cond, ...) do {                                   \
+    if (!(cond)) {                                              \
+        fprintf(stderr, "  FAIL %s:%d: ", __FILE__, __LINE__);  \
+        fprintf(stderr, __VA_ARGS__);                           \
+        fprintf(stderr, "\n");                                  \
+        g_failures++;                                           \
+    }                                                           \
+} while (0)
+
+static void snapshot_take(game_session_t *game, snapshot_t *out) {
+    memset(out, 0, sizeof(*out));
+    out->state = game->state;
+    memcpy(out->current_turn, game->current_turn, sizeof(out->current_turn));
+    memcpy(out->winner_id, game->winner_id, sizeof(out->winner_id));
+    out->player1_ready = game->player1_ready;
+    out->player2_ready = game->player2_ready;
+
+    const board_t *boards[2] = { &game->player1_board, &game->player2_board };
+    for (int i = 0; i < 2; i++) {
+        out->bits[i][0] = boards[i]->ship_bits;
+        out->bits[i][1] = boards[i]->hit_bits;
+        out->bits[i][2] = boards[i]->miss_bits;
+    }
+
+    move_log_iter_t it;
+    move_t move;
+    move_log_iter_init(&it, &game->moves);
+    while (move_log_next(&it, &move) && out->move_count < sizeof(out->moves)) {
+        out->moves[out->move_count++] =
+            (uint8_t)(move.shooter << 7 | (move.row * GRID_SIZE + move.col));
+    }
+}
+
+static void snapshot_path(char *out, size_t cap) {
+    snprintf(out, cap, "%s/expected.bin", g_dir);
+}
+
+// Game như vừa được game_get nạp từ Mongo (registry giữ 1 ref, trả về 1 ref)
+static game_session_t* seed_game(game_state_t state) {
+    game_session_t *game = calloc(1, sizeof(game_session_t));
+    game->refcount = 1;
+    pthread_mutex_init(&game->mb_lock, NULL);
+    pthread_mutex_init(&game->state_lock, NULL);
+    timer_init(&game->turn_timer, NULL, game);
+    timer_init(&game->evict_timer, NULL, game);
+
+    strncpy(game->game_id, TEST_GAME_ID, sizeof(game->game_id) - 1);
+    strncpy(game->player1_id, TEST_P1, sizeof(game->player1_id) - 1);
+    strncpy(game->player2_id, TEST_P2, sizeof(game->player2_id) - 1);
+    strncpy(game->current_turn, TEST_P1, sizeof(game->current_turn) - 1);
+    game->state = state;
+    board_init(&game->player1_board);
+    board_init(&game->player2_board);
+    move_log_init(&game->moves, move_log_now_ms());
+    move_log_iter_init(&game->moves_sync_it, &game->moves);
+
+    return game_registry_insert(game);
+}
+
+// ==================== Phases (mỗi phase một process) ====================
+// Chơi hết một trận: cả hai tự xếp tàu, player1 bắn trúng lần lượt từng ô tàu
+// của player2, player2 bắn lần lượt từ ô 0. Ghi snapshot cuối ra file.
+static int phase_play(bool crash_in_elo) {
+    game_registry_init();
+    game_wal_start();
+
+    game_session_t *game = seed_game(GAME_STATE_PLACING_SHIPS);
+    pthread_mutex_lock(&game->state_lock);
+
+    game_place_fleet(game, TEST_P1, -1, NULL, 0);
+    game_place_fleet(game, TEST_P2, -1, NULL, 0);
+    if (game->state != GAME_STATE_PLAYING) {
+        fprintf(stderr, "  game did not start\n");
+        return 1;
+    }
+
+    // Snapshot trước phát bắn cuối: khi crash trong ELO, process chết ở đó
+    snapshot_t expected;
+    int p2_next = 0;
+    for (int cell = 0; cell < BOARD_SIZE && game->state == GAME_STATE_PLAYING; cell++) {
+        if (!(game->player2_board.ship_bits & BB_BIT(cell))) continue;
+
+        if (bb_popcount(game->player2_board.ship_bits & ~game->player2_board.hit_bits) == 1) {
+            // Phát cuối: trạng thái sau khi thắng được dựng lại từ bản sao
+            snapshot_take(game, &expected);
+            expected.state = GAME_STATE_FINISHED;
+            memcpy(expected.winner_id, TEST_P1, sizeof(TEST_P1));
+            expected.bits[1][1] |= BB_BIT(cell);
+            expected.moves[expected.move_count++] = (uint8_t)cell;
+
+            FILE *f;
+            char path[512];
+            snapshot_path(path, sizeof(path));
+            if (!(f = fopen(path, "wb")) || fwrite(&expected, sizeof(expected), 1, f) != 1) {
+                return 1;
+            }
+            fclose(f);
+        }
+
+        shot_result_t result;
+        g_crash_in_elo = crash_in_elo;
+        if (!game_process_shot(game, TEST_P1, cell / GRID_SIZE, cell % GRID_SIZE, &result)) {
+            fprintf(stderr, "  shot rejected at %d\n", cell);
+            return 1;
+        }
+        if (game->state == GAME_STATE_PLAYING) {
+            game_process_shot(game, TEST_P2, p2_next / GRID_SIZE, p2_next % GRID_SIZE, &result);
+            p2_next++;
+        }
+    }
+
+    snapshot_t actual;
+    snapshot_take(game, &actual);
+    CHECK(memcmp(&actual, &expected, sizeof(actual)) == 0, "final state differs from expected");
+    CHECK(g_elo_updates == 1, "ELO updated %d times, expected 1", g_elo_updates);
+
+    // Crash: không unlock, không flush
+    return g_failures ? 1 : 0;
+}
+
+// Replay trên state ban đầu của document (PLACING, board rỗng)
+static int phase_replay(int expected_elo) {
+    snapshot_t expected;
+    char path[512];
+    snapshot_path(path, sizeof(path));
+    FILE *f = fopen(path, "rb");
+    if (!f || fread(&expected, sizeof(expected), 1, f) != 1) return 1;
+    fclose(f);
+
+    game_registry_init();
+    game_session_t *game = seed_game(GAME_STATE_PLACING_SHIPS);
+    game_wal_start();
+
+    game_wal_stats_t stats;
+    game_wal_stats(&stats);
+
+    pthread_mutex_lock(&game->state_lock);
+    snapshot_t actual;
+    snapshot_take(game, &actual);
+    pthread_mutex_unlock(&game->state_lock);
+
+    CHECK(stats.replayed > 0, "no events replayed");
+    CHECK(actual.state == expected.state, "state %d, expected %d", actual.state, expected.state);
+    CHECK(strcmp(actual.winner_id, expected.winner_id) == 0, "winner '%s', expected '%s'",
+          actual.winner_id, expected.winner_id);
+    CHECK(actual.move_count == expected.move_count, "%u moves, expected %u",
+          actual.move_count, expected.move_count);
+    CHECK(memcmp(&actual, &expected, sizeof(actual)) == 0, "replayed state differs");
+    CHECK(g_elo_updates == expected_elo, "ELO updated %d times, expected %d",
+          g_elo_updates, expected_elo);
+    return g_failures ? 1 : 0;
+}
+
+// Replay khi Mongo đã có kết quả trận
+static int phase_replay_finished(void) {
+    game_registry_init();
+    game_session_t *game = seed_game(GAME_STATE_FINISHED);
+    strncpy(game->winner_id, TEST_P1, sizeof(game->winner_id) - 1);
+    game->finished_at = TEST_FINISHED_AT;
+    game->player1_ready = true;
+    game->player2_ready = true;
+    game_wal_start();
+
+    pthread_mutex_lock(&game->state_lock);
+    CHECK(game->state == GAME_STATE_FINISHED, "state changed to %d", game->state);
+    CHECK(game->finished_at == TEST_FINISHED_AT, "finished_at rewritten to %lld", game->finished_at);
+    CHECK(!game->evict_timer.armed, "game_end ran again (evict timer re-armed)");
+    CHECK(g_elo_updates == 0, "ELO updated %d times on replay", g_elo_updates);
+    pthread_mutex_unlock(&game->state_lock);
+    return g_failures ? 1 : 0;
+}
+
+// ==================== Runner ====================
+static bool run_phase(const char *name, int (*fn)(int), int arg) {
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        _exit(fn(arg));
+    }
+    int status = 0;
+    waitpid(pid, &status, 0);
+    bool ok = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    printf("  %-44s %s\n", name, ok ? "ok" : "FAILED");
+    return ok;
+}
+
+static int play_normal(int arg) { (void)arg; return phase_play(false); }
+static int play_crash_in_elo(int arg) { (void)arg; return phase_play(true); }
+static int replay_finished(int arg) { (void)arg; return phase_replay_finished(); }
+
+static void reset_dir(const char *name) {
+    char cmd[600];
+    snprintf(g_dir, sizeof(g_dir), "/tmp/game_wal_replay_%d_%s", (int)getpid(), name);
+    snprintf(cmd, sizeof(cmd), "rm -rf %s && mkdir -p %s", g_dir, g_dir);
+    if (system(cmd) != 0) {
+        fprintf(stderr, "cannot create %s\n", g_dir);
+        exit(1);
+    }
+    setenv("GAME_WAL_DIR", g_dir, 1);
+}
+
+int main(void) {
+    setenv("GAME_WAL_SEGMENT_MB", "1", 1);
+    bool ok = true;
+
+    printf("finished game, replayed twice:\n");
+    reset_dir("normal");
+    ok &= run_phase("play until player1 wins", play_normal, 0);
+    ok &= run_phase("replay #1 (END present: no ELO)", phase_replay, 0);
+    ok &= run_phase("replay #2 (same state, no ELO)", phase_replay, 0);
+    ok &= run_phase("replay onto finished document", replay_finished, 0);
+
+    printf("crash while updating ELO:\n");
+    reset_dir("crash_elo");
+    ok &= run_phase("play, crash inside ELO update", play_crash_in_elo, 0);
+    ok &= run_phase("replay #1 (ELO once, END logged)", phase_replay, 1);
+    ok &= run_phase("replay #2 (END present: no ELO)", phase_replay, 0);
+
+    char cmd[300];
+    snprintf(cmd, sizeof(cmd), "rm -rf /tmp/game_wal_replay_%d_*", (int)getpid());
+    if (system(cmd) != 0) {
+        fprintf(stderr, "cannot remove test directories\n");
+    }
+
+    printf("%s\n", ok ? "PASS" : "FAIL");
+    return ok ? 0 : 1;
+}
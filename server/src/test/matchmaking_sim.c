@@ -0,0 +1,154 @@
+// Mô phỏng so sánh ghép greedy và batch (MATCH_MODE) trên cùng một luồng
+// người chơi, chạy theo thời gian ảo (không cần Mongo / mạng).
+//
+// Trong 10 phút, mỗi giây có RATE người vào hàng đợi ranked: ELO phân phối
+// chuẩn quanh 1200 (độ lệch 300), cứ 400 người có một người 2800+. Matcher
+// chạy mỗi MATCH_TICK_MS (250 ms), thêm 1 phút cuối để hàng đợi cạn. In số
+// cặp, chênh ELO trung bình, thời gian chờ theo band và thời gian một lượt
+// ghép khi có 10k người trong hàng đợi.
+//
+// Build (từ thư mục server/):
+//   gcc -std=gnu11 -O2 -Iinclude -o matchmaking_sim
+//       src/test/matchmaking_sim.c src/matchmaking/matchmaking.c -lpthread -lm
+// Chạy: ./matchmaking_sim [RATE]   (mặc định 40 người/giây)
+
+#include "matchmaking/matcher.h"
+#include "game/game.h"
+#include "network/ws_protocol.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#define SIM_TICK_MS 250
+#define SIM_ARRIVAL_MS (10 * 60 * 1000)   // Thời gian có người vào hàng đợi
+#define SIM_DRAIN_MS (60 * 1000)          // Chạy tiếp cho hàng đợi cạn
+#define SIM_LARGE_QUEUE 10000
+
+// ==================== Stub ====================
+static uint64_t g_now_ms = 0;             // Thời gian ảo
+
+void log_message(int level, const char *file, int line, const char *fmt, ...) {
+    (void)level; (void)file; (void)line; (void)fmt;
+}
+
+uint64_t timer_now_ms(void) {
+    return g_now_ms;
+}
+
+static game_session_t g_game = { .game_id = "sim" };
+
+game_session_t* game_create(const char *player1_id, const char *player2_id,
+                            int player1_socket, int player2_socket) {
+    (void)player1_id; (void)player2_id; (void)player1_socket; (void)player2_socket;
+    return &g_game;
+}
+
+void game_release(game_session_t *game) {
+    (void)game;
+}
+
+ssize_t ws_send_message(int client_sock, message_t *msg) {
+    (void)client_sock; (void)msg;
+    return 0;
+}
+
+// ==================== Simulation ====================
+static double gauss(void) {
+    double u = (rand() + 1.0) / (RAND_MAX + 2.0);
+    double v = (rand() + 1.0) / (RAND_MAX + 2.0);
+    return sqrt(-2 * log(u)) * cos(2 * M_PI * v);
+}
+
+static int sim_elo(int n) {
+    if (n % 400 == 0) return 2800 + rand() % 400;
+    return (int)(1200 + 300 * gauss());
+}
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void sim_run(const char *mode, int rate) {
+    setenv("MATCH_MODE", mode, 1);
+    matcher_init();
+    srand(11);
+
+    char user_id[16];
+    int next = 0;
+    double worst_pass = 0;
+
+    for (g_now_ms = 0; g_now_ms <= SIM_ARRIVAL_MS + SIM_DRAIN_MS; g_now_ms += SIM_TICK_MS) {
+        if (g_now_ms <= SIM_ARRIVAL_MS) {
+            for (int i = 0; i < rate * SIM_TICK_MS / 1000; i++, next++) {
+                snprintf(user_id, sizeof(user_id), "u%d", next);
+                matcher_add_to_queue(next, user_id, sim_elo(next), "ranked");
+            }
+        }
+        double start = now_sec();
+        matcher_find_match();
+        double pass = now_sec() - start;
+        if (pass > worst_pass) worst_pass = pass;
+    }
+
+    matcher_stats_t st;
+    matcher_stats(&st);
+    printf("%-6s rate=%d/s: pairs=%llu left=%llu avg_gap=%.1f worst_pass=%.2fms\n",
+           mode, rate, (unsigned long long)st.matches, (unsigned long long)st.queued,
+           st.matches ? (double)st.elo_gap_total / st.matches : 0.0, worst_pass * 1e3);
+    printf("       wait 1200-1599 p50=%llums p99=%llums, >=2000 p50=%llums p99=%llums max=%llums\n",
+           (unsigned long long)st.bands[2].p50_ms, (unsigned long long)st.bands[2].p99_ms,
+           (unsigned long long)st.bands[4].p50_ms, (unsigned long long)st.bands[4].p99_ms,
+           (unsigned long long)st.bands[4].max_ms);
+    matcher_cleanup();
+}
+
+// Một lượt ghép khi hàng đợi lớn (mọi người đã chờ 60 giây)
+static void sim_large_pass(const char *mode, int rate) {
+    (void)rate;
+    setenv("MATCH_MODE", mode, 1);
+    matcher_init();
+    srand(11);
+
+    char user_id[16];
+    g_now_ms = 0;
+    for (int i = 0; i < SIM_LARGE_QUEUE; i++) {
+        snprintf(user_id, sizeof(user_id), "w%d", i);
+        matcher_add_to_queue(i, user_id, (int)(1200 + 300 * gauss()), "ranked");
+    }
+    g_now_ms = 60000;
+    double start = now_sec();
+    matcher_find_match();
+    printf("%-6s one pass over %d queued: %.2f ms\n", mode, SIM_LARGE_QUEUE,
+           (now_sec() - start) * 1e3);
+    matcher_cleanup();
+}
+
+// Thống kê của matcher là static và không reset: mỗi lần đo một process
+static void sim_fork(void (*fn)(const char*, int), const char *mode, int rate) {
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        fn(mode, rate);
+        fflush(stdout);
+        _exit(0);
+    }
+    if (pid > 0) waitpid(pid, NULL, 0);
+}
+
+int main(int argc, char **argv) {
+    int rate = argc > 1 ? atoi(argv[1]) : 40;
+    if (rate <= 0) rate = 40;
+
+    setenv("MATCH_QUEUE_MAX", "100000", 1);
+    sim_fork(sim_run, "greedy", rate);
+    sim_fork(sim_run, "batch", rate);
+    sim_fork(sim_large_pass, "greedy", rate);
+    sim_fork(sim_large_pass, "batch", rate);
+    return 0;
+}
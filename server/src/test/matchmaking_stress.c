@@ -0,0 +1,158 @@
+// Stress test cho intake MPSC của matchmaking (không cần Mongo / mạng).
+//
+// THREADS producer liên tục join/leave trên IDS user id riêng của mình, một
+// owner thread chạy matcher_find_match như matchmaking thread. game_create
+// luôn lỗi nên cặp ghép được quay lại hàng đợi: cuối cùng số người trong hàng
+// đợi phải bằng số user có thao tác cuối là join.
+//
+// Build (từ thư mục server/):
+//   gcc -std=gnu11 -O2 -Iinclude -o matchmaking_stress
+//       src/test/matchmaking_stress.c src/matchmaking/matchmaking.c -lpthread -lm
+// Thêm -fsanitize=thread để kiểm tra data race; -DTHREADS=N đổi số producer.
+
+#include "matchmaking/matcher.h"
+#include "game/game.h"
+#include "network/ws_protocol.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#ifndef THREADS
+#define THREADS 16
+#endif
+#define IDS 256        // User id mỗi producer
+#define OPS 20000      // Thao tác mỗi producer
+
+// ==================== Stub ====================
+void log_message(int level, const char *file, int line, const char *fmt, ...) {
+    (void)level; (void)file; (void)line; (void)fmt;
+}
+
+uint64_t timer_now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+static int g_creates = 0;
+
+// Luôn lỗi: match_start trả cặp về hàng đợi
+game_session_t* game_create(const char *player1_id, const char *player2_id,
+                            int player1_socket, int player2_socket) {
+    (void)player1_id; (void)player2_id; (void)player1_socket; (void)player2_socket;
+    __atomic_add_fetch(&g_creates, 1, __ATOMIC_RELAXED);
+    return NULL;
+}
+
+void game_release(game_session_t *game) {
+    (void)game;
+}
+
+ssize_t ws_send_message(int client_sock, message_t *msg) {
+    (void)client_sock; (void)msg;
+    return 0;
+}
+
+// ==================== Test ====================
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static bool g_joined[THREADS][IDS];   // Thao tác cuối của mỗi user
+static float g_latency[THREADS][OPS];
+static int g_stop = 0;
+
+static void* producer_thread(void *arg) {
+    long t = (long)arg;
+    unsigned seed = (unsigned)(t * 7919 + 1);
+    char user_id[32];
+
+    for (int i = 0; i < OPS; i++) {
+        int k = rand_r(&seed) % IDS;
+        bool join = rand_r(&seed) & 1;
+        snprintf(user_id, sizeof(user_id), "t%ld-%d", t, k);
+
+        double start = now_sec();
+        if (join) {
+            matcher_add_to_queue(k, user_id, 1000 + rand_r(&seed) % 600,
+                                 (k & 1) ? "ranked" : "casual");
+        } else {
+            matcher_remove_from_queue(user_id);
+        }
+        g_latency[t][i] = (float)(now_sec() - start);
+        g_joined[t][k] = join;
+    }
+    return NULL;
+}
+
+static void* owner_thread(void *arg) {
+    (void)arg;
+    while (!__atomic_load_n(&g_stop, __ATOMIC_ACQUIRE)) {
+        matcher_find_match();
+    }
+    // Áp nốt phần intake còn lại
+    matcher_find_match();
+    return NULL;
+}
+
+static int float_compare(const void *a, const void *b) {
+    float x = *(const float*)a;
+    float y = *(const float*)b;
+    return (x > y) - (x < y);
+}
+
+int main(void) {
+    setenv("MATCH_QUEUE_MAX", "100000", 1);
+    if (!matcher_init()) {
+        fprintf(stderr, "matcher_init failed\n");
+        return 1;
+    }
+
+    pthread_t owner, producers[THREADS];
+    pthread_create(&owner, NULL, owner_thread, NULL);
+
+    double start = now_sec();
+    for (long i = 0; i < THREADS; i++) {
+        pthread_create(&producers[i], NULL, producer_thread, (void*)i);
+    }
+    for (int i = 0; i < THREADS; i++) {
+        pthread_join(producers[i], NULL);
+    }
+    double elapsed = now_sec() - start;
+
+    __atomic_store_n(&g_stop, 1, __ATOMIC_RELEASE);
+    pthread_join(owner, NULL);
+
+    uint64_t expected = 0;
+    for (int t = 0; t < THREADS; t++) {
+        for (int k = 0; k < IDS; k++) expected += g_joined[t][k];
+    }
+
+    matcher_stats_t stats;
+    matcher_stats(&stats);
+
+    bool ok = stats.queued == expected &&
+              stats.intake_ops == (uint64_t)THREADS * OPS &&
+              stats.intake_pending == 0;
+
+    printf("%d producers x %d ops in %.1f ms (%.2f Mops/s), %d pairs tried\n",
+           THREADS, OPS, elapsed * 1e3, THREADS * OPS / elapsed / 1e6, g_creates);
+    printf("queued=%llu expected=%llu pending=%llu applied=%llu\n",
+           (unsigned long long)stats.queued, (unsigned long long)expected,
+           (unsigned long long)stats.intake_pending, (unsigned long long)stats.intake_ops);
+
+    static float all[THREADS * OPS];
+    memcpy(all, g_latency, sizeof(all));
+    qsort(all, THREADS * OPS, sizeof(float), float_compare);
+    printf("producer op p50=%.2f us p99=%.2f us p99.9=%.2f us\n",
+           all[THREADS * OPS / 2] * 1e6, all[THREADS * OPS * 99 / 100] * 1e6,
+           all[THREADS * OPS * 999 / 1000] * 1e6);
+
+    matcher_cleanup();
+    printf("%s\n", ok ? "PASS" : "FAIL");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,250 @@
+#include "utils/timer_wheel.h"
+#include "utils/logger.h"
+#include <pthread.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/timerfd.h>
+
+#define TIMER_WHEEL_MASK (TIMER_WHEEL_SLOTS - 1)
+#define TIMER_WHEEL_SPAN (1ULL << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS))
+
+// Mỗi slot là một danh sách vòng có đầu giả (head)
+static timer_entry_t g_slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+static uint64_t g_tick = 0;          // Tick kế tiếp cần xử lý
+static int g_count = 0;              // Số timer đang arm
+static int g_timer_fd = -1;
+static pthread_t g_timer_tid;
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_done = PTHREAD_COND_INITIALIZER;
+static timer_entry_t *g_running = NULL;   // Timer đang chạy callback
+
+uint64_t timer_now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+static uint64_t now_tick(void) {
+    return timer_now_ms() / TIMER_TICK_MS;
+}
+
+// ====================== Wheel (gọi khi giữ g_lock) ======================
+static void list_unlink(timer_entry_t *t) {
+    t->prev->next = t->next;
+    t->next->prev = t->prev;
+    t->next = t->prev = NULL;
+}
+
+static void list_append(timer_entry_t *head, timer_entry_t *t) {
+    t->prev = head->prev;
+    t->next = head;
+    head->prev->next = t;
+    head->prev = t;
+}
+
+static void wheel_insert(timer_entry_t *t) {
+    uint64_t expires = t->expires_tick < g_tick ? g_tick : t->expires_tick;
+    uint64_t delta = expires - g_tick;
+
+    // Xa hơn tầm của wheel: đặt ở cuối, lúc tới hạn sẽ được chèn lại
+    if (delta >= TIMER_WHEEL_SPAN) {
+        delta = TIMER_WHEEL_SPAN - 1;
+        expires = g_tick + delta;
+    }
+
+    int level = 0;
+    while (level < TIMER_WHEEL_LEVELS - 1 &&
+           delta >= (1ULL << (TIMER_WHEEL_BITS * (level + 1)))) {
+        level++;
+    }
+
+    int slot = (int)((expires >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK);
+    list_append(&g_slots[level][slot], t);
+}
+
+// Đổ slot của level cao xuống các level thấp hơn; trả về index của slot
+static int wheel_cascade(int level) {
+    int index = (int)((g_tick >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK);
+    timer_entry_t *head = &g_slots[level][index];
+
+    timer_entry_t *t = head->next;
+    head->next = head->prev = head;
+    while (t != head) {
+        timer_entry_t *next = t->next;
+        wheel_insert(t);
+        t = next;
+    }
+    return index;
+}
+
+static void timer_fd_set(bool enable) {
+    struct itimerspec its;
+    memset(&its, 0, sizeof(its));
+    if (enable) {
+        its.it_value.tv_nsec = TIMER_TICK_MS * 1000000L;
+        its.it_interval.tv_nsec = TIMER_TICK_MS * 1000000L;
+    }
+    if (timerfd_settime(g_timer_fd, 0, &its, NULL) < 0) {
+        log_error("[TIMER] timerfd_settime failed: errno=%d", errno);
+    }
+}
+
+// Chạy mọi timer tới hạn tới tick `target`. Callback chạy ngoài lock.
+static void wheel_advance(uint64_t target) {
+    pthread_mutex_lock(&g_lock);
+
+    while (g_tick <= target) {
+        int index = (int)(g_tick & TIMER_WHEEL_MASK);
+        if (index == 0) {
+            for (int level = 1; level < TIMER_WHEEL_LEVELS; level++) {
+                if (wheel_cascade(level) != 0) break;
+            }
+        }
+
+        // Tách danh sách của slot hiện tại rồi mới tăng tick, để timer được
+        // arm lại trong callback rơi vào slot sau chứ không phải slot này
+        timer_entry_t expired;
+        timer_entry_t *head = &g_slots[0][index];
+        if (head->next == head) {
+            g_tick++;
+            continue;
+        }
+        expired.next = head->next;
+        expired.prev = head->prev;
+        expired.next->prev = &expired;
+        expired.prev->next = &expired;
+        head->next = head->prev = head;
+        g_tick++;
+
+        while (expired.next != &expired) {
+            timer_entry_t *t = expired.next;
+            list_unlink(t);
+
+            // Bị kẹp ở cuối wheel: chưa tới hạn thật
+            if (t->expires_tick >= g_tick) {
+                wheel_insert(t);
+                continue;
+            }
+
+            t->armed = false;
+            g_count--;
+            g_running = t;
+            timer_cb_t cb = t->cb;
+            void *arg = t->arg;
+
+            pthread_mutex_unlock(&g_lock);
+            cb(arg);
+            pthread_mutex_lock(&g_lock);
+
+            g_running = NULL;
+            pthread_cond_broadcast(&g_done);
+        }
+    }
+
+    // Không còn timer nào: tắt timerfd, thread ngủ cho tới lần arm kế tiếp
+    if (g_count == 0) timer_fd_set(false);
+
+    pthread_mutex_unlock(&g_lock);
+}
+
+static void* timer_thread(void *arg) {
+    (void)arg;
+    log_info("[TIMER] Thread started (tick=%dms)", TIMER_TICK_MS);
+
+    while (1) {
+        uint64_t expirations;
+        ssize_t n = read(g_timer_fd, &expirations, sizeof(expirations));
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            log_error("[TIMER] read timerfd failed: errno=%d", errno);
+            sleep(1);
+            continue;
+        }
+        wheel_advance(now_tick());
+    }
+
+    return NULL;
+}
+
+// ====================== Public API ======================
+bool timer_wheel_start(void) {
+    for (int level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+        for (int slot = 0; slot < TIMER_WHEEL_SLOTS; slot++) {
+            g_slots[level][slot].next = &g_slots[level][slot];
+            g_slots[level][slot].prev = &g_slots[level][slot];
+        }
+    }
+    g_tick = now_tick();
+
+    g_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    if (g_timer_fd < 0) {
+        log_error("[TIMER] timerfd_create failed: errno=%d", errno);
+        return false;
+    }
+
+    int result = pthread_create(&g_timer_tid, NULL, timer_thread, NULL);
+    if (result != 0) {
+        log_error("[TIMER] Failed to create thread: %d", result);
+        close(g_timer_fd);
+        g_timer_fd = -1;
+        return false;
+    }
+    pthread_detach(g_timer_tid);
+
+    log_info("[TIMER] ✅ Timer wheel initialized");
+    return true;
+}
+
+void timer_init(timer_entry_t *t, timer_cb_t cb, void *arg) {
+    memset(t, 0, sizeof(*t));
+    t->cb = cb;
+    t->arg = arg;
+}
+
+void timer_arm(timer_entry_t *t, uint64_t delay_ms) {
+    pthread_mutex_lock(&g_lock);
+
+    if (t->armed) {
+        list_unlink(t);
+    } else {
+        // Wheel đang trống: đồng bộ lại tick hiện tại rồi bật timerfd
+        if (g_count == 0) {
+            g_tick = now_tick();
+            timer_fd_set(true);
+        }
+        g_count++;
+        t->armed = true;
+    }
+
+    // Làm tròn lên để không bao giờ chạy sớm hơn deadline
+    t->expires_tick = (timer_now_ms() + delay_ms + TIMER_TICK_MS - 1) / TIMER_TICK_MS;
+    wheel_insert(t);
+
+    pthread_mutex_unlock(&g_lock);
+}
+
+bool timer_cancel(timer_entry_t *t) {
+    pthread_mutex_lock(&g_lock);
+
+    bool was_armed = false;
+    bool on_timer_thread = pthread_equal(pthread_self(), g_timer_tid);
+
+    while (1) {
+        if (t->armed) {
+            list_unlink(t);
+            t->armed = false;
+            g_count--;
+            was_armed = true;
+        }
+
+        // Callback đang chạy ở thread timer: chờ xong (trừ khi chính callback
+        // gọi), rồi gỡ tiếp nếu callback vừa tự arm lại
+        if (on_timer_thread || g_running != t) break;
+        pthread_cond_wait(&g_done, &g_lock);
+    }
+
+    pthread_mutex_unlock(&g_lock);
+    return was_armed;
+}